@@ -0,0 +1,65 @@
+/*
+ * ev3dev-mapping benchmarks common implementation file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+
+#include <sys/utsname.h> //uname
+#include <stdio.h> //printf
+
+volatile uint64_t g_bench_sink;
+
+const char *BenchArch()
+{
+	static utsname machine;
+
+	if(machine.machine[0] == '\0' && uname(&machine) == -1)
+		DieErrno("bench: uname");
+
+	return machine.machine;
+}
+
+void Bench(const char *suite, const char *name, bench_function function, void *data)
+{
+	uint64_t start, elapsed_us;
+	int iterations=1;
+
+	function(data, 1); //warm up caches
+
+	//calibrate so that the timestamp cost doesn't count
+	for(;;)
+	{
+		start=TimestampUs();
+		function(data, iterations);
+		elapsed_us=TimestampUs()-start;
+
+		if(elapsed_us >= (uint64_t)BENCH_MIN_US || iterations >= (1 << 27))
+			break;
+		iterations *= elapsed_us < (uint64_t)BENCH_MIN_US/16 ? 8 : 2;
+	}
+
+	double ns_per_op=elapsed_us*1000.0/iterations;
+
+	printf("{\"suite\":\"%s\",\"name\":\"%s\",\"arch\":\"%s\",\"iterations\":%d,\"ns_per_op\":%.2f,\"ops_per_s\":%.0f}\n",
+		suite, name, BenchArch(), iterations, ns_per_op, 1e9/ns_per_op);
+	fflush(stdout);
+}
+
+void BenchValue(const char *suite, const char *name, double value, const char *unit)
+{
+	printf("{\"suite\":\"%s\",\"name\":\"%s\",\"arch\":\"%s\",\"value\":%.2f,\"unit\":\"%s\"}\n",
+		suite, name, BenchArch(), value, unit);
+	fflush(stdout);
+}
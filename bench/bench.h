@@ -0,0 +1,35 @@
+/*
+ * ev3dev-mapping benchmarks common header file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdint.h> //uint64_t
+
+// each benchmark runs at least that long (after calibration)
+const int BENCH_MIN_US=200000;
+
+// runs the operation iterations times, data is benchmark specific
+typedef void (*bench_function)(void *data, int iterations);
+
+// runs function with growing iterations until it takes BENCH_MIN_US
+// prints the result as JSON line to stdout:
+// {"suite":"...","name":"...","arch":"armv5tejl","iterations":...,"ns_per_op":...,"ops_per_s":...}
+void Bench(const char *suite, const char *name, bench_function function, void *data);
+
+// prints measured property that is not operation time (e.g. clock resolution) as JSON line:
+// {"suite":"...","name":"...","arch":"armv5tejl","value":...,"unit":"..."}
+void BenchValue(const char *suite, const char *name, double value, const char *unit);
+
+// results of benchmarked operations are accumulated here so that compiler can't drop them
+extern volatile uint64_t g_bench_sink;
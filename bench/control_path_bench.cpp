@@ -0,0 +1,298 @@
+/*
+ * ev3dev-mapping ev3control control path benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures ev3control handling of ENABLE, DISABLE and QUERY_STATUS messages
+  * and counts memory allocations it makes
+  *
+  * The messages go the way of ev3control main.cpp: header -> ParseControlMessage ->
+  * module table (FindModule, InsertModule) -> Control::EnableModule (tokenizing the call into argv,
+  * posix_spawn of /bin/cat which exits on stdin EOF) and Control::DisableModule, the module is reaped
+  * with CheckModulesStates. QUERY_STATUS encodes STATUS_ALL messages of the module table.
+  *
+  * malloc, calloc, realloc and operator new are interposed (glibc __libc_* functions do the work)
+  * and counted after warm-up (the first ENABLE of module allocates its log once, by design).
+  * The results are allocations_per_message and messages_per_s. The control path doesn't allocate,
+  * the benchmark dies if it does (e.g. posix_spawn file actions prepared per ENABLE, glibc allocates them).
+  */
+
+#include "bench.h"
+
+#include "ev3control/control.h"
+#include "ev3control/control_protocol.h"
+#include "shared/misc.h"
+
+#include <stdio.h> //snprintf
+#include <stdlib.h> //size_t
+#include <new> //std::bad_alloc
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+const char BENCH_NAME[]="cat";
+const char BENCH_CALL[]="/bin/cat";
+const uint16_t BENCH_CREATION_DELAY_MS=500;
+const int BENCH_STATUS_MODULES=8; //table size for QUERY_STATUS (besides the enabled one)
+
+bool g_counting=false;
+uint64_t g_allocations=0;
+
+extern "C" void *malloc(size_t size)
+{
+	if(g_counting)
+		++g_allocations;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	if(g_counting)
+		++g_allocations;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	if(g_counting)
+		++g_allocations;
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+void *operator new(size_t size)
+{
+	void *ptr;
+
+	if(g_counting)
+		++g_allocations;
+	if( (ptr=__libc_malloc(size ? size : 1)) == NULL )
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+struct control_path_bench
+{
+	Control *control;
+	char enable[CONTROL_BUFFER_BYTES];
+	char disable[CONTROL_BUFFER_BYTES];
+	char query_status[CONTROL_BUFFER_BYTES];
+	char response[CONTROL_BUFFER_BYTES];
+	bench_function counted;
+	uint64_t messages;
+};
+
+void EncodeMessages(control_path_bench *bench)
+{
+	if(!PutControlHeader(bench->enable, CONTROL_BUFFER_BYTES, 0, ENABLE)
+	|| !PutControlAttributeString(bench->enable, CONTROL_BUFFER_BYTES, UNIQUE_NAME, BENCH_NAME)
+	|| !PutControlAttributeString(bench->enable, CONTROL_BUFFER_BYTES, CALL, BENCH_CALL)
+	|| !PutControlAttributeU16(bench->enable, CONTROL_BUFFER_BYTES, CREATION_DELAY_MS, BENCH_CREATION_DELAY_MS)
+	|| !PutControlHeader(bench->disable, CONTROL_BUFFER_BYTES, 0, DISABLE)
+	|| !PutControlAttributeString(bench->disable, CONTROL_BUFFER_BYTES, UNIQUE_NAME, BENCH_NAME)
+	|| !PutControlHeader(bench->query_status, CONTROL_BUFFER_BYTES, 0, QUERY_STATUS))
+		Die("bench: unable to encode control messages");
+}
+
+void ProcessEnable(control_path_bench *bench)
+{
+	static const ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+	control_attribute attributes[3];
+	control_header header;
+	int module;
+
+	GetControlHeader(bench->enable, &header);
+	if(!ParseControlMessage(header, bench->enable+CONTROL_HEADER_BYTES, attributes, 3, expected))
+		Die("bench: invalid enable message");
+
+	const char *unique_name=GetControlAttributeString(attributes[0]);
+	const char *call=GetControlAttributeString(attributes[1]);
+	uint16_t creation_delay_ms=GetControlAttributeU16(attributes[2]);
+
+	if( (module=bench->control->FindModule(unique_name)) == -1 && (module=bench->control->InsertModule(unique_name, creation_delay_ms)) == -1)
+		Die("bench: module table full");
+
+	if(!bench->control->EnableModule(module, call, creation_delay_ms))
+		Die("bench: unable to enable module");
+}
+
+void ProcessDisable(control_path_bench *bench)
+{
+	static const ControlAttributes expected[]={UNIQUE_NAME};
+	control_attribute attributes[1];
+	control_header header;
+	int module;
+
+	GetControlHeader(bench->disable, &header);
+	if(!ParseControlMessage(header, bench->disable+CONTROL_HEADER_BYTES, attributes, 1, expected))
+		Die("bench: invalid disable message");
+
+	if( (module=bench->control->FindModule(GetControlAttributeString(attributes[0]))) == -1)
+		Die("bench: no module to disable");
+
+	bench->control->DisableModule(module);
+}
+
+// STATUS_ALL messages as EncodeStatusAllMessage of ev3control
+void ProcessQueryStatus(control_path_bench *bench)
+{
+	const Control &control=*bench->control;
+	control_header header;
+	int module=0;
+
+	GetControlHeader(bench->query_status, &header);
+	if(header.command != QUERY_STATUS || header.payload_length != 0)
+		Die("bench: invalid query status message");
+
+	do
+	{
+		if( !PutControlHeader(bench->response, CONTROL_BUFFER_BYTES, TimestampUs(), STATUS_ALL) )
+			Die("bench: unable to encode status message");
+
+		for(; module < control.ModulesCount(); ++module)
+		{
+			const Module &m=control.GetModule(module);
+			int length=GetControlMessageLength(bench->response);
+
+			if(!PutControlAttributeString(bench->response, CONTROL_BUFFER_BYTES, UNIQUE_NAME, m.name)
+			|| !PutControlAttributeU8(bench->response, CONTROL_BUFFER_BYTES, MODULE_STATE, m.state)
+			|| !PutControlAttributeI32(bench->response, CONTROL_BUFFER_BYTES, RETURN_VALUE, m.return_value))
+			{
+				SetControlMessageLength(bench->response, length);
+				break;
+			}
+		}
+		g_bench_sink += GetControlMessageLength(bench->response);
+	}
+	while(module != control.ModulesCount());
+}
+
+// waits until disabled module exits
+void ReapModule(control_path_bench *bench)
+{
+	int modules_out[CONTROL_MAX_MODULES];
+	ModuleOutput output[CONTROL_MAX_MODULES*MODULE_OUTPUT_STREAMS];
+	uint64_t deadline=TimestampUs() + MODULE_DISABLE_TRIES*MODULE_DISABLE_MS*1000;
+
+	while(bench->control->CheckModulesStates(modules_out) == 0)
+	{
+		if(TimestampUs() > deadline)
+			Die("bench: module didn't exit on stdin EOF");
+		SleepUs(50);
+	}
+	bench->control->DrainModulesOutput(output);
+}
+
+// ENABLE, QUERY_STATUS, DISABLE (and reaping the module)
+void BenchEnableDisable(void *data, int iterations)
+{
+	control_path_bench *bench=(control_path_bench*)data;
+
+	for(int i=0;i<iterations;++i)
+	{
+		ProcessEnable(bench);
+		ProcessQueryStatus(bench);
+		ProcessDisable(bench);
+		ReapModule(bench);
+	}
+	bench->messages += 3*iterations;
+}
+
+void BenchQueryStatus(void *data, int iterations)
+{
+	control_path_bench *bench=(control_path_bench*)data;
+
+	for(int i=0;i<iterations;++i)
+		ProcessQueryStatus(bench);
+	bench->messages += iterations;
+}
+
+// counts only the benchmarked function, not Bench (its first result allocates stdout buffer)
+void CountAllocations(void *data, int iterations)
+{
+	control_path_bench *bench=(control_path_bench*)data;
+
+	g_counting=true;
+	bench->counted(bench, iterations);
+	g_counting=false;
+}
+
+void BenchControlPath(control_path_bench *bench, const char *name, bench_function function)
+{
+	char result_name[64];
+	uint64_t start_us;
+
+	bench->messages=0;
+	bench->counted=function;
+	g_allocations=0;
+	start_us=TimestampUs();
+
+	Bench("control_path", name, CountAllocations, bench);
+
+	double elapsed_s=(TimestampUs()-start_us)/1000000.0;
+
+	snprintf(result_name, sizeof(result_name), "%s_allocations_per_message", name);
+	BenchValue("control_path", result_name, (double)g_allocations/bench->messages, "allocations");
+	snprintf(result_name, sizeof(result_name), "%s_messages_per_s", name);
+	BenchValue("control_path", result_name, bench->messages/elapsed_s, "messages/s");
+
+	if(g_allocations != 0)
+		Die("bench: control path allocates memory");
+}
+
+int main(int argc, char **argv)
+{
+	static control_path_bench bench;
+	char name[16];
+
+	bench.control=new Control();
+	EncodeMessages(&bench);
+
+	//the table has some disabled modules as in real use
+	for(int i=0;i<BENCH_STATUS_MODULES;++i)
+	{
+		snprintf(name, sizeof(name), "module%d", i);
+		if(bench.control->InsertModule(name, BENCH_CREATION_DELAY_MS) == -1)
+			Die("bench: module table full");
+	}
+
+	BenchEnableDisable(&bench, 1); //warm-up, inserts the module
+
+	BenchControlPath(&bench, "enable_query_disable", BenchEnableDisable);
+	BenchControlPath(&bench, "query_status", BenchQueryStatus);
+
+	delete bench.control;
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * ev3dev-mapping ev3control control protocol benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures encoding and parsing of typical control messages
+  * and parsing of corrupted messages (random byte flips and truncations).
+  *
+  * Round trip of encoding and parsing is checked by control_protocol_check (make check),
+ * parsing of arbitrary input by control_protocol_fuzz.
+  * Corrupted messages are kept in buffers of their exact size, compile
+  * with control_protocol.cpp and -fsanitize=address to catch reads past them.
+  */
+
+#include "bench.h"
+
+#include "ev3control/control_protocol.h"
+#include "shared/misc.h"
+
+#include <stdio.h> //snprintf
+#include <stdlib.h> //malloc
+#include <string.h> //memcpy
+
+const int BENCH_BATCH_MODULES=16; //as CONTROL_MAX_BATCH_MODULES of ev3control
+const int BENCH_STATUS_MODULES=32; //as CONTROL_MAX_MODULES of ev3control
+const int BENCH_CORRUPTED_MESSAGES=1024;
+
+const char *BENCH_NAME="drive";
+const char *BENCH_CALL="./ev3drive 8003 10000";
+const uint16_t BENCH_CREATION_DELAY_MS=500;
+
+struct corrupted_message
+{
+	char *msg; //exactly CONTROL_HEADER_BYTES + payload_length bytes
+};
+
+char g_enable[CONTROL_BUFFER_BYTES];
+char g_enable_many[CONTROL_BUFFER_BYTES];
+corrupted_message g_corrupted[BENCH_CORRUPTED_MESSAGES];
+
+int EncodeEnable(char *buffer)
+{
+	if(!PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, ENABLE)
+	|| !PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, BENCH_NAME)
+	|| !PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, CALL, BENCH_CALL)
+	|| !PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, CREATION_DELAY_MS, BENCH_CREATION_DELAY_MS))
+		Die("bench: unable to encode enable message");
+	return GetControlMessageLength(buffer);
+}
+
+int EncodeEnableMany(char *buffer)
+{
+	char name[16];
+
+	if(!PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, ENABLE_MANY))
+		Die("bench: unable to encode enable many message");
+
+	for(int i=0;i<BENCH_BATCH_MODULES;++i)
+	{
+		snprintf(name, sizeof(name), "module%d", i);
+		if(!PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, name)
+		|| !PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, CALL, BENCH_CALL)
+		|| !PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, CREATION_DELAY_MS, BENCH_CREATION_DELAY_MS))
+			Die("bench: unable to encode enable many message");
+	}
+	return GetControlMessageLength(buffer);
+}
+
+int EncodeStatusAll(char *buffer)
+{
+	if(!PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, STATUS_ALL))
+		Die("bench: unable to encode status message");
+
+	for(int i=0;i<BENCH_STATUS_MODULES;++i)
+		if(!PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, BENCH_NAME)
+		|| !PutControlAttributeU8(buffer, CONTROL_BUFFER_BYTES, MODULE_STATE, STATE_ENABLED)
+		|| !PutControlAttributeI32(buffer, CONTROL_BUFFER_BYTES, RETURN_VALUE, 0))
+			Die("bench: unable to encode status message");
+
+	return GetControlMessageLength(buffer);
+}
+
+// returns the number of accepted attributes groups or -1
+int ParseEnable(const char *msg, int max_groups, control_attribute *attributes)
+{
+	const static ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+	control_header header;
+
+	GetControlHeader(msg, &header);
+	return ParseControlMessageGroups(header, msg+CONTROL_HEADER_BYTES, attributes, max_groups, expected, 3);
+}
+
+// deterministic so that runs are comparable
+uint32_t Random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+// enable many messages with flipped bytes, some truncated (payload length lies or message is cut)
+void PrepareCorrupted()
+{
+	uint32_t state=2016;
+	int length=GetControlMessageLength(g_enable_many);
+
+	for(int i=0;i<BENCH_CORRUPTED_MESSAGES;++i)
+	{
+		char msg[CONTROL_BUFFER_BYTES];
+		memcpy(msg, g_enable_many, length);
+
+		int flips=1 + Random(&state) % 8;
+		for(int f=0;f<flips;++f)
+			msg[CONTROL_HEADER_BYTES + Random(&state) % (length-CONTROL_HEADER_BYTES)] = Random(&state);
+
+		int msg_length=length;
+		if(Random(&state) % 4 == 0)
+		{
+			//truncate keeping the header consistent with the length
+			msg_length=CONTROL_HEADER_BYTES + Random(&state) % (length-CONTROL_HEADER_BYTES);
+			SetControlMessageLength(msg, msg_length);
+		}
+
+		g_corrupted[i].msg=(char*)malloc(msg_length);
+		if(g_corrupted[i].msg == NULL)
+			Die("bench: malloc failed");
+		memcpy(g_corrupted[i].msg, msg, msg_length);
+	}
+}
+
+void BenchEncodeEnable(void *data, int iterations)
+{
+	char buffer[CONTROL_BUFFER_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += EncodeEnable(buffer);
+}
+
+void BenchParseEnable(void *data, int iterations)
+{
+	control_attribute attributes[3];
+	for(int i=0;i<iterations;++i)
+	{
+		g_bench_sink += ParseEnable(g_enable, 1, attributes);
+		g_bench_sink += GetControlAttributeU16(attributes[2]);
+	}
+}
+
+void BenchParseEnableMany(void *data, int iterations)
+{
+	control_attribute attributes[3*BENCH_BATCH_MODULES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += ParseEnable(g_enable_many, BENCH_BATCH_MODULES, attributes);
+}
+
+void BenchEncodeStatusAll(void *data, int iterations)
+{
+	char buffer[CONTROL_BUFFER_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += EncodeStatusAll(buffer);
+}
+
+void BenchParseCorrupted(void *data, int iterations)
+{
+	control_attribute attributes[3*BENCH_BATCH_MODULES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += ParseEnable(g_corrupted[i % BENCH_CORRUPTED_MESSAGES].msg, BENCH_BATCH_MODULES, attributes);
+}
+
+int main(int argc, char **argv)
+{
+	EncodeEnable(g_enable);
+	EncodeEnableMany(g_enable_many);
+	PrepareCorrupted();
+
+	Bench("control_protocol", "encode_enable", BenchEncodeEnable, NULL);
+	Bench("control_protocol", "parse_enable", BenchParseEnable, NULL);
+	Bench("control_protocol", "parse_enable_many_16", BenchParseEnableMany, NULL);
+	Bench("control_protocol", "encode_status_all_32", BenchEncodeStatusAll, NULL);
+	Bench("control_protocol", "parse_corrupted", BenchParseCorrupted, NULL);
+
+	return 0;
+}
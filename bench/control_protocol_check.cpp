@@ -0,0 +1,226 @@
+/*
+ * ev3dev-mapping ev3control control protocol round trip check
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Encodes control messages with PutControl* functions and parses them back with
+  * GetControlHeader, ParseControlMessage, ParseControlMessageGroups and GetControlAttribute*
+  *
+  * - every attribute type, including limit values
+  * - message with repeated groups (ENABLE_MANY), empty one and group limit
+  * - attributes that don't fit the buffer or attribute length limit
+  * - truncated messages
+  *
+  * Prints every mismatch on stderr, exit status is non-zero if there was any.
+  */
+
+#include "ev3control/control_protocol.h"
+
+#include <stdio.h> //fprintf, snprintf
+#include <stdlib.h> //EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h> //strcmp, memset, memcmp
+
+const int CHECK_BATCH_MODULES=16; //as CONTROL_MAX_BATCH_MODULES of ev3control
+const uint64_t CHECK_TIMESTAMP_US=0x0123456789ABCDEFULL;
+
+const char *CHECK_NAME="drive";
+const char *CHECK_CALL="./ev3drive 8003 10000";
+
+int g_failures=0;
+
+void Check(bool ok, const char *what)
+{
+	if(ok)
+		return;
+	fprintf(stderr, "control_protocol_check: %s\n", what);
+	++g_failures;
+}
+
+void CheckHeader()
+{
+	char buffer[CONTROL_BUFFER_BYTES];
+	control_header header;
+
+	Check(PutControlHeader(buffer, CONTROL_BUFFER_BYTES, CHECK_TIMESTAMP_US, LOG_DATA), "header doesn't fit buffer");
+	GetControlHeader(buffer, &header);
+
+	Check(header.timestamp_us == CHECK_TIMESTAMP_US, "header timestamp mismatch");
+	Check(header.protocol_version == CONTROL_PROTOCOL_VERSION, "header protocol version mismatch");
+	Check(header.command == LOG_DATA, "header command mismatch (negative)");
+	Check(header.payload_length == 0 && GetControlMessageLength(buffer) == CONTROL_HEADER_BYTES, "header payload length not zero");
+
+	Check(!PutControlHeader(buffer, CONTROL_HEADER_BYTES-1, 0, KEEPALIVE), "header put into too small buffer");
+}
+
+void CheckEnable()
+{
+	const static ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+	char buffer[CONTROL_BUFFER_BYTES];
+	control_attribute attributes[3];
+	control_header header;
+
+	Check(PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, ENABLE)
+	&& PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, CHECK_NAME)
+	&& PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, CALL, CHECK_CALL)
+	&& PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, CREATION_DELAY_MS, UINT16_MAX), "unable to encode enable");
+
+	GetControlHeader(buffer, &header);
+	Check(GetControlMessageLength(buffer) == CONTROL_HEADER_BYTES + header.payload_length, "enable message length mismatch");
+	Check(ParseControlMessage(header, buffer+CONTROL_HEADER_BYTES, attributes, 3, expected), "enable doesn't parse");
+	Check(strcmp(GetControlAttributeString(attributes[0]), CHECK_NAME) == 0, "enable name mismatch");
+	Check(strcmp(GetControlAttributeString(attributes[1]), CHECK_CALL) == 0, "enable call mismatch");
+	Check(GetControlAttributeU16(attributes[2]) == UINT16_MAX, "enable creation delay mismatch");
+
+	//the last attribute cut off
+	SetControlMessageLength(buffer, GetControlMessageLength(buffer)-1);
+	GetControlHeader(buffer, &header);
+	Check(!ParseControlMessage(header, buffer+CONTROL_HEADER_BYTES, attributes, 3, expected), "truncated enable parses");
+}
+
+void CheckStats()
+{
+	const static ControlAttributes expected[]={UNIQUE_NAME, CPU_PERMILLE, RSS_KB, VOLUNTARY_SWITCHES, INVOLUNTARY_SWITCHES, IOWAIT_PERMILLE, RETURN_VALUE, MODULE_STATE};
+	char buffer[CONTROL_BUFFER_BYTES];
+	control_attribute attributes[8];
+	control_header header;
+
+	Check(PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, STATS)
+	&& PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, "")
+	&& PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, CPU_PERMILLE, 1000)
+	&& PutControlAttributeU32(buffer, CONTROL_BUFFER_BYTES, RSS_KB, UINT32_MAX)
+	&& PutControlAttributeU32(buffer, CONTROL_BUFFER_BYTES, VOLUNTARY_SWITCHES, 0)
+	&& PutControlAttributeU32(buffer, CONTROL_BUFFER_BYTES, INVOLUNTARY_SWITCHES, 0x80000001U)
+	&& PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, IOWAIT_PERMILLE, 0x8001)
+	&& PutControlAttributeI32(buffer, CONTROL_BUFFER_BYTES, RETURN_VALUE, INT32_MIN)
+	&& PutControlAttributeU8(buffer, CONTROL_BUFFER_BYTES, MODULE_STATE, UINT8_MAX), "unable to encode stats");
+
+	GetControlHeader(buffer, &header);
+	Check(ParseControlMessage(header, buffer+CONTROL_HEADER_BYTES, attributes, 8, expected), "stats doesn't parse");
+	Check(strcmp(GetControlAttributeString(attributes[0]), "") == 0, "empty string mismatch");
+	Check(GetControlAttributeU16(attributes[1]) == 1000, "u16 mismatch");
+	Check(GetControlAttributeU32(attributes[2]) == UINT32_MAX, "u32 max mismatch");
+	Check(GetControlAttributeU32(attributes[3]) == 0, "u32 zero mismatch");
+	Check(GetControlAttributeU32(attributes[4]) == 0x80000001U, "u32 high bit mismatch");
+	Check(GetControlAttributeU16(attributes[5]) == 0x8001, "u16 high bit mismatch");
+	Check(GetControlAttributeI32(attributes[6]) == INT32_MIN, "i32 min mismatch");
+	Check(GetControlAttributeU8(attributes[7]) == UINT8_MAX, "u8 max mismatch");
+
+	//attribute of different type than expected
+	const static ControlAttributes reordered[]={UNIQUE_NAME, RSS_KB};
+	Check(!ParseControlMessage(header, buffer+CONTROL_HEADER_BYTES, attributes, 2, reordered), "unexpected attribute parses");
+}
+
+void CheckLogData()
+{
+	const static ControlAttributes expected[]={UNIQUE_NAME, LOG_STREAM, LOG_OFFSET, LOG_TEXT};
+	char buffer[CONTROL_BUFFER_BYTES], text[CONTROL_MAX_ATTRIBUTE_DATA_LENGTH+1], name[CONTROL_MAX_ATTRIBUTE_DATA_LENGTH+1];
+	control_attribute attributes[4];
+	control_header header;
+
+	for(int i=0;i<=CONTROL_MAX_ATTRIBUTE_DATA_LENGTH;++i)
+		text[i]=i; //with '\0' in the middle, LOG_TEXT is not zero terminated
+	memset(name, 'x', sizeof(name)-1);
+	name[sizeof(name)-1]='\0';
+
+	Check(PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, LOG_DATA)
+	&& !PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, name), "string longer than attribute limit put");
+
+	name[CONTROL_MAX_ATTRIBUTE_DATA_LENGTH-1]='\0';
+
+	Check(PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, name)
+	&& PutControlAttributeU8(buffer, CONTROL_BUFFER_BYTES, LOG_STREAM, LOG_STDERR)
+	&& PutControlAttributeU32(buffer, CONTROL_BUFFER_BYTES, LOG_OFFSET, 123456)
+	&& !PutControlAttributeBytes(buffer, CONTROL_BUFFER_BYTES, LOG_TEXT, text, CONTROL_MAX_ATTRIBUTE_DATA_LENGTH+1)
+	&& PutControlAttributeBytes(buffer, CONTROL_BUFFER_BYTES, LOG_TEXT, text, CONTROL_MAX_ATTRIBUTE_DATA_LENGTH), "unable to encode log data");
+
+	GetControlHeader(buffer, &header);
+	Check(ParseControlMessage(header, buffer+CONTROL_HEADER_BYTES, attributes, 4, expected), "log data doesn't parse");
+	Check(strcmp(GetControlAttributeString(attributes[0]), name) == 0, "max length string mismatch");
+	Check(GetControlAttributeU8(attributes[1]) == LOG_STDERR, "log stream mismatch");
+	Check(GetControlAttributeU32(attributes[2]) == 123456, "log offset mismatch");
+	Check(attributes[3].length == CONTROL_MAX_ATTRIBUTE_DATA_LENGTH && memcmp(attributes[3].data, text, CONTROL_MAX_ATTRIBUTE_DATA_LENGTH) == 0, "bytes mismatch");
+}
+
+void CheckEnableMany()
+{
+	const static ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+	char buffer[CONTROL_BUFFER_BYTES], name[16];
+	control_attribute attributes[3*CHECK_BATCH_MODULES];
+	control_header header;
+	int groups;
+
+	Check(PutControlHeader(buffer, CONTROL_BUFFER_BYTES, 0, ENABLE_MANY), "unable to encode enable many");
+	GetControlHeader(buffer, &header);
+	Check(ParseControlMessageGroups(header, buffer+CONTROL_HEADER_BYTES, attributes, CHECK_BATCH_MODULES, expected, 3) == 0, "empty enable many doesn't have 0 groups");
+
+	for(int i=0;i<CHECK_BATCH_MODULES;++i)
+	{
+		snprintf(name, sizeof(name), "module%d", i);
+		Check(PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, UNIQUE_NAME, name)
+		&& PutControlAttributeString(buffer, CONTROL_BUFFER_BYTES, CALL, CHECK_CALL)
+		&& PutControlAttributeU16(buffer, CONTROL_BUFFER_BYTES, CREATION_DELAY_MS, i), "unable to encode enable many");
+	}
+
+	GetControlHeader(buffer, &header);
+	groups=ParseControlMessageGroups(header, buffer+CONTROL_HEADER_BYTES, attributes, CHECK_BATCH_MODULES, expected, 3);
+	Check(groups == CHECK_BATCH_MODULES, "enable many groups count mismatch");
+
+	for(int i=0;i<groups;++i)
+	{
+		snprintf(name, sizeof(name), "module%d", i);
+		Check(strcmp(GetControlAttributeString(attributes[3*i]), name) == 0
+		&& strcmp(GetControlAttributeString(attributes[3*i+1]), CHECK_CALL) == 0
+		&& GetControlAttributeU16(attributes[3*i+2]) == i, "enable many group mismatch");
+	}
+
+	Check(ParseControlMessageGroups(header, buffer+CONTROL_HEADER_BYTES, attributes, CHECK_BATCH_MODULES-1, expected, 3) == -1, "enable many over group limit parses");
+
+	//incomplete last group
+	SetControlMessageLength(buffer, GetControlMessageLength(buffer)-4);
+	GetControlHeader(buffer, &header);
+	Check(ParseControlMessageGroups(header, buffer+CONTROL_HEADER_BYTES, attributes, CHECK_BATCH_MODULES, expected, 3) == -1, "truncated enable many parses");
+}
+
+// attribute that doesn't fit leaves the message as it was
+void CheckBufferFull()
+{
+	char buffer[CONTROL_HEADER_BYTES+9]; //header, U32 and U8 attribute
+	int length;
+
+	Check(PutControlHeader(buffer, sizeof(buffer), 0, DISABLE)
+	&& PutControlAttributeU32(buffer, sizeof(buffer), RSS_KB, 1), "unable to encode small message");
+
+	length=GetControlMessageLength(buffer);
+
+	Check(!PutControlAttributeU32(buffer, sizeof(buffer), RSS_KB, 2), "attribute past buffer put");
+	Check(!PutControlAttributeString(buffer, sizeof(buffer), UNIQUE_NAME, CHECK_NAME), "string past buffer put");
+	Check(GetControlMessageLength(buffer) == length, "failed put changed message length");
+	Check(PutControlAttributeU8(buffer, sizeof(buffer), MODULE_STATE, 1), "attribute that fits exactly not put");
+}
+
+int main(int argc, char **argv)
+{
+	CheckHeader();
+	CheckEnable();
+	CheckStats();
+	CheckLogData();
+	CheckEnableMany();
+	CheckBufferFull();
+
+	if(g_failures)
+	{
+		fprintf(stderr, "control_protocol_check: %d checks failed\n", g_failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
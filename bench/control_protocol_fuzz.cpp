@@ -0,0 +1,220 @@
+/*
+ * ev3dev-mapping ev3control control protocol fuzz target
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Feeds arbitrary bytes to control message parsing as ev3control does with client data
+  *
+  * The input is taken as a message when it has the header and the payload it declares
+  * (ev3control waits for that many bytes, messages that don't fit its buffer are skipped).
+  * The message is copied to a buffer of its exact size and parsed with GetControlHeader,
+  * ParseControlMessage and ParseControlMessageGroups as every message with attributes,
+  * parsed attributes are read with GetControlAttribute*.
+  *
+  * - with clang, libFuzzer and AddressSanitizer (make fuzz, -DLIBFUZZER):
+  *   ./control_protocol_libfuzzer corpus/control_protocol
+  * - with gcc, replays the files (or directories of files) given as arguments (make check):
+  *   ./control_protocol_fuzz corpus/control_protocol
+  */
+
+#include "ev3control/control_protocol.h"
+
+#include <stdio.h> //fprintf, fopen, fread
+#include <stdlib.h> //malloc, free
+#include <string.h> //memcpy, strlen
+#include <stddef.h> //size_t
+#include <dirent.h> //opendir, readdir
+
+const int FUZZ_MAX_GROUPS=32; //as CONTROL_MAX_MODULES of ev3control
+const int FUZZ_MAX_ATTRIBUTES=8;
+
+struct fuzz_message
+{
+	const ControlAttributes *attributes;
+	int length; //attributes in message or group
+	bool groups;
+};
+
+const ControlAttributes FUZZ_ENABLE[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+const ControlAttributes FUZZ_DISABLE[]={UNIQUE_NAME};
+const ControlAttributes FUZZ_FAILED[]={UNIQUE_NAME, RETURN_VALUE};
+const ControlAttributes FUZZ_SUBSCRIBE_STATS[]={STATS_PERIOD_MS};
+const ControlAttributes FUZZ_STATS[]={UNIQUE_NAME, CPU_PERMILLE, RSS_KB, VOLUNTARY_SWITCHES, INVOLUNTARY_SWITCHES, IOWAIT_PERMILLE};
+const ControlAttributes FUZZ_STATUS_ALL[]={UNIQUE_NAME, MODULE_STATE, RETURN_VALUE};
+const ControlAttributes FUZZ_LOG[]={UNIQUE_NAME, LOG_STREAM, LOG_OFFSET, LOG_FOLLOW};
+const ControlAttributes FUZZ_LOG_DATA[]={UNIQUE_NAME, LOG_STREAM, LOG_OFFSET, LOG_TEXT};
+
+const fuzz_message FUZZ_MESSAGES[]={
+	{FUZZ_ENABLE, 3, false}, {FUZZ_DISABLE, 1, false}, {FUZZ_FAILED, 2, false},
+	{FUZZ_SUBSCRIBE_STATS, 1, false}, {FUZZ_STATS, 6, false}, {FUZZ_LOG, 4, false}, {FUZZ_LOG_DATA, 4, false},
+	{FUZZ_ENABLE, 3, true}, {FUZZ_DISABLE, 1, true}, {FUZZ_STATUS_ALL, 3, true}};
+const int FUZZ_MESSAGES_COUNT=sizeof(FUZZ_MESSAGES)/sizeof(FUZZ_MESSAGES[0]);
+
+volatile uint32_t g_fuzz_sink;
+
+void ReadAttribute(const control_attribute &attribute)
+{
+	switch(attribute.attribute)
+	{
+		case UNIQUE_NAME:
+		case CALL:
+			g_fuzz_sink += strlen(GetControlAttributeString(attribute));
+			break;
+		case MODULE_STATE:
+		case LOG_STREAM:
+		case LOG_FOLLOW:
+			g_fuzz_sink += GetControlAttributeU8(attribute);
+			break;
+		case CREATION_DELAY_MS:
+		case STATS_PERIOD_MS:
+		case CPU_PERMILLE:
+		case IOWAIT_PERMILLE:
+			g_fuzz_sink += GetControlAttributeU16(attribute);
+			break;
+		case RETURN_VALUE:
+			g_fuzz_sink += GetControlAttributeI32(attribute);
+			break;
+		default: //u32 and bytes
+			for(int i=0;i<attribute.length;++i)
+				g_fuzz_sink += attribute.data[i];
+	}
+}
+
+void ParseMessage(const char *msg)
+{
+	static control_attribute attributes[FUZZ_MAX_GROUPS*FUZZ_MAX_ATTRIBUTES];
+	control_header header;
+	int count;
+
+	GetControlHeader(msg, &header);
+
+	for(int m=0;m<FUZZ_MESSAGES_COUNT;++m)
+	{
+		const fuzz_message &message=FUZZ_MESSAGES[m];
+
+		if(message.groups)
+			count=ParseControlMessageGroups(header, msg+CONTROL_HEADER_BYTES, attributes, FUZZ_MAX_GROUPS, message.attributes, message.length);
+		else
+			count=ParseControlMessage(header, msg+CONTROL_HEADER_BYTES, attributes, message.length, message.attributes) ? 1 : -1;
+
+		for(int i=0;i<count*message.length;++i)
+			ReadAttribute(attributes[i]);
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char *msg;
+	int length;
+
+	if(size < (size_t)CONTROL_HEADER_BYTES)
+		return 0;
+
+	length=CONTROL_HEADER_BYTES + GetControlHeaderPayloadLength((const char*)data);
+
+	if((size_t)length > size || length > CONTROL_BUFFER_BYTES)
+		return 0;
+
+	//exact size so that reads past the message are caught
+	if( (msg=(char*)malloc(length)) == NULL )
+		return 0;
+	memcpy(msg, data, length);
+
+	ParseMessage(msg);
+
+	free(msg);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+
+// returns false if file can't be read
+bool ReplayFile(const char *path)
+{
+	uint8_t *data;
+	long size;
+	FILE *file;
+
+	if( (file=fopen(path, "rb")) == NULL )
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	size=ftell(file);
+	rewind(file);
+
+	if(size < 0 || (data=(uint8_t*)malloc(size ? size : 1)) == NULL || fread(data, 1, size, file) != (size_t)size)
+	{
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+
+	return true;
+}
+
+// returns the number of replayed files or -1 on error
+int Replay(const char *path)
+{
+	char file[512];
+	DIR *dir;
+	dirent *entry;
+	int count=0;
+
+	if( (dir=opendir(path)) == NULL )
+		return ReplayFile(path) ? 1 : -1;
+
+	while( (entry=readdir(dir)) != NULL )
+	{
+		if(entry->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+		if(!ReplayFile(file))
+		{
+			closedir(dir);
+			return -1;
+		}
+		++count;
+	}
+	closedir(dir);
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	int count, total=0;
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "control_protocol_fuzz file_or_directory...\n");
+		return EXIT_FAILURE;
+	}
+
+	for(int i=1;i<argc;++i)
+	{
+		if( (count=Replay(argv[i])) == -1 )
+		{
+			fprintf(stderr, "control_protocol_fuzz: unable to read %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+		total += count;
+	}
+
+	fprintf(stderr, "control_protocol_fuzz: replayed %d inputs\n", total);
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * ev3dev-mapping benchmarks fake ev3dev-lang-cpp
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ev3dev.h"
+
+#include <stdio.h> //snprintf
+#include <stdlib.h> //getenv, strtol
+#include <string.h> //strlen
+#include <unistd.h> //read, write, close, access
+#include <fcntl.h> //open
+#include <sstream> //istringstream
+
+namespace ev3dev {
+
+const port_type OUTPUT_A("outA");
+const port_type OUTPUT_B("outB");
+const port_type OUTPUT_C("outC");
+const port_type OUTPUT_D("outD");
+
+const std::string motor::stop_action_coast("coast");
+
+// like sysfs, each access opens the attribute, a write replaces the whole value
+int device::get_attr_int(const std::string &name) const
+{
+	return strtol(get_attr_string(name).c_str(), NULL, 10);
+}
+
+std::string device::get_attr_string(const std::string &name) const
+{
+	char buffer[128];
+	int fd, length;
+
+	if( (fd=open((_path + name).c_str(), O_RDONLY | O_CLOEXEC)) == -1)
+		return std::string();
+	length=read(fd, buffer, sizeof(buffer)-1);
+	close(fd);
+
+	if(length <= 0)
+		return std::string();
+	if(buffer[length-1] == '\n')
+		--length;
+
+	return std::string(buffer, length);
+}
+
+void device::set_attr_int(const std::string &name, int value)
+{
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "%d", value);
+	set_attr_string(name, buffer);
+}
+
+void device::set_attr_string(const std::string &name, const std::string &value)
+{
+	int fd;
+
+	if( (fd=open((_path + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+		return;
+	if(write(fd, value.c_str(), value.size()) != (ssize_t)value.size())
+		perror("fake ev3dev: write");
+	close(fd);
+}
+
+motor::motor(port_type port)
+{
+	const char *root=getenv("EV3_FAKE_SYSFS");
+
+	if(root == NULL)
+		return;
+
+	_path=std::string(root) + "/" + port + "/";
+	_connected = access(_path.c_str(), F_OK) == 0;
+}
+
+mode_set motor::state() const
+{
+	std::istringstream flags(get_attr_string("state"));
+	std::string flag;
+	mode_set state;
+
+	while(flags >> flag)
+		state.insert(flag);
+
+	return state;
+}
+
+}
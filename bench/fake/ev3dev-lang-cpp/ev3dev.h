@@ -0,0 +1,89 @@
+/*
+ * ev3dev-mapping benchmarks fake ev3dev-lang-cpp header file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Stand-in for the part of ev3dev-lang-cpp used by ev3drive, so that ev3drive can run on any Linux
+  *
+  * The motor attributes are files in <EV3_FAKE_SYSFS>/<port> directory (e.g. /dev/shm/stall/outA/speed)
+  * written and read the same way as sysfs attributes, the benchmark plays the driver part.
+  * There are no sensors (connected() is false).
+  */
+
+#pragma once
+
+#include <string>
+#include <set>
+
+namespace ev3dev {
+
+typedef std::string port_type;
+typedef std::set<std::string> mode_set;
+
+extern const port_type OUTPUT_A;
+extern const port_type OUTPUT_B;
+extern const port_type OUTPUT_C;
+extern const port_type OUTPUT_D;
+
+class device
+{
+public:
+	bool connected() const { return _connected; }
+	int device_index() const { return 0; }
+
+	int get_attr_int(const std::string &name) const;
+	std::string get_attr_string(const std::string &name) const;
+	void set_attr_int(const std::string &name, int value);
+	void set_attr_string(const std::string &name, const std::string &value);
+protected:
+	device() : _connected(false) {}
+	std::string _path; //directory with attribute files
+	bool _connected;
+};
+
+class motor : public device
+{
+public:
+	motor(port_type port);
+
+	static const std::string stop_action_coast;
+
+	int speed() const { return get_attr_int("speed"); }
+	int speed_sp() const { return get_attr_int("speed_sp"); }
+	int duty_cycle() const { return get_attr_int("duty_cycle"); }
+	mode_set state() const;
+
+	motor &set_speed_sp(int v) { set_attr_int("speed_sp", v); return *this; }
+	motor &set_position_sp(int v) { set_attr_int("position_sp", v); return *this; }
+	motor &set_time_sp(int v) { set_attr_int("time_sp", v); return *this; }
+	motor &set_stop_action(const std::string &v) { set_attr_string("stop_action", v); return *this; }
+
+	void run_forever() { set_attr_string("command", "run-forever"); }
+	void run_to_rel_pos() { set_attr_string("command", "run-to-rel-pos"); }
+	void run_timed() { set_attr_string("command", "run-timed"); }
+	void stop() { set_attr_string("command", "stop"); }
+};
+
+class large_motor : public motor
+{
+public:
+	large_motor(port_type port) : motor(port) {}
+};
+
+class i2c_sensor : public device
+{
+public:
+	i2c_sensor(port_type port, const std::set<std::string> &drivers) {}
+};
+
+}
@@ -0,0 +1,343 @@
+/*
+ * ev3dev-mapping packet codec benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Compares packet codecs generated from layouts in lib/shared/packets.h
+  * with the hand-written encoders/decoders the modules used before (kept here as reference).
+  *
+  * The outputs are compared before benchmarking, the program dies on mismatch.
+  * The *_codec results should be the same as *_hand ones.
+  */
+
+#include "bench.h"
+
+#include "shared/packets.h"
+#include "shared/misc.h"
+
+#include <string.h> //memcmp, memset
+#include <endian.h> //htobe16, htobe32, htobe64
+
+const int BENCH_PACKETS=64; //different packets, checked and cycled through
+
+odometry_packet g_odometry[BENCH_PACKETS];
+dead_reconning_packet g_dead_reconning[BENCH_PACKETS];
+wifi_packet g_wifi[BENCH_PACKETS];
+laser_packet g_laser[BENCH_PACKETS];
+drive_status_packet g_drive_status[BENCH_PACKETS];
+char g_drive[BENCH_PACKETS][DRIVE_PACKET_BYTES];
+
+// reference hand-written code
+
+int HandEncodeOdometryPacket(const odometry_packet &p, char *data)
+{
+	*((uint64_t*)data) = htobe64(p.timestamp_us);
+	data += sizeof(p.timestamp_us);
+
+	*((uint32_t*)data)= htobe32(p.position_left);
+	data += sizeof(p.position_left);
+
+	*((uint32_t*)data)= htobe32(p.position_right);
+	data += sizeof(p.position_right);
+
+	*((uint16_t*)data)= htobe16(0);
+	data += sizeof(p.reserved1);
+
+	return 18;
+}
+
+int HandEncodeDeadReconningPacket(const dead_reconning_packet &p, char *data)
+{
+	*((uint64_t*)data) = htobe64(p.timestamp_us);
+	data += sizeof(p.timestamp_us);
+
+	*((uint32_t*)data)= htobe32(p.position_left);
+	data += sizeof(p.position_left);
+
+	*((uint32_t*)data)= htobe32(p.position_right);
+	data += sizeof(p.position_right);
+
+	*((uint16_t*)data)= htobe16(p.heading);
+	data += sizeof(p.heading);
+
+	return 18;
+}
+
+int HandEncodeWifiPacket(const wifi_packet &p, char *data)
+{
+	*((uint64_t*)data) = htobe64(p.timestamp_us);
+	data += sizeof(p.timestamp_us);
+
+	memcpy(data, p.bssid, WIFI_BSSID_BYTES);
+	data += WIFI_BSSID_BYTES;
+
+	memcpy(data, p.ssid, WIFI_SSID_BYTES);
+	data += WIFI_SSID_BYTES;
+
+	*data=p.signal_dbm;
+	data += 1;
+
+	*((uint32_t*)data)= htobe32(p.rx_packets);
+	data += sizeof(p.rx_packets);
+
+	*((uint32_t*)data)= htobe32(p.tx_packets);
+	data += sizeof(p.tx_packets);
+
+	return 56;
+}
+
+int HandEncodeLaserReading(const laser_reading *reading, char *data)
+{
+	const uint16_t *reading_as_u16=(uint16_t*)reading;
+
+	*((uint16_t*)data)=htobe16(reading_as_u16[0]);
+	data += sizeof(uint16_t);
+	*((uint16_t*)data)=htobe16(reading_as_u16[1]);
+	data += sizeof(uint16_t);
+
+	return 4;
+}
+
+int HandEncodeLaserPacket(const laser_packet &p, char *data)
+{
+	*((uint64_t*)data) = htobe64(p.timestamp_us);
+	data += sizeof(p.timestamp_us);
+
+	*((uint16_t*)data)= htobe16(p.laser_speed);
+	data += sizeof(p.laser_speed);
+
+	*((uint16_t*)data)= htobe16(p.laser_angle);
+	data += sizeof(p.laser_angle);
+
+	for(int i=0;i<4*LASER_FRAMES_PER_READ; ++i)
+		data += HandEncodeLaserReading(p.laser_readings+i, data);
+
+	return 12 + 16 * LASER_FRAMES_PER_READ;
+}
+
+void HandDecodeDrivePacket(drive_packet *packet, const char *data)
+{
+	packet->timestamp_us=be64toh(*((uint64_t*)data));
+	packet->command=be16toh(*((int16_t*)(data+8)));
+	packet->param1=be16toh(*((int16_t*)(data+10)));
+	packet->param2=be16toh(*((int16_t*)(data+12)));
+	packet->param3=be16toh(*((int16_t*)(data+14)));
+	packet->param4=be16toh(*((int16_t*)(data+16)));
+}
+
+int HandEncodeDriveStatusPacket(const drive_status_packet &p, char *data)
+{
+	*((uint64_t*)data) = htobe64(p.timestamp_us);
+	data += sizeof(p.timestamp_us);
+
+	*((uint16_t*)data)= htobe16(p.status);
+	data += sizeof(p.status);
+
+	*((uint16_t*)data)= htobe16(p.motors);
+	data += sizeof(p.motors);
+
+	*((uint32_t*)data)= htobe32(p.reaction_us);
+	data += sizeof(p.reaction_us);
+
+	return 16;
+}
+
+// deterministic so that runs are comparable
+uint32_t Random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+void PreparePackets()
+{
+	uint32_t state=2016;
+
+	for(int i=0;i<BENCH_PACKETS;++i)
+	{
+		uint64_t timestamp=(uint64_t)Random(&state) << 24 | Random(&state);
+
+		g_odometry[i]={timestamp, (int32_t)Random(&state), -(int32_t)Random(&state), 0};
+		g_dead_reconning[i]={timestamp, (int32_t)Random(&state), -(int32_t)Random(&state), (int16_t)(Random(&state) % 36000 - 18000)};
+
+		g_wifi[i].timestamp_us=timestamp;
+		for(int b=0;b<WIFI_BSSID_BYTES;++b)
+			g_wifi[i].bssid[b]=Random(&state);
+		memset(g_wifi[i].ssid, 0, WIFI_SSID_BYTES);
+		for(int c=0;c<1+i%(WIFI_SSID_BYTES-1);++c)
+			g_wifi[i].ssid[c]='a' + Random(&state) % 26;
+		g_wifi[i].signal_dbm=-(int)(Random(&state) % 90);
+		g_wifi[i].rx_packets=Random(&state);
+		g_wifi[i].tx_packets=Random(&state);
+
+		g_laser[i].timestamp_us=timestamp;
+		g_laser[i].laser_speed=Random(&state);
+		g_laser[i].laser_angle=Random(&state) % 360;
+		for(int r=0;r<LASER_READINGS_PER_FRAME*LASER_FRAMES_PER_READ;++r)
+			g_laser[i].laser_readings[r]={(uint16_t)Random(&state), (uint16_t)Random(&state)};
+
+		g_drive_status[i]={timestamp, 1, (int16_t)(Random(&state) % 4), (int32_t)Random(&state)};
+
+		for(int b=0;b<DRIVE_PACKET_BYTES;++b)
+			g_drive[i][b]=Random(&state);
+	}
+}
+
+void CheckSame()
+{
+	char hand[LASER_PACKET_BYTES], codec[LASER_PACKET_BYTES];
+	drive_packet hand_drive, codec_drive;
+
+	for(int i=0;i<BENCH_PACKETS;++i)
+	{
+		if( HandEncodeOdometryPacket(g_odometry[i], hand) != odometry_codec::Encode(g_odometry[i], codec)
+		|| memcmp(hand, codec, ODOMETRY_PACKET_BYTES) )
+			Die("bench: odometry codec differs from hand-written");
+
+		if( HandEncodeDeadReconningPacket(g_dead_reconning[i], hand) != dead_reconning_codec::Encode(g_dead_reconning[i], codec)
+		|| memcmp(hand, codec, DEAD_RECONNING_PACKET_BYTES) )
+			Die("bench: dead reconning codec differs from hand-written");
+
+		if( HandEncodeWifiPacket(g_wifi[i], hand) != wifi_codec::Encode(g_wifi[i], codec)
+		|| memcmp(hand, codec, WIFI_PACKET_BYTES) )
+			Die("bench: wifi codec differs from hand-written");
+
+		if( HandEncodeLaserPacket(g_laser[i], hand) != laser_codec::Encode(g_laser[i], codec)
+		|| memcmp(hand, codec, LASER_PACKET_BYTES) )
+			Die("bench: laser codec differs from hand-written");
+
+		if( HandEncodeDriveStatusPacket(g_drive_status[i], hand) != drive_status_codec::Encode(g_drive_status[i], codec)
+		|| memcmp(hand, codec, DRIVE_STATUS_PACKET_BYTES) )
+			Die("bench: drive status codec differs from hand-written");
+
+		HandDecodeDrivePacket(&hand_drive, g_drive[i]);
+		drive_codec::Decode(&codec_drive, g_drive[i]);
+
+		if( hand_drive.timestamp_us != codec_drive.timestamp_us || hand_drive.command != codec_drive.command
+		|| hand_drive.param1 != codec_drive.param1 || hand_drive.param2 != codec_drive.param2
+		|| hand_drive.param3 != codec_drive.param3 || hand_drive.param4 != codec_drive.param4)
+			Die("bench: drive codec differs from hand-written");
+	}
+}
+
+// static buffers as in the modules
+void BenchOdometryHand(void *data, int iterations)
+{
+	static char buffer[ODOMETRY_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += HandEncodeOdometryPacket(g_odometry[i % BENCH_PACKETS], buffer) + buffer[i % ODOMETRY_PACKET_BYTES];
+}
+
+void BenchOdometryCodec(void *data, int iterations)
+{
+	static char buffer[ODOMETRY_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += odometry_codec::Encode(g_odometry[i % BENCH_PACKETS], buffer) + buffer[i % ODOMETRY_PACKET_BYTES];
+}
+
+void BenchDeadReconningHand(void *data, int iterations)
+{
+	static char buffer[DEAD_RECONNING_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += HandEncodeDeadReconningPacket(g_dead_reconning[i % BENCH_PACKETS], buffer) + buffer[i % DEAD_RECONNING_PACKET_BYTES];
+}
+
+void BenchDeadReconningCodec(void *data, int iterations)
+{
+	static char buffer[DEAD_RECONNING_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += dead_reconning_codec::Encode(g_dead_reconning[i % BENCH_PACKETS], buffer) + buffer[i % DEAD_RECONNING_PACKET_BYTES];
+}
+
+void BenchWifiHand(void *data, int iterations)
+{
+	static char buffer[WIFI_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += HandEncodeWifiPacket(g_wifi[i % BENCH_PACKETS], buffer) + buffer[i % WIFI_PACKET_BYTES];
+}
+
+void BenchWifiCodec(void *data, int iterations)
+{
+	static char buffer[WIFI_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += wifi_codec::Encode(g_wifi[i % BENCH_PACKETS], buffer) + buffer[i % WIFI_PACKET_BYTES];
+}
+
+void BenchLaserHand(void *data, int iterations)
+{
+	static char buffer[LASER_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += HandEncodeLaserPacket(g_laser[i % BENCH_PACKETS], buffer) + buffer[i % LASER_PACKET_BYTES];
+}
+
+void BenchLaserCodec(void *data, int iterations)
+{
+	static char buffer[LASER_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += laser_codec::Encode(g_laser[i % BENCH_PACKETS], buffer) + buffer[i % LASER_PACKET_BYTES];
+}
+
+void BenchDriveStatusHand(void *data, int iterations)
+{
+	static char buffer[DRIVE_STATUS_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += HandEncodeDriveStatusPacket(g_drive_status[i % BENCH_PACKETS], buffer) + buffer[i % DRIVE_STATUS_PACKET_BYTES];
+}
+
+void BenchDriveStatusCodec(void *data, int iterations)
+{
+	static char buffer[DRIVE_STATUS_PACKET_BYTES];
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += drive_status_codec::Encode(g_drive_status[i % BENCH_PACKETS], buffer) + buffer[i % DRIVE_STATUS_PACKET_BYTES];
+}
+
+void BenchDriveHand(void *data, int iterations)
+{
+	drive_packet packet;
+	for(int i=0;i<iterations;++i)
+	{
+		HandDecodeDrivePacket(&packet, g_drive[i % BENCH_PACKETS]);
+		g_bench_sink += packet.timestamp_us + packet.param4;
+	}
+}
+
+void BenchDriveCodec(void *data, int iterations)
+{
+	drive_packet packet;
+	for(int i=0;i<iterations;++i)
+	{
+		drive_codec::Decode(&packet, g_drive[i % BENCH_PACKETS]);
+		g_bench_sink += packet.timestamp_us + packet.param4;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	PreparePackets();
+	CheckSame();
+
+	Bench("packet_codec", "encode_odometry_hand", BenchOdometryHand, NULL);
+	Bench("packet_codec", "encode_odometry_codec", BenchOdometryCodec, NULL);
+	Bench("packet_codec", "encode_dead_reconning_hand", BenchDeadReconningHand, NULL);
+	Bench("packet_codec", "encode_dead_reconning_codec", BenchDeadReconningCodec, NULL);
+	Bench("packet_codec", "encode_wifi_hand", BenchWifiHand, NULL);
+	Bench("packet_codec", "encode_wifi_codec", BenchWifiCodec, NULL);
+	Bench("packet_codec", "encode_laser_hand", BenchLaserHand, NULL);
+	Bench("packet_codec", "encode_laser_codec", BenchLaserCodec, NULL);
+	Bench("packet_codec", "encode_drive_status_hand", BenchDriveStatusHand, NULL);
+	Bench("packet_codec", "encode_drive_status_codec", BenchDriveStatusCodec, NULL);
+	Bench("packet_codec", "decode_drive_hand", BenchDriveHand, NULL);
+	Bench("packet_codec", "decode_drive_codec", BenchDriveCodec, NULL);
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * ev3dev-mapping process spawn benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures starting a process (as ev3control starts modules) while the parent holds large RSS
+  *
+  * - posix_spawn (with POSIX_SPAWN_USEVFORK as ev3control), the child shares parent memory until exec
+  * - fork and execv, the child gets a copy of parent page tables first
+  *
+  * Each operation is spawn of /bin/true and waitpid for it. The parent RSS (in MB) is the argument
+  * (default 16, EV3 has 64 MB of RAM). Maximum RSS of the parent and of the children
+  * (getrusage RUSAGE_CHILDREN, posix_spawn children are measured first) are printed in KB.
+  * Linux accounts the address space the child had before exec to its maximum RSS, so both kinds
+  * of children report the parent RSS, the cost of copying page tables shows in the latency.
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+
+#include <stdlib.h> //malloc, strtol
+#include <string.h> //memset
+#include <unistd.h> //fork, execv, _exit
+#include <spawn.h> //posix_spawn
+#include <sys/wait.h> //waitpid
+#include <sys/resource.h> //getrusage
+
+extern char **environ;
+
+const char BENCH_SPAWN_PATH[]="/bin/true";
+const int BENCH_SPAWN_DEFAULT_RSS_MB=16;
+
+void WaitChild(pid_t pid)
+{
+	int status;
+
+	if(waitpid(pid, &status, 0) == -1)
+		DieErrno("bench: waitpid");
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		Die("bench: child failed");
+}
+
+void BenchPosixSpawn(void *data, int iterations)
+{
+	char *argv[]={(char*)BENCH_SPAWN_PATH, NULL};
+	posix_spawnattr_t attributes;
+	short flags=0;
+	pid_t pid;
+
+#ifdef POSIX_SPAWN_USEVFORK
+	flags |= POSIX_SPAWN_USEVFORK;
+#endif
+
+	if( posix_spawnattr_init(&attributes) != 0 || posix_spawnattr_setflags(&attributes, flags) != 0 )
+		Die("bench: posix_spawn attributes failed");
+
+	for(int i=0;i<iterations;++i)
+	{
+		if(posix_spawn(&pid, BENCH_SPAWN_PATH, NULL, &attributes, argv, environ) != 0)
+			Die("bench: posix_spawn failed");
+		WaitChild(pid);
+	}
+
+	posix_spawnattr_destroy(&attributes);
+	g_bench_sink += iterations;
+}
+
+void BenchForkExecv(void *data, int iterations)
+{
+	char *argv[]={(char*)BENCH_SPAWN_PATH, NULL};
+	pid_t pid;
+
+	for(int i=0;i<iterations;++i)
+	{
+		if( (pid=fork()) == -1)
+			DieErrno("bench: fork");
+		if(pid == 0)
+		{
+			execv(BENCH_SPAWN_PATH, argv);
+			_exit(EXIT_FAILURE);
+		}
+		WaitChild(pid);
+	}
+
+	g_bench_sink += iterations;
+}
+
+void BenchMaxRSS(const char *name, int who)
+{
+	rusage usage;
+
+	if(getrusage(who, &usage) == -1)
+		DieErrno("bench: getrusage");
+
+	BenchValue("spawn", name, usage.ru_maxrss, "KB");
+}
+
+int main(int argc, char **argv)
+{
+	long rss_mb = argc > 1 ? strtol(argv[1], NULL, 10) : BENCH_SPAWN_DEFAULT_RSS_MB;
+	char *memory;
+
+	if(rss_mb <= 0)
+		Die("bench: the argument rss_mb has to be positive");
+
+	//touched so that the pages are resident and mapped in page tables
+	if( (memory=(char*)malloc(rss_mb*1024*1024)) == NULL )
+		Die("bench: unable to allocate memory");
+	memset(memory, 1, rss_mb*1024*1024);
+
+	BenchValue("spawn", "parent_rss", rss_mb*1024, "KB");
+
+	Bench("spawn", "posix_spawn_true", BenchPosixSpawn, NULL);
+	BenchMaxRSS("posix_spawn_children_maxrss", RUSAGE_CHILDREN);
+
+	Bench("spawn", "fork_execv_true", BenchForkExecv, NULL);
+	BenchMaxRSS("fork_execv_children_maxrss", RUSAGE_CHILDREN);
+
+	BenchMaxRSS("parent_maxrss", RUSAGE_SELF);
+
+	g_bench_sink += memory[rss_mb];
+	free(memory);
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * ev3dev-mapping ev3drive stall reaction benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures ev3drive reaction to motor stall, from stall onset to motors stopped
+  *
+  * ev3drive is built with fake ev3dev-lang-cpp (stall_bench_drive, see fake directory)
+  * which keeps the motor attributes in files on tmpfs, the benchmark plays the motor driver:
+  * - commands the motors to run with SET_SPEED drive packet
+  * - after spin-up injects stall at known time in one motor
+  *   (high duty_cycle and no speed, or stalled state reported by the driver)
+  * - waits for command attribute of the other motor to become stop (set after the stalled motor)
+  * - with stall back-off checks that only the stalled motor backs off (run-timed, against its direction)
+  *   and that stop command is accepted during back-off
+  * - receives the drive status packet and compares its reaction_us
+  *
+  * The stand-in is created in directory given as argument (default /dev/shm) and removed at exit.
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/packets.h"
+
+#include <stdio.h> //snprintf, fprintf
+#include <stdlib.h> //rand
+#include <string.h> //strcmp
+#include <unistd.h> //read, write, close, pipe, unlink, rmdir, getpid
+#include <fcntl.h> //open
+#include <spawn.h> //posix_spawn
+#include <sys/stat.h> //mkdir
+#include <sys/wait.h> //waitpid
+
+const int BENCH_DRIVE_PORT=18010;
+const int BENCH_DIRECTORY_MAX=128;
+const int BENCH_PATH_MAX=256;
+const int BENCH_TRIALS=5;
+const int BENCH_SPINUP_WAIT_MS=150; //longer than STALL_SPINUP_MS of ev3drive
+const int BENCH_COMMAND_TIMEOUT_MS=2000; //longer than STALL_HOLDOFF_MS of ev3drive
+const int BENCH_STATUS_TIMEOUT_MS=1000;
+const int BENCH_BACKOFF_MS=300;
+const char BENCH_BACKOFF_SPEED[]="-200"; //STALL_BACKOFF_SPEED of ev3drive against positive duty cycle
+const int BENCH_SPEED=300;
+
+const char *BENCH_MOTORS[]={"outA", "outD"};
+const char *BENCH_ATTRIBUTES[]={"command", "speed_sp", "position_sp", "time_sp", "stop_action", "state", "duty_cycle", "speed"};
+const int BENCH_ATTRIBUTES_COUNT=sizeof(BENCH_ATTRIBUTES)/sizeof(BENCH_ATTRIBUTES[0]);
+
+enum StallKind {STALL_KIND_SAMPLES, STALL_KIND_STATE};
+
+struct stall_bench
+{
+	char directory[BENCH_DIRECTORY_MAX]; //fake sysfs root
+	int socket_udp;
+	sockaddr_in drive;
+	pid_t pid;
+	int stdin_pipe; //closing it ends ev3drive
+};
+
+struct stall_result
+{
+	int onset_to_stop_us; //measured here
+	int reaction_us; //reported by ev3drive
+};
+
+void AttributePath(const stall_bench &bench, const char *motor, const char *attribute, char *path)
+{
+	snprintf(path, BENCH_PATH_MAX, "%s/%s/%s", bench.directory, motor, attribute);
+}
+
+// written as new file and renamed so that ev3drive never reads partial value
+void WriteAttribute(const stall_bench &bench, const char *motor, const char *attribute, const char *value)
+{
+	char path[BENCH_PATH_MAX], temp[BENCH_PATH_MAX+8];
+	int fd, length=strlen(value);
+
+	AttributePath(bench, motor, attribute, path);
+	snprintf(temp, sizeof(temp), "%s.new", path);
+
+	if( (fd=open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+		DieErrno("bench: open attribute");
+	if(write(fd, value, length) != length)
+		DieErrno("bench: write attribute");
+	close(fd);
+	if(rename(temp, path) == -1)
+		DieErrno("bench: rename attribute");
+}
+
+bool AttributeIs(const stall_bench &bench, const char *motor, const char *attribute, const char *value)
+{
+	char path[BENCH_PATH_MAX], buffer[32];
+	int fd, length;
+
+	AttributePath(bench, motor, attribute, path);
+
+	if( (fd=open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		DieErrno("bench: open attribute");
+	length=read(fd, buffer, sizeof(buffer)-1);
+	close(fd);
+
+	if(length < 0)
+		DieErrno("bench: read attribute");
+	buffer[length]='\0';
+
+	return strcmp(buffer, value) == 0;
+}
+
+void InitFakeSysfs(stall_bench *bench, const char *root)
+{
+	char path[BENCH_PATH_MAX];
+
+	snprintf(bench->directory, BENCH_DIRECTORY_MAX, "%s/bench-stall-%d", root, (int)getpid());
+	if(mkdir(bench->directory, 0700) == -1)
+		DieErrno("bench: unable to create fake sysfs");
+
+	for(int m=0;m<2;++m)
+	{
+		snprintf(path, BENCH_PATH_MAX, "%s/%s", bench->directory, BENCH_MOTORS[m]);
+		if(mkdir(path, 0700) == -1)
+			DieErrno("bench: unable to create fake motor");
+		for(int a=0;a<BENCH_ATTRIBUTES_COUNT;++a)
+			WriteAttribute(*bench, BENCH_MOTORS[m], BENCH_ATTRIBUTES[a], "0");
+	}
+}
+
+void CloseFakeSysfs(const stall_bench &bench)
+{
+	char path[BENCH_PATH_MAX];
+
+	for(int m=0;m<2;++m)
+	{
+		for(int a=0;a<BENCH_ATTRIBUTES_COUNT;++a)
+		{
+			AttributePath(bench, BENCH_MOTORS[m], BENCH_ATTRIBUTES[a], path);
+			unlink(path);
+		}
+		snprintf(path, BENCH_PATH_MAX, "%s/%s", bench.directory, BENCH_MOTORS[m]);
+		rmdir(path);
+	}
+	rmdir(bench.directory);
+}
+
+// ev3drive stdout goes to stderr, stdout is for results
+void StartDrive(stall_bench *bench, const char *drive_path, int backoff_ms)
+{
+	char port[8], timeout[8], backoff[8], environment[BENCH_PATH_MAX];
+	char *argv[]={(char*)drive_path, port, timeout, backoff, NULL};
+	char *envp[]={environment, NULL};
+	posix_spawn_file_actions_t actions;
+	int pipe_read_write[2];
+
+	snprintf(port, sizeof(port), "%d", BENCH_DRIVE_PORT);
+	snprintf(timeout, sizeof(timeout), "%d", 10000); //trials send packets often enough
+	snprintf(backoff, sizeof(backoff), "%d", backoff_ms);
+	snprintf(environment, BENCH_PATH_MAX, "EV3_FAKE_SYSFS=%s", bench->directory);
+
+	if(pipe2(pipe_read_write, O_CLOEXEC) == -1)
+		DieErrno("bench: pipe");
+
+	if( posix_spawn_file_actions_init(&actions) != 0
+	|| posix_spawn_file_actions_adddup2(&actions, pipe_read_write[0], STDIN_FILENO) != 0
+	|| posix_spawn_file_actions_adddup2(&actions, STDERR_FILENO, STDOUT_FILENO) != 0)
+		Die("bench: posix_spawn file actions failed");
+
+	if(posix_spawn(&bench->pid, drive_path, &actions, NULL, argv, envp) != 0)
+		Die("bench: unable to start stall_bench_drive");
+
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipe_read_write[0]);
+	bench->stdin_pipe=pipe_read_write[1];
+}
+
+void StopDrive(stall_bench *bench)
+{
+	int status;
+
+	close(bench->stdin_pipe);
+	if(waitpid(bench->pid, &status, 0) == -1)
+		DieErrno("bench: waitpid");
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		Die("bench: stall_bench_drive failed");
+}
+
+void SendDrivePacket(const stall_bench &bench, int16_t command, int16_t left, int16_t right)
+{
+	char buffer[DRIVE_PACKET_BYTES];
+	drive_packet packet={TimestampUs(), command, left, right, 0, 0};
+
+	drive_codec::Encode(packet, buffer);
+	SendToUDP(bench.socket_udp, bench.drive, buffer, DRIVE_PACKET_BYTES);
+}
+
+// returns time when motor command became value, 0 on timeout
+uint64_t WaitCommand(const stall_bench &bench, int motor, const char *value, int timeout_ms)
+{
+	uint64_t deadline=TimestampUs() + timeout_ms*1000ULL, now;
+
+	while( (now=TimestampUs()) < deadline )
+	{
+		if(AttributeIs(bench, BENCH_MOTORS[motor], "command", value))
+			return now;
+		SleepUs(20);
+	}
+	return 0;
+}
+
+// sets motors running and waits until ev3drive starts them
+// (motion commands are ignored during stall hold-off, so the command is repeated)
+void RunMotors(const stall_bench &bench)
+{
+	uint64_t deadline=TimestampUs() + BENCH_COMMAND_TIMEOUT_MS*1000ULL;
+
+	for(int m=0;m<2;++m)
+	{
+		WriteAttribute(bench, BENCH_MOTORS[m], "state", "running");
+		WriteAttribute(bench, BENCH_MOTORS[m], "duty_cycle", "50");
+		WriteAttribute(bench, BENCH_MOTORS[m], "speed", "300");
+		WriteAttribute(bench, BENCH_MOTORS[m], "command", "");
+	}
+
+	while(TimestampUs() < deadline)
+	{
+		SendDrivePacket(bench, 1, BENCH_SPEED, BENCH_SPEED); //SET_SPEED
+		if(WaitCommand(bench, 1, "run-forever", 50))
+			return;
+	}
+	Die("bench: ev3drive didn't start the motors");
+}
+
+stall_result StallTrial(const stall_bench &bench, StallKind kind, bool backoff)
+{
+	char buffer[DRIVE_STATUS_PACKET_BYTES], backoff_ms[8];
+	drive_status_packet status;
+	stall_result result;
+	uint64_t onset, stopped;
+
+	RunMotors(bench);
+	SleepUs(BENCH_SPINUP_WAIT_MS*1000 + rand() % 5000); //random phase to the monitor samples
+
+	if(kind == STALL_KIND_SAMPLES)
+	{
+		WriteAttribute(bench, BENCH_MOTORS[0], "duty_cycle", "100");
+		WriteAttribute(bench, BENCH_MOTORS[0], "speed", "0");
+	}
+	else
+		WriteAttribute(bench, BENCH_MOTORS[0], "state", "running stalled");
+
+	onset=TimestampUs();
+
+	//the right motor is handled after the left one
+	if( (stopped=WaitCommand(bench, 1, "stop", BENCH_COMMAND_TIMEOUT_MS)) == 0)
+		Die("bench: ev3drive didn't react to the stall");
+
+	snprintf(backoff_ms, sizeof(backoff_ms), "%d", BENCH_BACKOFF_MS);
+	if(backoff && (!AttributeIs(bench, BENCH_MOTORS[0], "command", "run-timed")
+	|| !AttributeIs(bench, BENCH_MOTORS[0], "speed_sp", BENCH_BACKOFF_SPEED) || !AttributeIs(bench, BENCH_MOTORS[0], "time_sp", backoff_ms)))
+		Die("bench: ev3drive didn't back off the stalled motor");
+	if(!backoff && !AttributeIs(bench, BENCH_MOTORS[0], "command", "stop"))
+		Die("bench: ev3drive didn't stop the stalled motor");
+
+	if(recv(bench.socket_udp, buffer, DRIVE_STATUS_PACKET_BYTES, 0) != DRIVE_STATUS_PACKET_BYTES)
+		DieErrno("bench: no drive status packet");
+	drive_status_codec::Decode(&status, buffer);
+
+	if(status.status != 1 || status.motors != 1) //STATUS_STALLED, STATUS_MOTOR_LEFT
+		Die("bench: unexpected drive status packet");
+
+	//operator stops the robot during back-off (stall hold-off)
+	if(backoff)
+	{
+		SendDrivePacket(bench, 1, 0, 0); //SET_SPEED
+		if(!WaitCommand(bench, 0, "stop", BENCH_STATUS_TIMEOUT_MS))
+			Die("bench: ev3drive ignored stop command during back-off");
+	}
+
+	result.onset_to_stop_us=(int)(stopped-onset);
+	result.reaction_us=status.reaction_us;
+	return result;
+}
+
+void BenchStall(const stall_bench &bench, const char *name, StallKind kind, bool backoff)
+{
+	char result_name[64];
+	stall_result result;
+	double onset_to_stop_sum=0, reaction_sum=0;
+	int onset_to_stop_max=0;
+
+	for(int i=0;i<BENCH_TRIALS;++i)
+	{
+		result=StallTrial(bench, kind, backoff);
+		onset_to_stop_sum += result.onset_to_stop_us;
+		reaction_sum += result.reaction_us;
+		if(result.onset_to_stop_us > onset_to_stop_max)
+			onset_to_stop_max=result.onset_to_stop_us;
+	}
+
+	snprintf(result_name, sizeof(result_name), "%s_onset_to_stop_mean", name);
+	BenchValue("stall", result_name, onset_to_stop_sum/BENCH_TRIALS, "us");
+	snprintf(result_name, sizeof(result_name), "%s_onset_to_stop_max", name);
+	BenchValue("stall", result_name, onset_to_stop_max, "us");
+	snprintf(result_name, sizeof(result_name), "%s_reported_reaction_mean", name);
+	BenchValue("stall", result_name, reaction_sum/BENCH_TRIALS, "us");
+}
+
+int main(int argc, char **argv)
+{
+	const char *root = argc > 1 ? argv[1] : "/dev/shm";
+	char drive_path[BENCH_PATH_MAX];
+	stall_bench bench;
+
+	snprintf(drive_path, BENCH_PATH_MAX, "%s_drive", argv[0]);
+
+	InitFakeSysfs(&bench, root);
+	InitNetworkUDP(&bench.socket_udp, NULL, NULL, 0, BENCH_STATUS_TIMEOUT_MS, TRAFFIC_DEFAULT);
+	InitDestinationUDP(&bench.drive, "127.0.0.1", BENCH_DRIVE_PORT);
+
+	StartDrive(&bench, drive_path, 0);
+	BenchStall(bench, "duty_cycle_speed", STALL_KIND_SAMPLES, false);
+	BenchStall(bench, "driver_state", STALL_KIND_STATE, false);
+	StopDrive(&bench);
+
+	StartDrive(&bench, drive_path, BENCH_BACKOFF_MS);
+	BenchStall(bench, "backoff", STALL_KIND_SAMPLES, true);
+	StopDrive(&bench);
+
+	CloseNetworkUDP(bench.socket_udp);
+	CloseFakeSysfs(bench);
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * ev3dev-mapping stream consumer benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures receiving module packets on loopback, one operation is one packet
+  * sent and received (send cost alone is in udp_bench):
+  * -recv: recv call per packet and odometry_codec::Decode (how consumers did it by hand)
+  * -consumer: ReceiveStreamConsumer (recvmmsg batches) and read through odometry_view
+  *
+  * Packets are sent in chunks that fit socket buffer so none are lost.
+  * robot_packets_per_s is the combined rate of the modules on the robot for comparison
+  * (odometry and dead-reconning at 10 ms, two lasers at 5 rotations/s, wifi at 100 ms).
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/stream_consumer.h"
+
+#include <sys/socket.h> //recv
+
+const int BENCH_CONSUMER_PORT=18002;
+const int BENCH_CHUNK=32;
+const double ROBOT_PACKETS_PER_S=100 + 100 + 2*45 + 10;
+
+struct consumer_bench
+{
+	int socket_udp;
+	sockaddr_in destination;
+	int receiver; //for recv
+	stream_consumer consumer;
+	char packet[PACKET_HEADER_BYTES+ODOMETRY_PACKET_BYTES];
+};
+
+void SendChunk(consumer_bench *bench, int count)
+{
+	for(int i=0;i<count;++i)
+		SendToUDP(bench->socket_udp, bench->destination, bench->packet, sizeof(bench->packet));
+}
+
+void BenchRecv(void *data, int iterations)
+{
+	consumer_bench *bench=(consumer_bench*)data;
+	char buffer[STREAM_CONSUMER_SLOT_BYTES];
+	odometry_packet packet;
+	int chunk;
+
+	for(int done=0;done<iterations;done+=chunk)
+	{
+		chunk=iterations-done < BENCH_CHUNK ? iterations-done : BENCH_CHUNK;
+		SendChunk(bench, chunk);
+
+		for(int i=0;i<chunk;++i)
+		{
+			if(recv(bench->receiver, buffer, sizeof(buffer), 0) != sizeof(bench->packet))
+				DieErrno("stream_consumer_bench: recv");
+			odometry_codec::Decode(&packet, buffer + PACKET_HEADER_BYTES);
+			g_bench_sink += packet.position_left;
+		}
+	}
+}
+
+void BenchConsumer(void *data, int iterations)
+{
+	consumer_bench *bench=(consumer_bench*)data;
+	int chunk;
+
+	for(int done=0;done<iterations;done+=chunk)
+	{
+		chunk=iterations-done < BENCH_CHUNK ? iterations-done : BENCH_CHUNK;
+		SendChunk(bench, chunk);
+
+		for(int received=0;received<chunk;)
+		{
+			int count=ReceiveStreamConsumer(&bench->consumer, -1);
+			for(int i=0;i<count;++i)
+				g_bench_sink += StreamView<odometry_view>(bench->consumer.datagrams[i]).position_left();
+			received += count;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	consumer_bench bench;
+	packet_header header={PACKET_VERSION, PACKET_ODOMETRY, BENCH_CONSUMER_PORT, 0};
+	odometry_packet packet={TimestampUs(), 100, 200, 0};
+	int port=BENCH_CONSUMER_PORT;
+
+	packet_header_codec::Encode(header, bench.packet);
+	odometry_codec::Encode(packet, bench.packet + PACKET_HEADER_BYTES);
+
+	InitNetworkUDP(&bench.socket_udp, NULL, NULL, 0, 0, TRAFFIC_DEFAULT);
+	InitDestinationUDP(&bench.destination, "127.0.0.1", BENCH_CONSUMER_PORT);
+
+	InitNetworkUDP(&bench.receiver, NULL, NULL, BENCH_CONSUMER_PORT, 0, TRAFFIC_DEFAULT);
+	Bench("stream_consumer", "recv_decode_odometry", BenchRecv, &bench);
+	CloseNetworkUDP(bench.receiver);
+
+	InitStreamConsumer(&bench.consumer, &port, 1, STREAM_CONSUMER_DEFAULT_BATCH);
+	Bench("stream_consumer", "recvmmsg_view_odometry", BenchConsumer, &bench);
+	BenchValue("stream_consumer", "packets_per_receive_call", (double)bench.consumer.received / bench.consumer.receive_calls, "packets");
+	CloseStreamConsumer(&bench.consumer);
+
+	BenchValue("stream_consumer", "robot_packets_per_s", ROBOT_PACKETS_PER_S, "packets/s");
+
+	CloseNetworkUDP(bench.socket_udp);
+
+	return 0;
+}
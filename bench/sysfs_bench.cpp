@@ -0,0 +1,125 @@
+/*
+ * ev3dev-mapping sysfs attribute read benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures the ways of reading sysfs attribute (e.g. motor position) on tmpfs stand-in
+  *
+  * tmpfs has no driver behind the file, so the results are the file system
+  * overhead only (the driver part is the same for all ways):
+  * - ifstream opened for each read (ev3dev-lang-cpp get_attr_int)
+  * - open, read, close for each read
+  * - descriptor kept open, pread from offset 0 (sysfs regenerates attribute on each read from 0)
+  * - descriptor kept open, lseek and read (direct file of gyroscope)
+  *
+  * The stand-in is created in directory given as argument (default /dev/shm) and removed at exit.
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+
+#include <stdio.h> //snprintf
+#include <stdlib.h> //strtol
+#include <unistd.h> //read, pread, lseek, close, unlink, getpid
+#include <fcntl.h> //open
+#include <fstream> //ifstream
+
+const int BENCH_PATH_MAX=128;
+const char BENCH_ATTRIBUTE[]="-123456\n"; //position of tacho motor
+
+void BenchIfstream(void *data, int iterations)
+{
+	const char *path=(const char*)data;
+	int value;
+
+	for(int i=0;i<iterations;++i)
+	{
+		std::ifstream attribute(path);
+		attribute >> value;
+		g_bench_sink += value;
+	}
+}
+
+int ReadAttribute(int fd)
+{
+	char buffer[32];
+	int length;
+
+	if( (length=pread(fd, buffer, sizeof(buffer)-1, 0)) == -1 )
+		DieErrno("bench: pread");
+	buffer[length]='\0';
+
+	return strtol(buffer, NULL, 10);
+}
+
+void BenchOpenReadClose(void *data, int iterations)
+{
+	const char *path=(const char*)data;
+	int fd;
+
+	for(int i=0;i<iterations;++i)
+	{
+		if( (fd=open(path, O_RDONLY | O_CLOEXEC)) == -1)
+			DieErrno("bench: open");
+		g_bench_sink += ReadAttribute(fd);
+		close(fd);
+	}
+}
+
+void BenchPread(void *data, int iterations)
+{
+	int fd=*(int*)data;
+
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += ReadAttribute(fd);
+}
+
+void BenchLseekRead(void *data, int iterations)
+{
+	int fd=*(int*)data;
+	char buffer[2];
+
+	for(int i=0;i<iterations;++i)
+	{
+		if(lseek(fd, 2, SEEK_SET) == -1)
+			DieErrno("bench: lseek");
+		if(read(fd, buffer, 2) != 2)
+			DieErrno("bench: read");
+		g_bench_sink += buffer[0];
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *directory = argc > 1 ? argv[1] : "/dev/shm";
+	char path[BENCH_PATH_MAX];
+	int fd;
+
+	snprintf(path, BENCH_PATH_MAX, "%s/bench-sysfs-%d", directory, (int)getpid());
+
+	if( (fd=open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+		DieErrno("bench: unable to create attribute stand-in");
+	if(write(fd, BENCH_ATTRIBUTE, sizeof(BENCH_ATTRIBUTE)-1) != sizeof(BENCH_ATTRIBUTE)-1)
+		DieErrno("bench: write attribute stand-in");
+
+	Bench("sysfs", "ifstream_open_read", BenchIfstream, path);
+	Bench("sysfs", "open_read_close", BenchOpenReadClose, path);
+	Bench("sysfs", "pread_kept_open", BenchPread, &fd);
+	Bench("sysfs", "lseek_read_kept_open", BenchLseekRead, &fd);
+
+	close(fd);
+	unlink(path);
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * ev3dev-mapping timestamp benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures the cost of timestamps taken for every packet (TimestampUs)
+  *
+  * - clock_gettime CLOCK_MONOTONIC through vDSO (as TimestampUs)
+  * - the same clock through real system call, the difference is what vDSO saves
+  *   (ARMv5 kernels of ev3dev may have no vDSO for clock_gettime, then both are the same)
+  * - CLOCK_MONOTONIC_COARSE, cheaper but only with tick resolution (printed as value)
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+
+#include <time.h> //clock_gettime, clock_getres
+#include <unistd.h> //syscall
+#include <sys/syscall.h> //SYS_clock_gettime
+
+void BenchTimestampUs(void *data, int iterations)
+{
+	for(int i=0;i<iterations;++i)
+		g_bench_sink += TimestampUs();
+}
+
+void BenchClockGettime(void *data, int iterations)
+{
+	clockid_t clock=*(clockid_t*)data;
+	timespec ts;
+
+	for(int i=0;i<iterations;++i)
+	{
+		clock_gettime(clock, &ts);
+		g_bench_sink += ts.tv_nsec;
+	}
+}
+
+void BenchClockGettimeSyscall(void *data, int iterations)
+{
+	clockid_t clock=*(clockid_t*)data;
+	timespec ts;
+
+	for(int i=0;i<iterations;++i)
+	{
+		syscall(SYS_clock_gettime, clock, &ts);
+		g_bench_sink += ts.tv_nsec;
+	}
+}
+
+void BenchResolution(const char *name, clockid_t clock)
+{
+	timespec resolution;
+
+	if(clock_getres(clock, &resolution) == -1)
+		DieErrno("bench: clock_getres");
+
+	BenchValue("timestamp", name, resolution.tv_sec*1e9 + resolution.tv_nsec, "ns");
+}
+
+int main(int argc, char **argv)
+{
+	clockid_t monotonic=CLOCK_MONOTONIC, coarse=CLOCK_MONOTONIC_COARSE;
+
+	Bench("timestamp", "timestamp_us", BenchTimestampUs, NULL);
+	Bench("timestamp", "monotonic", BenchClockGettime, &monotonic);
+	Bench("timestamp", "monotonic_syscall", BenchClockGettimeSyscall, &monotonic);
+	Bench("timestamp", "monotonic_coarse", BenchClockGettime, &coarse);
+	Bench("timestamp", "monotonic_coarse_syscall", BenchClockGettimeSyscall, &coarse);
+
+	BenchResolution("monotonic_resolution", monotonic);
+	BenchResolution("monotonic_coarse_resolution", coarse);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * ev3dev-mapping traffic class check
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Checks that TRAFFIC_CONTROL packets don't wait behind TRAFFIC_BULK flood
+  *
+  * A child process floods loopback with laser sized TRAFFIC_BULK packets (to a socket that is never read),
+  * then round trips of small packets are measured, first TRAFFIC_BULK (as the flood), then TRAFFIC_CONTROL.
+  * Loopback doesn't queue by default, scripts/traffic_class_test.sh sets up rate limited qdisc
+  * with priority bands (as congested WiFi) and runs this program.
+  *
+  * Mean and max round trips and lost packets are printed as JSON lines, exits with failure
+  * if control packets are lost or their round trip is not CHECK_MIN_SPEEDUP times shorter.
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/packets.h"
+
+#include <stdio.h> //fprintf
+#include <stdlib.h> //EXIT_FAILURE
+#include <unistd.h> //fork
+#include <signal.h> //kill
+#include <sys/wait.h> //waitpid
+#include <sys/socket.h> //recvfrom
+
+const int CHECK_ECHO_PORT=18020;
+const int CHECK_SINK_PORT=18021;
+const int CHECK_PINGS=20;
+const int CHECK_PING_INTERVAL_US=20000;
+const int CHECK_TIMEOUT_MS=500;
+const int CHECK_FLOOD_WARMUP_US=500000; //so that the queue is full
+const int CHECK_MIN_SPEEDUP=10;
+
+struct round_trips
+{
+	int received;
+	int lost;
+	uint64_t sum_us;
+	uint64_t max_us;
+};
+
+// the child sends until killed
+pid_t StartFlood()
+{
+	static char buffer[LASER_PACKET_BYTES];
+	sockaddr_in sink;
+	int flood;
+	pid_t pid;
+
+	if( (pid=fork()) == -1 )
+		DieErrno("check: fork");
+	if(pid > 0)
+		return pid;
+
+	InitNetworkUDP(&flood, NULL, NULL, 0, 0, TRAFFIC_BULK);
+	InitDestinationUDP(&sink, "127.0.0.1", CHECK_SINK_PORT);
+
+	for(;;)
+		SendToUDP(flood, sink, buffer, LASER_PACKET_BYTES);
+}
+
+// false if the packet was lost (or not sent because of congestion)
+bool RoundTrip(int ping, int echo, const sockaddr_in &echo_address, uint32_t sequence, uint64_t *round_trip_us)
+{
+	uint64_t start_us=TimestampUs();
+	sockaddr_in from;
+	socklen_t from_length;
+	uint32_t received;
+
+	if(!SendToUDP(ping, echo_address, (const char*)&sequence, sizeof(sequence)))
+		return false;
+
+	//late replies of lost round trips are skipped
+	do
+	{
+		from_length=sizeof(from);
+		if(recvfrom(echo, &received, sizeof(received), 0, (sockaddr*)&from, &from_length) != sizeof(received))
+			return false;
+	}
+	while(received != sequence);
+
+	if(!SendToUDP(echo, from, (const char*)&received, sizeof(received)))
+		return false;
+
+	do
+		if(recv(ping, &received, sizeof(received), 0) != sizeof(received))
+			return false;
+	while(received != sequence);
+
+	*round_trip_us=TimestampUs()-start_us;
+	return true;
+}
+
+void MeasureRoundTrips(TrafficClass traffic, uint32_t *sequence, round_trips *result)
+{
+	int ping, echo;
+	sockaddr_in echo_address;
+	uint64_t round_trip_us;
+
+	InitNetworkUDP(&ping, NULL, NULL, 0, CHECK_TIMEOUT_MS, traffic);
+	InitNetworkUDP(&echo, &echo_address, "127.0.0.1", CHECK_ECHO_PORT, CHECK_TIMEOUT_MS, traffic);
+
+	*result={0, 0, 0, 0};
+
+	for(int i=0;i<CHECK_PINGS;++i, ++*sequence)
+	{
+		if(!RoundTrip(ping, echo, echo_address, *sequence, &round_trip_us))
+		{
+			++result->lost;
+			continue;
+		}
+		++result->received;
+		result->sum_us += round_trip_us;
+		if(round_trip_us > result->max_us)
+			result->max_us=round_trip_us;
+		SleepUs(CHECK_PING_INTERVAL_US);
+	}
+
+	CloseNetworkUDP(ping);
+	CloseNetworkUDP(echo);
+}
+
+// lost round trips count as timeout for the mean
+double MeanUs(const round_trips &r)
+{
+	return (r.sum_us + (uint64_t)r.lost*CHECK_TIMEOUT_MS*1000) / (double)CHECK_PINGS;
+}
+
+void PrintRoundTrips(const char *traffic, const round_trips &r)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s_round_trip_mean", traffic);
+	BenchValue("traffic_class", name, MeanUs(r), "us");
+	snprintf(name, sizeof(name), "%s_round_trip_max", traffic);
+	BenchValue("traffic_class", name, r.max_us, "us");
+	snprintf(name, sizeof(name), "%s_lost", traffic);
+	BenchValue("traffic_class", name, r.lost, "packets");
+}
+
+int main(int argc, char **argv)
+{
+	round_trips bulk, control;
+	uint32_t sequence=0;
+	int sink;
+	pid_t flood;
+
+	InitNetworkUDP(&sink, NULL, NULL, CHECK_SINK_PORT, 0, TRAFFIC_DEFAULT);
+
+	flood=StartFlood();
+	SleepUs(CHECK_FLOOD_WARMUP_US);
+
+	MeasureRoundTrips(TRAFFIC_BULK, &sequence, &bulk);
+	MeasureRoundTrips(TRAFFIC_CONTROL, &sequence, &control);
+
+	if(kill(flood, SIGTERM) == -1 || waitpid(flood, NULL, 0) == -1)
+		DieErrno("check: stopping flood");
+	CloseNetworkUDP(sink);
+
+	PrintRoundTrips("bulk", bulk);
+	PrintRoundTrips("control", control);
+
+	if(control.lost > 0 || MeanUs(control)*CHECK_MIN_SPEEDUP > MeanUs(bulk))
+	{
+		fprintf(stderr, "traffic_class_check: control packets wait behind bulk flood (is the qdisc set up?)\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
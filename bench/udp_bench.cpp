@@ -0,0 +1,91 @@
+/*
+ * ev3dev-mapping UDP send benchmark
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * Measures SendToUDP and SendSenderUDP (connect()ed, non-blocking, used by the modules) on loopback
+  *
+  * Packets are sent to a bound socket that is never read, loopback drops them
+  * when its buffer is full, sendto cost is the same. The sizes are odometry
+  * and laser packets.
+  */
+
+#include "bench.h"
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/packets.h"
+
+#include <string.h> //memset
+
+const int BENCH_UDP_PORT=18001;
+const int BENCH_CONNECTED_PORT=18003;
+
+struct udp_bench
+{
+	int socket_udp;
+	sockaddr_in destination;
+	udp_sender sender;
+	int length;
+};
+
+void BenchSendToUDP(void *data, int iterations)
+{
+	static char buffer[LASER_PACKET_BYTES];
+	udp_bench *bench=(udp_bench*)data;
+
+	for(int i=0;i<iterations;++i)
+		SendToUDP(bench->socket_udp, bench->destination, buffer, bench->length);
+
+	g_bench_sink += iterations;
+}
+
+void BenchSendSenderUDP(void *data, int iterations)
+{
+	static char buffer[LASER_PACKET_BYTES];
+	udp_bench *bench=(udp_bench*)data;
+
+	for(int i=0;i<iterations;++i)
+		SendSenderUDP(&bench->sender, buffer, bench->length);
+
+	g_bench_sink += iterations;
+}
+
+int main(int argc, char **argv)
+{
+	int receiver;
+	udp_bench bench;
+	udp_sender_config config={0, UDP_DROP_OLDEST, 0, TRAFFIC_DEFAULT, 0, NULL, -1};
+
+	InitNetworkUDP(&receiver, NULL, NULL, BENCH_UDP_PORT, 0, TRAFFIC_DEFAULT);
+	InitNetworkUDP(&bench.socket_udp, NULL, NULL, 0, 0, TRAFFIC_DEFAULT);
+	InitDestinationUDP(&bench.destination, "127.0.0.1", BENCH_UDP_PORT);
+
+	bench.length=ODOMETRY_PACKET_BYTES;
+	Bench("udp", "send_loopback_odometry", BenchSendToUDP, &bench);
+	bench.length=LASER_PACKET_BYTES;
+	Bench("udp", "send_loopback_laser", BenchSendToUDP, &bench);
+
+	//the sender binds the destination port as modules do, on loopback the packets go to the sender socket itself
+	InitSenderUDP(&bench.sender, "127.0.0.1", BENCH_CONNECTED_PORT, LASER_PACKET_BYTES, config);
+	bench.length=ODOMETRY_PACKET_BYTES;
+	Bench("udp", "send_connected_odometry", BenchSendSenderUDP, &bench);
+	bench.length=LASER_PACKET_BYTES;
+	Bench("udp", "send_connected_laser", BenchSendSenderUDP, &bench);
+	CloseSenderUDP(&bench.sender);
+
+	CloseNetworkUDP(bench.socket_udp);
+	CloseNetworkUDP(receiver);
+
+	return 0;
+}
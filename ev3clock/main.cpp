@@ -0,0 +1,178 @@
+/*
+ * ev3clock program
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * This program works on PC (the host that receives data from EV3)
+  *
+  * ev3clock:
+  * -sends clock synchronization requests to ev3control on EV3 (UDP port the same as its TCP port)
+  * -estimates robot clock offset and drift from the answers (see lib/shared/clock_sync.h)
+  * -prints the estimate every second
+  *
+  * robot timestamp in host clock (TimestampUs, CLOCK_MONOTONIC of the host) is
+  * host_us = robot_us - offset_us, one-way latency of packet is receive time - host_us
+  *
+  * See Usage() function for syntax details (or run the program without arguments)
+  */
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/clock_sync.h"
+
+#include <stdio.h>
+#include <stdlib.h> //strtol
+#include <signal.h> //sig_atomic_t
+#include <errno.h> //errno
+#include <sys/socket.h> //recv
+
+// GLOBAL VARIABLES
+volatile sig_atomic_t g_finish_program=0;
+
+const int REPORT_MS=1000;
+
+void MainLoop(int socket_udp, const sockaddr_in &robot, int period_ms);
+// false on timeout
+bool Exchange(int socket_udp, const sockaddr_in &robot, uint32_t sequence, clock_sync *sync, uint32_t *round_trip_us);
+
+void Usage();
+int ProcessInput(int argc, char **argv, int *out_port, int *out_period_ms);
+void Finish(int signal);
+
+int main(int argc, char **argv)
+{
+	int socket_udp;
+	sockaddr_in robot;
+	int port, period_ms;
+
+	if( ProcessInput(argc, argv, &port, &period_ms) )
+	{
+		Usage();
+		return 0;
+	}
+	const char *host=argv[1];
+
+	SetStandardOutputLineBuffered();
+	RegisterSignals(Finish);
+
+	InitNetworkUDP(&socket_udp, NULL, NULL, 0, period_ms, TRAFFIC_CONTROL); //answers later than period are lost
+	InitDestinationUDP(&robot, host, port);
+
+	MainLoop(socket_udp, robot, period_ms);
+
+	CloseNetworkUDP(socket_udp);
+
+	printf("ev3clock: bye\n");
+
+	return 0;
+}
+
+void MainLoop(int socket_udp, const sockaddr_in &robot, int period_ms)
+{
+	clock_sync sync;
+	uint64_t start, next_report=TimestampUs() + REPORT_MS*1000;
+	uint32_t sequence, round_trip_us=0, lost=0;
+	int elapsed_us, period_us=1000*period_ms;
+
+	InitClockSync(&sync);
+
+	for(sequence=0;!g_finish_program;++sequence)
+	{
+		start=TimestampUs();
+
+		if(!Exchange(socket_udp, robot, sequence, &sync, &round_trip_us))
+			++lost;
+
+		if(start >= next_report && ClockSyncValid(sync))
+		{
+			printf("ev3clock: offset_us %lld drift_ppm %.3f round_trip_us %u min_round_trip_us %u lost %u\n",
+				(long long)ClockSyncOffsetUs(sync, start), sync.drift*1e6, round_trip_us, ClockSyncRoundTripUs(sync), lost);
+			next_report=start + REPORT_MS*1000;
+		}
+
+		elapsed_us=(int)(TimestampUs()-start);
+
+		if( elapsed_us < period_us )
+			SleepUs(period_us - elapsed_us);
+	}
+}
+
+bool Exchange(int socket_udp, const sockaddr_in &robot, uint32_t sequence, clock_sync *sync, uint32_t *round_trip_us)
+{
+	char buffer[CLOCK_SYNC_RESPONSE_BYTES];
+	uint32_t answer_sequence;
+	uint64_t t1, t2, t3, t4;
+	int length;
+
+	length=EncodeClockSyncRequest(buffer, sequence, TimestampUs());
+	SendToUDP(socket_udp, robot, buffer, length);
+
+	for(;;)
+	{
+		if( (length=recv(socket_udp, buffer, sizeof(buffer), 0)) == -1 )
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return false;
+			DieErrno("ev3clock: recv failed");
+		}
+
+		t4=TimestampUs();
+
+		//late answers to previous requests are ignored, their round trip is large anyway
+		if(DecodeClockSyncResponse(buffer, length, &answer_sequence, &t1, &t2, &t3) && answer_sequence == sequence)
+			break;
+	}
+
+	AddClockSyncSample(sync, t1, t2, t3, t4);
+	*round_trip_us=(t4-t1) - (t3-t2);
+
+	return true;
+}
+
+void Usage()
+{
+	printf("ev3clock robot_host port period_ms\n\n");
+	printf("examples:\n");
+	printf("./ev3clock 192.168.0.104 8004 100\n");
+}
+
+int ProcessInput(int argc, char **argv, int *out_port, int *out_period_ms)
+{
+	long int port, period_ms;
+
+	if(argc!=4)
+		return -1;
+
+	port=strtol(argv[2], NULL, 0);
+	if(port <= 0 || port > 65535)
+	{
+		fprintf(stderr, "ev3clock: the argument port has to be in range <1, 65535>\n");
+		return -1;
+	}
+	*out_port=port;
+
+	period_ms=strtol(argv[3], NULL, 0);
+	if(period_ms <= 0 || period_ms > 10000)
+	{
+		fprintf(stderr, "ev3clock: the argument period_ms has to be in range <1, 10000>\n");
+		return -1;
+	}
+	*out_period_ms=period_ms;
+
+	return 0;
+}
+
+void Finish(int signal)
+{
+	g_finish_program=1;
+}
@@ -17,11 +17,15 @@
 #include "shared/misc.h"
 
 #include <sys/wait.h> //wait
-#include <unistd.h> //close
-#include <fcntl.h> //O_NONBLOCK
-#include <string.h> //strtok
-
-using namespace std;
+#include <sys/epoll.h> //epoll_create1, epoll_ctl
+#include <unistd.h> //close, dup3, environ
+#include <fcntl.h> //open, fcntl, O_NONBLOCK
+#include <string.h> //strtok_r, strerror, strcmp
+#include <spawn.h> //posix_spawn
+#include <signal.h> //sigemptyset, kill
+#include <stdio.h> //fprintf, snprintf
+#include <stdlib.h> //setenv
+#include <errno.h> //errno
 
 int32_t ModuleReturnValue(int32_t status)
 {
@@ -30,229 +34,523 @@ int32_t ModuleReturnValue(int32_t status)
 	return -1;
 }
 
-Control::Control()
+Control::Control(): modules_count(0)
+{
+	char notify_fd[16]; //the same for every module, inherited through environment
+	snprintf(notify_fd, sizeof(notify_fd), "%d", MODULE_NOTIFY_FD);
+	if( setenv("EV3_NOTIFY_FD", notify_fd, 1) == -1)
+		DieErrno("Control: setenv failed\n");
+
+	if( (events_epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DieErrno("Control: epoll_create1 failed\n");
+
+	InitSpawn();
+}
+
+void Control::InitSpawn()
+{
+	const int module_fds[MODULE_SPAWN_FDS]={STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, MODULE_NOTIFY_FD};
+	sigset_t empty; //ev3control blocks some signals (SIGCHLD), don't pass that to module
+	short flags=POSIX_SPAWN_SETSIGMASK;
+
+#ifdef POSIX_SPAWN_USEVFORK
+	flags |= POSIX_SPAWN_USEVFORK; //older glibc copies page tables without it
+#endif
+
+	if( (spawn_placeholder_fd=open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1)
+		DieErrno("Control: open /dev/null failed\n");
+
+	//above module descriptors, so dup2 onto them never meets the source (that wouldn't clear close-on-exec)
+	for(int i=0;i<MODULE_SPAWN_FDS;++i)
+		if( (spawn_fds[i]=fcntl(spawn_placeholder_fd, F_DUPFD_CLOEXEC, MODULE_NOTIFY_FD+1)) == -1)
+			DieErrno("Control: reserving spawn descriptors failed\n");
+
+	sigemptyset(&empty);
+
+	if( posix_spawn_file_actions_init(&spawn_actions) != 0 )
+		Die("Control: posix_spawn file actions failed\n");
+	for(int i=0;i<MODULE_SPAWN_FDS;++i)
+		if( posix_spawn_file_actions_adddup2(&spawn_actions, spawn_fds[i], module_fds[i]) != 0 )
+			Die("Control: posix_spawn file actions failed\n");
+
+	if( posix_spawnattr_init(&spawn_attributes) != 0
+	|| posix_spawnattr_setflags(&spawn_attributes, flags) != 0
+	|| posix_spawnattr_setsigmask(&spawn_attributes, &empty) != 0 )
+		Die("Control: posix_spawn attributes failed\n");
+}
+
+// the pipe ends held by spawn descriptors are closed, the descriptors stay reserved
+void Control::ReleaseSpawnFds()
 {
+	for(int i=0;i<MODULE_SPAWN_FDS;++i)
+		if( dup3(spawn_placeholder_fd, spawn_fds[i], O_CLOEXEC) == -1)
+			DieErrno("Control: EnableModule dup3 failed\n");
 }
 
 Control::~Control()
 {
-	DisableModules();
+	DisableModulesWait();
+	close(events_epoll_fd);
+
+	posix_spawn_file_actions_destroy(&spawn_actions);
+	posix_spawnattr_destroy(&spawn_attributes);
+	for(int i=0;i<MODULE_SPAWN_FDS;++i)
+		close(spawn_fds[i]);
+	close(spawn_placeholder_fd);
+
+	for(int i=0;i<modules_count;++i)
+		delete modules[i].log;
 }
 
-bool Control::ContainsModule(const std::string& name, Module* module)
+int Control::FindModule(const char *name) const
 {
-	map<std::string, Module>::iterator it=modules.find(name);
-	if(it == modules.end())
-		return false;
+	for(int i=0;i<modules_count;++i)
+		if( strcmp(modules[i].name, name) == 0 )
+			return i;
+	return -1;
+}
 
-	*module=it->second;
-	return true;
+const Module &Control::GetModule(int module) const
+{
+	return modules[module];
 }
 
-void Control::InsertModule(const std::string& name, int creation_delay_ms)
+int Control::ModulesCount() const
 {
-	Module m={MODULE_DISABLED, creation_delay_ms, 0, 0, 0};
-	modules.insert( pair<string, Module>(name, m ) );
+	return modules_count;
 }
 
-void Control::EnableModule(const std::string& name, const std::string& module_call)
+int Control::InsertModule(const char *name, int creation_delay_ms)
 {
-	Module module;
+	if(modules_count == CONTROL_MAX_MODULES)
+		return -1;
 
-	if( !ContainsModule(name, &module) )
-		Die("Control: request to enable module but no such module\n");
+	if( strlen(name) >= (size_t)MODULE_NAME_BYTES )
+		Die("Control: request to insert module but name is too long\n");
 
-	if(module.state == MODULE_ENABLED)
+	Module m={"", MODULE_DISABLED, creation_delay_ms, 0, 0, 0, MODULE_NO_OWNER, DISABLE_EOF, 0, -1, 0, {}, 0, {-1, -1}, new ModuleLog()};
+	strcpy(m.name, name);
+
+	modules[modules_count]=m;
+	return modules_count++;
+}
+
+bool Control::EnableModule(int module_index, const char *module_call, int creation_delay_ms)
+{
+	Module &module=modules[module_index];
+
+	if(module.state == MODULE_ENABLED || module.state == MODULE_ENABLING || module.state == MODULE_DISABLING)
 		Die("Control: request to enable module but module already enabled\n");
 
-	int pipe_read_write[2];
-	if( pipe2(pipe_read_write, O_NONBLOCK) == -1 )
+	char **argv=PrepareExecvArgumentList(module_call);
+
+	if(argv == NULL)
+	{
+		fprintf(stderr, "Control: EnableModule %s call is empty or has more than %d arguments\n", module.name, MODULE_MAX_ARGS);
+		module.state=MODULE_FAILED;
+		module.return_value=-1;
+		return false;
+	}
+
+	//all ev3control descriptors are close-on-exec, only the ones dup2'ed below are inherited
+	int pipe_read_write[2], notify_read_write[2];
+	if( pipe2(pipe_read_write, O_NONBLOCK | O_CLOEXEC) == -1 )
 		DieErrno("PrepareChild() pipe failed");
+	if( pipe2(notify_read_write, O_NONBLOCK | O_CLOEXEC) == -1 )
+		DieErrno("Control: EnableModule notify pipe failed\n");
 
-	pid_t pid=fork();
+	//module writes block (as to terminal), only ev3control end is non-blocking
+	int output_read_write[MODULE_OUTPUT_STREAMS][2];
+	for(int i=0;i<MODULE_OUTPUT_STREAMS;++i)
+		if( pipe2(output_read_write[i], O_CLOEXEC) == -1 || fcntl(output_read_write[i][0], F_SETFL, O_NONBLOCK) == -1 )
+			DieErrno("Control: EnableModule output pipe failed\n");
 
-	if(pid==-1)
-		DieErrno("Cotrol: EnableModule fork failed\n");
-	if(pid==0) //child
-	{
-		close(pipe_read_write[1]);
-		if( dup2(pipe_read_write[0], STDIN_FILENO) == -1)
-			DieErrno("Control: EnableModule child dup2 failed\n");
+	//module ends go to the spawn descriptors in the order of file actions (see InitSpawn)
+	const int module_ends[MODULE_SPAWN_FDS]={pipe_read_write[0], output_read_write[MODULE_STDOUT][1], output_read_write[MODULE_STDERR][1], notify_read_write[1]};
 
-		//close the descriptors for older children
+	for(int i=0;i<MODULE_SPAWN_FDS;++i)
+		if( dup3(module_ends[i], spawn_fds[i], O_CLOEXEC) == -1)
+			DieErrno("Control: EnableModule dup3 failed\n");
 
-		map<string, Module>::iterator it;
+	pid_t pid;
 
-		for(it=modules.begin();it!=modules.end();++it)
-			if(it->second.state == MODULE_ENABLED)
-				close(it->second.write_fd);
+	int error=posix_spawn(&pid, argv[0], &spawn_actions, &spawn_attributes, argv, environ);
 
-		string argv_str;
-		vector<char *> argv=PrepareExecvArgumentList(module_call, argv_str);
+	ReleaseSpawnFds();
+	close(pipe_read_write[0]);
+	close(notify_read_write[1]);
+	for(int i=0;i<MODULE_OUTPUT_STREAMS;++i)
+		close(output_read_write[i][1]);
 
-		if( execv(argv[0], &argv[0]) == -1 )
-			DieErrno("Control: EnableModule execv failed\n");
+	if(error != 0)
+	{
+		fprintf(stderr, "Control: EnableModule posix_spawn %s failed: %s\n", argv[0], strerror(error));
+		close(pipe_read_write[1]);
+		close(notify_read_write[0]);
+		for(int i=0;i<MODULE_OUTPUT_STREAMS;++i)
+			close(output_read_write[i][0]);
+		module.state=MODULE_FAILED;
+		module.return_value=-1;
+		return false;
 	}
 
-	// parent pid points to child
-	close(pipe_read_write[0]);
+	AddEvents(notify_read_write[0]);
 
-	module.state=MODULE_ENABLED;
+	for(int i=0;i<MODULE_OUTPUT_STREAMS;++i)
+	{
+		CloseOutput(&module, i); //the previous run output may still be open (e.g. held by module's children)
+		AddEvents(output_read_write[i][0]);
+		module.output_fds[i]=output_read_write[i][0];
+	}
+
+	module.state=MODULE_ENABLING;
+	module.creation_delay_ms=creation_delay_ms;
 	module.pid=pid;
 	module.write_fd=pipe_read_write[1];
 	module.return_value=0;
-	modules[name]=module;
-	Sleep(module.creation_delay_ms);
+	module.notify_fd=notify_read_write[0];
+	module.enable_deadline_us=TimestampUs() + module.creation_delay_ms*1000;
+	module.stats=proc_stats(); //new process counters start from zero
+	module.stats_sample_us=TimestampUs();
+	return true;
 }
 
-vector<char*> Control::PrepareExecvArgumentList(const string& module_call, string &out_argv_string)
+int Control::EventsFd()
 {
-	out_argv_string=module_call;
-	char *argv=(char*)out_argv_string.c_str();
-	vector<char *> result;
-	char *token=strtok(argv, " ");
+	return events_epoll_fd;
+}
+
+int Control::CheckModulesReady(uint64_t now_us, int modules_out[])
+{
+	char buffer[64];
+	int ret, count=0;
 
-	while(token!=NULL)
+	for(int i=0;i<modules_count;++i)
 	{
-		result.push_back(token);
-		token=strtok(NULL, " ");
+		Module &module=modules[i];
+		bool ready=false;
+
+		if(module.state != MODULE_ENABLING)
+			continue;
+
+		while(module.notify_fd != -1 && !ready)
+		{
+			ret=read(module.notify_fd, buffer, sizeof(buffer)-1);
+
+			if(ret > 0)
+			{
+				buffer[ret]='\0';
+				ready = strstr(buffer, "READY=1") != NULL;
+			}
+			else if(ret == 0) //module closed the pipe without notifying, wait for deadline
+				CloseNotify(&module);
+			else if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			else if(errno != EINTR)
+				DieErrno("Control: CheckModulesReady read failed\n");
+		}
+
+		if(!ready && now_us < module.enable_deadline_us)
+			continue;
+
+		if(!ready)
+			fprintf(stderr, "Control: module %s didn't notify readiness in %d ms, assuming ready\n", module.name, module.creation_delay_ms);
+
+		CloseNotify(&module);
+		module.state=MODULE_ENABLED;
+		modules_out[count++]=i;
 	}
+	return count;
+}
+
+uint64_t Control::EnableModulesDeadline() const
+{
+	uint64_t deadline=0;
 
-	result.push_back(NULL);
+	for(int i=0;i<modules_count;++i)
+	{
+		const Module &module=modules[i];
 
-	return result;
+		if(module.state != MODULE_ENABLING)
+			continue;
+		if(deadline == 0 || module.enable_deadline_us < deadline)
+			deadline=module.enable_deadline_us;
+	}
+	return deadline;
 }
 
+void Control::AddEvents(int fd)
+{
+	epoll_event event;
+	event.events=EPOLLIN;
+	event.data.fd=fd;
+
+	if( epoll_ctl(events_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+		DieErrno("Control: AddEvents epoll_ctl failed\n");
+}
 
-bool Control::DisableModule(const std::string &name)
+void Control::CloseOutput(Module *module, int stream)
 {
-	Module module;
+	if(module->output_fds[stream] == -1)
+		return;
 
-	if( !ContainsModule(name, &module) )
-		Die("Control: request to disable module but no such module\n");
+	if( epoll_ctl(events_epoll_fd, EPOLL_CTL_DEL, module->output_fds[stream], NULL) == -1)
+		DieErrno("Control: CloseOutput epoll_ctl failed\n");
+	close(module->output_fds[stream]);
+	module->output_fds[stream]=-1;
+}
 
-	if(module.state != MODULE_ENABLED)
-		Die("Control: request to disable module but module is not enabled\n");
+int Control::DrainModulesOutput(ModuleOutput output[])
+{
+	char buffer[512];
+	int ret, count=0;
 
-	if(module.write_fd!=-1)
+	for(int m=0;m<modules_count;++m)
 	{
-		close(module.write_fd);
-		module.write_fd=-1;
-		modules[name]=module;
+		Module &module=modules[m];
+
+		for(int i=0;i<MODULE_OUTPUT_STREAMS;++i)
+		{
+			if(module.output_fds[i] == -1)
+				continue;
+
+			RingLog &log=module.log->streams[i];
+			uint32_t offset=log.End();
+
+			while(module.output_fds[i] != -1)
+			{
+				ret=read(module.output_fds[i], buffer, sizeof(buffer));
+
+				if(ret > 0)
+					log.Write(buffer, ret);
+				else if(ret == 0) //module (and its children) closed the stream
+					CloseOutput(&module, i);
+				else if(errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				else if(errno != EINTR)
+					DieErrno("Control: DrainModulesOutput read failed\n");
+			}
+
+			if(log.End() != offset)
+			{
+				ModuleOutput new_output={m, (ModuleOutputStream)i, offset};
+				output[count++]=new_output;
+			}
+		}
 	}
+	return count;
+}
 
-	if(DisableModuleWait(name, &module))
-		return true;
+int Control::ReadModuleLog(int module, ModuleOutputStream stream, uint32_t *offset, char *buffer, int length) const
+{
+	return modules[module].log->streams[stream].Read(offset, buffer, length);
+}
 
-	fprintf(stderr, "Control: DisableModule terminating module %s with SIGINT\n", name.c_str());	
+void Control::CloseNotify(Module *module)
+{
+	if(module->notify_fd == -1)
+		return;
 
-	if(kill(module.pid, SIGINT) == -1)
-		DieErrno("Control: DisableModule kill SIGINT error\n");
+	if( epoll_ctl(events_epoll_fd, EPOLL_CTL_DEL, module->notify_fd, NULL) == -1)
+		DieErrno("Control: CloseNotify epoll_ctl failed\n");
+	close(module->notify_fd);
+	module->notify_fd=-1;
+}
 
-	if(DisableModuleWait(name, &module))
-		return true;
+// tokenizes the copy of call in place, NULL if there is no program or too many arguments
+char **Control::PrepareExecvArgumentList(const char *module_call)
+{
+	char *save, *token;
+	int args=0;
 
-	fprintf(stderr, "Control: DisableModule terminating module %s with SIGKILL\n", name.c_str());	
+	if( strlen(module_call) >= (size_t)MODULE_CALL_BYTES )
+		return NULL;
 
-	if(kill(module.pid, SIGKILL) == -1)
-		DieErrno("Control: DisableModule kill SIGKILL error\n");
+	strcpy(argv_buffer, module_call);
 
-	if(DisableModuleWait(name, &module))
-		return true;
+	for(token=strtok_r(argv_buffer, " ", &save); token!=NULL; token=strtok_r(NULL, " ", &save))
+	{
+		if(args == MODULE_MAX_ARGS)
+			return NULL;
+		argv[args++]=token;
+	}
 
-	fprintf(stderr, "Control: DisableModule unable to terminate module %s with SIGKILL\n", name.c_str());	
+	argv[args]=NULL;
 
-	return false;
+	return args ? argv : NULL;
 }
 
-bool Control::DisableModuleWait(const std::string &name, Module *module)
+
+void Control::DisableModule(int module_index)
 {
-	int status;
-	pid_t pid;
+	Module &module=modules[module_index];
+
+	if(module.state != MODULE_ENABLED && module.state != MODULE_ENABLING)
+		Die("Control: request to disable module but module is not enabled\n");
+
+	CloseNotify(&module);
 
-	for(int i=0;i<MODULE_DISABLE_TRIES;++i)
+	//module should exit on EOF from stdin
+	close(module.write_fd);
+	module.write_fd=-1;
+	module.state=MODULE_DISABLING;
+	module.disable_stage=DISABLE_EOF;
+	module.disable_deadline_us=TimestampUs() + MODULE_DISABLE_TRIES*MODULE_DISABLE_MS*1000;
+}
+
+int Control::DisableModules(int modules_out[])
+{
+	int count=0;
+
+	for(int i=0;i<modules_count;++i)
 	{
-		Sleep(MODULE_DISABLE_MS);
-		if( (pid=waitpid(module->pid, &status, WNOHANG)) == -1)
-			DieErrno("Control: DisableModule waitpid error");
-		if (pid == 0)
+		if(modules[i].state != MODULE_ENABLED && modules[i].state != MODULE_ENABLING)
 			continue;
 
-		module->pid=0;
-		module->state=MODULE_DISABLED;
-		modules[name]=*module;
+		DisableModule(i);
+		modules_out[count++]=i;
+	}
+	return count;
+}
+
+int Control::DisableModules(int owner, int modules_out[])
+{
+	int count=0;
+
+	for(int i=0;i<modules_count;++i)
+	{
+		if(modules[i].state != MODULE_ENABLED && modules[i].state != MODULE_ENABLING)
+			continue;
+		if(modules[i].owner != owner && modules[i].owner != MODULE_NO_OWNER)
+			continue;
 
-		return true;
+		DisableModule(i);
+		modules_out[count++]=i;
 	}
-	return false;
+	return count;
 }
 
-std::list<std::string> Control::DisableModules()
+int Control::EscalateDisableModules(uint64_t now_us, int modules_out[])
 {
-	map<string, Module>::iterator it;
-	list<std::string> disabled;
+	int count=0;
 
-	for(it=modules.begin();it!=modules.end();++it)
+	for(int i=0;i<modules_count;++i)
 	{
-		Module module=it->second;
+		Module &module=modules[i];
+
+		if(module.state != MODULE_DISABLING || module.disable_stage == DISABLE_GAVE_UP || now_us < module.disable_deadline_us)
+			continue;
+
+		if(module.disable_stage == DISABLE_EOF)
+		{
+			fprintf(stderr, "Control: DisableModule terminating module %s with SIGINT\n", module.name);
+
+			if(kill(module.pid, SIGINT) == -1)
+				DieErrno("Control: DisableModule kill SIGINT error\n");
+			module.disable_stage=DISABLE_SIGINT;
+		}
+		else if(module.disable_stage == DISABLE_SIGINT)
+		{
+			fprintf(stderr, "Control: DisableModule terminating module %s with SIGKILL\n", module.name);
 
-		if(module.state != MODULE_ENABLED)
+			if(kill(module.pid, SIGKILL) == -1)
+				DieErrno("Control: DisableModule kill SIGKILL error\n");
+			module.disable_stage=DISABLE_SIGKILL;
+		}
+		else //if(module.disable_stage == DISABLE_SIGKILL)
+		{
+			fprintf(stderr, "Control: DisableModule unable to terminate module %s with SIGKILL\n", module.name);
+			module.disable_stage=DISABLE_GAVE_UP;
+			modules_out[count++]=i;
 			continue;
+		}
 
-		if(DisableModule(it->first))
-			disabled.push_back(it->first);
+		module.disable_deadline_us=now_us + MODULE_DISABLE_TRIES*MODULE_DISABLE_MS*1000;
 	}
-	return disabled;
+	return count;
 }
 
-ModuleState Control::CheckModuleState(const std::string& name)
+uint64_t Control::DisableModulesDeadline() const
 {
-	map<std::string, Module>::iterator it=modules.find(name);
-	if( it == modules.end() )
-		Die("Control: request to check module state but module is not present\n");
-
-	Module module=it->second;
+	uint64_t deadline=0;
 
-	// if not enabled just return state
-	if(module.state != MODULE_ENABLED )
-		return module.state;
+	for(int i=0;i<modules_count;++i)
+	{
+		const Module &module=modules[i];
 
-	// otherwise check state and return it
+		if(module.state != MODULE_DISABLING || module.disable_stage == DISABLE_GAVE_UP)
+			continue;
+		if(deadline == 0 || module.disable_deadline_us < deadline)
+			deadline=module.disable_deadline_us;
+	}
+	return deadline;
+}
 
-	int status;
-	int ret=waitpid(module.pid, &status, WNOHANG );
+void Control::DisableModulesWait()
+{
+	int modules_out[CONTROL_MAX_MODULES];
 
-	if(ret == 0) //still running
-		return MODULE_ENABLED;
+	DisableModules(modules_out);
 
-	if(ret == module.pid)
+	while( DisableModulesDeadline() )
 	{
-		close(module.write_fd);
-		module.state=MODULE_FAILED;
-		module.write_fd=0;
-		module.pid=0;
-		module.return_value=ModuleReturnValue(status);
-		modules[name]=module;
-		return MODULE_FAILED;
+		Sleep(MODULE_DISABLE_MS);
+		CheckModulesStates(modules_out);
+		EscalateDisableModules(TimestampUs(), modules_out);
 	}
+}
 
-	DieErrno("Control: CheckModuleState waitpid failed\n");
-	return module.state;
+void Control::SetModuleOwner(int module, int owner)
+{
+	modules[module].owner=owner;
+}
+
+void Control::ReleaseModules(int owner)
+{
+	for(int i=0;i<modules_count;++i)
+		if(modules[i].owner == owner)
+			modules[i].owner=MODULE_NO_OWNER;
 }
 
-std::list<FailedModule> Control::CheckModulesStates()
+int Control::SampleModulesStats(uint64_t now_us, ModuleStats sampled[])
 {
-	list<FailedModule> failed;
+	proc_stats stats;
+	int count=0;
+
+	for(int i=0;i<modules_count;++i)
+	{
+		Module &module=modules[i];
+
+		if(module.state != MODULE_ENABLED && module.state != MODULE_ENABLING && module.state != MODULE_DISABLING)
+			continue;
+		if( !ReadProcStats(module.pid, &stats) ) //exited in the meantime
+			continue;
+
+		uint64_t elapsed_us=now_us - module.stats_sample_us;
 
-	int status, ret;
+		ModuleStats sample={i,
+			ProcTicksPermille(stats.cpu_ticks - module.stats.cpu_ticks, elapsed_us),
+			stats.rss_kb,
+			stats.voluntary_switches - module.stats.voluntary_switches,
+			stats.involuntary_switches - module.stats.involuntary_switches,
+			ProcTicksPermille(stats.blkio_ticks - module.stats.blkio_ticks, elapsed_us)};
+
+		sampled[count++]=sample;
+		module.stats=stats;
+		module.stats_sample_us=now_us;
+	}
+	return count;
+}
 
-	map<string, Module>::iterator it;
+int Control::CheckModulesStates(int modules_out[])
+{
+	int status, ret, count=0;
 
-	for(it=modules.begin();it!=modules.end();++it)
+	for(int i=0;i<modules_count;++i)
 	{
-		Module module=it->second;
+		Module &module=modules[i];
 
-		if(module.state != MODULE_ENABLED)
+		if(module.state != MODULE_ENABLED && module.state != MODULE_ENABLING && module.state != MODULE_DISABLING)
 			continue;
 
 		ret=waitpid(module.pid, &status, WNOHANG );
@@ -263,17 +561,22 @@ std::list<FailedModule> Control::CheckModulesStates()
 			DieErrno("Control: CheckModuleStates waitpid error\n");
 		if(ret == module.pid)
 		{
-			close(module.write_fd);
-			module.state=MODULE_FAILED;
+			if(module.state == MODULE_ENABLED || module.state == MODULE_ENABLING)
+			{
+				CloseNotify(&module);
+				close(module.write_fd);
+				module.state=MODULE_FAILED;
+			}
+			else //if(module.state == MODULE_DISABLING)
+				module.state=MODULE_DISABLED;
+
 			module.write_fd=0;
 			module.pid=0;
+			module.owner=MODULE_NO_OWNER;
 			module.return_value = ModuleReturnValue(status);
-			modules[it->first]=module;
-
-			FailedModule fail={it->first, module.return_value};
 
-			failed.push_back(fail);
+			modules_out[count++]=i;
 		}
 	}
-	return failed;
+	return count;
 }
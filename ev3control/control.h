@@ -17,52 +17,164 @@
 /*
  * Those constants can be tuned:
  * https://github.com/bmegli/ev3dev-mapping/issues/28 for explanation
+ *
+ * Disabling escalates EOF -> SIGINT -> SIGKILL, each step waits
+ * MODULE_DISABLE_TRIES*MODULE_DISABLE_MS for the module to exit
 */
 const int MODULE_DISABLE_TRIES=5;
 const int MODULE_DISABLE_MS=100;
 
+#include "proc_stats.h"
+#include "ring_log.h"
+
 #include <sys/types.h> //pid_t
+#include <stdint.h> //uint64_t
+#include <spawn.h> //posix_spawn_file_actions_t, posix_spawnattr_t
+
+// modules live in fixed table, the control path doesn't allocate memory
+// (the log of a module is allocated once, when module is inserted,
+// posix_spawn file actions and attributes once, in constructor)
+const int CONTROL_MAX_MODULES=32;
+const int MODULE_NAME_BYTES=256; //UNIQUE_NAME attribute with terminating '\0' fits
+const int MODULE_CALL_BYTES=256; //CALL attribute with terminating '\0' fits
+const int MODULE_MAX_ARGS=32;
+
+enum ModuleState {MODULE_DISABLED=0, MODULE_ENABLED=1, MODULE_FAILED=2, MODULE_DISABLING=3, MODULE_ENABLING=4};
+
+enum ModuleDisableStage {DISABLE_EOF=0, DISABLE_SIGINT=1, DISABLE_SIGKILL=2, DISABLE_GAVE_UP=3};
+
+// modules are owned by the client that enabled them (client socket) or by nobody
+const int MODULE_NO_OWNER=-1;
 
-#include <string> //string
-#include <map> //map
-#include <list> //list
-#include <vector> //vector
+// modules get the write end of notification pipe as this descriptor (and in EV3_NOTIFY_FD)
+// they write READY=1 when initialized, creation_delay_ms is only the timeout for that
+const int MODULE_NOTIFY_FD=3;
 
-enum ModuleState {MODULE_DISABLED=0, MODULE_ENABLED=1, MODULE_FAILED=2}; 
+// descriptors of module stdin, stdout, stderr and notification (in this order)
+const int MODULE_SPAWN_FDS=4;
+
+// module stdout and stderr go through pipes to per module in-memory logs
+enum ModuleOutputStream {MODULE_STDOUT=0, MODULE_STDERR=1};
+const int MODULE_OUTPUT_STREAMS=2;
+const int MODULE_LOG_BYTES=8192; //per stream, power of 2
+
+// the last MODULE_LOG_BYTES of module output, kept after module exits
+struct ModuleLog
+{
+	RingLog streams[MODULE_OUTPUT_STREAMS];
+	ModuleLog(): streams{RingLog(MODULE_LOG_BYTES), RingLog(MODULE_LOG_BYTES)} {}
+};
 
 struct Module
 {
+	char name[MODULE_NAME_BYTES];
 	ModuleState state;
 	int creation_delay_ms;
 	int write_fd;
 	pid_t pid;
-	int32_t return_value;
+	int32_t return_value; //of the last run
+	int owner;
+	ModuleDisableStage disable_stage;
+	uint64_t disable_deadline_us;
+	int notify_fd; //read end of notification pipe, -1 if closed
+	uint64_t enable_deadline_us;
+	proc_stats stats; //at the last sample (zeroes at start)
+	uint64_t stats_sample_us;
+	int output_fds[MODULE_OUTPUT_STREAMS]; //read ends of stdout/stderr pipes, -1 if closed
+	ModuleLog *log;
+};
+
+// new output in module log starting at offset
+struct ModuleOutput
+{
+	int module;
+	ModuleOutputStream stream;
+	uint32_t offset;
 };
 
-struct FailedModule
+// resource usage since the previous sample of the module
+struct ModuleStats
 {
-	std::string name;
-	int status;
+	int module;
+	uint16_t cpu_permille;
+	uint32_t rss_kb;
+	uint32_t voluntary_switches;
+	uint32_t involuntary_switches;
+	uint16_t iowait_permille;
 };
 
+// modules are identified by the index in the table (never changes once inserted)
+// functions returning many modules write indexes to caller array of CONTROL_MAX_MODULES size and return their count
 class Control
 {
 private:
-	std::map<std::string, Module> modules;
-	
-	std::vector<char *> PrepareExecvArgumentList(const std::string &module_call, std::string &out_argv_string);
-	bool DisableModuleWait(const std::string &name, Module *module);
+	Module modules[CONTROL_MAX_MODULES];
+	int modules_count;
+	int events_epoll_fd; //notification pipes of enabling modules and output pipes
+	char argv_buffer[MODULE_CALL_BYTES];
+	char *argv[MODULE_MAX_ARGS+1];
+	//the pipe ends are dup'ed to descriptors reserved at start (held by /dev/null between spawns)
+	//so that the file actions, dup2 of them to module descriptors, are prepared only once
+	int spawn_fds[MODULE_SPAWN_FDS];
+	int spawn_placeholder_fd;
+	posix_spawn_file_actions_t spawn_actions;
+	posix_spawnattr_t spawn_attributes;
+
+	void CloseNotify(Module *module);
+	void AddEvents(int fd);
+	void CloseOutput(Module *module, int stream);
+	char **PrepareExecvArgumentList(const char *module_call);
+	void InitSpawn();
+	void ReleaseSpawnFds();
+	int DisableModules(int modules_out[]);
 public:
 	Control();
 	~Control();
-	
-	bool ContainsModule(const std::string &name, Module *module);
-	void InsertModule(const std::string &name, int creation_delay_ms);
-	void EnableModule(const std::string &name, const std::string &call);
-	bool DisableModule(const std::string &name);
-	std::list<std::string> DisableModules();
-
-	ModuleState CheckModuleState(const std::string &name);
-	std::list<FailedModule> CheckModulesStates();	
-};
 
+	// -1 if there is no such module
+	int FindModule(const char *name) const;
+	const Module &GetModule(int module) const;
+	int ModulesCount() const;
+
+	// -1 if the table is full
+	int InsertModule(const char *name, int creation_delay_ms);
+	// enabling doesn't block, the module is MODULE_ENABLING until it notifies readiness
+	// or creation_delay_ms passes (see CheckModulesReady)
+	// false if module couldn't be started (it is MODULE_FAILED then)
+	bool EnableModule(int module, const char *call, int creation_delay_ms);
+
+	// becomes readable when any of enabling modules notifies or any module writes output
+	int EventsFd();
+	// modules that became MODULE_ENABLED (notified or past their deadline)
+	int CheckModulesReady(uint64_t now_us, int modules_out[]);
+	// the earliest deadline of enabling modules, 0 if none
+	uint64_t EnableModulesDeadline() const;
+
+	// disabling doesn't block, it only closes module stdin and starts escalation timer
+	// the module becomes MODULE_DISABLED when it exits (see CheckModulesStates)
+	void DisableModule(int module);
+	int DisableModules(int owner, int modules_out[]); //owned by owner or by nobody
+
+	// sends signals to modules past their disable deadline
+	// returns modules that didn't exit even after SIGKILL
+	int EscalateDisableModules(uint64_t now_us, int modules_out[]);
+	// the earliest deadline of disabling modules, 0 if none
+	uint64_t DisableModulesDeadline() const;
+	// disables all the modules in parallel and waits until done (e.g. on exit)
+	void DisableModulesWait();
+
+	void SetModuleOwner(int module, int owner);
+	void ReleaseModules(int owner);
+
+	// reads available output of modules to their logs, returns the streams that got new data
+	// output has to have space for CONTROL_MAX_MODULES*MODULE_OUTPUT_STREAMS entries
+	int DrainModulesOutput(ModuleOutput output[]);
+	// reads module log starting at offset (see RingLog::Read)
+	int ReadModuleLog(int module, ModuleOutputStream stream, uint32_t *offset, char *buffer, int length) const;
+
+	// samples /proc for all running modules, stats has to have space for CONTROL_MAX_MODULES entries
+	int SampleModulesStats(uint64_t now_us, ModuleStats stats[]);
+
+	// modules that exited, MODULE_FAILED or MODULE_DISABLED if they were being disabled
+	int CheckModulesStates(int modules_out[]);
+};
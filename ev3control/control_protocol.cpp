@@ -21,7 +21,7 @@
 #include "control_protocol.h"
 
 #include <endian.h> //htobe16, htobe32, htobe64, be16toh, be32toh, be64toh
-#include <string.h> //strlen
+#include <string.h> //strnlen, memcpy
 
 // header
 const int CONTROL_HEADER_TIMESTAMP_OFFSET=0;
@@ -68,59 +68,95 @@ int GetControlAttribute(const char *payload, control_attribute *attribute)
 	return attribute->length+CONTROL_ATTRIBUTE_HEADER_BYTES;
 }
 
-bool ParseControlMessage(const control_header &header, const char *message_payload, control_attribute attributes[], int attributes_length,const ControlAttributes expected_attributes[])
+// returns pointer past the parsed attribute or NULL if attribute is invalid
+// the checks compare remaining bytes, pointers never go past message_boundrary
+const char *ParseControlAttribute(const char *payload, const char *message_boundrary, ControlAttributes expected_attribute, control_attribute *attribute)
 {
-	char *payload=(char*)message_payload;
-	const char *message_boundrary=payload+header.payload_length;
-	
-	for(int i=0;i< attributes_length;++i)
-	{
-		//check if attribute header fits message
-		if(payload + CONTROL_ATTRIBUTE_HEADER_BYTES > message_boundrary)
-			return false;
+	//check if attribute header fits message
+	if(message_boundrary - payload < CONTROL_ATTRIBUTE_HEADER_BYTES)
+		return NULL;
 		
-		payload += GetControlAttribute(payload, attributes +i);
+	GetControlAttribute(payload, attribute);
 		
-		const control_attribute &a=attributes[i];
+	const control_attribute &a=*attribute;
 		
-		//check if attribute is as expected
-		if(a.attribute != expected_attributes[i])
-			return false;
+	//check if attribute is as expected
+	if(a.attribute != expected_attribute)
+		return NULL;
 		
-		//check if attribute data fits message
-		if(a.data + a.length > message_boundrary)
-			return false;
+	//check if attribute data fits message
+	if(message_boundrary - a.data < a.length)
+		return NULL;
 		
-		//check if attribute has data
-		if(a.length == 0)
-			return false;
+	//check if attribute has data
+	if(a.length == 0)
+		return NULL;
 		
-		//if attribute is known
-		if(a.attribute >= CONTROL_ATTRIBUTES_FIRST && a.attribute <= CONTROL_ATTRIBUTES_LAST)
-		{
-			//check if attribute size matches known sizes
-			if(CONTROL_ATTRIBUTES_LENGTHS[a.attribute] && a.length != CONTROL_ATTRIBUTES_LENGTHS[a.attribute])
-				return false;
+	//if attribute is known
+	if(a.attribute <= CONTROL_ATTRIBUTES_LAST)
+	{
+		//check if attribute size matches known sizes
+		if(CONTROL_ATTRIBUTES_LENGTHS[a.attribute] && a.length != CONTROL_ATTRIBUTES_LENGTHS[a.attribute])
+			return NULL;
 			
-			//check if zero terminated attribute is terminated
-			if(CONTROL_ATTRIBUTES_ZERO_TERMINATED[a.attribute] && a.data[a.length-1]!='\0')
-				return false;
-		}
+		//check if zero terminated attribute is terminated
+		if(CONTROL_ATTRIBUTES_ZERO_TERMINATED[a.attribute] && a.data[a.length-1]!='\0')
+			return NULL;
 	}
+	return a.data + a.length;
+}
+
+bool ParseControlMessage(const control_header &header, const char *message_payload, control_attribute attributes[], int attributes_length,const ControlAttributes expected_attributes[])
+{
+	const char *payload=message_payload;
+	const char *message_boundrary=payload+header.payload_length;
+	
+	for(int i=0;i< attributes_length;++i)
+		if( (payload=ParseControlAttribute(payload, message_boundrary, expected_attributes[i], attributes+i)) == NULL )
+			return false;
 	
 	return true;
 }
 
+int ParseControlMessageGroups(const control_header &header, const char *message_payload, control_attribute attributes[], int max_groups, const ControlAttributes expected_group[], int group_length)
+{
+	const char *payload=message_payload;
+	const char *message_boundrary=payload+header.payload_length;
+	int groups;
+	
+	for(groups=0; payload < message_boundrary; ++groups)
+	{
+		if(groups == max_groups)
+			return -1;
+			
+		for(int i=0;i<group_length;++i)
+			if( (payload=ParseControlAttribute(payload, message_boundrary, expected_group[i], attributes + groups*group_length + i)) == NULL )
+				return -1;
+	}
+	
+	return groups;
+}
+
 const char *GetControlAttributeString(const control_attribute &attribute)
 {
 	return attribute.data;
 }
+uint8_t GetControlAttributeU8(const control_attribute &attribute)
+{
+	return *((uint8_t*) attribute.data);
+}
 uint16_t GetControlAttributeU16(const control_attribute &attribute)
 {
 	uint16_t value;
 	memcpy(&value, attribute.data, 2);
 	return be16toh(value);
 }
+uint32_t GetControlAttributeU32(const control_attribute &attribute)
+{
+	uint32_t value;
+	memcpy(&value, attribute.data, 4);
+	return be32toh(value);
+}
 int32_t GetControlAttributeI32(const control_attribute &attribute)
 {
 	int32_t value;
@@ -150,14 +186,15 @@ bool PutControlHeader(char *buffer, int buffer_length, uint64_t timestamp_us, in
 
 int PutControlAttribute(char *buffer, int buffer_length, uint8_t attribute, int attribute_length)
 {
-	//check if attribute length will attribute limits
-	if(attribute_length > CONTROL_MAX_ATTRIBUTE_DATA_LENGTH)
+	//check if attribute length will fit attribute limits
+	if(attribute_length < 0 || attribute_length > CONTROL_MAX_ATTRIBUTE_DATA_LENGTH)
 		return -1;
 		
 	int payload_length=GetControlHeaderPayloadLength(buffer);
 	
-	//check if attribute will fit buffer
-	if(CONTROL_HEADER_BYTES + payload_length + CONTROL_ATTRIBUTE_HEADER_BYTES + attribute_length > buffer_length)
+	//check if attribute will fit buffer and uint16_t payload length
+	if(CONTROL_HEADER_BYTES + payload_length + CONTROL_ATTRIBUTE_HEADER_BYTES + attribute_length > buffer_length
+	|| payload_length + CONTROL_ATTRIBUTE_HEADER_BYTES + attribute_length > UINT16_MAX)
 		return -1;
 		
 	char *attr_data=buffer + CONTROL_HEADER_BYTES + payload_length;
@@ -171,7 +208,8 @@ int PutControlAttribute(char *buffer, int buffer_length, uint8_t attribute, int
 
 bool PutControlAttributeString(char *buffer, int buffer_length, uint8_t attribute, const char *data)
 {
-	int len= strlen(data) + 1;
+	//don't scan past the attribute limit for (possibly unterminated) data
+	int len= strnlen(data, CONTROL_MAX_ATTRIBUTE_DATA_LENGTH) + 1;
 	
 	int attribute_data_offset=PutControlAttribute(buffer, buffer_length, attribute, len);
 	
@@ -197,7 +235,63 @@ bool PutControlAttributeI32(char *buffer, int buffer_length, uint8_t attribute,
 	return true;
 }
 
+bool PutControlAttributeBytes(char *buffer, int buffer_length, uint8_t attribute, const char *data, int length)
+{
+	int attribute_data_offset=PutControlAttribute(buffer, buffer_length, attribute, length);
+	
+	if(attribute_data_offset==-1)
+		return false;
+		
+	memcpy(buffer + attribute_data_offset, data, length);
+		
+	return true;
+}
+
+bool PutControlAttributeU8(char *buffer, int buffer_length, uint8_t attribute, uint8_t data)
+{
+	int attribute_data_offset=PutControlAttribute(buffer, buffer_length, attribute, sizeof(uint8_t));
+	
+	if(attribute_data_offset==-1)
+		return false;
+	*((uint8_t*) (buffer + attribute_data_offset) ) = data;
+	
+	return true;
+}
+
+bool PutControlAttributeU16(char *buffer, int buffer_length, uint8_t attribute, uint16_t data)
+{
+	int len = sizeof(uint16_t);
+
+	int attribute_data_offset=PutControlAttribute(buffer, buffer_length, attribute, len);
+	
+	if(attribute_data_offset==-1)
+		return false;
+	data = htobe16(data);
+	memcpy(buffer + attribute_data_offset, &data, 2);
+	
+	return true;
+}
+
+bool PutControlAttributeU32(char *buffer, int buffer_length, uint8_t attribute, uint32_t data)
+{
+	int len = sizeof(uint32_t);
+
+	int attribute_data_offset=PutControlAttribute(buffer, buffer_length, attribute, len);
+	
+	if(attribute_data_offset==-1)
+		return false;
+	data = htobe32(data);
+	memcpy(buffer + attribute_data_offset, &data, 4);
+	
+	return true;
+}
+
 int GetControlMessageLength(char *buffer)
 {
 	return CONTROL_HEADER_BYTES + GetControlHeaderPayloadLength(buffer);
-}
\ No newline at end of file
+}
+
+void SetControlMessageLength(char *buffer, int message_length)
+{
+	SetControlHeaderPayloadLength(buffer, message_length - CONTROL_HEADER_BYTES);
+}
@@ -20,14 +20,18 @@
 
 #pragma once
 
-#include <stdint.h> //uint16_t, int32_t
+#include <stdint.h> //uint16_t, int32_t, uint32_t
 
-const int CONTROL_PROTOCOL_VERSION=1;
+// version 2 adds SUBSCRIBE_STATS, ENABLE_MANY, DISABLE_MANY, QUERY_STATUS and LOG
+const int CONTROL_PROTOCOL_VERSION=2;
 
-const int CONTROL_BUFFER_BYTES=512;
+const int CONTROL_BUFFER_BYTES=2048; //batched commands carry several modules
 const int CONTROL_MAX_ATTRIBUTE_DATA_LENGTH=255; //uint8_t attribute length
 
-enum ControlCommands {KEEPALIVE=0, ENABLE=1, DISABLE=2, DISABLE_ALL=3, ENABLED=-1, DISABLED=-2, FAILED=-3 };
+enum ControlCommands {CONTROL_COMMANDS_FIRST=0, KEEPALIVE=0, ENABLE=1, DISABLE=2, DISABLE_ALL=3, SUBSCRIBE_STATS=4, ENABLE_MANY=5, DISABLE_MANY=6, QUERY_STATUS=7, LOG=8, CONTROL_COMMANDS_LAST=8,
+	ENABLED=-1, DISABLED=-2, FAILED=-3, STATS=-4, STATUS_ALL=-5, LOG_DATA=-6 };
+// the protocol version in which request command was introduced
+const int CONTROL_COMMANDS_VERSIONS[] = {1, 1, 1, 1, 2, 2, 2, 2, 2};
 
 // header
 const int CONTROL_HEADER_BYTES=12;
@@ -46,9 +50,29 @@ void GetControlHeader(const char *msg, control_header *header);
 
 // attributes
 
-enum ControlAttributes {CONTROL_ATTRIBUTES_FIRST=0, UNIQUE_NAME=0, CALL=1, CREATION_DELAY_MS=2, RETURN_VALUE=3, CONTROL_ATTRIBUTES_LAST=3};
-const int CONTROL_ATTRIBUTES_LENGTHS[] = {0, 0, sizeof(uint16_t), sizeof(int32_t)};
-const bool CONTROL_ATTRIBUTES_ZERO_TERMINATED[] = {true, true, false, false};
+// ENABLE_MANY has repeated UNIQUE_NAME, CALL, CREATION_DELAY_MS
+// DISABLE_MANY has repeated UNIQUE_NAME
+// QUERY_STATUS has no attributes, STATUS_ALL has repeated UNIQUE_NAME, MODULE_STATE, RETURN_VALUE
+// (there may be more STATUS_ALL messages if modules don't fit single one)
+// SUBSCRIBE_STATS has STATS_PERIOD_MS (0 unsubscribes)
+// STATS has UNIQUE_NAME, CPU_PERMILLE, RSS_KB, VOLUNTARY_SWITCHES, INVOLUNTARY_SWITCHES, IOWAIT_PERMILLE
+// permilles and switches are for the time since the previous sample
+// LOG has UNIQUE_NAME, LOG_STREAM, LOG_OFFSET, LOG_FOLLOW (1 to get new output as it comes, 0 to stop)
+// LOG_DATA has UNIQUE_NAME, LOG_STREAM, LOG_OFFSET (of the first byte of LOG_TEXT), LOG_TEXT (not zero terminated)
+// (offsets count bytes since module was first enabled, older than the kept ones mean from the oldest kept)
+enum ControlAttributes {CONTROL_ATTRIBUTES_FIRST=0, UNIQUE_NAME=0, CALL=1, CREATION_DELAY_MS=2, RETURN_VALUE=3,
+	STATS_PERIOD_MS=4, CPU_PERMILLE=5, RSS_KB=6, VOLUNTARY_SWITCHES=7, INVOLUNTARY_SWITCHES=8, IOWAIT_PERMILLE=9,
+	MODULE_STATE=10, LOG_STREAM=11, LOG_OFFSET=12, LOG_FOLLOW=13, LOG_TEXT=14, CONTROL_ATTRIBUTES_LAST=14};
+const int CONTROL_ATTRIBUTES_LENGTHS[] = {0, 0, sizeof(uint16_t), sizeof(int32_t),
+	sizeof(uint16_t), sizeof(uint16_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint16_t),
+	sizeof(uint8_t), sizeof(uint8_t), sizeof(uint32_t), sizeof(uint8_t), 0};
+const bool CONTROL_ATTRIBUTES_ZERO_TERMINATED[] = {true, true, false, false, false, false, false, false, false, false, false,
+	false, false, false, false};
+
+// MODULE_STATE values (the same as ModuleState of ev3control)
+enum ControlModuleStates {STATE_DISABLED=0, STATE_ENABLED=1, STATE_FAILED=2, STATE_DISABLING=3, STATE_ENABLING=4};
+// LOG_STREAM values
+enum ControlLogStreams {LOG_STDOUT=1, LOG_STDERR=2};
 
 struct control_attribute
 {
@@ -59,10 +83,19 @@ struct control_attribute
 
 bool ParseControlMessage(const control_header &header, const char *payload, control_attribute attributes[], int attributes_length,const ControlAttributes expected_attributes[]);
 
+// for messages with repeated group of attributes (e.g. UNIQUE_NAME, CALL, CREATION_DELAY_MS, UNIQUE_NAME, CALL...)
+// attributes has to have space for max_groups*group_length attributes
+// returns:
+// - number of complete groups parsed (0 for empty payload)
+// - -1 if message is invalid or has more than max_groups groups
+int ParseControlMessageGroups(const control_header &header, const char *payload, control_attribute attributes[], int max_groups, const ControlAttributes expected_group[], int group_length);
+
 // attributes data
 
 const char *GetControlAttributeString(const control_attribute &attribute);
+uint8_t GetControlAttributeU8(const control_attribute &attribute);
 uint16_t GetControlAttributeU16(const control_attribute &attribute);
+uint32_t GetControlAttributeU32(const control_attribute &attribute);
 int32_t GetControlAttributeI32(const control_attribute &attribute);
 
 // message creation
@@ -77,7 +110,28 @@ bool PutControlAttributeString(char *buffer, int buffer_length, uint8_t attribut
 // - PutControlHeader called with buffer argument
 bool PutControlAttributeI32(char *buffer, int buffer_length, uint8_t attribute, int32_t data);
 
+//prerequisities:
+// - PutControlHeader called with buffer argument
+// - length <= CONTROL_MAX_ATTRIBUTE_DATA_LENGTH
+bool PutControlAttributeBytes(char *buffer, int buffer_length, uint8_t attribute, const char *data, int length);
+
+//prerequisities:
+// - PutControlHeader called with buffer argument
+bool PutControlAttributeU8(char *buffer, int buffer_length, uint8_t attribute, uint8_t data);
+
+//prerequisities:
+// - PutControlHeader called with buffer argument
+bool PutControlAttributeU16(char *buffer, int buffer_length, uint8_t attribute, uint16_t data);
+
+//prerequisities:
+// - PutControlHeader called with buffer argument
+bool PutControlAttributeU32(char *buffer, int buffer_length, uint8_t attribute, uint32_t data);
+
 //prerequisities:
 // - PutControlHeader called with buffer argument
 // - optionally PutControlAttributeXY any number of times
-int GetControlMessageLength(char *buffer);
\ No newline at end of file
+int GetControlMessageLength(char *buffer);
+
+// truncates message to message_length bytes (e.g. drops partially put attributes)
+// message_length is previous GetControlMessageLength result
+void SetControlMessageLength(char *buffer, int message_length);
\ No newline at end of file
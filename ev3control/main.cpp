@@ -16,12 +16,16 @@
   * This program was created for EV3 with ev3dev OS
   *  
   * ev3control:
-  * -starts TCP/IP server and waits for client
+  * -starts TCP/IP server and serves multiple clients in single epoll loop
   * -reads messages
-  * -starts modules on request
+  * -starts modules on request (in parallel, modules notify readiness through inherited pipe)
   * -disables modules on request (by closing their stdin so that they get EOF on read)
-  * -monitors modules state
-  * -informs peer on module state changes
+  * -monitors modules state (SIGCHLD through signalfd)
+  * -informs all connected peers on module state changes
+  * -samples modules resource usage (/proc) for subscribed peers
+  * -keeps the last output of modules (stdout/stderr) in memory for peers
+  * -tracks module ownership (the client that enabled the module)
+  * -answers clock synchronization requests on UDP port with the same number (see lib/shared/clock_sync.h)
   *
   * See Usage() function for syntax details (or run the program without arguments)
   * 
@@ -37,44 +41,130 @@
 #include "net_tcp.h"
 
 #include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/clock_sync.h"
 
-#include <sys/socket.h> //send
+#include <sys/socket.h> //send, recvfrom, sendto
+#include <sys/epoll.h> //epoll_create1, epoll_ctl, epoll_wait
+#include <sys/signalfd.h> //signalfd
+#include <sys/timerfd.h> //timerfd_create, timerfd_settime
 
 #include <unistd.h> //read
 #include <signal.h> //sigaction, sig_atomic_t
 #include <stdio.h> //printf, etc
 #include <errno.h> // errno
 #include <stdlib.h> //EXIT_FAILURE
+#include <string.h> //memset, memcpy, memmove
 
+const int CONTROL_MAX_CLIENTS=8;
+const int CONTROL_MIN_STATS_PERIOD_MS=100; //reading /proc is not free on EV3
+const int CONTROL_MAX_BATCH_MODULES=16; //ENABLE_MANY, DISABLE_MANY
+const int CONTROL_OUTPUT_BYTES=8*CONTROL_BUFFER_BYTES; //per client, rides out short WiFi stalls
+const int CONTROL_OUTPUT_RESERVE_BYTES=2*CONTROL_BUFFER_BYTES; //kept for module state messages and responses
 
-#include <list> //list
-#include <string> //string
+// per connection state, the messages are reassembled incrementally from non-blocking reads
+struct Client
+{
+	int socket; //-1 if not connected
+	bool failed; //send failed or output overflow, disconnect at the end of event loop iteration
+	int received; //bytes of current message in buffer
+	int skip; //bytes of the current (too large) message left to ignore
+	int stats_period_ms; //0 if not subscribed to STATS
+	uint64_t stats_next_us;
+	uint8_t log_follow[CONTROL_MAX_MODULES]; //followed streams of module (bit per ModuleOutputStream)
+	int output_length; //bytes waiting for EPOLLOUT
+	bool output_watched; //EPOLLOUT is in epoll events of the socket
+	char buffer[CONTROL_BUFFER_BYTES];
+	char output[CONTROL_OUTPUT_BYTES];
+};
 
-using namespace std;
+// epoll data.ptr points to Client, to one of the descriptors below or to control (modules readiness)
+struct Server
+{
+	int epoll_fd;
+	int serv_socket;
+	int clock_socket; //UDP, clock synchronization requests
+	int child_signal_fd; //SIGCHLD
+	int keepalive_timer_fd;
+	int module_timer_fd; //armed with the earliest enable timeout or disable escalation deadline
+	uint64_t module_deadline_us;
+	int stats_timer_fd; //armed with the earliest STATS due time of subscribed clients
+	uint64_t stats_deadline_us;
+	Control *control;
+	Client clients[CONTROL_MAX_CLIENTS];
+};
 
 // GLOBAL VARIABLES
 volatile sig_atomic_t g_finish_program=0;
 
-void ServerLoop(int serv_socket, int timeout_ms, Control *control);
-void MainClientLoop(int client_socket, Control *control);
+void ServerLoop(int serv_socket, int clock_socket, int timeout_ms, Control *control);
+void InitServer(Server *server, int serv_socket, int clock_socket, int timeout_ms, Control *control);
+void CloseServer(Server *server);
+void AddToEpoll(Server *server, int fd, void *ptr);
+
+int InitChildSignal();
+int InitKeepaliveTimer(int timeout_ms);
+int InitDeadlineTimer();
+void ReadChildSignal(int child_signal_fd);
+void ReadTimer(int timer_fd);
+void ArmDeadlineTimer(int timer_fd, uint64_t deadline_us, uint64_t *armed_deadline_us);
+void ArmModuleTimer(Server *server);
+void ArmStatsTimer(Server *server);
 
-bool ReceiveMessage(int client_socket, Control *control);
-bool ProcessMessage(int client_socket, const char *msg, char *response, Control *control);
+void AcceptClients(Server *server);
+void AnswerClockRequests(int clock_socket);
+void DisconnectClient(Client *client, Server *server);
+void DisconnectFailedClients(Server *server);
+// EPOLLOUT is watched only while client has output waiting
+void WatchClientsOutput(Server *server);
+
+bool ReceiveMessages(Client *client, Server *server);
+bool ProcessMessage(Client *client, const char *msg, char *response, Server *server);
 void CheckProtocolVersion(const control_header &header);
 bool CheckCommandSupport(const control_header &header);
 
-bool ProcessMessageKEEPALIVE(int client_socket, const char *payload, const control_header &header, char *response, Control *control);
-bool ProcessMessageENABLE(int client_socket, const char *payload, const control_header &header, char *response, Control *control);
-bool ProcessMessageDISABLE(int client_socket, const char *payload, const control_header &header, char *response, Control *control);
-bool ProcessMessageDISABLE_ALL(int client_socket, const char *payload, const control_header &header, char *response, Control *control);
+bool ProcessMessageKEEPALIVE(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageENABLE(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageDISABLE(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageDISABLE_ALL(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageSUBSCRIBE_STATS(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageENABLE_MANY(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageDISABLE_MANY(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageQUERY_STATUS(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+bool ProcessMessageLOG(Client *client, const char *payload, const control_header &header, char *response, Server *server);
+
+// common for single and batched commands, attributes are UNIQUE_NAME, CALL, CREATION_DELAY_MS (enable) or UNIQUE_NAME (disable)
+bool EnableModule(Client *client, const control_attribute attributes[3], char *response, Server *server);
+bool DisableModule(Client *client, const control_attribute attributes[1], char *response, Server *server);
 
-bool CheckModulesStates(int client_socket, char *response, Control *control);
+// broadcasts ENABLED messages for modules that notified readiness (or timed out)
+void CheckModulesReady(char *response, Server *server);
+// broadcasts FAILED (or DISABLED if module was being disabled) messages for modules that exited
+void CheckModulesStates(char *response, Server *server);
+void EscalateDisableModules(Server *server);
+// sends new output of modules to the clients that follow it
+void SendModulesOutput(char *response, Server *server);
+// sends module log from offset to the end in LOG_DATA messages
+bool SendModuleLog(Client *client, int module, ModuleOutputStream stream, uint32_t offset, char *response, Server *server);
+void SendKeepalives(char *response, Server *server);
+// samples modules and sends STATS to the clients that are due
+void SendStats(char *response, Server *server);
 
-bool SendMessage(int sock, char *msg, int msg_len);
+// sends as much as the socket takes, -1 on failure
+int SendData(int sock, const char *data, int length);
+// the part that doesn't fit the socket waits in client output, false on failure or overflow
+bool SendMessage(Client *client, char *msg, int msg_len);
+// sends waiting output on EPOLLOUT
+bool SendOutput(Client *client);
+void BroadcastMessage(Server *server, char *msg, int msg_len);
 
-int EncodeModuleMessage(char *buffer, int buffer_length, ControlCommands command, const std::string &module_name);
-int EncodeFailedMessage(char *buffer, int buffer_length, const std::string &module_name, int32_t status);
+int EncodeModuleMessage(char *buffer, int buffer_length, ControlCommands command, const char *module_name);
+int EncodeFailedMessage(char *buffer, int buffer_length, const char *module_name, int32_t status);
 int EncodeKeepaliveMessage(char *buffer, int buffer_length);
+int EncodeStatsMessage(char *buffer, int buffer_length, const char *module_name, const ModuleStats &stats);
+int EncodeLogDataMessage(char *buffer, int buffer_length, const char *module_name, ModuleOutputStream stream, uint32_t offset, const char *text, int text_length);
+// encodes modules starting from module, it is advanced past the last module that fit the buffer
+int EncodeStatusAllMessage(char *buffer, int buffer_length, const Control &control, int *module);
 
 void Usage();
 void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms);
@@ -83,7 +173,7 @@ void IgnoreSIGPIPE();
 
 int main(int argc, char **argv)
 {			
-	int serv_socket, port, timeout_ms;
+	int serv_socket, clock_socket, port, timeout_ms;
 	Control control;
 	
 	ProcessArguments(argc, argv, &port, &timeout_ms);
@@ -91,99 +181,441 @@ int main(int argc, char **argv)
 	//init
 	RegisterSignals(Finish);
 	IgnoreSIGPIPE();
-	InitNetworkTCP(&serv_socket, port);
+	InitNetworkTCP(&serv_socket, port, CONTROL_MAX_CLIENTS, TRAFFIC_CONTROL);
+	InitNetworkUDP(&clock_socket, NULL, NULL, port, 0, TRAFFIC_CONTROL);
 
 	
 	//work
-	ServerLoop(serv_socket, timeout_ms, &control);
+	ServerLoop(serv_socket, clock_socket, timeout_ms, &control);
 	
 	//cleanup
-	control.DisableModules();
+	control.DisableModulesWait();
+	CloseNetworkUDP(clock_socket);
 	CloseNetworkTCP(serv_socket);
 		
 	printf("ev3control: bye\n");	
    	return 0;
 }
 
-void ServerLoop(int serv_socket, int timeout_ms, Control *control)
+void ServerLoop(int serv_socket, int clock_socket, int timeout_ms, Control *control)
 {
-	int client_socket;
+	static char response_buffer[CONTROL_BUFFER_BYTES];		
+	static Server server;
+	const int MAX_EVENTS=CONTROL_MAX_CLIENTS+7;
+	epoll_event events[MAX_EVENTS];
+	int ready;
+
+	InitServer(&server, serv_socket, clock_socket, timeout_ms, control);
 	
 	while(!g_finish_program)
 	{
-		if( WaitForClientTCP(serv_socket, timeout_ms, &client_socket) == 0) //timeout
-			continue; //check g_finish_program
+		if( (ready=epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1)) == -1)
+		{
+			if(errno==EINTR)
+				continue; //check g_finish_program
+			DieErrno("ev3control: epoll_wait");
+		}
+
+		for(int i=0;i<ready;++i)
+		{
+			void *ptr=events[i].data.ptr;
+
+			if(ptr == &server.serv_socket)
+				AcceptClients(&server);
+			else if(ptr == &server.clock_socket)
+				AnswerClockRequests(server.clock_socket);
+			else if(ptr == &server.child_signal_fd)
+			{
+				ReadChildSignal(server.child_signal_fd);
+				SendModulesOutput(response_buffer, &server); //the last words before FAILED
+				CheckModulesStates(response_buffer, &server);
+			}
+			else if(ptr == &server.keepalive_timer_fd)
+			{
+				ReadTimer(server.keepalive_timer_fd);
+				SendKeepalives(response_buffer, &server);
+			}
+			else if(ptr == server.control)
+			{
+				CheckModulesReady(response_buffer, &server);
+				SendModulesOutput(response_buffer, &server);
+			}
+			else if(ptr == &server.module_timer_fd)
+			{
+				ReadTimer(server.module_timer_fd);
+				CheckModulesReady(response_buffer, &server);
+				EscalateDisableModules(&server);
+			}
+			else if(ptr == &server.stats_timer_fd)
+			{
+				ReadTimer(server.stats_timer_fd);
+				SendStats(response_buffer, &server);
+			}
+			else
+			{
+				Client *client=(Client*)ptr;
+				if(!client->failed && (events[i].events & EPOLLOUT) && !SendOutput(client))
+					client->failed=true;
+				if(!client->failed && (events[i].events & ~EPOLLOUT) && !ReceiveMessages(client, &server))
+					client->failed=true;
+			}
+		}
+				
+		DisconnectFailedClients(&server);
+		WatchClientsOutput(&server);
+		ArmModuleTimer(&server);
+		ArmStatsTimer(&server);
+	}
+	
+	CloseServer(&server);
+}
+
+void InitServer(Server *server, int serv_socket, int clock_socket, int timeout_ms, Control *control)
+{
+	server->serv_socket=serv_socket;
+	server->clock_socket=clock_socket;
+	server->control=control;
+	
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		server->clients[i].socket=-1;
+	
+	if( (server->epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DieErrno("ev3control: epoll_create1");
+
+	server->child_signal_fd=InitChildSignal();
+	server->keepalive_timer_fd=InitKeepaliveTimer(timeout_ms);
+	server->module_timer_fd=InitDeadlineTimer();
+	server->module_deadline_us=0;
+	server->stats_timer_fd=InitDeadlineTimer();
+	server->stats_deadline_us=0;
+
+	AddToEpoll(server, server->serv_socket, &server->serv_socket);
+	AddToEpoll(server, server->clock_socket, &server->clock_socket);
+	AddToEpoll(server, server->child_signal_fd, &server->child_signal_fd);
+	AddToEpoll(server, server->keepalive_timer_fd, &server->keepalive_timer_fd);
+	AddToEpoll(server, server->module_timer_fd, &server->module_timer_fd);
+	AddToEpoll(server, control->EventsFd(), control);
+	AddToEpoll(server, server->stats_timer_fd, &server->stats_timer_fd);
+}
+
+void CloseServer(Server *server)
+{
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		if(server->clients[i].socket != -1)
+			DisconnectClient(server->clients + i, server);
+
+	if(close(server->stats_timer_fd) == -1)
+		DieErrno("ev3control: close stats timer");
+	if(close(server->module_timer_fd) == -1)
+		DieErrno("ev3control: close module timer");
+	if(close(server->keepalive_timer_fd) == -1)
+		DieErrno("ev3control: close keepalive timer");
+	if(close(server->child_signal_fd) == -1)
+		DieErrno("ev3control: close child signal");
+	if(close(server->epoll_fd) == -1)
+		DieErrno("ev3control: close epoll");
+}
+
+void AddToEpoll(Server *server, int fd, void *ptr)
+{
+	epoll_event event;
+	event.events=EPOLLIN;
+	event.data.ptr=ptr;
+	
+	if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+		DieErrno("ev3control: epoll_ctl add");
+}
+
+// SIGCHLD is blocked and delivered through signalfd
+// the modules are started with clean signal mask (posix_spawn in Control::EnableModule)
+int InitChildSignal()
+{
+	sigset_t mask;
+	int fd;
+	
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	
+	if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+		DieErrno("ev3control: sigprocmask SIGCHLD");
 		
-		printf("ev3control: client connected\n");
-		MainClientLoop(client_socket, control);
-		printf("ev3control: client disconnected\n");
+	if( (fd=signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+		DieErrno("ev3control: signalfd");
 		
-		CloseNetworkTCP(client_socket);
-	}
+	return fd;
+}
+
+int InitKeepaliveTimer(int timeout_ms)
+{
+	itimerspec period;
+	int fd;
+	
+	if( (fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+		DieErrno("ev3control: timerfd_create");
+
+	period.it_interval.tv_sec = timeout_ms / 1000;
+	period.it_interval.tv_nsec = (timeout_ms % 1000) * 1000000;
+	period.it_value=period.it_interval;
+	
+	if(timerfd_settime(fd, 0, &period, NULL) == -1)
+		DieErrno("ev3control: timerfd_settime");
+		
+	return fd;
+}
+
+int InitDeadlineTimer()
+{
+	int fd;
 	
+	if( (fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+		DieErrno("ev3control: timerfd_create");
+		
+	return fd;
 }
 
-void MainClientLoop(int client_socket, Control *control)
+// arms one-shot timer for absolute deadline (0 disarms), does nothing if already armed with it
+void ArmDeadlineTimer(int timer_fd, uint64_t deadline_us, uint64_t *armed_deadline_us)
 {
-	while(!g_finish_program)
+	itimerspec deadline={};
+
+	if(deadline_us == *armed_deadline_us)
+		return;
+
+	//TimestampUs is CLOCK_MONOTONIC as the timer, zero deadline disarms the timer
+	deadline.it_value.tv_sec = deadline_us / 1000000;
+	deadline.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+
+	if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &deadline, NULL) == -1)
+		DieErrno("ev3control: timerfd_settime deadline timer");
+
+	*armed_deadline_us=deadline_us;
+}
+
+// the earliest deadline (disarms if there is nothing being enabled or disabled)
+void ArmModuleTimer(Server *server)
+{
+	uint64_t deadline_us=server->control->DisableModulesDeadline();
+	uint64_t enable_deadline_us=server->control->EnableModulesDeadline();
+
+	if(deadline_us == 0 || (enable_deadline_us != 0 && enable_deadline_us < deadline_us))
+		deadline_us=enable_deadline_us;
+
+	ArmDeadlineTimer(server->module_timer_fd, deadline_us, &server->module_deadline_us);
+}
+
+// the earliest due time (disarms if nobody is subscribed)
+void ArmStatsTimer(Server *server)
+{
+	uint64_t deadline_us=0;
+
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+	{
+		const Client &client=server->clients[i];
+		if(client.socket == -1 || client.stats_period_ms == 0)
+			continue;
+		if(deadline_us == 0 || client.stats_next_us < deadline_us)
+			deadline_us=client.stats_next_us;
+	}
+
+	ArmDeadlineTimer(server->stats_timer_fd, deadline_us, &server->stats_deadline_us);
+}
+
+void ReadChildSignal(int child_signal_fd)
+{	//multiple SIGCHLD may be merged into one, we only drain the descriptor
+	signalfd_siginfo info;
+	while(read(child_signal_fd, &info, sizeof(info)) == sizeof(info))
+		;
+}
+
+void ReadTimer(int timer_fd)
+{
+	uint64_t expirations;
+	if(read(timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+		DieErrno("ev3control: read timer");
+}
+
+// answered immediately, the receive time is taken as soon as possible (no kernel timestamps in CLOCK_MONOTONIC)
+// send failures are ignored, the host will send another request
+void AnswerClockRequests(int clock_socket)
+{
+	char buffer[CLOCK_SYNC_RESPONSE_BYTES];
+	sockaddr_in host;
+	socklen_t host_length;
+	uint32_t sequence;
+	uint64_t t1, t2;
+	int length;
+
+	for(;;)
 	{
-		if(!ReceiveMessage(client_socket, control))
+		host_length=sizeof(host);
+
+		if( (length=recvfrom(clock_socket, buffer, sizeof(buffer), MSG_DONTWAIT, (sockaddr*)&host, &host_length)) == -1 )
 			break;
+
+		t2=TimestampUs();
+
+		if(!DecodeClockSyncRequest(buffer, length, &sequence, &t1))
+			continue;
+
+		length=EncodeClockSyncResponse(buffer, sequence, t1, t2, TimestampUs());
+		sendto(clock_socket, buffer, length, MSG_DONTWAIT, (sockaddr*)&host, host_length);
 	}
+
+	if(errno != EAGAIN && errno != EWOULDBLOCK)
+		perror("ev3control: recvfrom clock request failed");
 }
 
-// false on disconnect, true otherwise 
-bool ReceiveMessage(int client_socket, Control *control)
+void AcceptClients(Server *server)
 {
-	static char buffer[CONTROL_BUFFER_BYTES];	
-	static char response_buffer[CONTROL_BUFFER_BYTES];		
+	int client_socket;
+	epoll_event event;
 	
-	char *data=buffer;
+	while( AcceptClientTCP(server->serv_socket, &client_socket) )
+	{
+		Client *client=NULL;
+		
+		for(int i=0;i<CONTROL_MAX_CLIENTS && !client;++i)
+			if(server->clients[i].socket == -1)
+				client=server->clients + i;
+				
+		if(!client)
+		{
+			fprintf(stderr, "ev3control: refusing client, already serving %d clients\n", CONTROL_MAX_CLIENTS);
+			CloseNetworkTCP(client_socket);
+			continue;
+		}
+		
+		client->socket=client_socket;
+		client->failed=false;
+		client->received=client->skip=0;
+		client->stats_period_ms=0;
+		memset(client->log_follow, 0, sizeof(client->log_follow));
+		client->output_length=0;
+		client->output_watched=false;
+		
+		event.events=EPOLLIN;
+		event.data.ptr=client;
+		
+		if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1)
+			DieErrno("ev3control: epoll_ctl client socket");
+			
+		printf("ev3control: client %d connected\n", client_socket);
+	}
+}
+
+void DisconnectClient(Client *client, Server *server)
+{
+	if(epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->socket, NULL) == -1)
+		DieErrno("ev3control: epoll_ctl remove client socket");
+
+	//the modules keep running, any client may take them over
+	server->control->ReleaseModules(client->socket);
+
+	CloseNetworkTCP(client->socket);
+	printf("ev3control: client %d disconnected\n", client->socket);
 	
-	int received=0, bytes=CONTROL_HEADER_BYTES, result;
+	client->socket=-1;
+}
+
+void DisconnectFailedClients(Server *server)
+{
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		if(server->clients[i].socket != -1 && server->clients[i].failed)
+			DisconnectClient(server->clients + i, server);
+}
+
+void WatchClientsOutput(Server *server)
+{
+	epoll_event event;
+
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+	{
+		Client *client=server->clients + i;
+		bool waiting=client->output_length > 0;
+
+		if(client->socket == -1 || waiting == client->output_watched)
+			continue;
+
+		event.events=waiting ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		event.data.ptr=client;
+
+		if(epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->socket, &event) == -1)
+			DieErrno("ev3control: epoll_ctl modify client socket");
+
+		client->output_watched=waiting;
+	}
+}
+
+// reads all available data, processes complete messages
+// false on disconnect, true otherwise 
+bool ReceiveMessages(Client *client, Server *server)
+{
+	static char response_buffer[CONTROL_BUFFER_BYTES];		
+	static char skip_buffer[CONTROL_BUFFER_BYTES];
 	
-	while(received<bytes)
+	int bytes, result;
+
+	while(!client->failed)
 	{
-		if( (result=read(client_socket, data+received, bytes-received)) == -1)
+		if(client->skip)
+			result=read(client->socket, skip_buffer, client->skip < CONTROL_BUFFER_BYTES ? client->skip : CONTROL_BUFFER_BYTES);
+		else
 		{
-			if(errno==EAGAIN || errno==EWOULDBLOCK) //timeout
-			{
-				if( !CheckModulesStates(client_socket, response_buffer, control))
-				{
-					printf("Check modules failed\n");
-					return false;
-				}
+			bytes = CONTROL_HEADER_BYTES;
+			if(client->received >= CONTROL_HEADER_BYTES)
+				bytes += GetControlHeaderPayloadLength(client->buffer);
+			result=read(client->socket, client->buffer+client->received, bytes-client->received);
+		}
+		
+		if(result == -1)
+		{
+			if(errno==EAGAIN || errno==EWOULDBLOCK) //no more data for now
+				return true;
+			if(errno==EINTR)
 				continue;
-			}
-			else //maybe handle EINTR separately
-			{
-				perror("ev3control: read\n");
-				return false; //connection closed
-			}
+			perror("ev3control: read\n");
+			return false; //connection closed
 		}
 		else if(result == 0)
 			return false;
-			
-		received += result;
 		
-		if(data == buffer && received==CONTROL_HEADER_BYTES)
-		{ //we have received complete header, now get payload
-			data=buffer+CONTROL_HEADER_BYTES;
-			bytes = GetControlHeaderPayloadLength(buffer);
-			received=0;
-			if(bytes > CONTROL_BUFFER_BYTES-CONTROL_HEADER_BYTES)
-			{
-				fprintf(stderr, "ev3control: ignoring message, doesn't fit buffer: payload %d, buffer is %d\n", bytes, CONTROL_BUFFER_BYTES-CONTROL_HEADER_BYTES);
-				return true;
-			}
+		if(client->skip)
+		{
+			client->skip -= result;
+			continue;
+		}
+		
+		client->received += result;
+		
+		if(client->received < CONTROL_HEADER_BYTES)
+			continue;
+		
+		//we have complete header, now get payload
+		bytes = GetControlHeaderPayloadLength(client->buffer);
+
+		if(bytes > CONTROL_BUFFER_BYTES-CONTROL_HEADER_BYTES)
+		{
+			fprintf(stderr, "ev3control: ignoring message, doesn't fit buffer: payload %d, buffer is %d\n", bytes, CONTROL_BUFFER_BYTES-CONTROL_HEADER_BYTES);
+			client->skip=bytes;
+			client->received=0;
+			continue;
 		}
-	}		
-	return ProcessMessage(client_socket, buffer, response_buffer, control);
+		
+		if(client->received < CONTROL_HEADER_BYTES + bytes)
+			continue;
+			
+		client->received=0;
+		
+		if(!ProcessMessage(client, client->buffer, response_buffer, server))
+			return false;
+	}
+	return false;
 }
 
-bool ProcessMessage(int client_socket, const char *msg, char *response, Control *control)
+bool ProcessMessage(Client *client, const char *msg, char *response, Server *server)
 {
-	static bool (*handlers[])(int, const char *, const control_header &,char *,Control *)={ProcessMessageKEEPALIVE, ProcessMessageENABLE, ProcessMessageDISABLE, ProcessMessageDISABLE_ALL};
+	static bool (*handlers[])(Client *, const char *, const control_header &,char *,Server *)={ProcessMessageKEEPALIVE, ProcessMessageENABLE, ProcessMessageDISABLE, ProcessMessageDISABLE_ALL, ProcessMessageSUBSCRIBE_STATS,
+		ProcessMessageENABLE_MANY, ProcessMessageDISABLE_MANY, ProcessMessageQUERY_STATUS, ProcessMessageLOG};
 	static control_header header;
 	
 	GetControlHeader(msg, &header);
@@ -192,14 +624,15 @@ bool ProcessMessage(int client_socket, const char *msg, char *response, Control
 	if( !CheckCommandSupport(header) )
 		return true;
 		
-	return handlers[header.command](client_socket, msg+CONTROL_HEADER_BYTES, header,response, control);
+	return handlers[header.command](client, msg+CONTROL_HEADER_BYTES, header,response, server);
 }
 
 
+// older peers are fine, all their commands are supported
 void CheckProtocolVersion(const control_header &header)
 {
 	static bool protocol_version_not_yet_warned=true;
-	if(protocol_version_not_yet_warned && header.protocol_version != CONTROL_PROTOCOL_VERSION)
+	if(protocol_version_not_yet_warned && header.protocol_version > CONTROL_PROTOCOL_VERSION)
 	{
 		fprintf(stderr, "ev3control: received message with protocol version %d, implementation version is %d\n", header.protocol_version, CONTROL_PROTOCOL_VERSION);
 		fprintf(stderr, "ev3control: some functionality may not be supported\n");
@@ -209,19 +642,28 @@ void CheckProtocolVersion(const control_header &header)
 
 bool CheckCommandSupport(const control_header &header)
 {
-	if(header.command >= KEEPALIVE && header.command <= DISABLE_ALL)
-		return true;
-	fprintf(stderr, "ev3control: ignoring message with unsupported command %d\n", header.command);
-	return false;
+	if(header.command < CONTROL_COMMANDS_FIRST || header.command > CONTROL_COMMANDS_LAST)
+	{
+		fprintf(stderr, "ev3control: ignoring message with unsupported command %d\n", header.command);
+		return false;
+	}
+	//the command didn't exist in the protocol version the peer claims to speak
+	if(header.protocol_version < CONTROL_COMMANDS_VERSIONS[header.command])
+	{
+		fprintf(stderr, "ev3control: ignoring command %d, it requires protocol version %d, message has version %d\n", header.command, CONTROL_COMMANDS_VERSIONS[header.command], header.protocol_version);
+		return false;
+	}
+	return true;
 }
 
 
-bool ProcessMessageKEEPALIVE(int client_socket, const char *payload, const control_header &header, char *response, Control *control)
+bool ProcessMessageKEEPALIVE(Client *client, const char *payload, const control_header &header, char *response, Server *server)
 {
-	return CheckModulesStates(client_socket, response, control);
+	int response_length=EncodeKeepaliveMessage(response, CONTROL_BUFFER_BYTES);
+	return SendMessage(client, response, response_length);
 }
 
-bool ProcessMessageENABLE(int client_socket, const char *payload, const control_header &header, char *response, Control *control)
+bool ProcessMessageENABLE(Client *client, const char *payload, const control_header &header, char *response, Server *server)
 {
 	static control_attribute attributes[3];
 	const static ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
@@ -232,35 +674,77 @@ bool ProcessMessageENABLE(int client_socket, const char *payload, const control_
 		return true;
 	}
 
-	string unique_name(GetControlAttributeString(attributes[0]));
-	string call(GetControlAttributeString(attributes[1]));
+	return EnableModule(client, attributes, response, server);
+}
+
+bool EnableModule(Client *client, const control_attribute attributes[3], char *response, Server *server)
+{
+	Control *control=server->control;
+	//names and calls are used in place, in the received message
+	const char *unique_name=GetControlAttributeString(attributes[0]);
+	const char *call=GetControlAttributeString(attributes[1]);
 	uint16_t creation_delay_ms = GetControlAttributeU16(attributes[2]);
 	
-	printf("ev3control: request to enable %s\n", unique_name.c_str());
+	printf("ev3control: request to enable %s\n", unique_name);
 	
-	Module module;
-	bool contains_module=control->ContainsModule(unique_name, &module);
+	int module=control->FindModule(unique_name);
+	bool contains_module= module != -1;
 	
-	if( contains_module && module.state == MODULE_ENABLED && control->CheckModuleState(unique_name) == MODULE_ENABLED )
+	if( contains_module && control->GetModule(module).state == MODULE_ENABLING )
+	{
+		fprintf(stderr, "ev3control: request to enable %s but it is being enabled\n", unique_name);
+
+		if(control->GetModule(module).owner == MODULE_NO_OWNER) //take over the orphaned module, ENABLED is broadcast when ready
+			control->SetModuleOwner(module, client->socket);
+		return true;
+	}
+
+	if( contains_module && control->GetModule(module).state == MODULE_DISABLING )
+	{
+		fprintf(stderr, "ev3control: request to enable %s but it is being disabled\n", unique_name);
+		return true;
+	}
+
+	//the module may have exited before its SIGCHLD was read, FAILED is broadcast once as from signalfd
+	if( contains_module && control->GetModule(module).state == MODULE_ENABLED )
 	{
-		fprintf(stderr, "ev3control: request to enable %s but it is enabled\n", unique_name.c_str());
+		SendModulesOutput(response, server);
+		CheckModulesStates(response, server);
+	}
+
+	if( contains_module && control->GetModule(module).state == MODULE_ENABLED )
+	{
+		fprintf(stderr, "ev3control: request to enable %s but it is enabled\n", unique_name);
 		
+		if(control->GetModule(module).owner == MODULE_NO_OWNER) //take over the orphaned module
+			control->SetModuleOwner(module, client->socket);
+			
 		int response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, ENABLED, unique_name);
-		return SendMessage(client_socket, response, response_length);
+		return SendMessage(client, response, response_length);
 	}
 	
-	if(!contains_module)
-		control->InsertModule(unique_name, creation_delay_ms);
+	if(!contains_module && (module=control->InsertModule(unique_name, creation_delay_ms)) == -1)
+	{
+		fprintf(stderr, "ev3control: request to enable %s but there are already %d modules\n", unique_name, CONTROL_MAX_MODULES);
+		int response_length=EncodeFailedMessage(response, CONTROL_BUFFER_BYTES, unique_name, -1);
+		return SendMessage(client, response, response_length);
+	}
 	
-	control->EnableModule(unique_name, call);
+	//ENABLED is broadcast when the module notifies readiness (or creation delay passes)
+	if( !control->EnableModule(module, call, creation_delay_ms) )
+	{
+		int32_t status=control->GetModule(module).return_value;
+		printf("ev3control: %s failed with status %d\n", unique_name, status);
+		int response_length=EncodeFailedMessage(response, CONTROL_BUFFER_BYTES, unique_name, status);
+		BroadcastMessage(server, response, response_length);
+		return true;
+	}
+	control->SetModuleOwner(module, client->socket);
 
-	printf("ev3control: enabled module: %s\n", unique_name.c_str());
-	
-	int response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, ENABLED, unique_name);
-	
-	return SendMessage(client_socket, response, response_length);
+	printf("ev3control: enabling module: %s\n", unique_name);
+	return true;
 }
-bool ProcessMessageDISABLE(int client_socket, const char *payload, const control_header &header, char *response, Control *control)
+bool ProcessMessageDISABLE(Client *client, const char *payload, const control_header &header, char *response, Server *server)
 {
 	static control_attribute attributes[1];
 	const static ControlAttributes expected[]={UNIQUE_NAME};
@@ -271,22 +755,35 @@ bool ProcessMessageDISABLE(int client_socket, const char *payload, const control
 		return true;
 	}
 	
-	string unique_name(GetControlAttributeString(attributes[0]));	
+	return DisableModule(client, attributes, response, server);
+}
+
+bool DisableModule(Client *client, const control_attribute attributes[1], char *response, Server *server)
+{
+	Control *control=server->control;
+	const char *unique_name=GetControlAttributeString(attributes[0]);
 		
-	printf("ev3control: request to disable %s\n", unique_name.c_str());
+	printf("ev3control: request to disable %s\n", unique_name);
 				
-	Module module;
-	bool contains_module=control->ContainsModule(unique_name, &module);
+	int index=control->FindModule(unique_name);
 	
-	if( !contains_module)
+	if( index == -1)
 	{
-		fprintf(stderr, "ev3control: request to disable %s but no such module\n", unique_name.c_str());
+		fprintf(stderr, "ev3control: request to disable %s but no such module\n", unique_name);
 		return true;
 	}
 	
-	if(module.state != MODULE_ENABLED)
+	const Module &module=control->GetModule(index);
+	
+	if(module.state == MODULE_DISABLING)
 	{
-		fprintf(stderr, "ev3control: request to disable %s module but is not enabled\n", unique_name.c_str());
+		fprintf(stderr, "ev3control: request to disable %s but it is already being disabled\n", unique_name);
+		return true;
+	}
+
+	if(module.state != MODULE_ENABLED && module.state != MODULE_ENABLING)
+	{
+		fprintf(stderr, "ev3control: request to disable %s module but is not enabled\n", unique_name);
 		
 		int response_length;
 		if(module.state==MODULE_DISABLED)
@@ -294,79 +791,363 @@ bool ProcessMessageDISABLE(int client_socket, const char *payload, const control
 		else //if(module.state==MODULE_FAILED)
 			response_length=EncodeFailedMessage(response, CONTROL_BUFFER_BYTES, unique_name, module.return_value);
 		
-		return SendMessage(client_socket, response, response_length);
+		return SendMessage(client, response, response_length);
 	}
 	
-	if(!control->DisableModule(unique_name))
+	if(module.owner != MODULE_NO_OWNER && module.owner != client->socket)
 	{
-		fprintf(stderr, "ev3control: unable to disable module: %s\n", unique_name.c_str());
+		fprintf(stderr, "ev3control: request to disable %s but it is owned by client %d\n", unique_name, module.owner);
 		return true;
 	}
-
-	printf("ev3control: disabled module: %s\n", unique_name.c_str());
-	int response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, DISABLED, unique_name);
-	return SendMessage(client_socket, response, response_length);
+	
+	//DISABLED is broadcast when the module exits
+	control->DisableModule(index);
+	printf("ev3control: disabling module: %s\n", unique_name);
+	return true;
 }
-bool ProcessMessageDISABLE_ALL(int client_socket, const char *payload, const control_header &header, char *response, Control *control)
+bool ProcessMessageDISABLE_ALL(Client *client, const char *payload, const control_header &header, char *response, Server *server)
 {
 	printf("ev3control: request to disable all modules\n");
 
-	list<string> disabled=control->DisableModules();
+	//modules owned by other clients are left alone, all the rest is disabled in parallel
+	//DISABLED is broadcast for each module when it exits
+	int disabling[CONTROL_MAX_MODULES];
+	int count=server->control->DisableModules(client->socket, disabling);
 	
-	for(list<string>::iterator it=disabled.begin();it!=disabled.end();++it)
+	for(int i=0;i<count;++i)
+		printf("ev3control: disabling module: %s\n", server->control->GetModule(disabling[i]).name);
+
+	return true;
+}
+
+bool ProcessMessageENABLE_MANY(Client *client, const char *payload, const control_header &header, char *response, Server *server)
+{
+	static control_attribute attributes[3*CONTROL_MAX_BATCH_MODULES];
+	const static ControlAttributes expected[]={UNIQUE_NAME, CALL, CREATION_DELAY_MS};
+	int modules;
+	
+	if( (modules=ParseControlMessageGroups(header, payload, attributes, CONTROL_MAX_BATCH_MODULES, expected, 3)) == -1 )
 	{
-		printf("ev3control: disabled module: %s\n", it->c_str());
-		int response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, DISABLED, *it);
-		if(!SendMessage(client_socket, response, response_length))
+		fprintf(stderr, "ev3control: ignoring invalid command %d\n", header.command);
+		return true;
+	}
+	
+	//modules are enabled in parallel, ENABLED (or FAILED) is broadcast for each separately
+	for(int i=0;i<modules;++i)
+		if( !EnableModule(client, attributes + 3*i, response, server) )
 			return false;
+	return true;
+}
+
+bool ProcessMessageDISABLE_MANY(Client *client, const char *payload, const control_header &header, char *response, Server *server)
+{
+	static control_attribute attributes[CONTROL_MAX_BATCH_MODULES];
+	const static ControlAttributes expected[]={UNIQUE_NAME};
+	int modules;
+	
+	if( (modules=ParseControlMessageGroups(header, payload, attributes, CONTROL_MAX_BATCH_MODULES, expected, 1)) == -1 )
+	{
+		fprintf(stderr, "ev3control: ignoring invalid command %d\n", header.command);
+		return true;
 	}
+	
+	for(int i=0;i<modules;++i)
+		if( !DisableModule(client, attributes + i, response, server) )
+			return false;
 	return true;
 }
 
-bool CheckModulesStates(int client_socket, char *response, Control *control)
+bool ProcessMessageQUERY_STATUS(Client *client, const char *payload, const control_header &header, char *response, Server *server)
 {
-	list<FailedModule> failed=control->CheckModulesStates();
+	int module=0;
 	
-	for(list<FailedModule>::iterator it=failed.begin();it!=failed.end();++it)
+	//at least one (possibly empty) STATUS_ALL, more if the modules don't fit single message
+	do
 	{
-		printf("ev3control: %s failed with status %d\n", it->name.c_str(), it->status);
-		int response_length=EncodeFailedMessage(response, CONTROL_BUFFER_BYTES, it->name, it->status);
-		if(!SendMessage(client_socket, response, response_length))
+		int response_length=EncodeStatusAllMessage(response, CONTROL_BUFFER_BYTES, *server->control, &module);
+		if( !SendMessage(client, response, response_length) )
 			return false;
+	}
+	while(module != server->control->ModulesCount());
+	
+	return true;
+}
+
+bool ProcessMessageLOG(Client *client, const char *payload, const control_header &header, char *response, Server *server)
+{
+	static control_attribute attributes[4];
+	const static ControlAttributes expected[]={UNIQUE_NAME, LOG_STREAM, LOG_OFFSET, LOG_FOLLOW};
+
+	if(!ParseControlMessage(header, payload, attributes, 4, expected))
+	{
+		fprintf(stderr, "ev3control: ignoring invalid command %d\n", header.command);
+		return true;
+	}
+
+	const char *unique_name=GetControlAttributeString(attributes[0]);
+	int log_stream=GetControlAttributeU8(attributes[1]);
+	uint32_t offset=GetControlAttributeU32(attributes[2]);
+	bool follow=GetControlAttributeU8(attributes[3]) != 0;
+
+	if(log_stream != LOG_STDOUT && log_stream != LOG_STDERR)
+	{
+		fprintf(stderr, "ev3control: ignoring log request with invalid stream %d\n", log_stream);
+		return true;
+	}
+
+	ModuleOutputStream stream = log_stream == LOG_STDOUT ? MODULE_STDOUT : MODULE_STDERR;
+	int stream_bit = 1 << stream;
+
+	int module=server->control->FindModule(unique_name);
+
+	if(module == -1 && !follow)
+	{
+		fprintf(stderr, "ev3control: no log for %s, it was never enabled\n", unique_name);
+		return true;
+	}
+	//the module may be followed before it is enabled, it gets creation delay on ENABLE
+	if(module == -1 && (module=server->control->InsertModule(unique_name, 0)) == -1)
+	{
+		fprintf(stderr, "ev3control: request to follow %s but there are already %d modules\n", unique_name, CONTROL_MAX_MODULES);
+		return true;
+	}
+
+	if(follow)
+		client->log_follow[module] |= stream_bit;
+	else
+		client->log_follow[module] &= ~stream_bit;
+
+	return SendModuleLog(client, module, stream, offset, response, server);
+}
+
+bool ProcessMessageSUBSCRIBE_STATS(Client *client, const char *payload, const control_header &header, char *response, Server *server)
+{
+	static control_attribute attributes[1];
+	const static ControlAttributes expected[]={STATS_PERIOD_MS};
+
+	if(!ParseControlMessage(header, payload, attributes, 1, expected))
+	{
+		fprintf(stderr, "ev3control: ignoring invalid command %d\n", header.command);
+		return true;
+	}
+
+	int period_ms=GetControlAttributeU16(attributes[0]);
+
+	if(period_ms != 0 && period_ms < CONTROL_MIN_STATS_PERIOD_MS)
+		period_ms=CONTROL_MIN_STATS_PERIOD_MS;
+
+	printf("ev3control: client %d subscribed to stats with period %d ms\n", client->socket, period_ms);
+
+	client->stats_period_ms=period_ms;
+	client->stats_next_us=TimestampUs() + (uint64_t)period_ms*1000;
+	return true;
+}
+
+void CheckModulesReady(char *response, Server *server)
+{
+	int ready[CONTROL_MAX_MODULES];
+	int count=server->control->CheckModulesReady(TimestampUs(), ready);
+	int response_length;
+
+	for(int i=0;i<count;++i)
+	{
+		const char *name=server->control->GetModule(ready[i]).name;
+		printf("ev3control: enabled module: %s\n", name);
+		response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, ENABLED, name);
+		BroadcastMessage(server, response, response_length);
+	}
+}
+
+void CheckModulesStates(char *response, Server *server)
+{
+	int exited[CONTROL_MAX_MODULES];
+	int count=server->control->CheckModulesStates(exited);
+	int response_length;
+	
+	for(int i=0;i<count;++i)
+	{
+		const Module &module=server->control->GetModule(exited[i]);
+
+		if(module.state == MODULE_DISABLED)
+		{
+			printf("ev3control: disabled module: %s\n", module.name);
+			response_length=EncodeModuleMessage(response, CONTROL_BUFFER_BYTES, DISABLED, module.name);
+		}
+		else //if(module.state == MODULE_FAILED)
+		{
+			printf("ev3control: %s failed with status %d\n", module.name, module.return_value);
+			response_length=EncodeFailedMessage(response, CONTROL_BUFFER_BYTES, module.name, module.return_value);
+		}
+		BroadcastMessage(server, response, response_length);
 	}	
-	if(failed.size() == 0)
+}
+
+void EscalateDisableModules(Server *server)
+{
+	int unable[CONTROL_MAX_MODULES];
+	int count=server->control->EscalateDisableModules(TimestampUs(), unable);
+
+	for(int i=0;i<count;++i)
+		fprintf(stderr, "ev3control: unable to disable module: %s\n", server->control->GetModule(unable[i]).name);
+}
+
+void SendModulesOutput(char *response, Server *server)
+{
+	ModuleOutput output[CONTROL_MAX_MODULES*MODULE_OUTPUT_STREAMS];
+	int count=server->control->DrainModulesOutput(output);
+
+	for(int m=0;m<count;++m)
+		for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		{
+			Client *client=server->clients + i;
+
+			if(client->socket != -1 && client->log_follow[output[m].module] & (1 << output[m].stream))
+				SendModuleLog(client, output[m].module, output[m].stream, output[m].offset, response, server);
+		}
+}
+
+bool SendModuleLog(Client *client, int module, ModuleOutputStream stream, uint32_t offset, char *response, Server *server)
+{
+	char text[CONTROL_MAX_ATTRIBUTE_DATA_LENGTH];
+	const char *name=server->control->GetModule(module).name;
+	int text_length, response_length;
+
+	while( (text_length=server->control->ReadModuleLog(module, stream, &offset, text, CONTROL_MAX_ATTRIBUTE_DATA_LENGTH)) > 0 )
 	{
-		int response_length=EncodeKeepaliveMessage(response, CONTROL_BUFFER_BYTES);
-		return SendMessage(client_socket, response, response_length);
+		//offset was advanced past the text
+		response_length=EncodeLogDataMessage(response, CONTROL_BUFFER_BYTES, name, stream, offset-text_length, text, text_length);
+		if( !SendMessage(client, response, response_length) )
+			return false;
 	}
+
 	return true;
 }
 
-bool SendMessage(int sock, char *msg, int msg_len)
+// clients with output waiting get data anyway, keepalives would only fill their output
+void SendKeepalives(char *response, Server *server)
+{
+	int response_length=EncodeKeepaliveMessage(response, CONTROL_BUFFER_BYTES);
+
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		if(server->clients[i].socket != -1 && server->clients[i].output_length == 0)
+			SendMessage(server->clients + i, response, response_length);
+}
+
+// modules are sampled once for all due clients
+// with different periods the usage is for the time since the previous sample of any client
+void SendStats(char *response, Server *server)
+{
+	uint64_t now=TimestampUs();
+	ModuleStats stats[CONTROL_MAX_MODULES];
+	int sampled=-1;
+	int response_length;
+
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+	{
+		Client *client=server->clients + i;
+
+		if(client->socket == -1 || client->stats_period_ms == 0 || client->stats_next_us > now)
+			continue;
+
+		if(sampled == -1)
+			sampled=server->control->SampleModulesStats(now, stats);
+
+		for(int m=0;m<sampled;++m)
+		{
+			response_length=EncodeStatsMessage(response, CONTROL_BUFFER_BYTES, server->control->GetModule(stats[m].module).name, stats[m]);
+			SendMessage(client, response, response_length);
+		}
+
+		client->stats_next_us += (uint64_t)client->stats_period_ms*1000;
+		if(client->stats_next_us <= now) //we were late, don't try to catch up
+			client->stats_next_us = now + (uint64_t)client->stats_period_ms*1000;
+	}
+}
+
+int SendData(int sock, const char *data, int length)
 {
 	int data_sent=0;
 	int data_written=0;
-	while(data_sent<msg_len)
+	while(data_sent<length)
 	{
-		if( ( data_written=send(sock , msg+data_sent , msg_len-data_sent, 0) ) == -1 )
+		if( ( data_written=send(sock , data+data_sent , length-data_sent, 0) ) == -1 )
 		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) //the rest waits for EPOLLOUT
+				break;
 			perror("ev3control: socket send failed");
-			return false;
+			return -1;
 		}
 		data_sent+=data_written;
 	}
+	return data_sent;
+}
+
+// STATS and LOG_DATA (what the client subscribed to) may not take the reserve,
+// the client that doesn't keep up with them is dropped before module state messages overflow
+bool SendMessage(Client *client, char *msg, int msg_len)
+{
+	static control_header header;
+	int sent=0;
+	int limit=CONTROL_OUTPUT_BYTES;
+
+	if(client->failed)
+		return false;
+
+	//the output waits, sending now would reorder messages
+	if(client->output_length == 0 && (sent=SendData(client->socket, msg, msg_len)) == -1)
+	{
+		client->failed=true;
+		return false;
+	}
+	if(sent == msg_len)
+		return true;
+
+	GetControlHeader(msg, &header);
+	if(header.command == STATS || header.command == LOG_DATA)
+		limit -= CONTROL_OUTPUT_RESERVE_BYTES;
+
+	if(client->output_length + msg_len - sent > limit)
+	{
+		fprintf(stderr, "ev3control: client %d doesn't keep up, %d bytes waiting\n", client->socket, client->output_length);
+		client->failed=true;
+		return false;
+	}
+
+	memcpy(client->output + client->output_length, msg + sent, msg_len - sent);
+	client->output_length += msg_len - sent;
 	return true;
 }
 
-int EncodeModuleMessage(char *buffer, int buffer_length, ControlCommands command, const std::string &module_name)
+bool SendOutput(Client *client)
+{
+	int sent=SendData(client->socket, client->output, client->output_length);
+
+	if(sent == -1)
+		return false;
+
+	client->output_length -= sent;
+	memmove(client->output, client->output + sent, client->output_length);
+	return true;
+}
+
+void BroadcastMessage(Server *server, char *msg, int msg_len)
+{
+	for(int i=0;i<CONTROL_MAX_CLIENTS;++i)
+		if(server->clients[i].socket != -1)
+			SendMessage(server->clients + i, msg, msg_len);
+}
+
+int EncodeModuleMessage(char *buffer, int buffer_length, ControlCommands command, const char *module_name)
 {
 	if( !PutControlHeader(buffer, buffer_length, TimestampUs(), command) 
-	|| !PutControlAttributeString(buffer, buffer_length, UNIQUE_NAME, module_name.c_str()) )
+	|| !PutControlAttributeString(buffer, buffer_length, UNIQUE_NAME, module_name) )
 		Die("ev3control: unable to encode module message\n");
 	
 	return GetControlMessageLength(buffer);
 }
-int EncodeFailedMessage(char *buffer, int buffer_length, const std::string &module_name, int32_t status)
+int EncodeFailedMessage(char *buffer, int buffer_length, const char *module_name, int32_t status)
 {
 	if(!EncodeModuleMessage(buffer, buffer_length, FAILED, module_name) 
 	|| !PutControlAttributeI32(buffer, buffer_length, RETURN_VALUE, status))
@@ -382,6 +1163,54 @@ int EncodeKeepaliveMessage(char *buffer, int buffer_length)
 	return GetControlMessageLength(buffer);
 }
 
+int EncodeStatsMessage(char *buffer, int buffer_length, const char *module_name, const ModuleStats &stats)
+{
+	if(!EncodeModuleMessage(buffer, buffer_length, STATS, module_name)
+	|| !PutControlAttributeU16(buffer, buffer_length, CPU_PERMILLE, stats.cpu_permille)
+	|| !PutControlAttributeU32(buffer, buffer_length, RSS_KB, stats.rss_kb)
+	|| !PutControlAttributeU32(buffer, buffer_length, VOLUNTARY_SWITCHES, stats.voluntary_switches)
+	|| !PutControlAttributeU32(buffer, buffer_length, INVOLUNTARY_SWITCHES, stats.involuntary_switches)
+	|| !PutControlAttributeU16(buffer, buffer_length, IOWAIT_PERMILLE, stats.iowait_permille))
+		Die("ev3control: unable to encode module stats message\n");
+
+	return GetControlMessageLength(buffer);
+}
+
+int EncodeLogDataMessage(char *buffer, int buffer_length, const char *module_name, ModuleOutputStream stream, uint32_t offset, const char *text, int text_length)
+{
+	if(!EncodeModuleMessage(buffer, buffer_length, LOG_DATA, module_name)
+	|| !PutControlAttributeU8(buffer, buffer_length, LOG_STREAM, stream == MODULE_STDOUT ? LOG_STDOUT : LOG_STDERR)
+	|| !PutControlAttributeU32(buffer, buffer_length, LOG_OFFSET, offset)
+	|| !PutControlAttributeBytes(buffer, buffer_length, LOG_TEXT, text, text_length))
+		Die("ev3control: unable to encode log data message\n");
+
+	return GetControlMessageLength(buffer);
+}
+
+int EncodeStatusAllMessage(char *buffer, int buffer_length, const Control &control, int *module_index)
+{
+	if( !PutControlHeader(buffer, buffer_length, TimestampUs(), STATUS_ALL) )
+		Die("ev3control: unable to encode status message\n");
+		
+	for(; *module_index < control.ModulesCount(); ++*module_index)
+	{
+		const Module &module=control.GetModule(*module_index);
+		int length=GetControlMessageLength(buffer);
+		
+		if(!PutControlAttributeString(buffer, buffer_length, UNIQUE_NAME, module.name)
+		|| !PutControlAttributeU8(buffer, buffer_length, MODULE_STATE, module.state)
+		|| !PutControlAttributeI32(buffer, buffer_length, RETURN_VALUE, module.return_value))
+		{
+			if(length == CONTROL_HEADER_BYTES)
+				Die("ev3control: unable to encode status message\n");
+			//doesn't fit, drop partially encoded module, it goes to the next message
+			SetControlMessageLength(buffer, length);
+			break;
+		}
+	}
+	return GetControlMessageLength(buffer);
+}
+
 void Usage()
 {
 	printf("ev3control tcp_port timeout_ms\n\n");
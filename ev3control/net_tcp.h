@@ -14,20 +14,22 @@
 
 #pragma once
 
+#include "shared/net_udp.h" //TrafficClass
+
 // all created sockets have O_CLOEXEC flag set
 
-void InitNetworkTCP(int *serv_sock, short port);
+// the server socket is non-blocking, backlog is the listen queue length
+// accepted client sockets inherit the traffic class (see net_udp.h)
+void InitNetworkTCP(int *serv_sock, short port, int backlog, TrafficClass traffic);
 
 // prerequisities:
 // - InitNetworkTCP called with serv_sock as argument
 //
-// timeout:
-// - waiting for client timeouts after timetout_ms
-// - the returned client socket has timeout_ms set for receiving
+// the returned client socket is non-blocking
 //
 // returns:
-// - false on timeout
+// - false if there is no client waiting (or it gave up)
 // - true if client was accepted, then client_sock is its socket
-bool WaitForClientTCP(int serv_sock, int timeout_ms, int *client_sock);
+bool AcceptClientTCP(int serv_sock, int *client_sock);
 
 void CloseNetworkTCP(int serv_sock);
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+ * ev3dev-mapping ev3control /proc process statistics implementation file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "proc_stats.h"
+
+#include <unistd.h> //read, close, sysconf
+#include <fcntl.h> //open
+#include <stdio.h> //snprintf
+#include <stdlib.h> //strtoull
+#include <string.h> //strrchr, strstr
+
+// /proc/<pid>/stat fields (counted from 1 as in proc(5))
+const int PROC_STAT_STATE_FIELD=3; //the first field after (comm)
+const int PROC_STAT_UTIME_FIELD=14;
+const int PROC_STAT_STIME_FIELD=15;
+const int PROC_STAT_BLKIO_FIELD=42;
+
+const int PROC_BUFFER_BYTES=2048; //context switches are at the end of status, ~1 KB
+
+int ReadProcFile(pid_t pid, const char *file, char *buffer, int buffer_length);
+uint32_t GetProcStatusValue(const char *status, const char *key);
+
+bool ReadProcStats(pid_t pid, proc_stats *stats)
+{
+	char buffer[PROC_BUFFER_BYTES];
+	uint64_t fields[PROC_STAT_BLKIO_FIELD+1]={};
+
+	if( ReadProcFile(pid, "stat", buffer, PROC_BUFFER_BYTES) <= 0 )
+		return false;
+
+	//comm may contain spaces and parentheses, the fields start after the last ')'
+	char *field=strrchr(buffer, ')');
+	if(field == NULL)
+		return false;
+	++field;
+
+	//the state field is a character, strtoull skips it as 0
+	for(int i=PROC_STAT_STATE_FIELD; i<=PROC_STAT_BLKIO_FIELD && *field; ++i)
+	{
+		while(*field == ' ')
+			++field;
+		if(i == PROC_STAT_STATE_FIELD)
+			++field;
+		else
+			fields[i]=strtoull(field, &field, 10);
+	}
+
+	stats->cpu_ticks=fields[PROC_STAT_UTIME_FIELD] + fields[PROC_STAT_STIME_FIELD];
+	stats->blkio_ticks=fields[PROC_STAT_BLKIO_FIELD];
+
+	if( ReadProcFile(pid, "status", buffer, PROC_BUFFER_BYTES) <= 0 )
+		return false;
+
+	//zombie processes have no VmRSS, it is 0 then
+	stats->rss_kb=GetProcStatusValue(buffer, "\nVmRSS:");
+	stats->voluntary_switches=GetProcStatusValue(buffer, "\nvoluntary_ctxt_switches:");
+	stats->involuntary_switches=GetProcStatusValue(buffer, "\nnonvoluntary_ctxt_switches:");
+
+	return true;
+}
+
+uint16_t ProcTicksPermille(uint64_t ticks, uint64_t elapsed_us)
+{
+	static const long TICKS_PER_SECOND=sysconf(_SC_CLK_TCK);
+
+	if(elapsed_us == 0)
+		return 0;
+
+	uint64_t permille=ticks * 1000 * 1000000 / (elapsed_us * TICKS_PER_SECOND);
+
+	return permille > UINT16_MAX ? UINT16_MAX : permille;
+}
+
+// reads the whole file (truncated to buffer length) and terminates it with '\0'
+// returns number of bytes read or -1 on error
+int ReadProcFile(pid_t pid, const char *file, char *buffer, int buffer_length)
+{
+	char path[64];
+	int fd, bytes=0, result=0;
+
+	snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, file);
+
+	if( (fd=open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+
+	while( bytes < buffer_length-1 && (result=read(fd, buffer+bytes, buffer_length-1-bytes)) > 0 )
+		bytes+=result;
+
+	close(fd);
+
+	if(result == -1)
+		return -1;
+
+	buffer[bytes]='\0';
+	return bytes;
+}
+
+uint32_t GetProcStatusValue(const char *status, const char *key)
+{
+	const char *value=strstr(status, key);
+
+	if(value == NULL)
+		return 0;
+
+	return strtoul(value + strlen(key), NULL, 10);
+}
@@ -0,0 +1,34 @@
+/*
+ * ev3dev-mapping ev3control /proc process statistics header file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <sys/types.h> //pid_t
+#include <stdint.h> //uint64_t, uint32_t
+
+// counters of the process since its start (rss is the current value)
+struct proc_stats
+{
+	uint64_t cpu_ticks; //utime + stime from /proc/<pid>/stat
+	uint64_t blkio_ticks; //delayacct_blkio_ticks from /proc/<pid>/stat (0 without delay accounting)
+	uint32_t rss_kb; //VmRSS from /proc/<pid>/status
+	uint32_t voluntary_switches; //voluntary_ctxt_switches from /proc/<pid>/status
+	uint32_t involuntary_switches; //nonvoluntary_ctxt_switches from /proc/<pid>/status
+};
+
+// false if process is gone (or /proc is not readable)
+bool ReadProcStats(pid_t pid, proc_stats *stats);
+
+// share of elapsed time in 1/1000, e.g. CPU or I/O wait share
+uint16_t ProcTicksPermille(uint64_t ticks, uint64_t elapsed_us);
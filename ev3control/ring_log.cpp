@@ -0,0 +1,77 @@
+/*
+ * ev3dev-mapping ev3control bounded in-memory log implementation file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ring_log.h"
+
+#include <string.h> //memcpy
+
+RingLog::RingLog(int capacity): data(capacity), end(0), full(false)
+{
+}
+
+void RingLog::Write(const char *buffer, int length)
+{
+	const int capacity=data.size();
+
+	//only the tail fits anyway
+	if(length >= capacity)
+	{
+		full=true;
+		end += length-capacity;
+		buffer += length-capacity;
+		length = capacity;
+	}
+
+	int position=end % capacity;
+	int first=length < capacity-position ? length : capacity-position;
+
+	memcpy(&data[position], buffer, first);
+	memcpy(&data[0], buffer+first, length-first);
+
+	if(!full && (uint32_t)capacity - position <= (uint32_t)length)
+		full=true;
+
+	end += length;
+}
+
+uint32_t RingLog::Begin() const
+{
+	return full ? end-data.size() : 0;
+}
+
+uint32_t RingLog::End() const
+{
+	return end;
+}
+
+int RingLog::Read(uint32_t *offset, char *buffer, int length) const
+{
+	const int capacity=data.size();
+
+	//offsets may wrap, compare distances from the end
+	if(end - *offset > end - Begin())
+		*offset=Begin();
+
+	if( (uint32_t)length > end - *offset )
+		length = end - *offset;
+
+	int position=*offset % capacity;
+	int first=length < capacity-position ? length : capacity-position;
+
+	memcpy(buffer, &data[position], first);
+	memcpy(buffer+first, &data[0], length-first);
+
+	*offset += length;
+	return length;
+}
@@ -0,0 +1,41 @@
+/*
+ * ev3dev-mapping ev3control bounded in-memory log header file
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdint.h> //uint32_t
+
+#include <vector> //vector
+
+// keeps the last capacity bytes written
+// bytes are addressed by offset from the first byte ever written
+// (offsets wrap after 4 GB, capacity has to be power of 2 for that)
+class RingLog
+{
+private:
+	std::vector<char> data;
+	uint32_t end;
+	bool full; //capacity bytes were written at least once
+public:
+	explicit RingLog(int capacity);
+
+	void Write(const char *buffer, int length);
+
+	uint32_t Begin() const; //offset of the oldest byte kept
+	uint32_t End() const; //offset of the next byte to be written
+
+	// copies up to length bytes starting at offset (moved to Begin() if already overwritten)
+	// offset is advanced past the copied bytes, returns the number of bytes copied
+	int Read(uint32_t *offset, char *buffer, int length) const;
+};
@@ -20,6 +20,7 @@
   * -reads gyroscope angle
   * -timestamps the data
   * -sends the above data in UDP messages
+  * -publishes the same messages on shared-memory bus (stream ev3dead-reconning-<port>)
   *
   * Preconditions (for EV3/ev3dev):
   * -two tacho motors connected to ports A, D
@@ -28,49 +29,36 @@
   * See Usage() function for syntax details (or run the program without arguments)
   */
 
-// GYRO CONSTANTS
-const char *GYRO_PORT="i2c-legoev35:i2c1";
-const int GYRO_PATH_MAX=100;
-char GYRO_PATH[GYRO_PATH_MAX]="/sys/class/lego-sensor/sensor";
-
 #include "shared/misc.h"
-#include "shared/net_udp.h"
+#include "shared/module_runtime.h"
+#include "shared/packets.h"
+#include "shared/gyro.h"
 
 #include "ev3dev-lang-cpp/ev3dev.h"
 
-#include <limits.h> //INT_MAX
 #include <stdio.h>
-#include <string.h> //memcpy
-#include <unistd.h> //open, close, read, write
-#include <fcntl.h> //O_RDONLY flag
-#include <endian.h> //htobe16, htobe32, htobe64
+#include <errno.h> //ENXIO
+#include <unistd.h> //close
 
-struct dead_reconning_packet
+struct dead_reconning_sensors
 {
-	uint64_t timestamp_us;
-	int32_t position_left;
-	int32_t position_right;
-	int16_t heading;
+	ev3dev::large_motor *left;
+	ev3dev::large_motor *right;
+	int gyro_direct_fd;
+	int enxios; //consecutive ENXIO failures
 };
 
-const int DEAD_RECONNING_PACKET_BYTES=18; //2 + 2*4 + 8
-
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, const ev3dev::large_motor &left,const ev3dev::large_motor &right, int gyro_direct_fd, int poll_ms);
+ModuleSampleStatus SampleDeadReconning(void *data, dead_reconning_packet *packet);
 
 void InitDriveMotor(ev3dev::large_motor *m);
 int InitGyro(ev3dev::i2c_sensor *gyro);
-int ReadGyroAngle(int gyro_direct_fd, int16_t *out_angle);
-
-int EncodeDeadReconningPacket(const dead_reconning_packet &packet, char *buffer);
-void SendDeadReconningFrameUDP(int socket, const sockaddr_in &dest, const dead_reconning_packet &frame);
 
 void Usage();
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms);
 
 int main(int argc, char **argv)
 {
-	int socket_udp, gyro_direct_fd;
-	sockaddr_in destination_udp;
+	module_runtime runtime;
 	int port, poll_ms;
 	
 	if( ProcessInput(argc, argv, &port, &poll_ms) )
@@ -82,64 +70,43 @@ int main(int argc, char **argv)
 	
 	ev3dev::large_motor motor_left(ev3dev::OUTPUT_A);
 	ev3dev::large_motor motor_right(ev3dev::OUTPUT_D);
-	ev3dev::i2c_sensor gyro(GYRO_PORT, {"mi-xg1300l"});
+	ev3dev::i2c_sensor gyro(GYRO_PORT, {GYRO_DRIVER});
+	dead_reconning_sensors sensors={&motor_left, &motor_right, -1, 0};
 
-	SetStandardInputNonBlocking();	
+	InitModuleRuntime(&runtime, "ev3dead-reconning", host, port, poll_ms, PACKET_DEAD_RECONNING, DEAD_RECONNING_PACKET_BYTES);
 
-	gyro_direct_fd=InitGyro(&gyro);
-
-	InitNetworkUDP(&socket_udp, &destination_udp, host, port, 0);
+	sensors.gyro_direct_fd=InitGyro(&gyro);
 	
 	InitDriveMotor(&motor_left);
 	InitDriveMotor(&motor_right);
 		
-	MainLoop(socket_udp, destination_udp, motor_left, motor_right, gyro_direct_fd, poll_ms);
+	RunModule<dead_reconning_codec>(&runtime, SampleDeadReconning, &sensors);
+	PrintModuleStats(runtime);
 	
-	close(gyro_direct_fd);
-	CloseNetworkUDP(socket_udp);
+	close(sensors.gyro_direct_fd);
+	CloseModuleRuntime(&runtime);
 
 	printf("ev3dead-reconning: bye\n");
 	
 	return 0;
 }
 
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, const ev3dev::large_motor &motor_left,const ev3dev::large_motor &motor_right, int gyro_direct_fd, int poll_ms)
+ModuleSampleStatus SampleDeadReconning(void *data, dead_reconning_packet *packet)
 {
-	const int BENCHS=INT_MAX;
-		
-	struct dead_reconning_packet frame;
-	int16_t heading;
-	uint64_t start=TimestampUs();
-	int i, enxios=0, elapsed_us, poll_us=1000*poll_ms;
-		
-	for(i=0;i<BENCHS;++i)
-	{	
-		frame.timestamp_us=TimestampUs();
-		frame.position_left=  motor_left.position();
-		frame.position_right=  motor_right.position();
-		
-		if(ReadGyroAngle(gyro_direct_fd, &heading) == -ENXIO)
-		{ //this is workaround for occasional ENXIO problem
-			fprintf(stderr, "ev3dead-reconning: got ENXIO, retrying %d\n", ++enxios);
-			continue; //we need to collect data again, this failure could be time consuming
-		}
-		frame.heading=heading;
-		SendDeadReconningFrameUDP(socket_udp, destination_udp, frame);
-		enxios=0; //part of workaround for occasoinal ENXIO
-
-		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
-			break;
-
-		elapsed_us=(int)(TimestampUs()-frame.timestamp_us);
+	dead_reconning_sensors *sensors=(dead_reconning_sensors*)data;
+
+	packet->timestamp_us=TimestampUs();
+	packet->position_left=sensors->left->position();
+	packet->position_right=sensors->right->position();
 		
-		if( elapsed_us < poll_us )
-			SleepUs(poll_us - elapsed_us);
+	if(ReadGyroAngle(sensors->gyro_direct_fd, &packet->heading) == -ENXIO)
+	{ //this is workaround for occasional ENXIO problem
+		fprintf(stderr, "ev3dead-reconning: got ENXIO, retrying %d\n", ++sensors->enxios);
+		return MODULE_SAMPLE_RETRY; //we need to collect data again, this failure could be time consuming
 	}
-		
-	uint64_t end=TimestampUs();
-	
-	double seconds_elapsed=(end-start)/ 1000000.0L;
-	printf("ev3dead-reconning: average loop %f seconds\n", seconds_elapsed/i);
+	sensors->enxios=0; //part of workaround for occasoinal ENXIO
+
+	return MODULE_SAMPLE_SEND;
 }
 
 void InitDriveMotor(ev3dev::large_motor *m)
@@ -161,62 +128,13 @@ int InitGyro(ev3dev::i2c_sensor *gyro)
 	Sleep(1000);
 	fflush(stdout);
 	
-	snprintf(GYRO_PATH+strlen(GYRO_PATH), GYRO_PATH_MAX, "%d/direct", gyro->device_index());
-	
-	if((fd=open(GYRO_PATH, O_RDONLY))==-1)	
-		DieErrno("ev3dead-reconning: open(GYRO_PATH, O_RDONLY)");
+	fd=OpenGyroDirect(gyro->device_index());
 
 	printf("ev3dead-reconning: gyroscope ready\n");
 
 	return fd;
 }
 
-int ReadGyroAngle(int gyro_direct_fd, int16_t *out_angle)
-{
-	char temp[2];
-	int result;
-	
-	if(lseek(gyro_direct_fd, 0x42, SEEK_SET)==-1)
-		DieErrno("ev3dead-reconning: lseek(gyro_direct_fd, 0x42, SEEK_SET)==-1");
-		
-	if( (result=read(gyro_direct_fd, temp, 2 )) == 2)
-	{
-		memcpy(out_angle, temp, 2);
-		return 0;
-	}	
-		
-	if( (result <= 0 && errno != ENXIO) )
-		DieErrno("ev3dead-reconning: read Gyro failed");
-		
-	if( result == 1)
-		Die("ev3dead-reconning: incomplete I2C read");
-	
-	return -ENXIO;			
-}
-
-int EncodeDeadReconningPacket(const dead_reconning_packet &p, char *data)
-{
-	*((uint64_t*)data) = htobe64(p.timestamp_us);
-	data += sizeof(p.timestamp_us);
-
-	*((uint32_t*)data)= htobe32(p.position_left);
-	data += sizeof(p.position_left);
-
-	*((uint32_t*)data)= htobe32(p.position_right);
-	data += sizeof(p.position_right);
-	
-	*((uint16_t*)data)= htobe16(p.heading);
-	data += sizeof(p.heading);
-	
-	return DEAD_RECONNING_PACKET_BYTES;	
-}
-void SendDeadReconningFrameUDP(int socket, const sockaddr_in &destination, const dead_reconning_packet &frame)
-{
-	static char buffer[DEAD_RECONNING_PACKET_BYTES];
-	EncodeDeadReconningPacket(frame, buffer);
-	SendToUDP(socket, destination, buffer, DEAD_RECONNING_PACKET_BYTES);
-}
-
 void Usage()
 {
 	printf("ev3dead-reconning host port poll_ms\n\n");
@@ -226,26 +144,14 @@ void Usage()
 
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms)
 {
-	long int port, poll_ms;
-		
 	if(argc!=4)
 		return -1;
 		
-	port=strtol(argv[2], NULL, 0);
-	if(port <= 0 || port > 65535)
-	{
-		fprintf(stderr, "ev3dead-reconning: the argument port has to be in range <1, 65535>\n");
+	if(!ParseModuleArgument("ev3dead-reconning", "port", argv[2], 1, 65535, out_port))
 		return -1;
-	}
-	*out_port=port;
 	
-	poll_ms=strtol(argv[3], NULL, 0);
-	if(poll_ms <= 0 || poll_ms > 1000)
-	{
-		fprintf(stderr, "ev3dead-reconning: the argument poll_ms has to be in range <1, 1000>\n");
+	if(!ParseModuleArgument("ev3dead-reconning", "poll_ms", argv[3], 1, 1000, out_poll_ms))
 		return -1;
-	}
-	*out_poll_ms=poll_ms;
 	
 	return 0;
 }
\ No newline at end of file
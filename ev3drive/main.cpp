@@ -20,7 +20,9 @@
   * -reads UDP messages
   * -sets motor speeds accordingly
   * -or sets motor positions and speeds accordingly
+  * -or holds gyroscope heading while driving with commanded speed (local PID)
   * -stops motors on timeout
+  * -monitors motors and stops them locally on stall, reporting it in UDP status message
   *
   * See Usage() function for syntax details (or run the program without arguments)
   */
@@ -28,69 +30,145 @@
 
 #include "shared/misc.h"
 #include "shared/net_udp.h"
+#include "shared/gyro.h"
+#include "shared/packets.h"
 
 #include "ev3dev-lang-cpp/ev3dev.h"
 
 #include <signal.h> //sigaction, sig_atomic_t
-#include <endian.h> //htobe16, htobe32, htobe64
 #include <stdio.h> //printf, etc
+#include <stdlib.h> //abs
+#include <errno.h> //errno, ENXIO
+#include <unistd.h> //close
+#include <poll.h> //poll
 
 using namespace ev3dev;
 
 // GLOBAL VARIABLES
 volatile sig_atomic_t g_finish_program=0;
 
-// temporary control packet, subject to change
-struct drive_packet
+/*
+ * Heading hold constants, those can be tuned
+ * - error is in gyroscope units (0.01 degree)
+ * - correction is in motor speed units (tacho counts per second)
+ * - positive correction speeds up the right motor (turns counterclockwise)
+ */
+const int HEADING_HOLD_PERIOD_MS=10;
+const float HEADING_HOLD_KP=0.1f;
+const float HEADING_HOLD_KI=0.05f; //per (0.01 degree * second) of accumulated error
+const float HEADING_HOLD_KD=0.005f; //per (0.01 degree / second) of rotation
+const float HEADING_HOLD_MAX_CORRECTION=300.0f;
+
+/*
+ * Stall detection constants, those can be tuned
+ * - motor is stalled if the driver reports stalled state
+ * - or if it is driven with high duty cycle but doesn't move for STALL_SAMPLES consecutive samples,
+ *   not during the first STALL_SPINUP_MS of motion (the motor is accelerating from standstill)
+ * - motors are sampled every STALL_MONITOR_PERIOD_MS, after sample that suspects stall
+ *   every STALL_CONFIRM_PERIOD_MS (sysfs reads are not free on EV3, fast sampling only when needed)
+ * - worst case latency from stall onset to stop is STALL_MONITOR_PERIOD_MS for driver reported stall
+ *   and STALL_MONITOR_PERIOD_MS + (STALL_SAMPLES-1)*STALL_CONFIRM_PERIOD_MS (7 ms) otherwise,
+ *   plus one loop wake-up, for stall from the start of motion up to STALL_SPINUP_MS more
+ * - after stall motion commands are ignored for STALL_HOLDOFF_MS (stop commands are not)
+ * - with stall_backoff_ms argument stalled motors back off for that time instead of just stopping,
+ *   in the direction opposite to the one they were pushing in (duty cycle sign), the other motor stops
+ */
+const int STALL_MONITOR_PERIOD_MS=5;
+const int STALL_CONFIRM_PERIOD_MS=2;
+const int STALL_DUTY_CYCLE=80; //percent
+const int STALL_SPEED=30; //tacho counts per second
+const int STALL_SAMPLES=2;
+const int STALL_SPINUP_MS=100;
+const int STALL_HOLDOFF_MS=500;
+const int STALL_BACKOFF_MAX_MS=2000;
+const int STALL_BACKOFF_SPEED=200;
+const char STALL_STATE[]="stalled";
+
+enum Commands {KEEPALIVE=0, SET_SPEED=1, TO_POSITION_WITH_SPEED=2, HEADING_HOLD=3};
+
+enum Status {STATUS_STALLED=1};
+enum StatusMotors {STATUS_MOTOR_LEFT=1, STATUS_MOTOR_RIGHT=2};
+
+// HEADING_HOLD: param1 - speed, param2 - heading (gyroscope units, as in ev3dead-reconning packets)
+struct heading_hold
 {
-	uint64_t timestamp_us;
-	int16_t command;
-	int16_t param1;
-	int16_t param2;	
-	int16_t param3;
-	int16_t param4;	
+	bool active;
+	bool primed;
+	int16_t speed;
+	int16_t heading;
+	int16_t last_heading;
+	float integral;
+	uint64_t last_us;
+	uint64_t next_us;
 };
 
-const int CONTROL_PACKET_BYTES = 18; //8 + 5*2 = 18 bytes
-enum Commands {KEEPALIVE=0, SET_SPEED=1, TO_POSITION_WITH_SPEED=2};
+struct stall_monitor
+{
+	bool active;
+	int samples_left;
+	int samples_right;
+	uint64_t onset_left_us; //the first sample that saw the motor stalled
+	uint64_t onset_right_us;
+	uint64_t next_us;
+	uint64_t spinup_us; //the end of spin-up
+	uint64_t holdoff_us;
+};
 
-void MainLoop(int socket_udp, large_motor *left, large_motor *right);
-void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *right);
+void MainLoop(int socket_udp, int timeout_ms, int backoff_ms, large_motor *left, large_motor *right, int gyro_direct_fd);
+void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *right, int gyro_direct_fd, heading_hold *hold, stall_monitor *monitor);
+bool IsStopCommand(const drive_packet &packet);
+void HeadingHold(heading_hold *hold, large_motor *left, large_motor *right, int gyro_direct_fd, uint64_t now_us);
+
+int MonitorMotors(stall_monitor *monitor, large_motor *left, large_motor *right, uint64_t now_us, uint64_t *onset_us);
+bool MotorStalled(large_motor *m, bool spinup, int *samples, uint64_t *onset_us, uint64_t now_us);
+int ReactToStall(large_motor *left, large_motor *right, int stalled_motors, uint64_t onset_us, int backoff_ms);
+void ReactToStall(large_motor *m, bool stalled, int backoff_ms);
+int MotorDirection(large_motor *m);
 
 void InitMotor(large_motor *m);
+int InitGyro(i2c_sensor *gyro);
 void StopMotors(large_motor *left, large_motor *right);
 
-int RecvDrivePacket(int socket_udp, drive_packet *packet);
-void DecodeDrivePacket(drive_packet *packet, const char *data);
+int RecvDrivePacket(int socket_udp, drive_packet *packet, int timeout_ms, sockaddr_in *source);
+
+void SendDriveStatusPacket(int socket_udp, const sockaddr_in &dest, const drive_status_packet &packet);
+
+int WaitMs(uint64_t now_us, uint64_t deadline_us, int wait_ms);
 
 void Usage();
-void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms);
+void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms, int *backoff_ms);
 void Finish(int signal);
 
 
 int main(int argc, char **argv)
 {			
-	int socket_udp, port, timeout_ms;
+	int socket_udp, port, timeout_ms, backoff_ms, gyro_direct_fd;
 	sockaddr_in destination_udp;
 	large_motor motor_left(OUTPUT_A);
 	large_motor motor_right(OUTPUT_D);
+	i2c_sensor gyro(GYRO_PORT, {GYRO_DRIVER});
 	
-	ProcessArguments(argc, argv, &port, &timeout_ms);
+	ProcessArguments(argc, argv, &port, &timeout_ms, &backoff_ms);
 	SetStandardInputNonBlocking();
+	SetStandardOutputLineBuffered();
 	
 	//init
 	RegisterSignals(Finish);
 
 	InitMotor(&motor_left);
 	InitMotor(&motor_right);
+	gyro_direct_fd=InitGyro(&gyro);
 		
-	InitNetworkUDP(&socket_udp, &destination_udp, NULL, port, timeout_ms);
+	InitNetworkUDP(&socket_udp, &destination_udp, NULL, port, timeout_ms, TRAFFIC_CONTROL);
+	NotifyReady();
 
 	//work
-	MainLoop(socket_udp, &motor_left, &motor_right);
+	MainLoop(socket_udp, timeout_ms, backoff_ms, &motor_left, &motor_right, gyro_direct_fd);
 	
 	//cleanup
 	StopMotors(&motor_left, &motor_right);
+	if(gyro_direct_fd != -1)
+		close(gyro_direct_fd);
 	CloseNetworkUDP(socket_udp);
 		
 	printf("ev3drive: bye\n");
@@ -98,33 +176,110 @@ int main(int argc, char **argv)
 	return 0;
 }
 
-void MainLoop(int socket_udp, large_motor *left, large_motor *right)
+void MainLoop(int socket_udp, int timeout_ms, int backoff_ms, large_motor *left, large_motor *right, int gyro_direct_fd)
 {
-	int status;
+	int status, wait_ms, stalled;
 	drive_packet packet;
+	heading_hold hold={};
+	stall_monitor monitor={};
+	sockaddr_in controller;
+	bool controller_known=false;
+	uint64_t now, onset, last_packet=TimestampUs();
 	
 	while(!g_finish_program)
 	{
-		status=RecvDrivePacket(socket_udp, &packet);
+		now=TimestampUs();
+		wait_ms=WaitMs(now, last_packet + (uint64_t)timeout_ms*1000, timeout_ms);
+
+		if(hold.active) //wake up for the next heading hold step
+			wait_ms=WaitMs(now, hold.next_us, wait_ms);
+		if(monitor.active) //wake up for the next stall monitor sample
+			wait_ms=WaitMs(now, monitor.next_us, wait_ms);
+
+		status=RecvDrivePacket(socket_udp, &packet, wait_ms, &controller);
 		if(status < 0)
 			break;
-		if(status == 0) //timeout
+
+		now=TimestampUs();
+
+		if(status > 0)
+		{
+			last_packet=now;
+			controller_known=true;
+			ProcessMessage(packet, left, right, gyro_direct_fd, &hold, &monitor);
+		}
+		else if(now-last_packet >= (uint64_t)timeout_ms*1000) //timeout
 		{
+			hold.active=false;
+			monitor.active=false;
 			StopMotors(left, right);
 			fprintf(stderr, "ev3drive: waiting for drive controller...\n");
+			last_packet=now;
+		}
+
+		if(monitor.active && now >= monitor.next_us && (stalled=MonitorMotors(&monitor, left, right, now, &onset)) )
+		{
+			hold.active=false;
+			drive_status_packet report={now, STATUS_STALLED, (int16_t)stalled, ReactToStall(left, right, stalled, onset, backoff_ms)};
+			if(controller_known)
+				SendDriveStatusPacket(socket_udp, controller, report);
 		}
-		else
-			ProcessMessage(packet, left, right);
+
+		if(hold.active && now >= hold.next_us)
+			HeadingHold(&hold, left, right, gyro_direct_fd, now);
 
 		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
 			break;
 	}
 }
 
-void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *right)
+void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *right, int gyro_direct_fd, heading_hold *hold, stall_monitor *monitor)
 {	
 	if(packet.command == KEEPALIVE)
 		return;
+
+	if(TimestampUs() < monitor->holdoff_us) //stalled recently, ignore motion commands but not stop (e.g. during back-off)
+	{
+		if(IsStopCommand(packet))
+		{
+			hold->active=false;
+			StopMotors(left, right);
+		}
+		return;
+	}
+
+	//motion command starts monitoring if not already running
+	if(!monitor->active)
+	{
+		monitor->active=true;
+		monitor->samples_left=monitor->samples_right=0;
+		monitor->next_us=TimestampUs() + STALL_MONITOR_PERIOD_MS*1000;
+		monitor->spinup_us=TimestampUs() + STALL_SPINUP_MS*1000;
+	}
+
+	if(packet.command == HEADING_HOLD)
+	{
+		if(gyro_direct_fd == -1)
+		{	//once, the commands come at teleoperation rate and the log is kept by ev3control
+			static bool reported=false;
+			if(!reported)
+				fprintf(stderr, "ev3drive: ignoring heading hold commands, no gyroscope\n");
+			reported=true;
+			return;
+		}
+		if(!hold->active)
+		{ //start new hold, the first control step only primes heading measurement
+			hold->active=true;
+			hold->primed=false;
+			hold->integral=0.0f;
+			hold->next_us=TimestampUs();
+		}
+		hold->speed=packet.param1;
+		hold->heading=packet.param2;
+		return;
+	}
+
+	hold->active=false;
 		
 	if(packet.command == SET_SPEED)
 	{		
@@ -134,6 +289,9 @@ void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *r
 		
 		(l!=0) ? left->run_forever() : left->stop(); 
 		(r!=0) ? right->run_forever() : right->stop(); 
+
+		if(l==0 && r==0)
+			monitor->active=false;
 	}
 	else if(packet.command == TO_POSITION_WITH_SPEED)
 	{
@@ -152,6 +310,161 @@ void ProcessMessage(const drive_packet &packet,large_motor *left, large_motor *r
 	}
 }
 
+// commands that don't drive the motors
+bool IsStopCommand(const drive_packet &packet)
+{
+	//param1 and param2 are the motor speeds of both
+	return (packet.command == SET_SPEED || packet.command == TO_POSITION_WITH_SPEED) && packet.param1 == 0 && packet.param2 == 0;
+}
+
+// PID step, called every HEADING_HOLD_PERIOD_MS while heading hold is active
+void HeadingHold(heading_hold *hold, large_motor *left, large_motor *right, int gyro_direct_fd, uint64_t now_us)
+{
+	int16_t heading;
+
+	hold->next_us += HEADING_HOLD_PERIOD_MS*1000;
+	if(hold->next_us <= now_us) //we are late, don't try to catch up
+		hold->next_us=now_us + HEADING_HOLD_PERIOD_MS*1000;
+
+	if(ReadGyroAngle(gyro_direct_fd, &heading) == -ENXIO)
+	{ //workaround for occasional ENXIO problem, retry in next step
+		fprintf(stderr, "ev3drive: got ENXIO while holding heading\n");
+		return;
+	}
+
+	if(!hold->primed)
+	{
+		hold->primed=true;
+		hold->last_heading=heading;
+		hold->last_us=now_us;
+		return;
+	}
+
+	float dt=(now_us-hold->last_us)/1000000.0f;
+	int error=GyroAngleDifference(hold->heading, heading);
+	int rotation=GyroAngleDifference(heading, hold->last_heading);
+
+	hold->integral += error*dt;
+
+	//anti-windup, integral term alone can't exceed the correction limit
+	if(HEADING_HOLD_KI*hold->integral > HEADING_HOLD_MAX_CORRECTION)
+		hold->integral=HEADING_HOLD_MAX_CORRECTION/HEADING_HOLD_KI;
+	else if(HEADING_HOLD_KI*hold->integral < -HEADING_HOLD_MAX_CORRECTION)
+		hold->integral=-HEADING_HOLD_MAX_CORRECTION/HEADING_HOLD_KI;
+
+	float correction=HEADING_HOLD_KP*error + HEADING_HOLD_KI*hold->integral - HEADING_HOLD_KD*rotation/dt;
+
+	if(correction > HEADING_HOLD_MAX_CORRECTION)
+		correction=HEADING_HOLD_MAX_CORRECTION;
+	else if(correction < -HEADING_HOLD_MAX_CORRECTION)
+		correction=-HEADING_HOLD_MAX_CORRECTION;
+
+	left->set_speed_sp(hold->speed - (int)correction);
+	right->set_speed_sp(hold->speed + (int)correction);
+	left->run_forever();
+	right->run_forever();
+
+	hold->last_heading=heading;
+	hold->last_us=now_us;
+}
+
+// samples motors state, returns bitmask of stalled motors (StatusMotors)
+// and in onset_us the earliest sample that saw stalled motor
+int MonitorMotors(stall_monitor *monitor, large_motor *left, large_motor *right, uint64_t now_us, uint64_t *onset_us)
+{
+	int stalled=0;
+	bool spinup = now_us < monitor->spinup_us;
+
+	monitor->next_us += STALL_MONITOR_PERIOD_MS*1000;
+	if(monitor->next_us <= now_us) //we are late, don't try to catch up
+		monitor->next_us=now_us + STALL_MONITOR_PERIOD_MS*1000;
+
+	*onset_us=now_us;
+
+	if(MotorStalled(left, spinup, &monitor->samples_left, &monitor->onset_left_us, now_us))
+	{
+		stalled |= STATUS_MOTOR_LEFT;
+		*onset_us=monitor->onset_left_us;
+	}
+	if(MotorStalled(right, spinup, &monitor->samples_right, &monitor->onset_right_us, now_us))
+	{
+		stalled |= STATUS_MOTOR_RIGHT;
+		if(monitor->onset_right_us < *onset_us)
+			*onset_us=monitor->onset_right_us;
+	}
+
+	if(!stalled && (monitor->samples_left || monitor->samples_right)) //suspected, confirm sooner
+		monitor->next_us=now_us + STALL_CONFIRM_PERIOD_MS*1000;
+
+	if(stalled)
+	{
+		monitor->active=false;
+		monitor->holdoff_us=now_us + STALL_HOLDOFF_MS*1000;
+	}
+
+	return stalled;
+}
+
+// during spin-up only the driver state is trusted
+bool MotorStalled(large_motor *m, bool spinup, int *samples, uint64_t *onset_us, uint64_t now_us)
+{
+	if(m->state().count(STALL_STATE)) //the driver knows best, no need to read more
+	{
+		if(*samples == 0)
+			*onset_us=now_us;
+		return true;
+	}
+
+	if(!spinup && abs(m->duty_cycle()) >= STALL_DUTY_CYCLE && abs(m->speed()) <= STALL_SPEED)
+	{
+		if(++*samples == 1)
+			*onset_us=now_us;
+	}
+	else
+		*samples=0;
+
+	return *samples >= STALL_SAMPLES;
+}
+
+// stops the motors or backs off the stalled ones, returns reaction time (from stall onset to motors stopped) in microseconds
+int ReactToStall(large_motor *left, large_motor *right, int stalled_motors, uint64_t onset_us, int backoff_ms)
+{
+	ReactToStall(left, stalled_motors & STATUS_MOTOR_LEFT, backoff_ms);
+	ReactToStall(right, stalled_motors & STATUS_MOTOR_RIGHT, backoff_ms);
+
+	int reaction_us=(int)(TimestampUs()-onset_us);
+	fprintf(stderr, "ev3drive: motor stall detected (motors %d), reaction %d us\n", stalled_motors, reaction_us);
+
+	return reaction_us;
+}
+
+void ReactToStall(large_motor *m, bool stalled, int backoff_ms)
+{
+	int direction = stalled && backoff_ms ? MotorDirection(m) : 0;
+
+	if(direction == 0)
+	{
+		m->stop();
+		return;
+	}
+
+	m->set_speed_sp(-direction*STALL_BACKOFF_SPEED);
+	m->set_time_sp(backoff_ms);
+	m->run_timed();
+}
+
+// the direction motor pushes in (the sign of duty cycle), measured speed if there is no duty cycle, 0 if neither
+// speed_sp can't tell it (it is always positive with positional commands)
+int MotorDirection(large_motor *m)
+{
+	int effort=m->duty_cycle();
+
+	if(effort == 0)
+		effort=m->speed();
+
+	return (effort > 0) - (effort < 0);
+}
+
 void InitMotor(large_motor *m)
 {
 	if(!m->connected())
@@ -159,6 +472,18 @@ void InitMotor(large_motor *m)
 	m->set_stop_action(m->stop_action_coast);
 }
 
+// the gyroscope is optional, it is only needed for heading hold
+// it is not reset here (ev3dead-reconning may be using it at the same time)
+int InitGyro(i2c_sensor *gyro)
+{
+	if(!gyro->connected())
+	{
+		printf("ev3drive: no gyroscope, heading hold disabled\n");
+		return -1;
+	}
+	return OpenGyroDirect(gyro->device_index());
+}
+
 void StopMotors(large_motor *left, large_motor *right)
 {
 	left->stop();
@@ -166,48 +491,66 @@ void StopMotors(large_motor *left, large_motor *right)
 }
 
 
-// returns CONTROL_PACKET_BYTES on success  0 on timeout, -1 on error
-int RecvDrivePacket(int socket_udp, drive_packet *packet)
+// returns DRIVE_PACKET_BYTES on success  0 on timeout, -1 on error
+// on success source is the address of the drive controller
+int RecvDrivePacket(int socket_udp, drive_packet *packet, int timeout_ms, sockaddr_in *source)
 {
-	static char buffer[CONTROL_PACKET_BYTES];	
-	int recv_len;
+	static char buffer[DRIVE_PACKET_BYTES];	
+	socklen_t source_length=sizeof(*source);
+	int recv_len, status;
+	struct pollfd pfd={socket_udp, POLLIN, 0};
+
+	if( (status=poll(&pfd, 1, timeout_ms)) == -1)
+	{
+		if(errno==EINTR)
+			return 0; //signal, let the caller check g_finish_program
+		perror("ev3drive: error while waiting for control packet");
+		return -1;
+	}
+	if(status == 0)
+		return 0; //timeout!
 	
-	if((recv_len = recvfrom(socket_udp, buffer, CONTROL_PACKET_BYTES, 0, NULL, NULL)) == -1)	
+	if((recv_len = recvfrom(socket_udp, buffer, DRIVE_PACKET_BYTES, 0, (sockaddr*)source, &source_length)) == -1)	
 	{
 		if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINPROGRESS)
 			return 0; //timeout!
 		perror("ev3drive: error while receiving control packet");
 		return -1;
 	}
-	if(recv_len < CONTROL_PACKET_BYTES)
+	if(recv_len < DRIVE_PACKET_BYTES)
 	{
 		fprintf(stderr, "ev3drive: received incomplete datagram\n");
 		return -1; 
 	}
-	DecodeDrivePacket(packet, buffer);	
+	drive_codec::Decode(packet, buffer);	
 
 	return recv_len;	       
 }
  
-void DecodeDrivePacket(drive_packet *packet, const char *data)
+void SendDriveStatusPacket(int socket_udp, const sockaddr_in &dest, const drive_status_packet &packet)
 {
-	packet->timestamp_us=be64toh(*((uint64_t*)data));
-	packet->command=be16toh(*((int16_t*)(data+8)));
-	packet->param1=be16toh(*((int16_t*)(data+10)));
-	packet->param2=be16toh(*((int16_t*)(data+12)));	
-	packet->param3=be16toh(*((int16_t*)(data+14)));
-	packet->param4=be16toh(*((int16_t*)(data+16)));
+	static char buffer[DRIVE_STATUS_PACKET_BYTES];
+	drive_status_codec::Encode(packet, buffer);
+	SendToUDP(socket_udp, dest, buffer, DRIVE_STATUS_PACKET_BYTES);
+}
+
+// returns time to deadline in ms (rounded up, not less than 0) if it is less than wait_ms, wait_ms otherwise
+int WaitMs(uint64_t now_us, uint64_t deadline_us, int wait_ms)
+{
+	int deadline_ms = deadline_us > now_us ? (int)((deadline_us-now_us+999)/1000) : 0;
+	return deadline_ms < wait_ms ? deadline_ms : wait_ms;
 }
 
 void Usage()
 {
-	printf("ev3drive udp_port timeout_ms\n\n");
+	printf("ev3drive udp_port timeout_ms [stall_backoff_ms]\n\n");
 	printf("examples:\n");
 	printf("./ev3drive 8003 500\n");
+	printf("./ev3drive 8003 500 300\n");
 }
-void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms)
+void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms, int *backoff_ms)
 {
-	if(argc!=3)
+	if(argc!=3 && argc!=4)
 	{
 		Usage();
 		exit(EXIT_SUCCESS);		
@@ -232,6 +575,18 @@ void ProcessArguments(int argc, char **argv, int *port, int *timeout_ms)
 	}
 	
 	*timeout_ms=temp;
+	*backoff_ms=0;
+
+	if(argc == 3)
+		return;
+
+	temp=strtol(argv[3], NULL, 0);
+	if(temp < 0 || temp > STALL_BACKOFF_MAX_MS)
+	{
+		fprintf(stderr, "ev3drive: the argument stall_backoff_ms has to be in range <0, %d>\n", STALL_BACKOFF_MAX_MS);
+		exit(EXIT_SUCCESS);
+	}
+	*backoff_ms=temp;
 }
 void Finish(int signal)
 {
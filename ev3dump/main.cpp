@@ -0,0 +1,170 @@
+/*
+ * ev3dump program
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * This program works on PC (the host that receives data from EV3)
+  *
+  * ev3dump:
+  * -listens on UDP ports of the modules (see lib/shared/stream_consumer.h)
+  * -prints every packet as text line (odometry, dead-reconning, laser, wifi)
+  *
+  * The statistics of the same streams are printed by ev3streamstat
+  *
+  * See Usage() function for syntax details (or run the program without arguments)
+  */
+
+#include "shared/misc.h"
+#include "shared/stream_consumer.h"
+#include "shared/stream_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h> //strtol
+#include <signal.h> //sig_atomic_t
+
+// GLOBAL VARIABLES
+volatile sig_atomic_t g_finish_program=0;
+
+const int RECEIVE_TIMEOUT_MS=100;
+
+// xv11lidar reading: 14 bits distance in mm, bit 15 invalid data, bit 14 strength warning
+const uint16_t LASER_INVALID_FLAG=1 << 15;
+const uint16_t LASER_DISTANCE_MASK=0x3FFF;
+
+void MainLoop(stream_consumer *consumer);
+void PrintDatagram(const stream_datagram &datagram);
+
+void Usage();
+int ProcessInput(int argc, char **argv, int *out_ports);
+void Finish(int signal);
+
+int main(int argc, char **argv)
+{
+	stream_consumer consumer;
+	int ports[STREAM_CONSUMER_MAX_PORTS];
+
+	if( ProcessInput(argc, argv, ports) )
+	{
+		Usage();
+		return 0;
+	}
+
+	SetStandardOutputLineBuffered();
+	RegisterSignals(Finish);
+
+	InitStreamConsumer(&consumer, ports, argc-1, STREAM_CONSUMER_DEFAULT_BATCH);
+
+	MainLoop(&consumer);
+
+	fprintf(stderr, "ev3dump: received %llu invalid %llu receive_calls %llu\n", (unsigned long long)consumer.received,
+		(unsigned long long)consumer.invalid, (unsigned long long)consumer.receive_calls);
+
+	CloseStreamConsumer(&consumer);
+
+	return 0;
+}
+
+void MainLoop(stream_consumer *consumer)
+{
+	int count;
+
+	while(!g_finish_program)
+	{
+		count=ReceiveStreamConsumer(consumer, RECEIVE_TIMEOUT_MS);
+
+		for(int i=0;i<count;++i)
+			PrintDatagram(consumer->datagrams[i]);
+	}
+}
+
+void PrintDatagram(const stream_datagram &datagram)
+{
+	const packet_header &h=datagram.header;
+
+	printf("%s %u seq %u arrival_us %llu ", PacketTypeName(h.type), h.stream, h.sequence, (unsigned long long)datagram.arrival_us);
+
+	switch(h.type)
+	{
+		case PACKET_ODOMETRY:
+		{
+			odometry_view v=StreamView<odometry_view>(datagram);
+			printf("timestamp_us %llu left %d right %d\n", (unsigned long long)v.timestamp_us(), v.position_left(), v.position_right());
+			break;
+		}
+		case PACKET_DEAD_RECONNING:
+		{
+			dead_reconning_view v=StreamView<dead_reconning_view>(datagram);
+			printf("timestamp_us %llu left %d right %d heading %d\n", (unsigned long long)v.timestamp_us(),
+				v.position_left(), v.position_right(), v.heading());
+			break;
+		}
+		case PACKET_WIFI:
+		{
+			wifi_view v=StreamView<wifi_view>(datagram);
+			const uint8_t *b=v.bssid();
+			printf("timestamp_us %llu bssid %02x:%02x:%02x:%02x:%02x:%02x ssid \"%.*s\" signal_dbm %d rx %u tx %u\n",
+				(unsigned long long)v.timestamp_us(), b[0], b[1], b[2], b[3], b[4], b[5], WIFI_SSID_BYTES, v.ssid(),
+				v.signal_dbm(), v.rx_packets(), v.tx_packets());
+			break;
+		}
+		case PACKET_LASER:
+		{
+			laser_view v=StreamView<laser_view>(datagram);
+			printf("timestamp_us %llu rpm %.2f angle %u distances", (unsigned long long)v.timestamp_us(), v.laser_speed()/64.0, v.laser_angle());
+			for(int i=0;i<laser_view::READINGS;++i)
+			{
+				laser_reading r=v.reading(i);
+				if(r.distance_flags & LASER_INVALID_FLAG)
+					printf(" -");
+				else
+					printf(" %u", r.distance_flags & LASER_DISTANCE_MASK);
+			}
+			printf("\n");
+			break;
+		}
+	}
+}
+
+void Usage()
+{
+	printf("ev3dump port [port ...]\n\n");
+	printf("examples:\n");
+	printf("./ev3dump 8005\n");
+	printf("./ev3dump 8005 8006 8007 > packets.txt\n");
+}
+
+int ProcessInput(int argc, char **argv, int *out_ports)
+{
+	long int port;
+
+	if(argc < 2 || argc-1 > STREAM_CONSUMER_MAX_PORTS)
+		return -1;
+
+	for(int i=1;i<argc;++i)
+	{
+		port=strtol(argv[i], NULL, 0);
+		if(port <= 0 || port > 65535)
+		{
+			fprintf(stderr, "ev3dump: the argument port has to be in range <1, 65535>\n");
+			return -1;
+		}
+		out_ports[i-1]=port;
+	}
+
+	return 0;
+}
+
+void Finish(int signal)
+{
+	g_finish_program=1;
+}
@@ -20,62 +20,48 @@
   * -reads lidar data from tty
   * -timestamps the data
   * -sends the above data in UDP messages
+  * -publishes the same messages on shared-memory bus (stream ev3laser-<port>)
   *
   * See Usage() function for syntax details (or run the program without arguments)
   */
 
 #include "shared/misc.h"
-#include "shared/net_udp.h"
+#include "shared/module_runtime.h"
+#include "shared/packets.h"
 
 #include "xv11lidar/xv11lidar.h"
 
 #include "ev3dev-lang-cpp/ev3dev.h"
 
-#include <limits.h> //INT_MAX
 #include <stdio.h>
-#include <signal.h> //sigaction
-#include <string.h> //memset
-#include <endian.h> //htobe16, htobe32, htobe64
-
-// GLOBAL VARIABLES
-volatile sig_atomic_t g_finish_program=0;
+#include <string.h> //memcpy
 
 const int TTY_PATH_MAX=100;
-const int LASER_FRAMES_PER_READ=10;
 const int LASER_FRAMES_PER_ROTATION=90;
 const uint64_t MICROSECONDS_PER_MINUTE=60000000;
 const uint64_t LASER_SPEED_FIXED_POINT_PRECISION=64;
 
-struct laser_packet
+static_assert(sizeof(xv11lidar_reading) == sizeof(laser_reading), "laser_reading doesn't match xv11lidar_reading");
+
+struct laser_sensor
 {
-	uint64_t timestamp_us;
-	uint16_t laser_speed; //fixed point, 6 bits precision, divide by 64.0 to get floating point 
-	uint16_t laser_angle; //angle of laser_readings[0]
-	xv11lidar_reading laser_readings[4*LASER_FRAMES_PER_READ];
+	xv11lidar *laser;
+	uint64_t last_timestamp; //when the previous read finished
+	uint16_t laser_speed; //of the last packet
 };
 
-const int LASER_PACKET_BYTES = 12 + 16 * LASER_FRAMES_PER_READ;
-
-void MainLoop(int socket_udp, const struct sockaddr_in &address, struct xv11lidar *laser, ev3dev::dc_motor *laser_motor);
+// reads block until lidar sends LASER_FRAMES_PER_READ frames, the module samples without timer
+ModuleSampleStatus SampleLaser(void *data, laser_packet *packet);
 
 int ProcessInput(int argc, char **argv, int *port, int *duty_cycle, int *crc_tolerance_pct);
 void Usage();
-void RegisterSignals();
-void Finish(int signal);
 
 void InitLaserMotor(ev3dev::dc_motor *m, int duty_cycle);
 
-int EncodeLaserReading(const xv11lidar_reading *reading, char *data);
-int EncodeLaserFrame(const xv11lidar_frame *frame, char *data);
-int EncodeLaserPacket(const laser_packet &p, char *data);
-
-void SendLaserPacket(int socket_udp, const sockaddr_in &dst, const laser_packet &packet);
-
 int main(int argc, char **argv)
 {
-	int socket_udp;
-	struct sockaddr_in address_udp;
-	struct xv11lidar *laser;    
+	module_runtime runtime;
+	laser_sensor sensor={};
 	int port, duty_cycle, crc_tolerance_pct;
 	
 	if( ProcessInput(argc, argv, &port, &duty_cycle, &crc_tolerance_pct) )
@@ -83,7 +69,6 @@ int main(int argc, char **argv)
 		Usage();
 		return 0;
 	}
-	SetStandardInputNonBlocking();
 	
 	const char *laser_tty=argv[1];
 	const char *motor_port=argv[2];
@@ -91,110 +76,77 @@ int main(int argc, char **argv)
 			
 	ev3dev::dc_motor motor(motor_port);
 
-	RegisterSignals(Finish);
-	InitNetworkUDP(&socket_udp, &address_udp, host, port, 0);
+	InitModuleRuntime(&runtime, "ev3laser", host, port, 0, PACKET_LASER, LASER_PACKET_BYTES);
 	InitLaserMotor(&motor, duty_cycle);
 	 
- 	if( (laser=xv11lidar_init(laser_tty, LASER_FRAMES_PER_READ, crc_tolerance_pct)) == NULL )
-	{
+ 	if( (sensor.laser=xv11lidar_init(laser_tty, LASER_FRAMES_PER_READ, crc_tolerance_pct)) == NULL )
 		fprintf(stderr, "ev3laser: init laser failed\n");
-		g_finish_program=true;
+	else
+	{
+		sensor.last_timestamp=TimestampUs();
+		RunModule<laser_codec>(&runtime, SampleLaser, &sensor);
+		PrintModuleStats(runtime);
+		printf("ev3laser: last laser rpm %f\n", sensor.laser_speed/64.0);
 	}
 
-	MainLoop(socket_udp, address_udp, laser, &motor);
-
-	xv11lidar_close(laser);
+	xv11lidar_close(sensor.laser);
 	motor.stop();
-	CloseNetworkUDP(socket_udp);
+	CloseModuleRuntime(&runtime);
 
 	printf("ev3laser: bye\n");
 
 	return 0;	
 }
 
-void MainLoop(int socket_udp, const struct sockaddr_in &address, struct xv11lidar *laser, ev3dev::dc_motor *laser_motor)
+ModuleSampleStatus SampleLaser(void *data, laser_packet *packet)
 {
-	struct laser_packet packet;
-	struct xv11lidar_frame frames[LASER_FRAMES_PER_READ];
-	uint64_t last_timestamp;
+	laser_sensor *sensor=(laser_sensor*)data;
+	xv11lidar_frame frames[LASER_FRAMES_PER_READ];
 	uint32_t rpm, sane_frames;
-	int status, counter, benchs=INT_MAX;
-	
-	uint64_t start=TimestampUs();	
-	last_timestamp=start;
+	int status;
+
+	packet->timestamp_us=sensor->last_timestamp;
 		
-	for(counter=0;!g_finish_program && counter<benchs;++counter)
+	if( (status=xv11lidar_read(sensor->laser, frames)) != XV11LIDAR_SUCCESS )
 	{
-		packet.timestamp_us=last_timestamp;
-		
-		if( (status=xv11lidar_read(laser, frames)) != XV11LIDAR_SUCCESS )
-		{
-			fprintf(stderr, "ev3laser: ReadLaser failed with status %d\n", status);
-			break;
-		}
-		// when read is finished, next read proceeds
-		last_timestamp=TimestampUs(); 
+		fprintf(stderr, "ev3laser: ReadLaser failed with status %d\n", status);
+		return MODULE_SAMPLE_STOP;
+	}
+	// when read is finished, next read proceeds
+	sensor->last_timestamp=TimestampUs(); 
 		
-		packet.laser_angle=(frames[0].index-0xA0)*4;
+	packet->laser_angle=(frames[0].index-0xA0)*4;
 		
-		rpm=sane_frames=0;
+	rpm=sane_frames=0;
 	
-		for(int i=0;i<LASER_FRAMES_PER_READ;++i)
+	for(int i=0;i<LASER_FRAMES_PER_READ;++i)
+	{
+		memcpy(packet->laser_readings+4*i, frames[i].readings, 4*sizeof(xv11lidar_reading));
+		if(frames[i].readings[0].invalid_data == 0 || frames[i].readings[0].distance != XV11LIDAR_CRC_FAILURE)
 		{
-			memcpy(packet.laser_readings+4*i, frames[i].readings, 4*sizeof(xv11lidar_reading));
-			if(frames[i].readings[0].invalid_data == 0 || frames[i].readings[0].distance != XV11LIDAR_CRC_FAILURE)
-			{
-				++sane_frames;
-				rpm+=frames[i].speed;
-			}
+			++sane_frames;
+			rpm+=frames[i].speed;
 		}
-		
-		packet.laser_speed=rpm/sane_frames;
-	 
-		SendLaserPacket(socket_udp, address, packet);
-		
-		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
-			break;
 	}
-	
-	uint64_t end=TimestampUs();
-	double seconds_elapsed=(end-start)/ 1000000.0L;
-	
-	printf("ev3laser: avg loop %f seconds\n", seconds_elapsed/counter);
-	printf("ev3laser: last laser rpm %f\n", packet.laser_speed/64.0);
-}
+		
+	packet->laser_speed=sensor->laser_speed=rpm/sane_frames;
 
+	return MODULE_SAMPLE_SEND;
+}
 
 int ProcessInput(int argc, char **argv, int *out_port, int *duty_cycle, int *crc_tolerance_pct)
 {
-	long int port, duty, crc;
-				
 	if(argc!=7)
 		return -1;
 		
-	port=strtol(argv[4], NULL, 0);
-	if(port <= 0 || port > 65535)
-	{
-		fprintf(stderr, "ev3laser: the argument port has to be in range <1, 65535>\n");
+	if(!ParseModuleArgument("ev3laser", "port", argv[4], 1, 65535, out_port))
 		return -1;
-	}
-	*out_port=port;
 
-	duty=strtol(argv[5], NULL, 0);
-	if(duty <= 0 || duty > 100)
-	{
-		fprintf(stderr, "ev3laser: the argument duty_cycle has to be in range <0, 100>\n");
+	if(!ParseModuleArgument("ev3laser", "duty_cycle", argv[5], 1, 100, duty_cycle))
 		return -1;
-	}
-	*duty_cycle=duty;
 
-	crc=strtol(argv[6], NULL, 0);
-	if(crc < 0 || crc > 100)
-	{
-		fprintf(stderr, "ev3laser: the argument crc_tolerance_pct has to be in range <0, 100>\n");
+	if(!ParseModuleArgument("ev3laser", "crc_tolerance_pct", argv[6], 0, 100, crc_tolerance_pct))
 		return -1;
-	}
-	*crc_tolerance_pct=crc;
 		
 	return 0;
 }
@@ -206,11 +158,6 @@ void Usage()
 	printf("./ev3laser /dev/tty_in1 outC 192.168.0.103 8001 -40 10\n");
 }
 
-void Finish(int signal)
-{
-	g_finish_program=1;
-}
-
 void InitLaserMotor(ev3dev::dc_motor *m, int duty_cycle)
 {
 	if(!m->connected())
@@ -219,61 +166,4 @@ void InitLaserMotor(ev3dev::dc_motor *m, int duty_cycle)
 
 	m->set_duty_cycle_sp(duty_cycle);
 	m->run_direct();
-}
-
- 
-int EncodeLaserReading(const xv11lidar_reading *reading, char *data)
-{
-	const uint16_t *reading_as_u16=(uint16_t*)reading;
-	
-	*((uint16_t*)data)=htobe16(reading_as_u16[0]);
-	data += sizeof(uint16_t);
-	*((uint16_t*)data)=htobe16(reading_as_u16[1]);
-	data += sizeof(uint16_t);
-	
-	return 4;
-}
-
-int EncodeLaserFrame(const xv11lidar_frame *frame, char *data)
-{
-	*data=frame->start;
-	++data;
-
-	*data=frame->index;
-	++data;
-	
-	*((uint16_t*)data)= htobe16(frame->speed);
-	data += sizeof(frame->speed);
-	
-	for(int i=0;i<4;++i)
-		data += EncodeLaserReading(frame->readings+i, data);
-		
-	*((uint16_t*)data)= htobe16(frame->checksum);
-	data += sizeof(frame->speed);
-	
-	return 22;// 1 + 1 + 2 + 4*4 + 2;
-}
-
-int EncodeLaserPacket(const laser_packet &p, char *data)
-{	
-	*((uint64_t*)data) = htobe64(p.timestamp_us);
-	data += sizeof(p.timestamp_us);
-
-	*((uint16_t*)data)= htobe16(p.laser_speed);
-	data += sizeof(p.laser_speed);
-	
-	*((uint16_t*)data)= htobe16(p.laser_angle);
-	data += sizeof(p.laser_angle);
-	
-	for(int i=0;i<4*LASER_FRAMES_PER_READ; ++i)
-		data += EncodeLaserReading(p.laser_readings+i, data);
-		
-	return 12 + 16 * LASER_FRAMES_PER_READ; //8 + 2 + 2 +  4*4 * LASER_FRAMES_PER_READ  	
-}
-
-void SendLaserPacket(int socket_udp, const sockaddr_in &dst, const laser_packet &packet)
-{
-	static char buffer[LASER_PACKET_BYTES];
-	EncodeLaserPacket(packet, buffer);
-	SendToUDP(socket_udp, dst, buffer, LASER_PACKET_BYTES);
 }
\ No newline at end of file
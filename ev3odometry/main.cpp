@@ -19,6 +19,7 @@
   * -reads 2 motors positions
   * -timestamps the data
   * -sends the above data in UDP messages
+  * -publishes the same messages on shared-memory bus (stream ev3odometry-<port>)
   * 
   * Preconditions (for EV3/ev3dev):
   * -two tacho motors connected to ports A, D
@@ -27,40 +28,29 @@
   */
 
 #include "shared/misc.h"
-#include "shared/net_udp.h"
+#include "shared/module_runtime.h"
+#include "shared/packets.h"
 
 #include "ev3dev-lang-cpp/ev3dev.h"
 
 #include <stdio.h>
-#include <endian.h> //htobe16, htobe32, htobe64
-#include <limits.h> //INT_MAX
 
-//odometry packets are binary compatible with dead-reconning packets (reserved field for heading)
-struct odometry_packet
+struct odometry_motors
 {
-	uint64_t timestamp_us;
-	int32_t position_left;
-	int32_t position_right;
-	int16_t reserved1;
+	ev3dev::large_motor *left;
+	ev3dev::large_motor *right;
 };
 
-const int ODOMETRY_PACKET_BYTES=18; //2 + 2*4 + 8
-
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, const ev3dev::large_motor &left,const ev3dev::large_motor &right, int poll_ms);
+ModuleSampleStatus SampleOdometry(void *data, odometry_packet *packet);
 
 void InitDriveMotor(ev3dev::large_motor *m);
 
-int EncodeOdometryPacket(const odometry_packet &packet, char *buffer);
-void SendOdometryFrameUDP(int socket, const sockaddr_in &dest, const odometry_packet &frame);
-
 void Usage();
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms);
 
 int main(int argc, char **argv)
 {
-	int socket_udp;
-	sockaddr_in destination_udp;
-	
+	module_runtime runtime;
 	int port, poll_ms;
 		
 	if( ProcessInput(argc, argv, &port, &poll_ms) )
@@ -72,50 +62,32 @@ int main(int argc, char **argv)
 	
 	ev3dev::large_motor motor_left(ev3dev::OUTPUT_A);
 	ev3dev::large_motor motor_right(ev3dev::OUTPUT_D);
+	odometry_motors motors={&motor_left, &motor_right};
 
-	SetStandardInputNonBlocking();	
-
-	InitNetworkUDP(&socket_udp, &destination_udp, host, port, 0);
+	InitModuleRuntime(&runtime, "ev3odometry", host, port, poll_ms, PACKET_ODOMETRY, ODOMETRY_PACKET_BYTES);
 	
 	InitDriveMotor(&motor_left);
 	InitDriveMotor(&motor_right);
 		
-	MainLoop(socket_udp, destination_udp, motor_left, motor_right, poll_ms);
+	RunModule<odometry_codec>(&runtime, SampleOdometry, &motors);
+	PrintModuleStats(runtime);
 	
-	CloseNetworkUDP(socket_udp);
+	CloseModuleRuntime(&runtime);
 
 	printf("ev3odemtry: bye\n");
 	
 	return 0;
 }
 
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, const ev3dev::large_motor &motor_left,const ev3dev::large_motor &motor_right, int poll_ms)
+ModuleSampleStatus SampleOdometry(void *data, odometry_packet *packet)
 {
-	const int BENCHS=INT_MAX;
-		
-	struct odometry_packet frame;
-	uint64_t start=TimestampUs();
-	int i, elapsed_us, poll_us=1000*poll_ms;
-	
-	for(i=0;i<BENCHS;++i)
-	{
-		frame.timestamp_us=TimestampUs();	
-		frame.position_left=  motor_left.position();
-		frame.position_right=  motor_right.position();
-		SendOdometryFrameUDP(socket_udp, destination_udp, frame);
+	odometry_motors *motors=(odometry_motors*)data;
 
-		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
-			break;
-		
-		elapsed_us=(int)(TimestampUs()-frame.timestamp_us);
-		
-		if( elapsed_us < poll_us )
-			SleepUs(poll_us - elapsed_us);
-	}
-		
-	uint64_t end=TimestampUs();
-	double seconds_elapsed=(end-start)/ 1000000.0L;
-	printf("ev3odometry: average loop %f seconds\n", seconds_elapsed/i);
+	packet->timestamp_us=TimestampUs();
+	packet->position_left=motors->left->position();
+	packet->position_right=motors->right->position();
+
+	return MODULE_SAMPLE_SEND;
 }
 
 void InitDriveMotor(ev3dev::large_motor *m)
@@ -124,29 +96,6 @@ void InitDriveMotor(ev3dev::large_motor *m)
 		Die("ev3odometry: motor not connected");
 }
 
-int EncodeOdometryPacket(const odometry_packet &p, char *data)
-{
-	*((uint64_t*)data) = htobe64(p.timestamp_us);
-	data += sizeof(p.timestamp_us);
-
-	*((uint32_t*)data)= htobe32(p.position_left);
-	data += sizeof(p.position_left);
-
-	*((uint32_t*)data)= htobe32(p.position_right);
-	data += sizeof(p.position_right);
-	
-	*((uint16_t*)data)= htobe16(0);
-	data += sizeof(p.reserved1);
-		
-	return ODOMETRY_PACKET_BYTES;	
-}
-void SendOdometryFrameUDP(int socket, const sockaddr_in &destination, const odometry_packet &frame)
-{
-	static char buffer[ODOMETRY_PACKET_BYTES];
-	EncodeOdometryPacket(frame, buffer);
-	SendToUDP(socket, destination, buffer, ODOMETRY_PACKET_BYTES);
-}
-
 void Usage()
 {
 	printf("ev3odemtry host port poll_ms\n\n");
@@ -156,26 +105,14 @@ void Usage()
 
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms)
 {
-	long int port, poll_ms;
-			
 	if(argc!=4)
 		return -1;
 		
-	port=strtol(argv[2], NULL, 0);
-	if(port <= 0 || port > 65535)
-	{
-		fprintf(stderr, "ev3odometry: the argument port has to be in range <1, 65535>\n");
+	if(!ParseModuleArgument("ev3odometry", "port", argv[2], 1, 65535, out_port))
 		return -1;
-	}
-	*out_port=port;
 
-	poll_ms=strtol(argv[3], NULL, 0);
-	if(poll_ms <= 0 || poll_ms > 1000)
-	{
-		fprintf(stderr, "ev3odometry: the argument poll_ms has to be in range <1, 1000>\n");
+	if(!ParseModuleArgument("ev3odometry", "poll_ms", argv[3], 1, 1000, out_poll_ms))
 		return -1;
-	}
-	*out_poll_ms=poll_ms;
 	
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,240 @@
+/*
+ * ev3recorder program
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * This program was created for EV3 with ev3dev OS
+  *
+  * ev3recorder:
+  * -finds shared-memory bus streams of the modules (/dev/shm/ev3-*), also the ones started later
+  * -reads every packet the modules publish
+  * -timestamps the packets and appends them to flight log file (see lib/shared/flight_log.h)
+  *
+  * The modules never wait for the recorder, if it doesn't keep up the lost packets are counted in the log.
+  *
+  * See Usage() function for syntax details (or run the program without arguments)
+  */
+
+#include "shared/misc.h"
+#include "shared/shm_bus.h"
+#include "shared/flight_log.h"
+
+#include <stdio.h>
+#include <stdlib.h> //strtol
+#include <signal.h> //sig_atomic_t
+#include <string.h> //strncmp, strcmp
+#include <dirent.h> //opendir, readdir
+
+// GLOBAL VARIABLES
+volatile sig_atomic_t g_finish_program=0;
+
+const char SHM_DIR[]="/dev/shm";
+const char STREAM_PREFIX[]="ev3-";
+const int SCAN_STREAMS_MS=250; //how often to look for new streams (less than ring of 64 packets at 10 ms)
+const int SYNC_MS=1000; //how often to write the log to disk (at most that much is lost on power failure)
+
+struct recorder_stream
+{
+	shm_bus bus; //header is NULL if the stream can't be recorded
+	int source; //in flight log
+};
+
+void MainLoop(flight_log *log, int poll_ms);
+
+void ScanStreams(flight_log *log, recorder_stream *streams, int *streams_count);
+bool RecordStreams(flight_log *log, recorder_stream *streams, int streams_count);
+
+void Usage();
+int ProcessInput(int argc, char **argv, int *out_size_mb, int *out_poll_ms);
+void Finish(int signal);
+
+int main(int argc, char **argv)
+{
+	flight_log log;
+	int size_mb, poll_ms;
+
+	if( ProcessInput(argc, argv, &size_mb, &poll_ms) )
+	{
+		Usage();
+		return 0;
+	}
+	const char *path=argv[1];
+
+	SetStandardInputNonBlocking();
+	SetStandardOutputLineBuffered();
+	RegisterSignals(Finish);
+
+	InitFlightLogWriter(&log, path, (uint32_t)size_mb*1024*1024);
+	NotifyReady();
+
+	MainLoop(&log, poll_ms);
+
+	for(uint32_t i=0;i<log.header->sources;++i)
+		printf("ev3recorder: %s records %u lost %u\n", log.header->source[i].name, log.header->source[i].records, log.header->source[i].lost);
+
+	CloseFlightLog(&log);
+
+	printf("ev3recorder: bye\n");
+
+	return 0;
+}
+
+void MainLoop(flight_log *log, int poll_ms)
+{
+	recorder_stream streams[FLIGHT_LOG_MAX_SOURCES];
+	int streams_count=0;
+	uint64_t now, next_scan_us=0, next_sync_us=TimestampUs() + SYNC_MS*1000;
+	int elapsed_us, poll_us=1000*poll_ms;
+
+	while(!g_finish_program)
+	{
+		now=TimestampUs();
+
+		if(now >= next_scan_us)
+		{
+			ScanStreams(log, streams, &streams_count);
+			next_scan_us=now + SCAN_STREAMS_MS*1000;
+		}
+
+		if(!RecordStreams(log, streams, streams_count))
+		{
+			printf("ev3recorder: log file full\n");
+			break;
+		}
+
+		if(now >= next_sync_us)
+		{
+			SyncFlightLog(log);
+			next_sync_us=now + SYNC_MS*1000;
+		}
+
+		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
+			break;
+
+		elapsed_us=(int)(TimestampUs()-now);
+
+		if( elapsed_us < poll_us )
+			SleepUs(poll_us - elapsed_us);
+	}
+
+	for(int i=0;i<streams_count;++i)
+		if(streams[i].bus.header)
+			CloseShmBus(&streams[i].bus);
+}
+
+void ScanStreams(flight_log *log, recorder_stream *streams, int *streams_count)
+{
+	const int PREFIX_LENGTH=sizeof(STREAM_PREFIX)-1;
+	DIR *dir;
+	dirent *entry;
+
+	if( (dir=opendir(SHM_DIR)) == NULL)
+		DieErrno("ev3recorder: opendir failed");
+
+	while( (entry=readdir(dir)) != NULL )
+	{
+		const char *name=entry->d_name + PREFIX_LENGTH;
+		int i;
+
+		if(strncmp(entry->d_name, STREAM_PREFIX, PREFIX_LENGTH) != 0)
+			continue;
+
+		for(i=0;i<*streams_count;++i)
+			if(strcmp(log->header->source[streams[i].source].name, name) == 0)
+				break;
+
+		if(i < *streams_count || *streams_count == FLIGHT_LOG_MAX_SOURCES)
+			continue;
+
+		recorder_stream *stream=streams + *streams_count;
+
+		if(!InitShmBusReader(&stream->bus, name)) //not initialized by the writer yet
+			continue;
+
+		if( (stream->source=AddFlightLogSource(log, name)) == -1)
+			Die("ev3recorder: too many sources"); //never, the same limit as streams
+
+		if(ShmBusSlotBytes(stream->bus) > FLIGHT_LOG_MAX_PACKET_BYTES)
+		{
+			fprintf(stderr, "ev3recorder: stream %s messages too long, not recording\n", name);
+			CloseShmBus(&stream->bus);
+		}
+		else
+			printf("ev3recorder: recording stream %s\n", name);
+
+		++*streams_count;
+	}
+
+	if(closedir(dir) == -1)
+		DieErrno("ev3recorder: closedir failed");
+}
+
+bool RecordStreams(flight_log *log, recorder_stream *streams, int streams_count)
+{
+	static char buffer[FLIGHT_LOG_MAX_PACKET_BYTES];
+	int length;
+
+	for(int i=0;i<streams_count;++i)
+	{
+		recorder_stream *stream=streams+i;
+
+		if(stream->bus.header == NULL)
+			continue;
+
+		uint64_t timestamp_us=TimestampUs();
+		uint32_t *lost=&log->header->source[stream->source].lost;
+
+		while( (length=ReadShmBus(&stream->bus, buffer, lost)) > 0 )
+			if(!AppendFlightLog(log, timestamp_us, stream->source, buffer, length))
+				return false;
+	}
+	return true;
+}
+
+void Usage()
+{
+	printf("ev3recorder file size_mb poll_ms\n\n");
+	printf("examples:\n");
+	printf("./ev3recorder /home/robot/run.ev3log 64 10\n");
+}
+
+int ProcessInput(int argc, char **argv, int *out_size_mb, int *out_poll_ms)
+{
+	long int size_mb, poll_ms;
+
+	if(argc!=4)
+		return -1;
+
+	size_mb=strtol(argv[2], NULL, 0);
+	if(size_mb <= 0 || size_mb > 1024)
+	{
+		fprintf(stderr, "ev3recorder: the argument size_mb has to be in range <1, 1024>\n");
+		return -1;
+	}
+	*out_size_mb=size_mb;
+
+	poll_ms=strtol(argv[3], NULL, 0);
+	if(poll_ms <= 0 || poll_ms > 1000)
+	{
+		fprintf(stderr, "ev3recorder: the argument poll_ms has to be in range <1, 1000>\n");
+		return -1;
+	}
+	*out_poll_ms=poll_ms;
+
+	return 0;
+}
+
+void Finish(int signal)
+{
+	g_finish_program=1;
+}
@@ -0,0 +1,290 @@
+/*
+ * ev3replay program
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * This program works on EV3 and PC
+  *
+  * ev3replay:
+  * -reads flight log recorded by ev3recorder (see lib/shared/flight_log.h)
+  * -sends the recorded packets in UDP messages to host, each source on its original port (<module>-<port>)
+  * -keeps the original timing, N times faster timing or sends as fast as possible
+  * -reports achieved packet rate and timing error
+  *
+  * The timing is of packets acquisition (timestamp_us of payload after the common header),
+  * not of recording (ev3recorder drains the bus periodically, the packets of one poll have the same
+  * record timestamp). Packets without header are timed by the record timestamp.
+  * The sources are merged in timestamp order, each source is read by its own cursor
+  * and the next packets of the sources are kept in min-heap (a stream recorded late is not sent in bursts).
+  *
+  * Packets are sent as recorded (with robot timestamps of the recording).
+  *
+  * See Usage() function for syntax details (or run the program without arguments)
+  */
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/flight_log.h"
+#include "shared/stream_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h> //strtol
+#include <signal.h> //sig_atomic_t
+#include <string.h> //strrchr
+
+#include <algorithm> //make_heap, push_heap, pop_heap
+
+// GLOBAL VARIABLES
+volatile sig_atomic_t g_finish_program=0;
+
+const int MAX_SLEEP_US=100000; //check g_finish_program at least that often
+
+struct replay_source
+{
+	bool send; //false if the port can't be found in the source name
+	sockaddr_in destination;
+	flight_log_cursor cursor; //past the next packet of the source
+	uint32_t packets;
+};
+
+// the next packet of source, min-heap by packet_us
+struct replay_head
+{
+	uint64_t packet_us;
+	int source;
+	const flight_log_record *record;
+};
+
+struct replay_stats
+{
+	uint32_t packets;
+	uint64_t elapsed_us;
+	uint64_t error_sum_us; //absolute
+	uint32_t error_max_us;
+};
+
+void InitSources(const flight_log &log, const char *host, replay_source *sources);
+void Replay(const flight_log &log, int socket_udp, replay_source *sources, int speed, int start_ms, replay_stats *stats);
+// advances the cursor of source past its next record, NULL at the end of log
+const flight_log_record *ReadSourceRecord(const flight_log &log, int source, replay_source *sources);
+bool LaterPacket(const replay_head &a, const replay_head &b);
+uint64_t PacketTimestampUs(const flight_log_record &record);
+
+void Usage();
+int ProcessInput(int argc, char **argv, int *out_speed, int *out_start_ms);
+void Finish(int signal);
+
+int main(int argc, char **argv)
+{
+	flight_log log;
+	replay_source sources[FLIGHT_LOG_MAX_SOURCES];
+	replay_stats stats={};
+	int socket_udp;
+	int speed, start_ms;
+
+	if( ProcessInput(argc, argv, &speed, &start_ms) )
+	{
+		Usage();
+		return 0;
+	}
+	const char *path=argv[1];
+	const char *host=argv[2];
+
+	RegisterSignals(Finish);
+
+	if(!InitFlightLogReader(&log, path))
+		Die("ev3replay: the file is not ev3recorder flight log");
+
+	InitNetworkUDP(&socket_udp, NULL, NULL, 0, 0, TRAFFIC_DEFAULT);
+	InitSources(log, host, sources);
+
+	Replay(log, socket_udp, sources, speed, start_ms, &stats);
+
+	for(uint32_t i=0;i<log.header->sources;++i)
+		if(sources[i].send)
+			printf("ev3replay: %s packets %u\n", log.header->source[i].name, sources[i].packets);
+
+	printf("ev3replay: %u packets in %f seconds, %f packets/s\n", stats.packets, stats.elapsed_us/1000000.0, stats.elapsed_us ? stats.packets*1000000.0/stats.elapsed_us : 0.0);
+
+	if(speed > 0 && stats.packets > 0)
+		printf("ev3replay: timing error avg %llu us max %u us\n", (unsigned long long)(stats.error_sum_us/stats.packets), stats.error_max_us);
+
+	CloseNetworkUDP(socket_udp);
+	CloseFlightLog(&log);
+
+	printf("ev3replay: bye\n");
+
+	return 0;
+}
+
+void InitSources(const flight_log &log, const char *host, replay_source *sources)
+{
+	for(uint32_t i=0;i<log.header->sources;++i)
+	{
+		const char *name=log.header->source[i].name;
+		const char *dash=strrchr(name, '-');
+		long port = dash ? strtol(dash+1, NULL, 10) : 0;
+
+		sources[i].packets=0;
+		sources[i].send = port > 0 && port <= 65535;
+
+		if(sources[i].send)
+			InitDestinationUDP(&sources[i].destination, host, port);
+		else
+			fprintf(stderr, "ev3replay: no port in source %s, skipping\n", name);
+	}
+}
+
+void Replay(const flight_log &log, int socket_udp, replay_source *sources, int speed, int start_ms, replay_stats *stats)
+{
+	flight_log_cursor cursor;
+	const flight_log_record *record;
+	replay_head heads[FLIGHT_LOG_MAX_SOURCES];
+	uint64_t first_packet_us, packet_us, start_us, due_us, now;
+	int64_t error_us;
+	int count=0;
+
+	if(log.header->chunks_used == 0)
+		return;
+
+	SeekFlightLog(log, log.index[0] + (uint64_t)start_ms*1000, &cursor);
+
+	for(uint32_t i=0;i<log.header->sources;++i)
+	{
+		if(!sources[i].send)
+			continue;
+
+		sources[i].cursor=cursor;
+
+		if( (record=ReadSourceRecord(log, i, sources)) != NULL )
+			heads[count++]={PacketTimestampUs(*record), (int)i, record};
+	}
+
+	std::make_heap(heads, heads+count, LaterPacket);
+
+	start_us=TimestampUs();
+	first_packet_us = count ? heads[0].packet_us : 0;
+
+	while(!g_finish_program && count > 0)
+	{
+		std::pop_heap(heads, heads+count, LaterPacket);
+
+		replay_head &head=heads[count-1];
+		replay_source *source=sources + head.source;
+
+		record=head.record;
+		packet_us=head.packet_us;
+
+		//the timestamps of source may go back (e.g. module restarted with other clock), such packets are due now
+		due_us=start_us + (packet_us > first_packet_us ? packet_us - first_packet_us : 0) / (speed > 0 ? speed : 1);
+
+		while(speed > 0 && !g_finish_program && (now=TimestampUs()) < due_us)
+			SleepUs(due_us - now < (uint64_t)MAX_SLEEP_US ? due_us - now : MAX_SLEEP_US);
+
+		SendToUDP(socket_udp, source->destination, (const char*)record + sizeof(flight_log_record), record->length);
+
+		++source->packets;
+		++stats->packets;
+
+		if(speed > 0)
+		{
+			error_us=(int64_t)(TimestampUs()-due_us);
+			error_us = error_us < 0 ? -error_us : error_us;
+			stats->error_sum_us += error_us;
+			if(error_us > stats->error_max_us)
+				stats->error_max_us=error_us;
+		}
+
+		if( (head.record=ReadSourceRecord(log, head.source, sources)) == NULL )
+			--count;
+		else
+		{
+			head.packet_us=PacketTimestampUs(*head.record);
+			std::push_heap(heads, heads+count, LaterPacket);
+		}
+	}
+
+	stats->elapsed_us=TimestampUs()-start_us;
+}
+
+const flight_log_record *ReadSourceRecord(const flight_log &log, int source, replay_source *sources)
+{
+	const flight_log_record *record;
+
+	while( (record=ReadFlightLog(log, &sources[source].cursor)) != NULL && record->source != source )
+		;
+
+	return record;
+}
+
+bool LaterPacket(const replay_head &a, const replay_head &b)
+{
+	return a.packet_us > b.packet_us;
+}
+
+// timestamp_us of payload after the common header, the record timestamp if there is no header
+uint64_t PacketTimestampUs(const flight_log_record &record)
+{
+	const char *data=(const char*)&record + sizeof(flight_log_record);
+	packet_header header;
+	uint64_t timestamp_us;
+
+	if(!DecodeStreamHeader(data, record.length, &header))
+		return record.timestamp_us;
+
+	//every payload starts with timestamp_us
+	PacketValue<uint64_t>::Get(data + PACKET_HEADER_BYTES, &timestamp_us);
+	return timestamp_us;
+}
+
+void Usage()
+{
+	printf("ev3replay file host speed [start_ms]\n\n");
+	printf("speed - 1 for original timing, N for N times faster, 0 for as fast as possible\n");
+	printf("start_ms - skip that much of the recording\n\n");
+	printf("examples:\n");
+	printf("./ev3replay run.ev3log 192.168.0.103 1\n");
+	printf("./ev3replay run.ev3log 127.0.0.1 0 60000\n");
+}
+
+int ProcessInput(int argc, char **argv, int *out_speed, int *out_start_ms)
+{
+	long int speed, start_ms=0;
+
+	if(argc!=4 && argc!=5)
+		return -1;
+
+	speed=strtol(argv[3], NULL, 0);
+	if(speed < 0 || speed > 1000)
+	{
+		fprintf(stderr, "ev3replay: the argument speed has to be in range <0, 1000>\n");
+		return -1;
+	}
+	*out_speed=speed;
+
+	if(argc==5)
+		start_ms=strtol(argv[4], NULL, 0);
+	if(start_ms < 0 || start_ms > 86400000)
+	{
+		fprintf(stderr, "ev3replay: the argument start_ms has to be in range <0, 86400000>\n");
+		return -1;
+	}
+	*out_start_ms=start_ms;
+
+	return 0;
+}
+
+void Finish(int signal)
+{
+	g_finish_program=1;
+}
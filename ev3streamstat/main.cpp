@@ -0,0 +1,341 @@
+/*
+ * ev3streamstat program
+ *
+ * Copyright (C) 2016 Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ * This program is distributed "as is" WITHOUT ANY WARRANTY of any
+ * kind, whether express or implied; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+ /*
+  * This program works on PC (the host that receives data from EV3)
+  *
+  * ev3streamstat:
+  * -listens on UDP ports of the modules (instead of ev3dev-mapping-ui or together with ev3replay)
+  *  and receives the packets in batches (see lib/shared/stream_consumer.h)
+  * -accounts sequence numbers of the packets (see lib/shared/stream_stats.h)
+  * -prints loss, duplication, reordering and interarrival jitter of each stream every report_ms
+  * -optionally synchronizes clock with ev3control (see lib/shared/clock_sync.h)
+  *  and prints one-way latency of each stream (arrival - packet timestamp in host clock)
+  *
+  * See Usage() function for syntax details (or run the program without arguments)
+  */
+
+#include "shared/misc.h"
+#include "shared/net_udp.h"
+#include "shared/clock_sync.h"
+#include "shared/stream_consumer.h"
+#include "shared/stream_stats.h"
+#include "shared/packet_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h> //strtol
+#include <string.h> //strchr
+#include <signal.h> //sig_atomic_t
+#include <errno.h> //errno
+#include <unistd.h> //close
+#include <sys/epoll.h> //epoll_create1, epoll_ctl, epoll_wait
+#include <sys/socket.h> //recv
+
+const int CLOCK_PERIOD_MS=100;
+
+// clock synchronization with ev3control, socket is -1 without robot argument
+struct clock_client
+{
+	int socket;
+	sockaddr_in robot;
+	uint32_t sequence; //of the last request, late answers are ignored
+	uint64_t next_request_us;
+	clock_sync sync;
+};
+
+// one-way latency of stream packets since the last report
+struct stream_latency
+{
+	uint32_t count;
+	int64_t sum_us;
+	int64_t min_us;
+	int64_t max_us;
+};
+
+// GLOBAL VARIABLES
+volatile sig_atomic_t g_finish_program=0;
+
+void MainLoop(stream_consumer *consumer, clock_client *clock, int report_ms);
+void SendClockRequest(clock_client *clock, uint64_t now_us);
+void ReceiveClockResponses(clock_client *clock);
+void AddStreamLatency(stream_latency *latency, const stream_datagram &datagram, const clock_sync &sync);
+void PrintStreamStats(const stream_stats_table &table, const stream_consumer &consumer, const clock_client &clock, uint32_t *last_received, stream_latency *latency, int elapsed_ms);
+
+void Usage();
+int ProcessInput(int argc, char **argv, int *out_report_ms, int *out_ports, int *out_count, char **out_robot_host, int *out_robot_port);
+void Finish(int signal);
+
+int main(int argc, char **argv)
+{
+	stream_consumer consumer;
+	clock_client clock={};
+	int ports[STREAM_CONSUMER_MAX_PORTS];
+	int report_ms, count, robot_port;
+	char *robot_host;
+
+	if( ProcessInput(argc, argv, &report_ms, ports, &count, &robot_host, &robot_port) )
+	{
+		Usage();
+		return 0;
+	}
+
+	SetStandardOutputLineBuffered();
+	RegisterSignals(Finish);
+
+	InitStreamConsumer(&consumer, ports, count, STREAM_CONSUMER_DEFAULT_BATCH);
+
+	clock.socket=-1;
+	InitClockSync(&clock.sync);
+	if(robot_host)
+	{
+		InitNetworkUDP(&clock.socket, NULL, NULL, 0, 0, TRAFFIC_CONTROL);
+		InitDestinationUDP(&clock.robot, robot_host, robot_port);
+	}
+
+	MainLoop(&consumer, &clock, report_ms);
+
+	if(clock.socket != -1)
+		CloseNetworkUDP(clock.socket);
+	CloseStreamConsumer(&consumer);
+
+	printf("ev3streamstat: bye\n");
+
+	return 0;
+}
+
+// the streams and the clock socket are watched by one epoll (consumer epoll is nested in it)
+// clock answers are taken first after wake-up, so that their receive time is not late
+void MainLoop(stream_consumer *consumer, clock_client *clock, int report_ms)
+{
+	stream_stats_table table;
+	stream_latency latency[STREAM_STATS_MAX_STREAMS]={};
+	uint32_t last_received[STREAM_STATS_MAX_STREAMS]={0};
+	uint64_t now, last_report=TimestampUs();
+	epoll_event event, events[2];
+	int epoll_fd, timeout_ms, clock_ms, ready, count;
+	bool streams_ready;
+
+	InitStreamStats(&table);
+
+	if( (epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DieErrno("ev3streamstat: epoll_create1");
+
+	event.events=EPOLLIN;
+	event.data.ptr=consumer;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, consumer->epoll_fd, &event) == -1)
+		DieErrno("ev3streamstat: epoll_ctl consumer");
+
+	event.data.ptr=clock;
+	if(clock->socket != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clock->socket, &event) == -1)
+		DieErrno("ev3streamstat: epoll_ctl clock");
+
+	while(!g_finish_program)
+	{
+		now=TimestampUs();
+		timeout_ms=report_ms - (int)((now-last_report)/1000);
+
+		if(timeout_ms <= 0)
+		{
+			PrintStreamStats(table, *consumer, *clock, last_received, latency, (int)((now-last_report)/1000));
+			last_report=now;
+			continue;
+		}
+
+		if(clock->socket != -1)
+		{
+			if(now >= clock->next_request_us)
+				SendClockRequest(clock, now);
+			clock_ms=(int)((clock->next_request_us - now)/1000) + 1;
+			if(clock_ms < timeout_ms)
+				timeout_ms=clock_ms;
+		}
+
+		if( (ready=epoll_wait(epoll_fd, events, 2, timeout_ms)) == -1)
+		{
+			if(errno == EINTR)
+				continue; //check g_finish_program
+			DieErrno("ev3streamstat: epoll_wait");
+		}
+
+		streams_ready=false;
+
+		for(int i=0;i<ready;++i)
+			if(events[i].data.ptr == clock)
+				ReceiveClockResponses(clock);
+			else
+				streams_ready=true;
+
+		if(!streams_ready)
+			continue;
+
+		count=ReceiveStreamConsumer(consumer, 0);
+
+		for(int i=0;i<count;++i)
+		{
+			const stream_datagram &datagram=consumer->datagrams[i];
+			stream_stats *stats=AddStreamPacket(&table, datagram.data, datagram.length, datagram.arrival_us);
+
+			if(stats && ClockSyncValid(clock->sync))
+				AddStreamLatency(latency + (stats - table.streams), datagram, clock->sync);
+		}
+	}
+
+	PrintStreamStats(table, *consumer, *clock, last_received, latency, (int)((TimestampUs()-last_report)/1000));
+
+	if(close(epoll_fd) == -1)
+		DieErrno("ev3streamstat: close epoll");
+}
+
+void SendClockRequest(clock_client *clock, uint64_t now_us)
+{
+	char buffer[CLOCK_SYNC_REQUEST_BYTES];
+	int length=EncodeClockSyncRequest(buffer, ++clock->sequence, TimestampUs());
+
+	//lost requests are not retried, the next one follows in CLOCK_PERIOD_MS
+	TrySendToUDP(clock->socket, clock->robot, buffer, length);
+	clock->next_request_us=now_us + CLOCK_PERIOD_MS*1000;
+}
+
+void ReceiveClockResponses(clock_client *clock)
+{
+	char buffer[CLOCK_SYNC_RESPONSE_BYTES];
+	uint32_t sequence;
+	uint64_t t1, t2, t3, t4;
+	int length;
+
+	while( (length=recv(clock->socket, buffer, sizeof(buffer), MSG_DONTWAIT)) != -1 )
+	{
+		t4=TimestampUs();
+
+		//late answers to previous requests are ignored, their round trip is large anyway
+		if(DecodeClockSyncResponse(buffer, length, &sequence, &t1, &t2, &t3) && sequence == clock->sequence)
+			AddClockSyncSample(&clock->sync, t1, t2, t3, t4);
+	}
+
+	if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		DieErrno("ev3streamstat: recv clock response failed");
+}
+
+void AddStreamLatency(stream_latency *latency, const stream_datagram &datagram, const clock_sync &sync)
+{
+	uint64_t timestamp_us;
+	int64_t latency_us;
+
+	//all payloads start with timestamp_us
+	PacketValue<uint64_t>::Get(datagram.payload, &timestamp_us);
+	latency_us=(int64_t)(datagram.arrival_us - RobotToHostUs(sync, timestamp_us));
+
+	if(latency->count == 0 || latency_us < latency->min_us)
+		latency->min_us=latency_us;
+	if(latency->count == 0 || latency_us > latency->max_us)
+		latency->max_us=latency_us;
+	latency->sum_us += latency_us;
+	++latency->count;
+}
+
+void PrintStreamStats(const stream_stats_table &table, const stream_consumer &consumer, const clock_client &clock, uint32_t *last_received, stream_latency *latency, int elapsed_ms)
+{
+	for(int i=0;i<table.count;++i)
+	{
+		const stream_stats &s=table.streams[i];
+
+		printf("ev3streamstat: %s %u packets_per_s %.1f received %u lost %u (%.2f%%) duplicated %u (%.2f%%) reordered %u (%.2f%%) restarts %u jitter_us %.1f",
+			PacketTypeName(s.type), s.stream, elapsed_ms > 0 ? 1000.0*(s.received-last_received[i])/elapsed_ms : 0.0,
+			s.received, s.lost, StreamLostPct(s), s.duplicated, StreamDuplicatedPct(s), s.reordered, StreamReorderedPct(s),
+			s.restarts, s.jitter_us);
+
+		if(latency[i].count)
+			printf(" latency_us mean %.1f min %lld max %lld", (double)latency[i].sum_us / latency[i].count,
+				(long long)latency[i].min_us, (long long)latency[i].max_us);
+		printf("\n");
+
+		last_received[i]=s.received;
+		latency[i].count=0;
+		latency[i].sum_us=0;
+	}
+
+	//the latency is as accurate as the offset, the error is up to half of minimal round trip
+	if(clock.socket != -1 && ClockSyncValid(clock.sync))
+		printf("ev3streamstat: clock offset_us %lld drift_ppm %.3f latency_error_us %u\n",
+			(long long)ClockSyncOffsetUs(clock.sync, TimestampUs()), clock.sync.drift*1e6, ClockSyncRoundTripUs(clock.sync)/2);
+	else if(clock.socket != -1)
+		printf("ev3streamstat: clock not synchronized yet, no answers from ev3control\n");
+
+	if(consumer.invalid || table.overflow)
+		printf("ev3streamstat: invalid %llu overflow %u\n", (unsigned long long)consumer.invalid, table.overflow);
+}
+
+void Usage()
+{
+	printf("ev3streamstat report_ms port [port ...] [robot_host:control_port]\n\n");
+	printf("with robot_host:control_port (ev3control) the clocks are synchronized and one-way latency is printed\n\n");
+	printf("examples:\n");
+	printf("./ev3streamstat 1000 8005\n");
+	printf("./ev3streamstat 1000 8005 8006 8007\n");
+	printf("./ev3streamstat 1000 8005 8006 192.168.0.104:8004\n");
+}
+
+int ProcessInput(int argc, char **argv, int *out_report_ms, int *out_ports, int *out_count, char **out_robot_host, int *out_robot_port)
+{
+	long int report_ms, port;
+	char *separator;
+
+	*out_robot_host=NULL;
+
+	//the last argument with host is the robot
+	if(argc > 3 && (separator=strchr(argv[argc-1], ':')) != NULL)
+	{
+		*separator='\0';
+		port=strtol(separator+1, NULL, 0);
+		if(port <= 0 || port > 65535)
+		{
+			fprintf(stderr, "ev3streamstat: the argument control_port has to be in range <1, 65535>\n");
+			return -1;
+		}
+		*out_robot_host=argv[argc-1];
+		*out_robot_port=port;
+		--argc;
+	}
+
+	if(argc < 3 || argc-2 > STREAM_CONSUMER_MAX_PORTS)
+		return -1;
+
+	*out_count=argc-2;
+
+	report_ms=strtol(argv[1], NULL, 0);
+	if(report_ms <= 0 || report_ms > 60000)
+	{
+		fprintf(stderr, "ev3streamstat: the argument report_ms has to be in range <1, 60000>\n");
+		return -1;
+	}
+	*out_report_ms=report_ms;
+
+	for(int i=2;i<argc;++i)
+	{
+		port=strtol(argv[i], NULL, 0);
+		if(port <= 0 || port > 65535)
+		{
+			fprintf(stderr, "ev3streamstat: the argument port has to be in range <1, 65535>\n");
+			return -1;
+		}
+		out_ports[i-2]=port;
+	}
+
+	return 0;
+}
+
+void Finish(int signal)
+{
+	g_finish_program=1;
+}
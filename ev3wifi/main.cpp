@@ -19,6 +19,7 @@
   * -reads associated WiFi station info (bssid, ssid, signal strength, rx/tx packets)
   * -timestamps the data
   * -sends the above data in UDP messages
+  * -publishes the same messages on shared-memory bus (stream ev3wifi-<port>)
   *
   * Preconditions (for EV3/ev3dev):
   * - libmnl has to be installed
@@ -29,39 +30,24 @@
 #include "wifi-scan/wifi_scan.h"
 
 #include "shared/misc.h"
-#include "shared/net_udp.h"
+#include "shared/module_runtime.h"
+#include "shared/packets.h"
 
-#include <limits.h> //INT_MAX
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h> //memcpy
-#include <unistd.h> //open, close, read, write
-#include <endian.h> //htobe16, htobe32, htobe64
 
-struct wifi_packet
-{
-	uint64_t timestamp_us;
-	uint8_t bssid[BSSID_LENGTH]; //this is hardware mac address of your AP
-	char ssid[SSID_MAX_LENGTH_WITH_NULL]; //this is the name of your AP as you see it when connecting
-	int8_t signal_dbm;  //signal strength in dBm from last received PPDU, you may need to average that
-	uint32_t rx_packets; //the number of received packets
-	uint32_t tx_packets; //the number of transmitted packets
-};
-
-const int WIFI_PACKET_BYTES=56; // 8 + 6 + 33 + 1 + 4 + 4
+static_assert(BSSID_LENGTH == WIFI_BSSID_BYTES && SSID_MAX_LENGTH_WITH_NULL == WIFI_SSID_BYTES, "wifi_packet doesn't match wifi-scan");
 
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, wifi_scan *wifi, int poll_ms);
-
-int EncodeWifiPacket(const wifi_packet &packet, char *buffer);
-void SendWifiPacketUDP(int socket, const sockaddr_in &dest, const wifi_packet &packet);
+ModuleSampleStatus SampleWifi(void *data, wifi_packet *packet);
 
 void Usage();
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms);
 
 int main(int argc, char **argv)
 {
-	int socket_udp, port, poll_ms;
-	sockaddr_in destination_udp;
+	module_runtime runtime;
+	int port, poll_ms;
 	wifi_scan *wifi=NULL;
 
 	if( ProcessInput(argc, argv, &port, &poll_ms) )
@@ -77,13 +63,12 @@ int main(int argc, char **argv)
 	if(!wifi)
 		Die("Unable to initialize wifi-scan library");
 
-	SetStandardInputNonBlocking();	
-
-	InitNetworkUDP(&socket_udp, &destination_udp, host, port, 0);
+	InitModuleRuntime(&runtime, "ev3wifi", host, port, poll_ms, PACKET_WIFI, WIFI_PACKET_BYTES);
 			
-	MainLoop(socket_udp, destination_udp, wifi, poll_ms);
+	RunModule<wifi_codec>(&runtime, SampleWifi, wifi);
+	PrintModuleStats(runtime);
 	
-	CloseNetworkUDP(socket_udp);
+	CloseModuleRuntime(&runtime);
 	
 	wifi_scan_close(wifi);
 
@@ -92,73 +77,26 @@ int main(int argc, char **argv)
 	return 0;
 }
 
-void MainLoop(int socket_udp, const sockaddr_in &destination_udp, wifi_scan *wifi, int poll_ms)
-{
-	const int BENCHS=INT_MAX;
-		
-	struct station_info station;	
-	struct wifi_packet packet;
-	uint64_t start=TimestampUs();
-	int i, elapsed_us, poll_us=1000*poll_ms;
-	
-	for(i=0;i<BENCHS;++i)
-	{	
-		packet.timestamp_us=TimestampUs();
-		if(wifi_scan_station(wifi, &station)>0)
-		{
-			memcpy(packet.bssid, station.bssid, BSSID_LENGTH);
-			memcpy(packet.ssid, station.ssid, SSID_MAX_LENGTH_WITH_NULL);
-			packet.signal_dbm=station.signal_dbm;
-			packet.rx_packets=station.rx_packets;
-			packet.tx_packets=station.tx_packets;
-		
-			SendWifiPacketUDP(socket_udp, destination_udp, packet);
-		}
-		else
-			fprintf(stderr, "ev3wifi: no associated station\n");
-			
-		if(IsStandardInputEOF()) //the parent process has closed it's pipe end
-			break;
-
-		elapsed_us=(int)(TimestampUs()-packet.timestamp_us);
-		
-		if( elapsed_us < poll_us )
-			SleepUs(poll_us - elapsed_us);
-	}
-		
-	uint64_t end=TimestampUs();
-	
-	double seconds_elapsed=(end-start)/ 1000000.0L;
-	printf("ev3wifi: average loop %f seconds\n", seconds_elapsed/i);
-}
-
-int EncodeWifiPacket(const wifi_packet &p, char *data)
+ModuleSampleStatus SampleWifi(void *data, wifi_packet *packet)
 {
-	*((uint64_t*)data) = htobe64(p.timestamp_us);
-	data += sizeof(p.timestamp_us);
+	wifi_scan *wifi=(wifi_scan*)data;
+	station_info station;
 
-	memcpy(data, p.bssid, BSSID_LENGTH);
-	data += BSSID_LENGTH;
+	packet->timestamp_us=TimestampUs();
 
-	memcpy(data, p.ssid, SSID_MAX_LENGTH_WITH_NULL);
-	data += SSID_MAX_LENGTH_WITH_NULL;
-
-	*data=p.signal_dbm;
-	data += 1;
+	if(wifi_scan_station(wifi, &station)<=0)
+	{
+		fprintf(stderr, "ev3wifi: no associated station\n");
+		return MODULE_SAMPLE_SKIP;
+	}
 
-	*((uint32_t*)data)= htobe32(p.rx_packets);
-	data += sizeof(p.rx_packets);
+	memcpy(packet->bssid, station.bssid, BSSID_LENGTH);
+	memcpy(packet->ssid, station.ssid, SSID_MAX_LENGTH_WITH_NULL);
+	packet->signal_dbm=station.signal_dbm;
+	packet->rx_packets=station.rx_packets;
+	packet->tx_packets=station.tx_packets;
 
-	*((uint32_t*)data)= htobe32(p.tx_packets);
-	data += sizeof(p.tx_packets);
-	
-	return WIFI_PACKET_BYTES;	
-}
-void SendWifiPacketUDP(int socket, const sockaddr_in &destination, const wifi_packet &packet)
-{
-	static char buffer[WIFI_PACKET_BYTES];
-	EncodeWifiPacket(packet, buffer);
-	SendToUDP(socket, destination, buffer, WIFI_PACKET_BYTES);
+	return MODULE_SAMPLE_SEND;
 }
 
 void Usage()
@@ -170,27 +108,14 @@ void Usage()
 
 int ProcessInput(int argc, char **argv, int *out_port, int *out_poll_ms)
 {
-	long int port, poll;
-		
 	if(argc!=5)
 		return -1;
 		
-	port=strtol(argv[2], NULL, 0);
-	if(port <= 0 || port > 65535)
-	{
-		fprintf(stderr, "ev3wifi: the argument port has to be in range <1, 65535>\n");
+	if(!ParseModuleArgument("ev3wifi", "port", argv[2], 1, 65535, out_port))
 		return -1;
-	}
-	*out_port=port;
 	
-	poll=strtol(argv[4], NULL, 0);
-	if(poll <= 0)
-	{
-		fprintf(stderr, "ev3wifi: the argument poll_ms has to be greater than 0\n");
+	if(!ParseModuleArgument("ev3wifi", "poll_ms", argv[4], 1, 3600000, out_poll_ms))
 		return -1;
-	}
-	*out_poll_ms=poll;
-
 	
 	return 0;
 }
\ No newline at end of file
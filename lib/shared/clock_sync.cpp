@@ -0,0 +1,163 @@
+#include "clock_sync.h"
+
+#include <endian.h> //htobe32, htobe64, be32toh, be64toh
+#include <string.h> //memcpy
+
+void ClockSyncPutU32(char *data, uint32_t value)
+{
+	value=htobe32(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+void ClockSyncPutU64(char *data, uint64_t value)
+{
+	value=htobe64(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+uint32_t ClockSyncGetU32(const char *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return be32toh(value);
+}
+
+uint64_t ClockSyncGetU64(const char *data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return be64toh(value);
+}
+
+int EncodeClockSyncRequest(char *buffer, uint32_t sequence, uint64_t t1)
+{
+	ClockSyncPutU32(buffer, CLOCK_SYNC_MAGIC);
+	ClockSyncPutU32(buffer+4, sequence);
+	ClockSyncPutU64(buffer+8, t1);
+	return CLOCK_SYNC_REQUEST_BYTES;
+}
+
+bool DecodeClockSyncRequest(const char *buffer, int length, uint32_t *sequence, uint64_t *t1)
+{
+	if(length != CLOCK_SYNC_REQUEST_BYTES || ClockSyncGetU32(buffer) != CLOCK_SYNC_MAGIC)
+		return false;
+
+	*sequence=ClockSyncGetU32(buffer+4);
+	*t1=ClockSyncGetU64(buffer+8);
+	return true;
+}
+
+int EncodeClockSyncResponse(char *buffer, uint32_t sequence, uint64_t t1, uint64_t t2, uint64_t t3)
+{
+	EncodeClockSyncRequest(buffer, sequence, t1);
+	ClockSyncPutU64(buffer+16, t2);
+	ClockSyncPutU64(buffer+24, t3);
+	return CLOCK_SYNC_RESPONSE_BYTES;
+}
+
+bool DecodeClockSyncResponse(const char *buffer, int length, uint32_t *sequence, uint64_t *t1, uint64_t *t2, uint64_t *t3)
+{
+	if(length != CLOCK_SYNC_RESPONSE_BYTES || ClockSyncGetU32(buffer) != CLOCK_SYNC_MAGIC)
+		return false;
+
+	*sequence=ClockSyncGetU32(buffer+4);
+	*t1=ClockSyncGetU64(buffer+8);
+	*t2=ClockSyncGetU64(buffer+16);
+	*t3=ClockSyncGetU64(buffer+24);
+	return true;
+}
+
+void InitClockSync(clock_sync *sync)
+{
+	memset(sync, 0, sizeof(*sync));
+}
+
+// least squares line through the closed windows minima, relative to the newest one
+// the window being filled is used only until the first one closes
+void EstimateClockSync(clock_sync *sync)
+{
+	int open=sync->windows_count > 1 ? sync->current : -1;
+	int newest_index=open == -1 ? sync->current : (sync->current + CLOCK_SYNC_WINDOWS - 1) % CLOCK_SYNC_WINDOWS;
+	const clock_sync_sample &newest=sync->windows[newest_index];
+	double mean_x=0, mean_y=0, sxx=0, sxy=0;
+	int n=sync->windows_count - (open != -1);
+
+	for(int i=0;i<sync->windows_count;++i)
+	{
+		if(i == open)
+			continue;
+		mean_x += (int64_t)(sync->windows[i].host_us - newest.host_us);
+		mean_y += sync->windows[i].offset_us;
+	}
+	mean_x/=n;
+	mean_y/=n;
+
+	for(int i=0;i<sync->windows_count;++i)
+	{
+		if(i == open)
+			continue;
+		double dx=(int64_t)(sync->windows[i].host_us - newest.host_us) - mean_x;
+		sxx += dx*dx;
+		sxy += dx*(sync->windows[i].offset_us - mean_y);
+	}
+
+	sync->drift = sxx > 0 ? sxy / sxx : 0;
+	sync->reference_host_us=newest.host_us;
+	sync->reference_offset_us=mean_y - sync->drift * mean_x;
+}
+
+void AddClockSyncSample(clock_sync *sync, uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+	clock_sync_sample sample;
+	int64_t round_trip=(int64_t)(t4-t1) - (int64_t)(t3-t2);
+
+	sample.host_us=t1 + (t4-t1)/2;
+	sample.offset_us=((int64_t)(t2-t1) + (int64_t)(t3-t4)) / 2;
+	sample.round_trip_us = round_trip > 0 ? round_trip : 0;
+
+	if(sync->windows_count == 0 || sample.host_us - sync->window_start_us >= (uint64_t)CLOCK_SYNC_WINDOW_US)
+	{
+		sync->current=(sync->current + (sync->windows_count > 0)) % CLOCK_SYNC_WINDOWS;
+		if(sync->windows_count < CLOCK_SYNC_WINDOWS)
+			++sync->windows_count;
+		sync->window_start_us=sample.host_us;
+		sync->windows[sync->current]=sample;
+	}
+	else if(sample.round_trip_us < sync->windows[sync->current].round_trip_us)
+	{
+		sync->windows[sync->current]=sample;
+		if(sync->windows_count > 1) //it joins the fit when the window closes
+			return;
+	}
+	else
+		return;
+
+	EstimateClockSync(sync);
+}
+
+bool ClockSyncValid(const clock_sync &sync)
+{
+	return sync.windows_count > 0;
+}
+
+int64_t ClockSyncOffsetUs(const clock_sync &sync, uint64_t host_us)
+{
+	return (int64_t)(sync.reference_offset_us + sync.drift * (int64_t)(host_us - sync.reference_host_us));
+}
+
+uint64_t RobotToHostUs(const clock_sync &sync, uint64_t robot_us)
+{	//offset changes by microseconds per second, evaluating it at approximate host time is enough
+	uint64_t host_us=robot_us - (int64_t)sync.reference_offset_us;
+	return robot_us - ClockSyncOffsetUs(sync, host_us);
+}
+
+uint32_t ClockSyncRoundTripUs(const clock_sync &sync)
+{
+	uint32_t round_trip=UINT32_MAX;
+
+	for(int i=0;i<sync.windows_count;++i)
+		if(sync.windows[i].round_trip_us < round_trip)
+			round_trip=sync.windows[i].round_trip_us;
+
+	return round_trip;
+}
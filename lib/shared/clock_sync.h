@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h> //uint64_t, int64_t, uint32_t
+
+/*
+ * Robot-host clock synchronization, NTP-like request/response over UDP
+ *
+ * ev3control answers time requests on UDP port with the same number as its TCP port.
+ * Host sends request with its transmit time t1, robot answers with t1, its receive time t2
+ * and transmit time t3 (TimestampUs, CLOCK_MONOTONIC), host notes receive time t4:
+ *
+ * round trip = (t4-t1) - (t3-t2)
+ * offset (robot - host) = ((t2-t1) + (t3-t4)) / 2, the error is at most half of round trip
+ *
+ * Samples with minimal round trip (not delayed in queues, WiFi retransmissions) are the most accurate.
+ * The estimator keeps the minimal round trip sample of each window and fits offset and drift through
+ * the closed windows. The minimum of the window being filled is tentative (its first sample is
+ * taken whatever the round trip), it joins the fit when the window closes.
+ *
+ * Messages (big endian):
+ * request  = magic u32 | sequence u32 | t1 u64
+ * response = magic u32 | sequence u32 | t1 u64 | t2 u64 | t3 u64
+ */
+
+const uint32_t CLOCK_SYNC_MAGIC=0x45563354; //EV3T
+const int CLOCK_SYNC_REQUEST_BYTES=16;
+const int CLOCK_SYNC_RESPONSE_BYTES=32;
+
+const int CLOCK_SYNC_WINDOW_US=2000000;
+const int CLOCK_SYNC_WINDOWS=16; //the estimate follows last 32 seconds
+
+struct clock_sync_sample
+{
+	uint64_t host_us; //the middle of exchange
+	int64_t offset_us;
+	uint32_t round_trip_us;
+};
+
+struct clock_sync
+{
+	clock_sync_sample windows[CLOCK_SYNC_WINDOWS]; //ring of minimal round trip samples
+	int windows_count;
+	int current; //the window being filled
+	uint64_t window_start_us;
+	//the estimate, offset(host_us) = reference_offset_us + drift * (host_us - reference_host_us)
+	uint64_t reference_host_us;
+	double reference_offset_us;
+	double drift; //robot clock rate relative to host clock - 1 (e.g. 20e-6 is 20 ppm)
+};
+
+int EncodeClockSyncRequest(char *buffer, uint32_t sequence, uint64_t t1);
+// false if it is not clock sync request
+bool DecodeClockSyncRequest(const char *buffer, int length, uint32_t *sequence, uint64_t *t1);
+int EncodeClockSyncResponse(char *buffer, uint32_t sequence, uint64_t t1, uint64_t t2, uint64_t t3);
+// false if it is not clock sync response
+bool DecodeClockSyncResponse(const char *buffer, int length, uint32_t *sequence, uint64_t *t1, uint64_t *t2, uint64_t *t3);
+
+void InitClockSync(clock_sync *sync);
+// t1-t4 as described above, updates the estimate
+void AddClockSyncSample(clock_sync *sync, uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+// false until the first sample
+bool ClockSyncValid(const clock_sync &sync);
+// robot - host at host time
+int64_t ClockSyncOffsetUs(const clock_sync &sync, uint64_t host_us);
+// robot timestamp (e.g. of module packet) in host clock
+uint64_t RobotToHostUs(const clock_sync &sync, uint64_t robot_us);
+// the smallest round trip of the windows, the offset error bound is about half of it
+uint32_t ClockSyncRoundTripUs(const clock_sync &sync);
@@ -0,0 +1,274 @@
+#include "flight_log.h"
+
+#include "misc.h"
+
+#include <sys/mman.h> //mmap, msync, madvise
+#include <sys/stat.h> //fstat
+#include <fcntl.h> //open, posix_fallocate
+#include <unistd.h> //close
+#include <string.h> //memcpy, strncpy
+#include <time.h> //clock_gettime
+#include <stdio.h> //fprintf
+
+// chunks are aligned to their size, this way also to page size (msync, madvise)
+uint32_t FlightLogDataOffset(uint32_t chunks)
+{
+	uint32_t end=sizeof(flight_log_header) + chunks*sizeof(uint64_t);
+	return (end + FLIGHT_LOG_CHUNK_BYTES - 1) / FLIGHT_LOG_CHUNK_BYTES * FLIGHT_LOG_CHUNK_BYTES;
+}
+
+uint32_t FlightLogRecordBytes(int length)
+{
+	return (sizeof(flight_log_record) + length + 7) & ~7;
+}
+
+flight_log_chunk *FlightLogChunk(const flight_log &log, uint32_t chunk)
+{
+	return (flight_log_chunk*)(log.mapped + log.header->data_offset + chunk * log.header->chunk_bytes);
+}
+
+void InitFlightLogWriter(flight_log *log, const char *path, uint32_t bytes)
+{
+	uint32_t chunks=bytes / FLIGHT_LOG_CHUNK_BYTES;
+	timespec realtime;
+	int error;
+
+	while(chunks > 0 && FlightLogDataOffset(chunks) + chunks * FLIGHT_LOG_CHUNK_BYTES > bytes)
+		--chunks;
+
+	if(chunks == 0)
+		Die("FlightLog: file too small for a single chunk");
+
+	if( (log->fd=open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+		DieErrno("FlightLog: open failed");
+
+	//the blocks are allocated now, not while recording (and recording can't run out of space)
+	if( (error=posix_fallocate(log->fd, 0, bytes)) != 0)
+	{
+		fprintf(stderr, "FlightLog: posix_fallocate failed with error %d\n", error);
+		Die("FlightLog: unable to preallocate file");
+	}
+
+	log->mapped=(char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+
+	if(log->mapped == MAP_FAILED)
+		DieErrno("FlightLog: mmap failed");
+
+	if(clock_gettime(CLOCK_REALTIME, &realtime) == -1)
+		DieErrno("FlightLog: clock_gettime failed");
+
+	log->mapped_bytes=bytes;
+	log->header=(flight_log_header*)log->mapped;
+	log->index=(uint64_t*)(log->mapped + sizeof(flight_log_header));
+	log->chunk=NULL;
+	log->synced_chunk=0;
+
+	//the file is zeroed, magic is written last
+	log->header->version=FLIGHT_LOG_VERSION;
+	log->header->chunk_bytes=FLIGHT_LOG_CHUNK_BYTES;
+	log->header->chunks=chunks;
+	log->header->index_offset=sizeof(flight_log_header);
+	log->header->data_offset=FlightLogDataOffset(chunks);
+	log->header->start_monotonic_us=TimestampUs();
+	log->header->start_realtime_us=(uint64_t)realtime.tv_sec*1000000 + (uint64_t)realtime.tv_nsec / 1000;
+	log->header->magic=FLIGHT_LOG_MAGIC;
+}
+
+int AddFlightLogSource(flight_log *log, const char *name)
+{
+	flight_log_header *header=log->header;
+
+	if(header->sources == FLIGHT_LOG_MAX_SOURCES)
+		return -1;
+
+	strncpy(header->source[header->sources].name, name, FLIGHT_LOG_SOURCE_NAME_BYTES-1);
+	return header->sources++;
+}
+
+bool NextFlightLogChunk(flight_log *log, uint64_t timestamp_us)
+{
+	flight_log_header *header=log->header;
+
+	if(header->chunks_used == header->chunks)
+		return false;
+
+	log->chunk=FlightLogChunk(*log, header->chunks_used);
+	log->chunk->records=0;
+	log->chunk->bytes=sizeof(flight_log_chunk);
+	log->chunk->first_timestamp_us=log->chunk->last_timestamp_us=timestamp_us;
+	log->index[header->chunks_used]=timestamp_us;
+	++header->chunks_used;
+
+	return true;
+}
+
+bool AppendFlightLog(flight_log *log, uint64_t timestamp_us, int source, const char *data, int length)
+{
+	uint32_t record_bytes=FlightLogRecordBytes(length);
+
+	if(length < 0 || length > FLIGHT_LOG_MAX_PACKET_BYTES)
+		return false;
+
+	if(log->chunk == NULL || log->chunk->bytes + record_bytes > log->header->chunk_bytes)
+		if(!NextFlightLogChunk(log, timestamp_us))
+			return false;
+
+	flight_log_chunk *chunk=log->chunk;
+	flight_log_record *record=(flight_log_record*)((char*)chunk + chunk->bytes);
+
+	record->timestamp_us=timestamp_us;
+	record->source=source;
+	record->length=length;
+	record->reserved=0;
+	memcpy((char*)record + sizeof(flight_log_record), data, length);
+
+	chunk->bytes += record_bytes;
+	++chunk->records;
+	chunk->last_timestamp_us=timestamp_us;
+	++log->header->source[source].records;
+
+	return true;
+}
+
+void SyncFlightLog(flight_log *log)
+{
+	flight_log_header *header=log->header;
+
+	if(header->chunks_used == 0)
+		return;
+
+	uint32_t current=header->chunks_used-1;
+	char *start=(char*)FlightLogChunk(*log, log->synced_chunk);
+
+	//records first, then the header and index that point to them
+	if(msync(start, (current - log->synced_chunk + 1) * header->chunk_bytes, MS_SYNC) == -1)
+		DieErrno("FlightLog: msync chunks failed");
+	if(msync(log->mapped, header->data_offset, MS_SYNC) == -1)
+		DieErrno("FlightLog: msync header failed");
+
+	//full chunks are on disk and never change, drop them from memory (EV3 has 64 MB)
+	if(current > log->synced_chunk && madvise(start, (current - log->synced_chunk) * header->chunk_bytes, MADV_DONTNEED) == -1)
+		DieErrno("FlightLog: madvise failed");
+
+	log->synced_chunk=current;
+}
+
+bool FlightLogValid(const flight_log_header *header, uint32_t bytes)
+{
+	return header->magic == FLIGHT_LOG_MAGIC && header->version == FLIGHT_LOG_VERSION
+		&& header->chunk_bytes == (uint32_t)FLIGHT_LOG_CHUNK_BYTES && header->chunks_used <= header->chunks
+		&& header->sources <= (uint32_t)FLIGHT_LOG_MAX_SOURCES && header->index_offset == sizeof(flight_log_header)
+		&& header->data_offset == FlightLogDataOffset(header->chunks)
+		&& header->data_offset + (uint64_t)header->chunks * header->chunk_bytes <= bytes;
+}
+
+bool InitFlightLogReader(flight_log *log, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if( (fd=open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		DieErrno("FlightLog: open failed");
+	if(fstat(fd, &st) == -1)
+		DieErrno("FlightLog: fstat failed");
+
+	if(st.st_size < (off_t)sizeof(flight_log_header) || st.st_size > UINT32_MAX)
+	{
+		close(fd);
+		return false;
+	}
+
+	log->mapped=(char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if(log->mapped == MAP_FAILED)
+		DieErrno("FlightLog: mmap failed");
+
+	close(fd);
+
+	log->fd=-1;
+	log->mapped_bytes=st.st_size;
+	log->header=(flight_log_header*)log->mapped;
+	log->index=(uint64_t*)(log->mapped + sizeof(flight_log_header));
+	log->chunk=NULL;
+	log->synced_chunk=0;
+
+	if(!FlightLogValid(log->header, log->mapped_bytes))
+	{
+		CloseFlightLog(log);
+		return false;
+	}
+
+	return true;
+}
+
+void SeekFlightLog(const flight_log &log, uint64_t timestamp_us, flight_log_cursor *cursor)
+{
+	uint32_t low=0, high=log.header->chunks_used, middle;
+	flight_log_cursor previous;
+	const flight_log_record *record;
+
+	//the first chunk starting at or after timestamp_us, the record may be also in the one before
+	while(low < high)
+	{
+		middle=low + (high-low)/2;
+		if(log.index[middle] < timestamp_us)
+			low=middle+1;
+		else
+			high=middle;
+	}
+
+	cursor->chunk = low > 0 ? low-1 : 0;
+	cursor->offset=0;
+
+	do
+	{
+		previous=*cursor;
+		record=ReadFlightLog(log, cursor);
+	}
+	while(record && record->timestamp_us < timestamp_us);
+
+	if(record)
+		*cursor=previous;
+}
+
+// stops at chunk with damaged record (e.g. the recorder was killed), continues with the next chunk
+const flight_log_record *ReadFlightLog(const flight_log &log, flight_log_cursor *cursor)
+{
+	const flight_log_header *header=log.header;
+
+	for(;cursor->chunk < header->chunks_used; ++cursor->chunk, cursor->offset=0)
+	{
+		const char *chunk=(const char*)FlightLogChunk(log, cursor->chunk);
+		uint32_t bytes=((const flight_log_chunk*)chunk)->bytes;
+
+		if(bytes > header->chunk_bytes)
+			continue;
+		if(cursor->offset == 0)
+			cursor->offset=sizeof(flight_log_chunk);
+		if(cursor->offset + sizeof(flight_log_record) > bytes)
+			continue;
+
+		const flight_log_record *record=(const flight_log_record*)(chunk + cursor->offset);
+
+		if(record->source >= header->sources || cursor->offset + FlightLogRecordBytes(record->length) > bytes)
+			continue;
+
+		cursor->offset += FlightLogRecordBytes(record->length);
+		return record;
+	}
+
+	return NULL;
+}
+
+void CloseFlightLog(flight_log *log)
+{
+	if(log->fd != -1)
+		SyncFlightLog(log);
+
+	if(munmap(log->mapped, log->mapped_bytes) == -1)
+		DieErrno("FlightLog: munmap failed");
+	if(log->fd != -1 && close(log->fd) == -1)
+		DieErrno("FlightLog: close failed");
+
+	log->mapped=NULL;
+}
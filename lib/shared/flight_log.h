@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h> //uint64_t, uint32_t, uint16_t
+
+/*
+ * Flight log - append-only binary log of encoded packets from many sources (ev3recorder)
+ *
+ * The file is preallocated and memory-mapped, native byte order (little endian on EV3):
+ *
+ * [header page(s)] flight_log_header, then time index (first_timestamp_us of each chunk)
+ * [chunk 0] [chunk 1] ... fixed size chunks
+ *
+ * chunk = flight_log_chunk, then records
+ * record = flight_log_record, then length bytes of packet, padded to 8 bytes
+ *
+ * Chunks are filled in order, records in chunk are in timestamp order.
+ * Seeking by time is binary search in the index, then linear scan of one chunk.
+ * Timestamps are CLOCK_MONOTONIC microseconds (as TimestampUs) when the recorder got the packet.
+ */
+
+const uint32_t FLIGHT_LOG_MAGIC=0x4C335645; //EV3L
+const uint32_t FLIGHT_LOG_VERSION=1;
+const int FLIGHT_LOG_CHUNK_BYTES=65536;
+const int FLIGHT_LOG_MAX_SOURCES=32;
+const int FLIGHT_LOG_SOURCE_NAME_BYTES=64; //same as SHM_BUS_NAME_MAX
+const int FLIGHT_LOG_MAX_PACKET_BYTES=4096;
+
+struct flight_log_source
+{
+	char name[FLIGHT_LOG_SOURCE_NAME_BYTES]; //e.g. ev3odometry-8005
+	uint32_t records;
+	uint32_t lost; //packets the recorder didn't keep up with
+};
+
+struct flight_log_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t chunk_bytes;
+	uint32_t chunks;
+	uint32_t chunks_used; //chunks with records, the last one may be partially filled
+	uint32_t sources;
+	uint32_t index_offset; //uint64_t first_timestamp_us[chunks]
+	uint32_t data_offset; //chunk 0
+	uint64_t start_monotonic_us;
+	uint64_t start_realtime_us; //wall clock at the same moment, to correlate with other logs
+	flight_log_source source[FLIGHT_LOG_MAX_SOURCES];
+};
+
+struct flight_log_chunk
+{
+	uint32_t records;
+	uint32_t bytes; //used, including this header
+	uint64_t first_timestamp_us;
+	uint64_t last_timestamp_us;
+};
+
+struct flight_log_record
+{
+	uint64_t timestamp_us;
+	uint16_t source; //index in header source table
+	uint16_t length;
+	uint32_t reserved;
+};
+
+// reader position in the log
+struct flight_log_cursor
+{
+	uint32_t chunk;
+	uint32_t offset; //in chunk, 0 is the first record
+};
+
+struct flight_log
+{
+	int fd; //writer, -1 for reader
+	char *mapped;
+	uint32_t mapped_bytes;
+	flight_log_header *header;
+	uint64_t *index;
+	flight_log_chunk *chunk; //writer, the chunk being filled
+	uint32_t synced_chunk; //writer, chunks before this one are on disk
+};
+
+// creates (truncates) the file of size bytes, preallocates and maps it
+void InitFlightLogWriter(flight_log *log, const char *path, uint32_t bytes);
+// -1 if the source table is full
+int AddFlightLogSource(flight_log *log, const char *name);
+// false if the log is full (or length > FLIGHT_LOG_MAX_PACKET_BYTES)
+bool AppendFlightLog(flight_log *log, uint64_t timestamp_us, int source, const char *data, int length);
+// writes dirty pages to the disk, blocks, call it periodically (not for every record)
+void SyncFlightLog(flight_log *log);
+
+// maps existing log read-only, false if it is not a flight log (the log may be still recorded)
+bool InitFlightLogReader(flight_log *log, const char *path);
+// positions cursor at the first record with timestamp >= timestamp_us
+void SeekFlightLog(const flight_log &log, uint64_t timestamp_us, flight_log_cursor *cursor);
+// returns the record at cursor (data follows it) and advances the cursor, NULL at the end of log
+const flight_log_record *ReadFlightLog(const flight_log &log, flight_log_cursor *cursor);
+
+// syncs (writer) and unmaps
+void CloseFlightLog(flight_log *log);
@@ -0,0 +1,60 @@
+#include "gyro.h"
+
+#include "misc.h"
+
+#include <stdio.h> //snprintf
+#include <string.h> //memcpy
+#include <errno.h> //errno, ENXIO
+#include <unistd.h> //lseek, read
+#include <fcntl.h> //open, O_RDONLY
+
+const int GYRO_PATH_MAX=100;
+const int GYRO_ANGLE_REGISTER=0x42;
+
+int OpenGyroDirect(int device_index)
+{
+	char gyro_path[GYRO_PATH_MAX];
+	int fd;
+
+	snprintf(gyro_path, GYRO_PATH_MAX, "/sys/class/lego-sensor/sensor%d/direct", device_index);
+
+	if((fd=open(gyro_path, O_RDONLY | O_CLOEXEC))==-1)
+		DieErrno("OpenGyroDirect, open(gyro_path, O_RDONLY)");
+
+	return fd;
+}
+
+int ReadGyroAngle(int gyro_direct_fd, int16_t *out_angle)
+{
+	char temp[2];
+	int result;
+	
+	if(lseek(gyro_direct_fd, GYRO_ANGLE_REGISTER, SEEK_SET)==-1)
+		DieErrno("ReadGyroAngle, lseek(gyro_direct_fd, 0x42, SEEK_SET)==-1");
+		
+	if( (result=read(gyro_direct_fd, temp, 2 )) == 2)
+	{
+		memcpy(out_angle, temp, 2);
+		return 0;
+	}	
+		
+	if( (result <= 0 && errno != ENXIO) )
+		DieErrno("ReadGyroAngle, read Gyro failed");
+		
+	if( result == 1)
+		Die("ReadGyroAngle, incomplete I2C read");
+	
+	return -ENXIO;			
+}
+
+int GyroAngleDifference(int a, int b)
+{
+	int diff=(a-b) % GYRO_ANGLE_FULL_TURN;
+
+	if(diff >= GYRO_ANGLE_FULL_TURN/2)
+		diff -= GYRO_ANGLE_FULL_TURN;
+	else if(diff < -GYRO_ANGLE_FULL_TURN/2)
+		diff += GYRO_ANGLE_FULL_TURN;
+
+	return diff;
+}
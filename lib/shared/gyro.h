@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// MicroInfinity CruizCore XG1300L gyroscope on EV3 input 3 (driver loaded manually by ev3init.sh)
+const char GYRO_PORT[]="i2c-legoev35:i2c1";
+const char GYRO_DRIVER[]="mi-xg1300l";
+
+// angle is in 0.01 degree units, in range <-18000, 18000>
+const int GYRO_ANGLE_FULL_TURN=36000;
+
+// opens /sys/class/lego-sensor/sensor<device_index>/direct for reading
+int OpenGyroDirect(int device_index);
+
+// reads angle register (0x42) through direct file
+// returns 0 on success, -ENXIO on occasional I2C failure (retry)
+int ReadGyroAngle(int gyro_direct_fd, int16_t *out_angle);
+
+// returns a-b wrapped to range <-18000, 18000)
+int GyroAngleDifference(int a, int b);
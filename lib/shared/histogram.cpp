@@ -0,0 +1,62 @@
+#include "histogram.h"
+
+#include <string.h> //memset
+
+void InitHistogram(latency_histogram *histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+// values < 2*SUB_BUCKETS map to themselves, for the rest 2*SUB_BUCKETS.. bucket is
+// (magnitude-SUB_BUCKET_BITS)*SUB_BUCKETS + (value >> (magnitude-SUB_BUCKET_BITS)), magnitude is index of the highest bit
+int HistogramBucket(uint32_t value)
+{
+	if(value < 2*HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	int shift=(31-__builtin_clz(value)) - HISTOGRAM_SUB_BUCKET_BITS;
+	return shift*HISTOGRAM_SUB_BUCKETS + (value >> shift);
+}
+
+// the highest value of bucket
+uint64_t HistogramBucketHighest(int bucket)
+{
+	if(bucket < 2*HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	int shift=bucket/HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub_bucket=bucket%HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+	return ((sub_bucket+1) << shift) - 1;
+}
+
+void RecordHistogram(latency_histogram *histogram, uint64_t value)
+{
+	histogram->counts[HistogramBucket(value > UINT32_MAX ? UINT32_MAX : value)]++;
+	histogram->count++;
+	histogram->total += value;
+	if(value > histogram->max)
+		histogram->max=value;
+}
+
+uint64_t HistogramPercentile(const latency_histogram &histogram, double percentile)
+{
+	uint64_t rank=(uint64_t)(percentile/100.0*histogram.count + 0.5), seen=0;
+
+	if(rank == 0)
+		rank=1;
+
+	for(int i=0;i<HISTOGRAM_BUCKETS;++i)
+		if( (seen+=histogram.counts[i]) >= rank )
+		{
+			uint64_t highest=HistogramBucketHighest(i);
+			return highest < histogram.max && i < HISTOGRAM_BUCKETS-1 ? highest : histogram.max;
+		}
+
+	return histogram.max;
+}
+
+uint64_t HistogramMean(const latency_histogram &histogram)
+{
+	return histogram.count ? histogram.total / histogram.count : 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h> //uint32_t, uint64_t
+
+/*
+ * HDR-style latency histogram (log-linear buckets, fixed memory, constant time record)
+ *
+ * Values below 32 have exact buckets, above that each power of 2 is split into 16 buckets,
+ * so the value is known with 1/16 (6.25%) relative precision from 0 up to 2^32-1
+ * (larger values are clamped, max keeps the real one).
+ *
+ * There are no locks, the histogram has single writer, the module loop that also reads it
+ * when printing statistics (signals are delivered through signalfd to the same loop)
+ */
+
+const int HISTOGRAM_SUB_BUCKET_BITS=4;
+const int HISTOGRAM_SUB_BUCKETS=1 << HISTOGRAM_SUB_BUCKET_BITS;
+const int HISTOGRAM_BUCKETS=(32-HISTOGRAM_SUB_BUCKET_BITS)*HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS; //464
+
+struct latency_histogram
+{
+	uint32_t counts[HISTOGRAM_BUCKETS];
+	uint32_t count;
+	uint64_t max;
+	uint64_t total;
+};
+
+void InitHistogram(latency_histogram *histogram);
+void RecordHistogram(latency_histogram *histogram, uint64_t value);
+// the highest value equivalent to percentile (0-100) sample, at most max, 0 if empty
+uint64_t HistogramPercentile(const latency_histogram &histogram, double percentile);
+uint64_t HistogramMean(const latency_histogram &histogram);
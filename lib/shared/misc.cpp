@@ -7,6 +7,9 @@
 #include <string.h> //memcpy, memset
 #include <unistd.h> //STDIN_FILE_NO
 #include <fcntl.h> //fcntl
+#include <stdlib.h> //getenv, strtol
+#include <stdio.h> //setvbuf
+#include <errno.h> //errno
 
 uint64_t TimestampUs()
 {
@@ -83,4 +86,27 @@ bool IsStandardInputEOF()
 
 	Die("Nothing should be on standard input!");
 	return true; //make compiler happy
-}
\ No newline at end of file
+}
+
+void SetStandardOutputLineBuffered()
+{
+	if( setvbuf(stdout, NULL, _IOLBF, 0) != 0 )
+		Die("SetStandardOutputLineBuffered() setvbuf failed");
+}
+
+// ev3control passes the write end of notification pipe in EV3_NOTIFY_FD
+void NotifyReady()
+{
+	const char READY[]="READY=1\n";
+	const char *env=getenv("EV3_NOTIFY_FD");
+	
+	if(env == NULL)
+		return;
+		
+	int fd=strtol(env, NULL, 10);
+		
+	if(write(fd, READY, sizeof(READY)-1) == -1)
+		perror("NotifyReady() write failed");
+	close(fd);
+	unsetenv("EV3_NOTIFY_FD");
+}
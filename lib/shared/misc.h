@@ -10,4 +10,9 @@ void Die(const char *s);
 void RegisterSignals(void (*signal_handler)(int) );
 void SetStandardInputNonBlocking();
 bool IsStandardInputEOF();
+// stdout is a pipe to ev3control log, flush it by lines instead of blocks
+void SetStandardOutputLineBuffered();
+
+// tells ev3control that module finished initialization (no-op if not started by ev3control)
+void NotifyReady();
 
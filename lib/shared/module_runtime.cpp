@@ -0,0 +1,521 @@
+#include "module_runtime.h"
+
+#include <stdio.h> //printf, snprintf
+#include <stdlib.h> //strtol, getenv
+#include <string.h> //strcmp
+#include <errno.h> //errno
+#include <time.h> //clock_gettime
+#include <signal.h> //sigset_t, sigprocmask, sigaction
+#include <unistd.h> //read, close, alarm, STDIN_FILENO
+#include <sys/epoll.h> //epoll_create1, epoll_ctl, epoll_wait
+#include <sys/signalfd.h> //signalfd
+#include <sys/timerfd.h> //timerfd_create, timerfd_settime
+#include <arpa/inet.h> //htons, inet_ntop
+
+const int MODULE_MAX_EVENTS=5; //stdin, signal, timer, stats timer, UDP socket
+const int MODULE_INTERRUPT_SIGNALS[]={SIGTERM, SIGINT, SIGQUIT, SIGHUP, SIGALRM}; //SIGALRM for InterruptModuleSample retry
+const int MODULE_INTERRUPT_SIGNALS_COUNT=sizeof(MODULE_INTERRUPT_SIGNALS)/sizeof(MODULE_INTERRUPT_SIGNALS[0]);
+const int MODULE_INTERRUPT_RETRY_S=1;
+
+// termination signal arrived during sample without timer
+volatile sig_atomic_t g_module_interrupted=0;
+
+void AddModuleEvent(module_runtime *runtime, int fd, void *ptr);
+int InitModuleSignals();
+void InitModuleInterruptMask(sigset_t *mask);
+void InterruptModuleSample(int signal);
+ModuleSampleStatus SampleInterruptible(module_sample_function sample, void *sampler);
+int InitModuleTimer();
+void InitModuleStats(module_runtime *runtime);
+void InitModuleSender(module_runtime *runtime, const char *host, int port);
+void WatchModuleSender(module_runtime *runtime);
+void ArmModuleTimer(int timer_fd, uint64_t start_ns, int period_ms);
+bool ReadModuleSignals(module_runtime *runtime);
+uint32_t ReadModuleTimer(int timer_fd);
+ModuleSampleStatus SampleModule(module_runtime *runtime, module_sample_function sample, module_encode_function encode, void *sampler, char *buffer);
+void SendModule(module_runtime *runtime, char *buffer);
+void SendModuleStats(const module_runtime &runtime);
+uint64_t TimestampNs();
+
+void InitModuleRuntime(module_runtime *runtime, const char *name, const char *host, int port, int poll_ms, PacketType type, int packet_bytes)
+{
+	char stream[SHM_BUS_NAME_MAX];
+	epoll_event event;
+
+	if(PACKET_HEADER_BYTES + packet_bytes > MODULE_MAX_PACKET_BYTES)
+		Die("InitModuleRuntime: packet too large");
+
+	runtime->name=name;
+	runtime->header.version=PACKET_VERSION;
+	runtime->header.type=type;
+	runtime->header.stream=port;
+	runtime->header.sequence=0;
+	runtime->packet_bytes=packet_bytes;
+	runtime->finished=false;
+
+	SetStandardInputNonBlocking();
+	SetStandardOutputLineBuffered();
+
+	InitModuleSender(runtime, host, port);
+	snprintf(stream, sizeof(stream), "%s-%d", name, port);
+	InitShmBusWriter(&runtime->bus, stream, PACKET_HEADER_BYTES + packet_bytes, SHM_BUS_DEFAULT_SLOTS);
+
+	if( (runtime->epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DieErrno("InitModuleRuntime: epoll_create1");
+
+	runtime->signal_fd=InitModuleSignals();
+	runtime->poll_ms=poll_ms;
+	runtime->timer_fd = poll_ms > 0 ? InitModuleTimer() : -1;
+	InitModuleStats(runtime);
+
+	AddModuleEvent(runtime, runtime->signal_fd, &runtime->signal_fd);
+	AddModuleEvent(runtime, runtime->sender.socket, &runtime->sender);
+	runtime->send_watched=true;
+	WatchModuleSender(runtime); //only when something is queued
+	if(runtime->timer_fd != -1)
+		AddModuleEvent(runtime, runtime->timer_fd, &runtime->timer_fd);
+	if(runtime->stats_timer_fd != -1)
+		AddModuleEvent(runtime, runtime->stats_timer_fd, &runtime->stats_timer_fd);
+
+	//regular files and /dev/null can't be polled (EPERM), nobody closes them anyway
+	event.events=EPOLLIN;
+	event.data.ptr=&runtime->stdin_watched;
+	runtime->stdin_watched=epoll_ctl(runtime->epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0;
+	if(!runtime->stdin_watched && errno != EPERM)
+		DieErrno("InitModuleRuntime: epoll_ctl stdin");
+}
+
+void CloseModuleRuntime(module_runtime *runtime)
+{
+	if(runtime->stats_socket != -1)
+	{
+		if(close(runtime->stats_timer_fd) == -1)
+			DieErrno("CloseModuleRuntime: close stats timer");
+		CloseNetworkUDP(runtime->stats_socket);
+	}
+	if(runtime->timer_fd != -1 && close(runtime->timer_fd) == -1)
+		DieErrno("CloseModuleRuntime: close timer");
+	if(close(runtime->signal_fd) == -1)
+		DieErrno("CloseModuleRuntime: close signal");
+	if(close(runtime->epoll_fd) == -1)
+		DieErrno("CloseModuleRuntime: close epoll");
+
+	CloseShmBus(&runtime->bus);
+	CloseSenderUDP(&runtime->sender);
+}
+
+void AddModuleEvent(module_runtime *runtime, int fd, void *ptr)
+{
+	epoll_event event;
+	event.events=EPOLLIN;
+	event.data.ptr=ptr;
+
+	if(epoll_ctl(runtime->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+		DieErrno("InitModuleRuntime: epoll_ctl add");
+}
+
+// the same signals as RegisterSignals and SIGUSR1, delivered through signalfd
+// the termination signals also have handler (without SA_RESTART) for SampleInterruptible
+int InitModuleSignals()
+{
+	struct sigaction action={};
+	sigset_t mask;
+	int fd;
+
+	InitModuleInterruptMask(&mask);
+	sigaddset(&mask, SIGUSR1);
+
+	if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+		DieErrno("InitModuleRuntime: sigprocmask");
+
+	if( (fd=signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+		DieErrno("InitModuleRuntime: signalfd");
+
+	action.sa_handler=InterruptModuleSample;
+	for(int i=0;i<MODULE_INTERRUPT_SIGNALS_COUNT;++i)
+		if(sigaction(MODULE_INTERRUPT_SIGNALS[i], &action, NULL) == -1)
+			DieErrno("InitModuleRuntime: sigaction");
+
+	return fd;
+}
+
+void InitModuleInterruptMask(sigset_t *mask)
+{
+	sigemptyset(mask);
+	for(int i=0;i<MODULE_INTERRUPT_SIGNALS_COUNT;++i)
+		sigaddset(mask, MODULE_INTERRUPT_SIGNALS[i]);
+}
+
+// the signal may come just before the blocking call of the sample, alarm interrupts it then
+void InterruptModuleSample(int signal)
+{
+	if(signal == SIGALRM)
+		return;
+	g_module_interrupted=1;
+	alarm(MODULE_INTERRUPT_RETRY_S);
+}
+
+// without timer the sample may block (e.g. read of laser tty that stopped sending data)
+// the termination signals are unblocked for the time of it, they interrupt blocking calls (EINTR)
+ModuleSampleStatus SampleInterruptible(module_sample_function sample, void *sampler)
+{
+	ModuleSampleStatus status;
+	sigset_t mask;
+
+	InitModuleInterruptMask(&mask);
+
+	if(sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
+		DieErrno("RunModuleLoop: sigprocmask unblock");
+
+	status=sample(sampler);
+
+	if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+		DieErrno("RunModuleLoop: sigprocmask block");
+
+	if(g_module_interrupted)
+		alarm(0);
+
+	return status;
+}
+
+// armed when the loop starts (module initialization may take long, e.g. gyroscope)
+int InitModuleTimer()
+{
+	int fd;
+
+	if( (fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+		DieErrno("InitModuleRuntime: timerfd_create");
+
+	return fd;
+}
+
+// EV3_STATS_PORT (and optional EV3_STATS_PERIOD_MS) enable periodic statistics over UDP, to the first destination
+void InitModuleStats(module_runtime *runtime)
+{
+	const char *port_env=getenv("EV3_STATS_PORT");
+	const char *period_env=getenv("EV3_STATS_PERIOD_MS");
+	int port=0, period_ms=MODULE_STATS_DEFAULT_PERIOD_MS;
+
+	runtime->stats_socket=runtime->stats_timer_fd=-1;
+
+	if(port_env == NULL)
+		return;
+
+	if(!ParseModuleArgument(runtime->name, "EV3_STATS_PORT", port_env, 1, 65535, &port))
+		Die("InitModuleRuntime: invalid EV3_STATS_PORT");
+	if(period_env != NULL && !ParseModuleArgument(runtime->name, "EV3_STATS_PERIOD_MS", period_env, 10, 3600000, &period_ms))
+		Die("InitModuleRuntime: invalid EV3_STATS_PERIOD_MS");
+
+	InitNetworkUDP(&runtime->stats_socket, NULL, NULL, 0, 0, TRAFFIC_BULK);
+	runtime->stats_destination=runtime->sender.destinations[0].address;
+	runtime->stats_destination.sin_port=htons(port);
+
+	runtime->stats_timer_fd=InitModuleTimer();
+	ArmModuleTimer(runtime->stats_timer_fd, TimestampNs() + period_ms*1000000ULL, period_ms);
+}
+
+// EV3_SEND_QUEUE, EV3_SEND_DROP, EV3_SNDBUF, EV3_TRAFFIC_CLASS and EV3_MULTICAST_* configure the sender
+void InitModuleSender(module_runtime *runtime, const char *host, int port)
+{
+	const char *queue_env=getenv("EV3_SEND_QUEUE");
+	const char *drop_env=getenv("EV3_SEND_DROP");
+	const char *sndbuf_env=getenv("EV3_SNDBUF");
+	const char *traffic_env=getenv("EV3_TRAFFIC_CLASS");
+	const char *ttl_env=getenv("EV3_MULTICAST_TTL");
+	const char *loop_env=getenv("EV3_MULTICAST_LOOP");
+	bool state=runtime->header.type == PACKET_ODOMETRY || runtime->header.type == PACKET_DEAD_RECONNING;
+	udp_sender_config config={MODULE_SEND_DEFAULT_QUEUE, UDP_DROP_OLDEST, 0, state ? TRAFFIC_STATE : TRAFFIC_BULK, 0, getenv("EV3_MULTICAST_IF"), -1};
+
+	if(queue_env != NULL && !ParseModuleArgument(runtime->name, "EV3_SEND_QUEUE", queue_env, 0, 1024, &config.queue_packets))
+		Die("InitModuleRuntime: invalid EV3_SEND_QUEUE");
+	if(sndbuf_env != NULL && !ParseModuleArgument(runtime->name, "EV3_SNDBUF", sndbuf_env, 0, 4*1024*1024, &config.send_buffer_bytes))
+		Die("InitModuleRuntime: invalid EV3_SNDBUF");
+	if(ttl_env != NULL && !ParseModuleArgument(runtime->name, "EV3_MULTICAST_TTL", ttl_env, 1, 255, &config.multicast_ttl))
+		Die("InitModuleRuntime: invalid EV3_MULTICAST_TTL");
+	if(loop_env != NULL && !ParseModuleArgument(runtime->name, "EV3_MULTICAST_LOOP", loop_env, 0, 1, &config.multicast_loop))
+		Die("InitModuleRuntime: invalid EV3_MULTICAST_LOOP");
+
+	if(drop_env != NULL && !strcmp(drop_env, "newest"))
+		config.policy=UDP_DROP_NEWEST;
+	else if(drop_env != NULL && strcmp(drop_env, "oldest"))
+	{
+		fprintf(stderr, "%s: EV3_SEND_DROP has to be oldest or newest\n", runtime->name);
+		Die("InitModuleRuntime: invalid EV3_SEND_DROP");
+	}
+
+	if(traffic_env != NULL && !ParseTrafficClass(traffic_env, &config.traffic))
+	{
+		fprintf(stderr, "%s: EV3_TRAFFIC_CLASS has to be default, control, state or bulk\n", runtime->name);
+		Die("InitModuleRuntime: invalid EV3_TRAFFIC_CLASS");
+	}
+
+	InitSenderUDP(&runtime->sender, host, port, PACKET_HEADER_BYTES + runtime->packet_bytes, config);
+}
+
+// EPOLLOUT only while packets are queued, otherwise the socket is always writable
+void WatchModuleSender(module_runtime *runtime)
+{
+	epoll_event event;
+	bool watch = runtime->sender.count > 0;
+
+	if(watch == runtime->send_watched)
+		return;
+
+	event.events = watch ? EPOLLOUT : 0;
+	event.data.ptr=&runtime->sender;
+
+	if(epoll_ctl(runtime->epoll_fd, EPOLL_CTL_MOD, runtime->sender.socket, &event) == -1)
+		DieErrno("RunModuleLoop: epoll_ctl sender");
+
+	runtime->send_watched=watch;
+}
+
+// periodic timer with the first expiration at start_ns (CLOCK_MONOTONIC)
+void ArmModuleTimer(int timer_fd, uint64_t start_ns, int period_ms)
+{
+	itimerspec period;
+
+	period.it_interval.tv_sec = period_ms / 1000;
+	period.it_interval.tv_nsec = (period_ms % 1000) * 1000000;
+	period.it_value.tv_sec = start_ns / 1000000000;
+	period.it_value.tv_nsec = start_ns % 1000000000;
+
+	if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &period, NULL) == -1)
+		DieErrno("ModuleRuntime: timerfd_settime");
+}
+
+// true if the module should finish, SIGUSR1 only prints statistics
+bool ReadModuleSignals(module_runtime *runtime)
+{
+	char buffer[MODULE_STATS_MAX_BYTES];
+	signalfd_siginfo info;
+	bool finish=false;
+
+	while(read(runtime->signal_fd, &info, sizeof(info)) == sizeof(info))
+		if(info.ssi_signo == SIGUSR1)
+		{
+			FormatModuleStats(*runtime, buffer);
+			fputs(buffer, stdout);
+		}
+		else
+			finish=true;
+
+	if(errno != EAGAIN)
+		DieErrno("RunModuleLoop: read signalfd");
+
+	return finish;
+}
+
+// returns the number of expirations since the last read
+uint32_t ReadModuleTimer(int timer_fd)
+{
+	uint64_t expirations;
+
+	if(read(timer_fd, &expirations, sizeof(expirations)) == -1)
+	{
+		if(errno == EAGAIN)
+			return 0;
+		DieErrno("RunModuleLoop: read timerfd");
+	}
+	return expirations;
+}
+
+void RunModuleLoop(module_runtime *runtime, module_sample_function sample, module_encode_function encode, void *sampler)
+{
+	static char buffer[MODULE_MAX_PACKET_BYTES];
+	epoll_event events[MODULE_MAX_EVENTS];
+	ModuleSampleStatus status=MODULE_SAMPLE_SEND;
+	uint64_t period_ns=runtime->poll_ms*1000000ULL, expired_ns=0;
+	uint32_t expirations;
+	int ready;
+	bool sample_due;
+
+	runtime->stats=module_stats();
+	runtime->stats.start_us=TimestampUs();
+
+	NotifyReady();
+
+	if(runtime->timer_fd != -1)
+	{
+		runtime->timer_deadline_ns=TimestampNs();
+		ArmModuleTimer(runtime->timer_fd, runtime->timer_deadline_ns, runtime->poll_ms);
+	}
+
+	while(!runtime->finished)
+	{	//without timer (or when retrying) only check the other sources
+		bool wait = runtime->timer_fd != -1 && status != MODULE_SAMPLE_RETRY;
+
+		if( (ready=epoll_wait(runtime->epoll_fd, events, MODULE_MAX_EVENTS, wait ? -1 : 0)) == -1)
+		{
+			if(errno==EINTR)
+				continue;
+			DieErrno("RunModuleLoop: epoll_wait");
+		}
+
+		sample_due=!wait;
+
+		for(int i=0;i<ready;++i)
+		{
+			void *ptr=events[i].data.ptr;
+
+			if(ptr == &runtime->stdin_watched && IsStandardInputEOF()) //the parent process has closed it's pipe end
+				runtime->finished=true;
+			else if(ptr == &runtime->signal_fd && ReadModuleSignals(runtime))
+				runtime->finished=true;
+			else if(ptr == &runtime->timer_fd && (expirations=ReadModuleTimer(runtime->timer_fd)) > 0)
+			{	//absolute deadlines, the latest expiration was expirations-1 periods after the expected one
+				expired_ns=runtime->timer_deadline_ns + (expirations-1)*period_ns;
+				runtime->timer_deadline_ns=expired_ns + period_ns;
+				runtime->stats.overruns += expirations-1;
+				sample_due=true;
+			}
+			else if(ptr == &runtime->stats_timer_fd && ReadModuleTimer(runtime->stats_timer_fd) > 0)
+				SendModuleStats(*runtime);
+			else if(ptr == &runtime->sender)
+			{	//connected socket reports ICMP errors (e.g. port unreachable) even when not watched
+				if(events[i].events & EPOLLERR)
+					ReadErrorSenderUDP(&runtime->sender);
+				FlushSenderUDP(&runtime->sender);
+				WatchModuleSender(runtime);
+			}
+		}
+
+		if(runtime->finished || !sample_due)
+			continue;
+
+		if(wait)
+			RecordHistogram(&runtime->stats.jitter_ns, TimestampNs() - expired_ns);
+
+		if( (status=SampleModule(runtime, sample, encode, sampler, buffer)) == MODULE_SAMPLE_STOP || g_module_interrupted)
+			runtime->finished=true;
+	}
+
+	runtime->stats.end_us=TimestampUs();
+}
+
+ModuleSampleStatus SampleModule(module_runtime *runtime, module_sample_function sample, module_encode_function encode, void *sampler, char *buffer)
+{
+	module_stats *stats=&runtime->stats;
+	uint64_t start=TimestampNs(), sampled, encoded;
+	ModuleSampleStatus status = runtime->timer_fd == -1 ? SampleInterruptible(sample, sampler) : sample(sampler);
+
+	sampled=TimestampNs();
+	RecordHistogram(&stats->sample_ns, sampled-start);
+
+	if(status == MODULE_SAMPLE_SKIP)
+		++stats->skipped;
+	else if(status == MODULE_SAMPLE_RETRY)
+		++stats->retries;
+
+	if(status != MODULE_SAMPLE_SEND)
+		return status;
+
+	encode(sampler, buffer + PACKET_HEADER_BYTES);
+	encoded=TimestampNs();
+	RecordHistogram(&stats->encode_ns, encoded-sampled);
+
+	SendModule(runtime, buffer);
+	RecordHistogram(&stats->send_ns, TimestampNs()-encoded);
+	++stats->samples;
+
+	return status;
+}
+
+// send failures are counted by the sender, the module keeps sampling (e.g. until WiFi reconnects)
+// the sequence number advances anyway, for receivers a failed send is a lost packet
+void SendModule(module_runtime *runtime, char *buffer)
+{
+	int length=PACKET_HEADER_BYTES + runtime->packet_bytes;
+
+	packet_header_codec::Encode(runtime->header, buffer);
+	++runtime->header.sequence;
+
+	SendSenderUDP(&runtime->sender, buffer, length);
+	WatchModuleSender(runtime);
+
+	PublishShmBus(&runtime->bus, buffer, length);
+}
+
+void SendModuleStats(const module_runtime &runtime)
+{
+	char buffer[MODULE_STATS_MAX_BYTES];
+	int length=FormatModuleStats(runtime, buffer);
+
+	//statistics are best effort, they must not stop the module
+	TrySendToUDP(runtime.stats_socket, runtime.stats_destination, buffer, length);
+}
+
+int FormatHistogram(const char *name, const char *histogram_name, const latency_histogram &histogram, char *buffer, int size)
+{
+	return snprintf(buffer, size, "%s: %s count %u mean %llu p50 %llu p90 %llu p99 %llu p999 %llu max %llu\n",
+		name, histogram_name, histogram.count, (unsigned long long)HistogramMean(histogram),
+		(unsigned long long)HistogramPercentile(histogram, 50), (unsigned long long)HistogramPercentile(histogram, 90),
+		(unsigned long long)HistogramPercentile(histogram, 99), (unsigned long long)HistogramPercentile(histogram, 99.9),
+		(unsigned long long)histogram.max);
+}
+
+int FormatDestination(const char *name, const udp_destination &destination, char *buffer, int size)
+{
+	char address[INET_ADDRSTRLEN];
+
+	if(inet_ntop(AF_INET, &destination.address.sin_addr, address, sizeof(address)) == NULL)
+		DieErrno("FormatModuleStats: inet_ntop");
+
+	return snprintf(buffer, size, "%s: destination %s sent %u send_errors %u\n", name, address, destination.sent, destination.errors);
+}
+
+int FormatModuleStats(const module_runtime &runtime, char *buffer)
+{
+	const module_stats &stats=runtime.stats;
+	const udp_sender &sender=runtime.sender;
+	int length=0;
+
+	length+=snprintf(buffer, MODULE_STATS_MAX_BYTES, "%s: samples %u skipped %u retries %u overruns %u\n",
+		runtime.name, stats.samples, stats.skipped, stats.retries, stats.overruns);
+	length+=snprintf(buffer+length, MODULE_STATS_MAX_BYTES-length, "%s: sent %u deferred %u queued %d drops %u send_errors %u\n",
+		runtime.name, sender.sent, sender.deferred, sender.count, sender.dropped, sender.errors);
+	for(int i=0;i<sender.destination_count && sender.destination_count > 1;++i)
+		length+=FormatDestination(runtime.name, sender.destinations[i], buffer+length, MODULE_STATS_MAX_BYTES-length);
+	length+=FormatHistogram(runtime.name, "sample_ns", stats.sample_ns, buffer+length, MODULE_STATS_MAX_BYTES-length);
+	length+=FormatHistogram(runtime.name, "encode_ns", stats.encode_ns, buffer+length, MODULE_STATS_MAX_BYTES-length);
+	length+=FormatHistogram(runtime.name, "send_ns", stats.send_ns, buffer+length, MODULE_STATS_MAX_BYTES-length);
+	length+=FormatHistogram(runtime.name, "jitter_ns", stats.jitter_ns, buffer+length, MODULE_STATS_MAX_BYTES-length);
+
+	return length;
+}
+
+void PrintModuleStats(const module_runtime &runtime)
+{
+	char buffer[MODULE_STATS_MAX_BYTES];
+	const module_stats &stats=runtime.stats;
+	uint32_t loops=stats.samples + stats.skipped + stats.retries;
+	double seconds_elapsed=(stats.end_us-stats.start_us) / 1000000.0;
+
+	FormatModuleStats(runtime, buffer);
+	fputs(buffer, stdout);
+
+	if(loops > 0)
+		printf("%s: average loop %f seconds\n", runtime.name, seconds_elapsed/loops);
+}
+
+uint64_t TimestampNs()
+{
+	timespec ts;
+	if( clock_gettime(CLOCK_MONOTONIC, &ts) )
+		DieErrno("TimestampNs failed");
+
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+bool ParseModuleArgument(const char *module, const char *name, const char *value, long min, long max, int *out)
+{
+	long number=strtol(value, NULL, 0);
+
+	if(number < min || number > max)
+	{
+		fprintf(stderr, "%s: the argument %s has to be in range <%ld, %ld>\n", module, name, min, max);
+		return false;
+	}
+	*out=number;
+	return true;
+}
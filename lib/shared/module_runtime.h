@@ -0,0 +1,146 @@
+#pragma once
+
+#include "shm_bus.h"
+#include "histogram.h"
+#include "packets.h"
+#include "misc.h"
+#include "net_udp.h"
+
+#include <stdint.h> //uint32_t, uint64_t
+#include <netinet/in.h> //sockaddr_in
+
+/*
+ * Runtime of sensor modules (ev3odometry, ev3dead-reconning, ev3wifi, ev3laser)
+ *
+ * The module provides only the sample function that fills its packet, the runtime:
+ * - prepends common header (packets.h) with module port as stream id and sequence number
+ * - sends the encoded packet over UDP and publishes it on shared-memory bus (stream <module>-<port>),
+ *   host may be a multicast group or comma separated list of destinations (see udp_sender in net_udp.h)
+ * - runs single epoll loop with sources:
+ *   -standard input (EOF when ev3control closes its pipe end)
+ *   -SIGTERM, SIGINT, SIGQUIT, SIGHUP (signalfd)
+ *   -SIGUSR1 (prints statistics to stdout, ev3control keeps it in module log)
+ *   -sampling timer (timerfd, fixed rate poll_ms), with poll_ms 0 the module samples
+ *    as soon as the previous sample finished (e.g. blocking read of laser), the termination signals
+ *    interrupt such sample (blocking calls fail with EINTR) so that the module can clean up (e.g. stop motor)
+ *   -statistics timer, if EV3_STATS_PORT environment variable is set the statistics are sent
+ *    every EV3_STATS_PERIOD_MS (default 1000) in UDP datagram to that port of host (text, the same as printed)
+ *   -UDP socket writable, only when packets are queued
+ * - never blocks on send, packets are queued on local congestion (see udp_sender in net_udp.h),
+ *   EV3_SEND_QUEUE (packets, default 8), EV3_SEND_DROP (oldest or newest, default oldest)
+ *   and EV3_SNDBUF (bytes, default system) environment variables configure it
+ * - sends with traffic class (see net_udp.h) state (odometry, dead-reconning) or bulk (laser, wifi),
+ *   EV3_TRAFFIC_CLASS environment variable (default, control, state, bulk) changes it
+ * - multicast destinations use EV3_MULTICAST_TTL (hops, default 1), EV3_MULTICAST_IF (address or interface name)
+ *   and EV3_MULTICAST_LOOP (0 or 1, default 1) environment variables
+ * - notifies ev3control that the module is ready when the loop starts
+ * - keeps uniform statistics, printed when the loop ends
+ *
+ * Statistics are counters and histograms (see histogram.h) of sample, encode and send duration
+ * and jitter (how late the sample started after the timer expiration), in nanoseconds
+ *
+ * ModuleSampleStatus SampleOdometry(void *data, odometry_packet *packet);
+ *
+ * InitModuleRuntime(&runtime, "ev3odometry", host, port, poll_ms, PACKET_ODOMETRY, ODOMETRY_PACKET_BYTES);
+ * RunModule<odometry_codec>(&runtime, SampleOdometry, &motors);
+ * CloseModuleRuntime(&runtime);
+ */
+
+const int MODULE_MAX_PACKET_BYTES=1472; //UDP payload that fits ethernet MTU, with header
+
+enum ModuleSampleStatus
+{
+	MODULE_SAMPLE_SEND, //packet is filled
+	MODULE_SAMPLE_SKIP, //nothing to send this period
+	MODULE_SAMPLE_RETRY, //sample again without waiting for the timer (signals and stdin are still checked)
+	MODULE_SAMPLE_STOP //unrecoverable failure, the loop ends
+};
+
+const int MODULE_STATS_DEFAULT_PERIOD_MS=1000;
+const int MODULE_STATS_MAX_BYTES=2048;
+const int MODULE_SEND_DEFAULT_QUEUE=8;
+
+struct module_stats
+{
+	uint32_t samples; //sent packets
+	uint32_t skipped;
+	uint32_t retries;
+	uint32_t overruns; //timer periods missed because sampling took longer
+	latency_histogram sample_ns;
+	latency_histogram encode_ns;
+	latency_histogram send_ns; //UDP and shared-memory bus
+	latency_histogram jitter_ns; //only with timer
+	uint64_t start_us;
+	uint64_t end_us;
+};
+
+struct module_runtime
+{
+	const char *name; //module name, prefix of messages
+	udp_sender sender; //counts sent, deferred, dropped packets and send errors
+	bool send_watched; //waiting for EPOLLOUT to send queued packets
+	shm_bus bus;
+	packet_header header; //sequence of the next packet
+	int packet_bytes; //without header
+	int poll_ms;
+	int epoll_fd;
+	int signal_fd;
+	int timer_fd; //-1 if module samples without timer
+	uint64_t timer_deadline_ns; //the next expiration
+	int stats_socket; //-1 if EV3_STATS_PORT is not set
+	sockaddr_in stats_destination;
+	int stats_timer_fd;
+	bool stdin_watched; //false if stdin can't be polled (e.g. /dev/null)
+	bool finished;
+	module_stats stats;
+};
+
+// samples into sampler, encodes last sample payload into buffer of packet_bytes
+typedef ModuleSampleStatus (*module_sample_function)(void *sampler);
+typedef void (*module_encode_function)(void *sampler, char *buffer);
+
+// also makes stdin non-blocking and stdout line buffered
+void InitModuleRuntime(module_runtime *runtime, const char *name, const char *host, int port, int poll_ms, PacketType type, int packet_bytes);
+// the loop ends on stdin EOF, signal or MODULE_SAMPLE_STOP
+void RunModuleLoop(module_runtime *runtime, module_sample_function sample, module_encode_function encode, void *sampler);
+// returns length of text written to buffer of MODULE_STATS_MAX_BYTES
+int FormatModuleStats(const module_runtime &runtime, char *buffer);
+void PrintModuleStats(const module_runtime &runtime);
+void CloseModuleRuntime(module_runtime *runtime);
+
+// false (and message on stderr) if value is not integer in range <min, max>
+bool ParseModuleArgument(const char *module, const char *name, const char *value, long min, long max, int *out);
+
+template <typename CODEC>
+struct ModuleSampler
+{
+	typedef typename CODEC::packet_type packet_type;
+
+	ModuleSampleStatus (*sample)(void *data, packet_type *packet);
+	void *data;
+	packet_type packet;
+
+	static ModuleSampleStatus Sample(void *sampler)
+	{
+		ModuleSampler *s=(ModuleSampler*)sampler;
+		return s->sample(s->data, &s->packet);
+	}
+	static void Encode(void *sampler, char *buffer)
+	{
+		CODEC::Encode(((ModuleSampler*)sampler)->packet, buffer);
+	}
+};
+
+// sample -> encode with CODEC -> send & publish, until the loop ends
+template <typename CODEC>
+void RunModule(module_runtime *runtime, ModuleSampleStatus (*sample)(void *data, typename CODEC::packet_type *packet), void *data)
+{
+	ModuleSampler<CODEC> sampler;
+	sampler.sample=sample;
+	sampler.data=data;
+
+	if(runtime->packet_bytes != CODEC::BYTES)
+		Die("RunModule: runtime initialized with different packet size");
+
+	RunModuleLoop(runtime, ModuleSampler<CODEC>::Sample, ModuleSampler<CODEC>::Encode, &sampler);
+}
@@ -1,11 +1,56 @@
 #include "net_udp.h"
 
 #include "misc.h"
-#include <string.h> //memset
+#include <string.h> //memset, memcpy, strcmp, strcpy, strtok_r
+#include <stdlib.h> //malloc, free
+#include <errno.h> //errno
+#include <fcntl.h> //fcntl
+#include <sys/socket.h> //sendmmsg
 #include <arpa/inet.h> //inet_pton, etc
+#include <net/if.h> //if_nametoindex
 #include <unistd.h> //close
 
-int InitSocketUDP(int port, int timeout_ms)
+struct traffic_class_options
+{
+	const char *name;
+	int tos; //DSCP << 2
+	int priority; //SO_PRIORITY, TC_PRIO_*
+};
+
+const traffic_class_options TRAFFIC_CLASSES[]=
+{
+	{"default", 0, 0},
+	{"control", 46 << 2, 6}, //EF, TC_PRIO_INTERACTIVE
+	{"state", 34 << 2, 4}, //AF41, TC_PRIO_INTERACTIVE_BULK
+	{"bulk", 8 << 2, 2}, //CS1, TC_PRIO_BULK
+};
+
+void SetTrafficClass(int sock, TrafficClass traffic)
+{
+	const traffic_class_options &options=TRAFFIC_CLASSES[traffic];
+
+	if(traffic == TRAFFIC_DEFAULT)
+		return;
+
+	//IP_TOS also sets the priority from TOS bits, SO_PRIORITY has to be the second
+	if(setsockopt(sock, IPPROTO_IP, IP_TOS, &options.tos, sizeof(options.tos)) == -1)
+		DieErrno("SetTrafficClass, setsockopt IP_TOS");
+	if(setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &options.priority, sizeof(options.priority)) == -1)
+		DieErrno("SetTrafficClass, setsockopt SO_PRIORITY");
+}
+
+bool ParseTrafficClass(const char *name, TrafficClass *traffic)
+{
+	for(int i=TRAFFIC_DEFAULT;i<=TRAFFIC_BULK;++i)
+		if(!strcmp(name, TRAFFIC_CLASSES[i].name))
+		{
+			*traffic=(TrafficClass)i;
+			return true;
+		}
+	return false;
+}
+
+int InitSocketUDP(int port, int timeout_ms, TrafficClass traffic)
 {
 	struct sockaddr_in si_me;
 	struct timeval tv;   
@@ -34,6 +79,8 @@ int InitSocketUDP(int port, int timeout_ms)
     si_me.sin_port = htons(port);
     si_me.sin_addr.s_addr = htonl(INADDR_ANY);
      
+	SetTrafficClass(s, traffic);
+
     //bind socket to port
     if( bind(s , (struct sockaddr*)&si_me, sizeof(si_me) ) == -1)
         DieErrno("InitSocketUDP, bind");
@@ -49,9 +96,9 @@ void InitDestinationUDP(struct sockaddr_in *si_dest, const char *host, int port)
 	si_dest->sin_port = htons(port);
 }
 
-void InitNetworkUDP(int *sock, struct sockaddr_in *si_dest,  const char *host, int port, int timeout_ms)
+void InitNetworkUDP(int *sock, struct sockaddr_in *si_dest,  const char *host, int port, int timeout_ms, TrafficClass traffic)
 {
-	*sock=InitSocketUDP(port, timeout_ms);
+	*sock=InitSocketUDP(port, timeout_ms, traffic);
 	
 	if(host)
 		InitDestinationUDP(si_dest, host, port);
@@ -62,15 +109,262 @@ void CloseNetworkUDP(int sock)
 		Die("CloseNetworkUDP, close");
 }
 
-void SendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size)
+// errors of the caller (not of the network), the program can't continue
+bool IsProgrammingErrorUDP(int error)
 {
-	int result;
-	int written=0;
-	
-	while(written<data_size)
+	return error == EBADF || error == EFAULT || error == EINVAL || error == ENOTSOCK || error == EMSGSIZE || error == EDESTADDRREQ;
+}
+
+// local congestion, the packet may be sent later
+bool IsCongestionUDP(int error)
+{
+	return error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS;
+}
+
+bool SendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size)
+{
+	//UDP datagram is sent whole or not at all
+	if(sendto(sock, data, data_size, 0, (struct sockaddr*)&dest, sizeof(dest)) == data_size)
+		return true;
+
+	if(IsProgrammingErrorUDP(errno))
+		DieErrno("SendToUDP, sendto failed");
+
+	return false;
+}
+
+bool TrySendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size)
+{
+	return sendto(sock, data, data_size, 0, (struct sockaddr*)&dest, sizeof(dest)) == data_size;
+}
+
+// host is comma separated list of addresses (or multicast groups)
+void InitDestinationsUDP(udp_sender *sender, const char *host, int port)
+{
+	char hosts[UDP_SENDER_MAX_HOSTS_LENGTH];
+	char *address, *save;
+
+	if(strlen(host) >= sizeof(hosts))
+		Die("InitSenderUDP, host list too long");
+
+	strcpy(hosts, host);
+	sender->destination_count=0;
+
+	for(address=strtok_r(hosts, ",", &save); address != NULL; address=strtok_r(NULL, ",", &save))
 	{
-		if ((result = sendto(sock, data+written, data_size-written, 0, (struct sockaddr*)&dest, sizeof(dest))) == -1)
-			DieErrno("SendToUDP, sendto failed");
-		written += result;		
+		udp_destination *destination=sender->destinations + sender->destination_count;
+
+		if(sender->destination_count == UDP_SENDER_MAX_DESTINATIONS)
+			Die("InitSenderUDP, too many destinations");
+
+		memset(destination, 0, sizeof(*destination));
+		InitDestinationUDP(&destination->address, address, port);
+		++sender->destination_count;
 	}
-}
\ No newline at end of file
+
+	if(sender->destination_count == 0)
+		Die("InitSenderUDP, no destination");
+}
+
+// only if some destination is multicast group, the options are not set for unicast
+void InitMulticastUDP(udp_sender *sender, const udp_sender_config &config)
+{
+	ip_mreqn interface;
+	unsigned char ttl=config.multicast_ttl, loop=config.multicast_loop;
+	bool multicast=false;
+
+	for(int i=0;i<sender->destination_count;++i)
+		multicast |= IN_MULTICAST(ntohl(sender->destinations[i].address.sin_addr.s_addr));
+
+	if(!multicast)
+		return;
+
+	if(config.multicast_ttl > 0 && setsockopt(sender->socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == -1)
+		DieErrno("InitSenderUDP, setsockopt IP_MULTICAST_TTL");
+
+	if(config.multicast_loop >= 0 && setsockopt(sender->socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == -1)
+		DieErrno("InitSenderUDP, setsockopt IP_MULTICAST_LOOP");
+
+	if(config.multicast_interface == NULL)
+		return;
+
+	memset(&interface, 0, sizeof(interface));
+
+	if(inet_pton(AF_INET, config.multicast_interface, &interface.imr_address) != 1
+	&& (interface.imr_ifindex=if_nametoindex(config.multicast_interface)) == 0)
+		Die("InitSenderUDP, multicast interface is neither address nor interface name");
+
+	if(setsockopt(sender->socket, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) == -1)
+		DieErrno("InitSenderUDP, setsockopt IP_MULTICAST_IF");
+}
+
+void InitSenderUDP(udp_sender *sender, const char *host, int port, int packet_bytes, const udp_sender_config &config)
+{
+	int flags;
+
+	if(config.queue_packets < 0 || packet_bytes <= 0)
+		Die("InitSenderUDP, invalid configuration");
+
+	InitNetworkUDP(&sender->socket, NULL, NULL, port, 0, config.traffic);
+	InitDestinationsUDP(sender, host, port);
+	InitMulticastUDP(sender, config);
+
+	//single destination (host or multicast group) is connected, route and destination are resolved once
+	//with more destinations every packet is one sendmmsg call with message for each of them
+	sender->connected = sender->destination_count == 1;
+
+	if( sender->connected && connect(sender->socket, (struct sockaddr*)&sender->destinations[0].address, sizeof(sockaddr_in)) == -1 )
+		DieErrno("InitSenderUDP, connect");
+
+	if( (flags=fcntl(sender->socket, F_GETFL, 0)) == -1 || fcntl(sender->socket, F_SETFL, flags | O_NONBLOCK) == -1 )
+		DieErrno("InitSenderUDP, fcntl");
+
+	if(config.send_buffer_bytes > 0 && setsockopt(sender->socket, SOL_SOCKET, SO_SNDBUF, &config.send_buffer_bytes, sizeof(config.send_buffer_bytes)) == -1)
+		DieErrno("InitSenderUDP, setsockopt SO_SNDBUF");
+
+	sender->policy=config.policy;
+	sender->capacity=config.queue_packets;
+	sender->packet_bytes=packet_bytes;
+	sender->head=sender->count=0;
+	sender->sent=sender->deferred=sender->dropped=sender->errors=0;
+	sender->queue=NULL;
+	sender->lengths=sender->next_destinations=NULL;
+
+	if(sender->capacity == 0)
+		return;
+
+	sender->queue=(char*)malloc(sender->capacity*packet_bytes);
+	sender->lengths=(int*)malloc(sender->capacity*sizeof(int));
+	sender->next_destinations=(int*)malloc(sender->capacity*sizeof(int));
+
+	if(sender->queue == NULL || sender->lengths == NULL || sender->next_destinations == NULL)
+		Die("InitSenderUDP, out of memory");
+}
+
+void CloseSenderUDP(udp_sender *sender)
+{
+	free(sender->queue);
+	free(sender->lengths);
+	free(sender->next_destinations);
+	CloseNetworkUDP(sender->socket);
+}
+
+// sends to destinations from *next, false on congestion (*next is the first destination not sent to)
+// other errors are counted for the destination and the rest get the packet anyway
+bool SendDestinationsUDP(udp_sender *sender, const char *data, int data_size, int *next)
+{
+	mmsghdr messages[UDP_SENDER_MAX_DESTINATIONS];
+	iovec vector={(void*)data, (size_t)data_size};
+	int count=sender->destination_count, sent;
+
+	for(int i=*next;i<count;++i)
+	{
+		memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+		messages[i].msg_hdr.msg_iov=&vector;
+		messages[i].msg_hdr.msg_iovlen=1;
+		messages[i].msg_hdr.msg_name = sender->connected ? NULL : &sender->destinations[i].address;
+		messages[i].msg_hdr.msg_namelen = sender->connected ? 0 : sizeof(sockaddr_in);
+	}
+
+	while(*next < count)
+	{
+		if( (sent=sendmmsg(sender->socket, messages + *next, count - *next, 0)) > 0 )
+		{
+			for(int i=0;i<sent;++i)
+				++sender->destinations[*next+i].sent;
+			sender->sent += sent;
+			*next += sent;
+			continue;
+		}
+
+		if(IsCongestionUDP(errno))
+			return false;
+
+		if(IsProgrammingErrorUDP(errno))
+			DieErrno("SendSenderUDP, sendmmsg failed");
+
+		//e.g. ECONNREFUSED (connected, nobody listens yet), ENETUNREACH (WiFi lost), EHOSTUNREACH (one consumer gone)
+		++sender->destinations[*next].errors;
+		++sender->errors;
+		++*next;
+	}
+
+	return true;
+}
+
+void QueueSenderUDP(udp_sender *sender, const char *data, int data_size, int next_destination)
+{
+	int slot;
+
+	if(sender->count == sender->capacity)
+	{
+		++sender->dropped;
+
+		if(sender->policy == UDP_DROP_NEWEST || sender->capacity == 0)
+			return;
+
+		sender->head=(sender->head+1) % sender->capacity;
+		--sender->count;
+	}
+
+	slot=(sender->head + sender->count) % sender->capacity;
+	memcpy(sender->queue + slot*sender->packet_bytes, data, data_size);
+	sender->lengths[slot]=data_size;
+	sender->next_destinations[slot]=next_destination;
+	++sender->count;
+	++sender->deferred;
+}
+
+bool SendSenderUDP(udp_sender *sender, const char *data, int data_size)
+{
+	uint32_t errors=sender->errors;
+	int next=0;
+
+	if(data_size > sender->packet_bytes)
+		Die("SendSenderUDP, packet larger than declared");
+
+	//the order is kept, nothing overtakes the queued packets
+	if(FlushSenderUDP(sender) > 0)
+	{
+		QueueSenderUDP(sender, data, data_size, 0);
+		return true;
+	}
+
+	if( !SendDestinationsUDP(sender, data, data_size, &next) )
+		QueueSenderUDP(sender, data, data_size, next);
+
+	return sender->errors == errors;
+}
+
+int FlushSenderUDP(udp_sender *sender)
+{
+	while(sender->count > 0)
+	{
+		int head=sender->head;
+
+		if( !SendDestinationsUDP(sender, sender->queue + head*sender->packet_bytes, sender->lengths[head], sender->next_destinations + head) )
+			break;
+
+		sender->head=(head+1) % sender->capacity;
+		--sender->count;
+	}
+
+	return sender->count;
+}
+
+int ReadErrorSenderUDP(udp_sender *sender)
+{
+	int error=0;
+	socklen_t length=sizeof(error);
+
+	if(getsockopt(sender->socket, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		DieErrno("ReadErrorSenderUDP, getsockopt");
+
+	if(error != 0)
+	{
+		++sender->destinations[0].errors;
+		++sender->errors;
+	}
+
+	return error;
+}
@@ -1,8 +1,100 @@
 #pragma once
 
 #include <netinet/in.h> //socaddr_in
+#include <stdint.h> //uint32_t
 
-void InitNetworkUDP(int *sock,struct sockaddr_in *si_dest,  const char *host, int port, int timeout_ms);
+/*
+ * Traffic class of the socket, on congested WiFi the control traffic is not queued behind the bulk
+ *
+ * Sets DSCP (IP_TOS, WiFi WMM access category is derived from it) and SO_PRIORITY (qdisc band, e.g. pfifo_fast):
+ * - TRAFFIC_CONTROL: ev3drive, ev3control, clock synchronization - DSCP EF, priority 6 (interactive)
+ * - TRAFFIC_STATE: odometry, dead-reconning - DSCP AF41, priority 4 (interactive bulk)
+ * - TRAFFIC_BULK: laser, wifi, statistics - DSCP CS1, priority 2 (bulk)
+ * - TRAFFIC_DEFAULT: the socket is not changed
+ */
+enum TrafficClass {TRAFFIC_DEFAULT, TRAFFIC_CONTROL, TRAFFIC_STATE, TRAFFIC_BULK};
+
+void SetTrafficClass(int sock, TrafficClass traffic);
+// "default", "control", "state" or "bulk", false if name is not one of them
+bool ParseTrafficClass(const char *name, TrafficClass *traffic);
+
+void InitNetworkUDP(int *sock,struct sockaddr_in *si_dest,  const char *host, int port, int timeout_ms, TrafficClass traffic);
+void InitDestinationUDP(struct sockaddr_in *si_dest, const char *host, int port);
 void CloseNetworkUDP(int sock);
-void SendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size);
+// false on network failure or congestion (errno is set), dies only on programming errors
+bool SendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size);
+// single sendto attempt, false on failure (errno is set)
+bool TrySendToUDP(int sock, const struct sockaddr_in &dest, const char *data, int data_size);
+
+/*
+ * Non-blocking sender with bounded queue to one or more destinations
+ *
+ * host is an address, multicast group or comma separated list of them (e.g. "192.168.0.103,192.168.0.110").
+ * Single destination is connect()ed (route resolved once), with more destinations every packet is sent
+ * in one sendmmsg call with message for each destination. Errors that sendmmsg reports (e.g. ENETUNREACH,
+ * EHOSTUNREACH of the route) are counted per destination, the other destinations get the packet anyway.
+ * Asynchronous ICMP errors (e.g. port unreachable, ECONNREFUSED) are reported only for single (connected)
+ * destination, unconnected socket doesn't get them.
+ *
+ * Multicast groups among destinations get IP_MULTICAST_TTL, IP_MULTICAST_IF and IP_MULTICAST_LOOP from config.
+ *
+ * Packets that can't be sent because of local congestion (socket buffer full, EAGAIN/ENOBUFS)
+ * are queued (with the destinations not sent to yet) and sent before the next ones
+ * (FlushSenderUDP, e.g. on EPOLLOUT of sender.socket).
+ * When the queue is full the policy drops the newest (the packet being sent) or the oldest queued packet.
+ * With queue_packets 0 congested packets are dropped immediately.
+ */
+
+const int UDP_SENDER_MAX_DESTINATIONS=8;
+const int UDP_SENDER_MAX_HOSTS_LENGTH=UDP_SENDER_MAX_DESTINATIONS*16;
+
+enum UDPDropPolicy {UDP_DROP_NEWEST, UDP_DROP_OLDEST};
+
+struct udp_sender_config
+{
+	int queue_packets;
+	UDPDropPolicy policy;
+	int send_buffer_bytes; //SO_SNDBUF, 0 for system default
+	TrafficClass traffic;
+	int multicast_ttl; //hops, 0 for system default (1, local network)
+	const char *multicast_interface; //address or name (e.g. wlan0), NULL for the route of the group
+	int multicast_loop; //copy to local listeners, 0 or 1, -1 for system default (1)
+};
+
+struct udp_destination
+{
+	sockaddr_in address;
+	uint32_t sent;
+	uint32_t errors;
+};
+
+struct udp_sender
+{
+	int socket;
+	udp_destination destinations[UDP_SENDER_MAX_DESTINATIONS];
+	int destination_count;
+	bool connected; //single destination
+	UDPDropPolicy policy;
+	char *queue; //capacity slots of packet_bytes
+	int *lengths;
+	int *next_destinations; //the first destination queued packet was not sent to
+	int capacity;
+	int packet_bytes; //max
+	int head;
+	int count; //queued now
+	uint32_t sent; //datagrams, sum of destinations
+	uint32_t deferred; //queued because of congestion
+	uint32_t dropped; //by the policy
+	uint32_t errors; //of all destinations, failed for other reasons than congestion
+};
 
+// socket is bound to port as with InitNetworkUDP, destinations have the same port
+void InitSenderUDP(udp_sender *sender, const char *host, int port, int packet_bytes, const udp_sender_config &config);
+void CloseSenderUDP(udp_sender *sender);
+// false if the packet was lost for some destination because of network error (not congestion)
+// dies only on programming errors
+bool SendSenderUDP(udp_sender *sender, const char *data, int data_size);
+// sends queued packets while possible, returns the number of packets still queued
+int FlushSenderUDP(udp_sender *sender);
+// reads (and counts) pending asynchronous error of connected socket, e.g. ICMP port unreachable (EPOLLERR)
+int ReadErrorSenderUDP(udp_sender *sender);
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <stdint.h> //uint16_t, uint32_t, uint64_t
+#include <string.h> //memcpy
+#include <endian.h> //htobe16, htobe32, htobe64, be16toh, be32toh, be64toh
+#include <type_traits> //remove_extent
+
+/*
+ * Compile-time packet codec
+ *
+ * Packet layout is declared once as a list of fields, encoding/decoding and size are generated from it:
+ *
+ * typedef PacketCodec<odometry_packet,
+ *	PACKET_FIELD(odometry_packet, timestamp_us),
+ *	PACKET_FIELD(odometry_packet, position_left),
+ *	PacketConstant<int16_t, 0> > odometry_codec;
+ *
+ * odometry_codec::BYTES is constexpr, odometry_codec::Encode(packet, buffer), odometry_codec::Decode(&packet, buffer)
+ *
+ * - integers are big endian (network order), the byte order is chosen at compile time
+ * - arrays are encoded element after element, char/uint8_t arrays as raw bytes
+ * - other element types need PacketValue specialization (see laser_reading in packets.h)
+ * - everything is inlined, the generated code is the same as hand-written (see bench/packet_codec_bench.cpp)
+ * - buffers don't have to be aligned
+ *
+ * PacketView<odometry_codec> reads single fields in place (no copy of the packet), view.Get<1>() is position_left
+ */
+
+template <int BYTES> struct PacketByteOrder;
+
+template <> struct PacketByteOrder<1>
+{
+	typedef uint8_t type;
+	static type ToNetwork(type value) { return value; }
+	static type FromNetwork(type value) { return value; }
+};
+
+template <> struct PacketByteOrder<2>
+{
+	typedef uint16_t type;
+	static type ToNetwork(type value) { return htobe16(value); }
+	static type FromNetwork(type value) { return be16toh(value); }
+};
+
+template <> struct PacketByteOrder<4>
+{
+	typedef uint32_t type;
+	static type ToNetwork(type value) { return htobe32(value); }
+	static type FromNetwork(type value) { return be32toh(value); }
+};
+
+template <> struct PacketByteOrder<8>
+{
+	typedef uint64_t type;
+	static type ToNetwork(type value) { return htobe64(value); }
+	static type FromNetwork(type value) { return be64toh(value); }
+};
+
+// encoding of single value, integers and enums by default
+template <typename T>
+struct PacketValue
+{
+	typedef PacketByteOrder<sizeof(T)> order;
+	static constexpr int BYTES=sizeof(T);
+
+	static void Put(char *data, const T &value)
+	{
+		typename order::type network=order::ToNetwork((typename order::type)value);
+		memcpy(data, &network, BYTES);
+	}
+	static void Get(const char *data, T *value)
+	{
+		typename order::type network;
+		memcpy(&network, data, BYTES);
+		*value=(T)order::FromNetwork(network);
+	}
+};
+
+// arrays, element after element
+template <typename T, int N>
+struct PacketValue<T[N]>
+{
+	static constexpr int BYTES=N*PacketValue<T>::BYTES;
+
+	static void Put(char *data, const T (&value)[N])
+	{
+		for(int i=0;i<N;++i)
+			PacketValue<T>::Put(data + i*PacketValue<T>::BYTES, value[i]);
+	}
+	static void Get(const char *data, T (*value)[N])
+	{
+		for(int i=0;i<N;++i)
+			PacketValue<T>::Get(data + i*PacketValue<T>::BYTES, *value + i);
+	}
+};
+
+// raw bytes (bssid, ssid)
+template <int N>
+struct PacketBytes
+{
+	static constexpr int BYTES=N;
+
+	template <typename T>
+	static void Put(char *data, const T (&value)[N]) { memcpy(data, value, N); }
+	template <typename T>
+	static void Get(const char *data, T (*value)[N]) { memcpy(*value, data, N); }
+};
+
+template <int N> struct PacketValue<char[N]> : PacketBytes<N> {};
+template <int N> struct PacketValue<uint8_t[N]> : PacketBytes<N> {};
+
+// member of packet struct
+template <typename P, typename T, T P::*MEMBER>
+struct PacketField
+{
+	typedef T value_type;
+	static constexpr int BYTES=PacketValue<T>::BYTES;
+
+	static void Encode(const P &packet, char *data) { PacketValue<T>::Put(data, packet.*MEMBER); }
+	static void Decode(P *packet, const char *data) { PacketValue<T>::Get(data, &(packet->*MEMBER)); }
+};
+
+#define PACKET_FIELD(packet, member) PacketField<packet, decltype(packet::member), &packet::member>
+
+// value that is always the same on the wire (reserved fields), ignored when decoding
+template <typename T, T VALUE>
+struct PacketConstant
+{
+	typedef T value_type;
+	static constexpr int BYTES=PacketValue<T>::BYTES;
+
+	template <typename P>
+	static void Encode(const P &, char *data) { PacketValue<T>::Put(data, VALUE); }
+	template <typename P>
+	static void Decode(P *, const char *) {}
+};
+
+// fields one after another
+template <typename P, typename... FIELDS>
+struct PacketCodec;
+
+template <typename P>
+struct PacketCodec<P>
+{
+	typedef P packet_type;
+	static constexpr int BYTES=0;
+
+	static int Encode(const P &, char *) { return 0; }
+	static int Decode(P *, const char *) { return 0; }
+};
+
+template <typename P, typename FIELD, typename... FIELDS>
+struct PacketCodec<P, FIELD, FIELDS...>
+{
+	typedef P packet_type;
+	static constexpr int BYTES=FIELD::BYTES + PacketCodec<P, FIELDS...>::BYTES;
+
+	// returns BYTES
+	static int Encode(const P &packet, char *data)
+	{
+		FIELD::Encode(packet, data);
+		PacketCodec<P, FIELDS...>::Encode(packet, data + FIELD::BYTES);
+		return BYTES;
+	}
+	// data has to have BYTES, returns BYTES
+	static int Decode(P *packet, const char *data)
+	{
+		FIELD::Decode(packet, data);
+		PacketCodec<P, FIELDS...>::Decode(packet, data + FIELD::BYTES);
+		return BYTES;
+	}
+};
+
+// I-th field of codec and its offset in encoded packet
+template <typename CODEC, int I>
+struct PacketCodecField;
+
+template <typename P, typename FIELD, typename... FIELDS>
+struct PacketCodecField<PacketCodec<P, FIELD, FIELDS...>, 0>
+{
+	typedef FIELD type;
+	static constexpr int OFFSET=0;
+};
+
+template <typename P, typename FIELD, typename... FIELDS, int I>
+struct PacketCodecField<PacketCodec<P, FIELD, FIELDS...>, I>
+{
+	typedef PacketCodecField<PacketCodec<P, FIELDS...>, I-1> next;
+	typedef typename next::type type;
+	static constexpr int OFFSET=FIELD::BYTES + next::OFFSET;
+};
+
+// read-only view of encoded packet, fields are decoded on access
+template <typename CODEC>
+struct PacketView
+{
+	const char *data; //CODEC::BYTES of encoded packet
+
+	// I-th field value
+	template <int I>
+	typename PacketCodecField<CODEC, I>::type::value_type Get() const
+	{
+		typedef PacketCodecField<CODEC, I> field;
+		typename field::type::value_type value;
+		PacketValue<typename field::type::value_type>::Get(data + field::OFFSET, &value);
+		return value;
+	}
+	// element of I-th field array
+	template <int I>
+	typename std::remove_extent<typename PacketCodecField<CODEC, I>::type::value_type>::type Element(int index) const
+	{
+		typedef PacketCodecField<CODEC, I> field;
+		typedef typename std::remove_extent<typename field::type::value_type>::type element_type;
+		element_type value;
+		PacketValue<element_type>::Get(data + field::OFFSET + index*PacketValue<element_type>::BYTES, &value);
+		return value;
+	}
+	// raw bytes of I-th field (bssid, ssid)
+	template <int I>
+	const char *Bytes() const
+	{
+		return data + PacketCodecField<CODEC, I>::OFFSET;
+	}
+};
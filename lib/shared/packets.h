@@ -0,0 +1,182 @@
+#pragma once
+
+#include "packet_codec.h"
+
+/*
+ * Packets of the modules, the layouts are declared once here (see packet_codec.h)
+ *
+ * The encoded packets (big endian) are sent over UDP, published on shared-memory bus
+ * and recorded by ev3recorder as they are.
+ *
+ * Packets of sensor modules (odometry, dead-reconning, laser, wifi) start with common header
+ * (added by module runtime), the payload follows it. The payloads start with timestamp_us.
+ */
+
+// common header, version 1
+// packets without header (before version 1) start with timestamp_us, its first byte is 0 (not a version)
+const uint8_t PACKET_VERSION=1;
+
+enum PacketType {PACKET_ODOMETRY=1, PACKET_DEAD_RECONNING=2, PACKET_LASER=3, PACKET_WIFI=4};
+
+struct packet_header
+{
+	uint8_t version; //PACKET_VERSION
+	uint8_t type; //PacketType, the layout of payload
+	uint16_t stream; //stream id, UDP port of the module (e.g. two lasers have different ones)
+	uint32_t sequence; //of the packets sent by module instance, from 0, wraps around
+};
+
+// version u8 | type u8 | stream u16 | sequence u32
+typedef PacketCodec<packet_header,
+	PACKET_FIELD(packet_header, version),
+	PACKET_FIELD(packet_header, type),
+	PACKET_FIELD(packet_header, stream),
+	PACKET_FIELD(packet_header, sequence)> packet_header_codec;
+
+const int PACKET_HEADER_BYTES=packet_header_codec::BYTES;
+
+// ev3odometry, binary compatible with dead-reconning packets (reserved field for heading)
+struct odometry_packet
+{
+	uint64_t timestamp_us;
+	int32_t position_left;
+	int32_t position_right;
+	int16_t reserved1;
+};
+
+// timestamp_us u64 | position_left i32 | position_right i32 | reserved i16 (0)
+typedef PacketCodec<odometry_packet,
+	PACKET_FIELD(odometry_packet, timestamp_us),
+	PACKET_FIELD(odometry_packet, position_left),
+	PACKET_FIELD(odometry_packet, position_right),
+	PacketConstant<int16_t, 0> > odometry_codec;
+
+const int ODOMETRY_PACKET_BYTES=odometry_codec::BYTES;
+
+// ev3dead-reconning
+struct dead_reconning_packet
+{
+	uint64_t timestamp_us;
+	int32_t position_left;
+	int32_t position_right;
+	int16_t heading;
+};
+
+// timestamp_us u64 | position_left i32 | position_right i32 | heading i16
+typedef PacketCodec<dead_reconning_packet,
+	PACKET_FIELD(dead_reconning_packet, timestamp_us),
+	PACKET_FIELD(dead_reconning_packet, position_left),
+	PACKET_FIELD(dead_reconning_packet, position_right),
+	PACKET_FIELD(dead_reconning_packet, heading)> dead_reconning_codec;
+
+const int DEAD_RECONNING_PACKET_BYTES=dead_reconning_codec::BYTES;
+
+// ev3wifi
+const int WIFI_BSSID_BYTES=6; //BSSID_LENGTH of wifi-scan
+const int WIFI_SSID_BYTES=33; //SSID_MAX_LENGTH_WITH_NULL of wifi-scan
+
+struct wifi_packet
+{
+	uint64_t timestamp_us;
+	uint8_t bssid[WIFI_BSSID_BYTES]; //this is hardware mac address of your AP
+	char ssid[WIFI_SSID_BYTES]; //this is the name of your AP as you see it when connecting
+	int8_t signal_dbm;  //signal strength in dBm from last received PPDU, you may need to average that
+	uint32_t rx_packets; //the number of received packets
+	uint32_t tx_packets; //the number of transmitted packets
+};
+
+// timestamp_us u64 | bssid 6 bytes | ssid 33 bytes ('\0' terminated) | signal_dbm i8 | rx_packets u32 | tx_packets u32
+typedef PacketCodec<wifi_packet,
+	PACKET_FIELD(wifi_packet, timestamp_us),
+	PACKET_FIELD(wifi_packet, bssid),
+	PACKET_FIELD(wifi_packet, ssid),
+	PACKET_FIELD(wifi_packet, signal_dbm),
+	PACKET_FIELD(wifi_packet, rx_packets),
+	PACKET_FIELD(wifi_packet, tx_packets)> wifi_codec;
+
+const int WIFI_PACKET_BYTES=wifi_codec::BYTES;
+
+// ev3laser
+const int LASER_FRAMES_PER_READ=10;
+const int LASER_READINGS_PER_FRAME=4;
+
+// the same memory layout as xv11lidar_reading (2 x 16 bits, distance with flags and signal strength)
+struct laser_reading
+{
+	uint16_t distance_flags;
+	uint16_t signal_strength;
+};
+
+template <>
+struct PacketValue<laser_reading>
+{
+	static constexpr int BYTES=4;
+
+	static void Put(char *data, const laser_reading &value)
+	{
+		PacketValue<uint16_t>::Put(data, value.distance_flags);
+		PacketValue<uint16_t>::Put(data+2, value.signal_strength);
+	}
+	static void Get(const char *data, laser_reading *value)
+	{
+		PacketValue<uint16_t>::Get(data, &value->distance_flags);
+		PacketValue<uint16_t>::Get(data+2, &value->signal_strength);
+	}
+};
+
+struct laser_packet
+{
+	uint64_t timestamp_us;
+	uint16_t laser_speed; //fixed point, 6 bits precision, divide by 64.0 to get floating point
+	uint16_t laser_angle; //angle of laser_readings[0]
+	laser_reading laser_readings[LASER_READINGS_PER_FRAME*LASER_FRAMES_PER_READ];
+};
+
+// timestamp_us u64 | laser_speed u16 (rpm*64) | laser_angle u16 | 4*LASER_FRAMES_PER_READ readings (2 x u16)
+typedef PacketCodec<laser_packet,
+	PACKET_FIELD(laser_packet, timestamp_us),
+	PACKET_FIELD(laser_packet, laser_speed),
+	PACKET_FIELD(laser_packet, laser_angle),
+	PACKET_FIELD(laser_packet, laser_readings)> laser_codec;
+
+const int LASER_PACKET_BYTES=laser_codec::BYTES;
+
+// ev3drive control packet (received), temporary, subject to change
+struct drive_packet
+{
+	uint64_t timestamp_us;
+	int16_t command;
+	int16_t param1;
+	int16_t param2;
+	int16_t param3;
+	int16_t param4;
+};
+
+// timestamp_us u64 | command i16 | param1 i16 | param2 i16 | param3 i16 | param4 i16
+typedef PacketCodec<drive_packet,
+	PACKET_FIELD(drive_packet, timestamp_us),
+	PACKET_FIELD(drive_packet, command),
+	PACKET_FIELD(drive_packet, param1),
+	PACKET_FIELD(drive_packet, param2),
+	PACKET_FIELD(drive_packet, param3),
+	PACKET_FIELD(drive_packet, param4)> drive_codec;
+
+const int DRIVE_PACKET_BYTES=drive_codec::BYTES;
+
+// ev3drive status packet, sent to the drive controller address (the source of the last drive packet)
+struct drive_status_packet
+{
+	uint64_t timestamp_us;
+	int16_t status;
+	int16_t motors; //bitmask of StatusMotors
+	int32_t reaction_us; //time from stall onset (the first monitor sample that saw it) to motors stopped or backing off
+};
+
+// timestamp_us u64 | status i16 | motors i16 | reaction_us i32
+typedef PacketCodec<drive_status_packet,
+	PACKET_FIELD(drive_status_packet, timestamp_us),
+	PACKET_FIELD(drive_status_packet, status),
+	PACKET_FIELD(drive_status_packet, motors),
+	PACKET_FIELD(drive_status_packet, reaction_us)> drive_status_codec;
+
+const int DRIVE_STATUS_PACKET_BYTES=drive_status_codec::BYTES;
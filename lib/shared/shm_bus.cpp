@@ -0,0 +1,238 @@
+#include "shm_bus.h"
+
+#include "misc.h"
+
+#include <sys/mman.h> //shm_open, mmap
+#include <sys/stat.h> //fstat
+#include <fcntl.h> //O_CREAT, O_RDWR
+#include <unistd.h> //ftruncate, close
+#include <string.h> //memcpy, memset, strchr
+#include <stdio.h> //snprintf
+#include <errno.h> //errno
+
+const uint32_t SHM_BUS_MAGIC=0x45563342; //EV3B
+const uint32_t SHM_BUS_VERSION=1;
+
+// magic is written last, the segment is initialized when it is set
+struct shm_bus_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_bytes;
+	uint32_t slots;
+	uint32_t published; //sequence number of the next message to be published
+	uint32_t reserved[3];
+};
+
+// sequence is 2n+1 while message n is written and 2n+2 when it is complete
+struct shm_bus_slot
+{
+	uint32_t sequence;
+	uint32_t length;
+	char data[];
+};
+
+int SlotStride(uint32_t slot_bytes)
+{
+	return (sizeof(shm_bus_slot) + slot_bytes + 7) & ~7;
+}
+
+int SegmentBytes(uint32_t slot_bytes, uint32_t slots)
+{
+	return sizeof(shm_bus_header) + slots * SlotStride(slot_bytes);
+}
+
+shm_bus_slot *Slot(const shm_bus &bus, uint32_t sequence)
+{
+	uint32_t slot=sequence & (bus.header->slots-1);
+	return (shm_bus_slot*)(bus.slots + slot * SlotStride(bus.header->slot_bytes));
+}
+
+void ShmBusName(const char *stream, char *name)
+{
+	if(strchr(stream, '/') || snprintf(name, SHM_BUS_NAME_MAX, "/ev3-%s", stream) >= SHM_BUS_NAME_MAX)
+		Die("ShmBus: invalid stream name");
+}
+
+void MapShmBus(shm_bus *bus, int fd, int bytes, int protection)
+{
+	void *mapped=mmap(NULL, bytes, protection, MAP_SHARED, fd, 0);
+
+	if(mapped == MAP_FAILED)
+		DieErrno("ShmBus: mmap failed");
+
+	bus->header=(shm_bus_header*)mapped;
+	bus->slots=(char*)mapped + sizeof(shm_bus_header);
+	bus->mapped_bytes=bytes;
+	bus->next=0;
+}
+
+bool ShmBusMatches(const shm_bus_header *header, int slot_bytes, int slots)
+{
+	return __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == SHM_BUS_MAGIC && header->version == SHM_BUS_VERSION
+		&& header->slot_bytes == (uint32_t)slot_bytes && header->slots == (uint32_t)slots;
+}
+
+void InitShmBusWriter(shm_bus *bus, const char *stream, int slot_bytes, int slots)
+{
+	char name[SHM_BUS_NAME_MAX];
+	struct stat st;
+	int fd, bytes=SegmentBytes(slot_bytes, slots);
+
+	if(slot_bytes <= 0 || slots <= 0 || (slots & (slots-1)) )
+		Die("ShmBus: slot_bytes has to be positive and slots power of 2");
+
+	ShmBusName(stream, name);
+
+	if( (fd=shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+		DieErrno("ShmBus: shm_open failed");
+	if(fstat(fd, &st) == -1)
+		DieErrno("ShmBus: fstat failed");
+
+	//different geometry, don't shrink the segment under old readers (SIGBUS), start a new one
+	if(st.st_size != 0 && st.st_size != bytes)
+	{
+		close(fd);
+		if(shm_unlink(name) == -1 || (fd=shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+			DieErrno("ShmBus: unable to recreate stream");
+		st.st_size=0;
+	}
+
+	if(st.st_size == 0 && ftruncate(fd, bytes) == -1)
+		DieErrno("ShmBus: ftruncate failed");
+
+	MapShmBus(bus, fd, bytes, PROT_READ | PROT_WRITE);
+	close(fd);
+
+	//the previous writer of the stream (module restart), readers continue
+	if(ShmBusMatches(bus->header, slot_bytes, slots))
+		return;
+
+	__atomic_store_n(&bus->header->magic, 0, __ATOMIC_RELEASE);
+	memset(bus->slots, 0, bytes - sizeof(shm_bus_header));
+	bus->header->version=SHM_BUS_VERSION;
+	bus->header->slot_bytes=slot_bytes;
+	bus->header->slots=slots;
+	bus->header->published=0;
+	__atomic_store_n(&bus->header->magic, SHM_BUS_MAGIC, __ATOMIC_RELEASE);
+}
+
+void PublishShmBus(shm_bus *bus, const char *data, int length)
+{
+	uint32_t sequence=bus->header->published; //only the writer changes it
+	shm_bus_slot *slot=Slot(*bus, sequence);
+
+	if(length < 0 || (uint32_t)length > bus->header->slot_bytes)
+		Die("ShmBus: message doesn't fit slot");
+
+	__atomic_store_n(&slot->sequence, 2*sequence+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); //the odd sequence is visible before any data
+	__atomic_store_n(&slot->length, length, __ATOMIC_RELAXED);
+	memcpy(slot->data, data, length);
+	__atomic_store_n(&slot->sequence, 2*sequence+2, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&bus->header->published, sequence+1, __ATOMIC_RELEASE);
+}
+
+bool InitShmBusReader(shm_bus *bus, const char *stream)
+{
+	char name[SHM_BUS_NAME_MAX];
+	struct stat st;
+	int fd;
+
+	ShmBusName(stream, name);
+
+	if( (fd=shm_open(name, O_RDONLY | O_CLOEXEC, 0)) == -1)
+	{
+		if(errno == ENOENT)
+			return false;
+		DieErrno("ShmBus: shm_open failed");
+	}
+
+	if(fstat(fd, &st) == -1)
+		DieErrno("ShmBus: fstat failed");
+
+	//created but not yet sized by the writer
+	if(st.st_size < (off_t)sizeof(shm_bus_header))
+	{
+		close(fd);
+		return false;
+	}
+
+	MapShmBus(bus, fd, st.st_size, PROT_READ);
+	close(fd);
+
+	const shm_bus_header *header=bus->header;
+
+	if(!ShmBusMatches(header, header->slot_bytes, header->slots) || SegmentBytes(header->slot_bytes, header->slots) != st.st_size)
+	{
+		CloseShmBus(bus);
+		return false;
+	}
+
+	uint32_t published=__atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+	bus->next = published < header->slots ? 0 : published - header->slots;
+	return true;
+}
+
+int ReadShmBus(shm_bus *bus, char *data, uint32_t *lost)
+{
+	const uint32_t slots=bus->header->slots;
+	uint32_t published, sequence, length, overwritten=0;
+
+	for(;;)
+	{
+		published=__atomic_load_n(&bus->header->published, __ATOMIC_ACQUIRE);
+
+		if(published == bus->next)
+		{
+			length=0;
+			break;
+		}
+
+		if(published - bus->next > slots) //the writer lapped us
+		{
+			overwritten += published - slots - bus->next;
+			bus->next = published - slots;
+		}
+
+		const shm_bus_slot *slot=Slot(*bus, bus->next);
+
+		sequence=__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		length=__atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+
+		//published messages are complete, anything else means the slot is being reused
+		if(sequence == 2*bus->next+2 && length <= bus->header->slot_bytes)
+		{
+			memcpy(data, slot->data, length);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE); //data is read before checking sequence again
+
+			if(__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence)
+			{
+				++bus->next;
+				break;
+			}
+		}
+
+		++overwritten;
+		++bus->next;
+	}
+
+	if(lost)
+		*lost += overwritten;
+
+	return length;
+}
+
+int ShmBusSlotBytes(const shm_bus &bus)
+{
+	return bus.header->slot_bytes;
+}
+
+void CloseShmBus(shm_bus *bus)
+{
+	//the stream is not removed, readers may still read the last messages
+	if(munmap(bus->header, bus->mapped_bytes) == -1)
+		DieErrno("ShmBus: munmap failed");
+	bus->header=NULL;
+}
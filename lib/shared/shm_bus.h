@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h> //uint32_t
+
+/*
+ * Shared-memory publish/subscribe bus for consumers running on the robot
+ *
+ * Each stream is a ring of fixed size slots in /dev/shm/ev3-<stream> (e.g. ev3-ev3odometry-8005)
+ * - single writer, publishing is wait-free (never waits for readers)
+ * - any number of readers, reading is lock-free (retries if writer overwrote the slot meanwhile)
+ * - readers that don't keep up lose the oldest messages, they are told how many
+ *
+ * Slots are seqlock protected, counters are 32 bit (EV3 ARMv5 has no 64 bit atomics)
+ * Messages are the same encoded packets that modules send over UDP
+ */
+
+const int SHM_BUS_NAME_MAX=64;
+const int SHM_BUS_DEFAULT_SLOTS=64; //power of 2
+
+struct shm_bus_header;
+
+struct shm_bus
+{
+	shm_bus_header *header; //mapped segment
+	char *slots;
+	int mapped_bytes;
+	uint32_t next; //reader, sequence number of the next message to read
+};
+
+// creates the stream (or reuses it if it was created with the same geometry, e.g. module restart)
+void InitShmBusWriter(shm_bus *bus, const char *stream, int slot_bytes, int slots);
+// publishes message of length <= slot_bytes
+void PublishShmBus(shm_bus *bus, const char *data, int length);
+
+// false if the stream doesn't exist (yet), reading starts from the oldest kept message
+bool InitShmBusReader(shm_bus *bus, const char *stream);
+// copies the next message to data (at least slot_bytes long)
+// returns message length, 0 if there is no new message
+// lost (may be NULL) is increased by the number of messages overwritten before they were read
+int ReadShmBus(shm_bus *bus, char *data, uint32_t *lost);
+// the maximum message length of the stream
+int ShmBusSlotBytes(const shm_bus &bus);
+
+void CloseShmBus(shm_bus *bus);
@@ -0,0 +1,140 @@
+#include "stream_consumer.h"
+
+#include "stream_stats.h"
+#include "net_udp.h"
+#include "misc.h"
+
+#include <stdlib.h> //malloc, free
+#include <errno.h> //errno
+#include <unistd.h> //close
+#include <sys/socket.h> //recvmmsg
+#include <sys/epoll.h> //epoll_create1, epoll_ctl, epoll_wait
+
+// receives from ready socket into slots from first, appends valid packets to datagrams, returns used slots
+int ReceiveStreamSocket(stream_consumer *consumer, int index, int first, int *count);
+
+void InitStreamConsumer(stream_consumer *consumer, const int *ports, int port_count, int batch)
+{
+	epoll_event event;
+
+	if(port_count <= 0 || port_count > STREAM_CONSUMER_MAX_PORTS)
+		Die("InitStreamConsumer: too many ports");
+	if(batch <= 0)
+		Die("InitStreamConsumer: batch has to be positive");
+
+	consumer->port_count=port_count;
+	consumer->batch=batch;
+	consumer->received=consumer->invalid=consumer->receive_calls=0;
+
+	consumer->arena=(char*)malloc(batch*STREAM_CONSUMER_SLOT_BYTES);
+	consumer->messages=(mmsghdr*)calloc(batch, sizeof(mmsghdr));
+	consumer->vectors=(iovec*)malloc(batch*sizeof(iovec));
+	consumer->sources=(sockaddr_in*)malloc(batch*sizeof(sockaddr_in));
+	consumer->datagrams=(stream_datagram*)malloc(batch*sizeof(stream_datagram));
+
+	if(!consumer->arena || !consumer->messages || !consumer->vectors || !consumer->sources || !consumer->datagrams)
+		Die("InitStreamConsumer: out of memory");
+
+	//the slots never move, the message headers point to them once for all
+	for(int i=0;i<batch;++i)
+	{
+		consumer->vectors[i].iov_base=consumer->arena + i*STREAM_CONSUMER_SLOT_BYTES;
+		consumer->vectors[i].iov_len=STREAM_CONSUMER_SLOT_BYTES;
+		consumer->messages[i].msg_hdr.msg_iov=consumer->vectors + i;
+		consumer->messages[i].msg_hdr.msg_iovlen=1;
+		consumer->messages[i].msg_hdr.msg_name=consumer->sources + i;
+	}
+
+	if( (consumer->epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DieErrno("InitStreamConsumer: epoll_create1");
+
+	for(int i=0;i<port_count;++i)
+	{
+		consumer->ports[i]=ports[i];
+		InitNetworkUDP(consumer->sockets + i, NULL, NULL, ports[i], 0, TRAFFIC_DEFAULT);
+
+		event.events=EPOLLIN;
+		event.data.u32=i;
+		if(epoll_ctl(consumer->epoll_fd, EPOLL_CTL_ADD, consumer->sockets[i], &event) == -1)
+			DieErrno("InitStreamConsumer: epoll_ctl");
+	}
+}
+
+int ReceiveStreamConsumer(stream_consumer *consumer, int timeout_ms)
+{
+	epoll_event events[STREAM_CONSUMER_MAX_PORTS];
+	int ready, slots=0, count=0;
+
+	if( (ready=epoll_wait(consumer->epoll_fd, events, consumer->port_count, timeout_ms)) == -1)
+	{
+		if(errno == EINTR)
+			return 0;
+		DieErrno("ReceiveStreamConsumer: epoll_wait");
+	}
+
+	//the slots are shared by ready sockets, the rest waits for the next call (level triggered)
+	for(int i=0;i<ready && slots < consumer->batch;++i)
+		slots += ReceiveStreamSocket(consumer, events[i].data.u32, slots, &count);
+
+	return count;
+}
+
+int ReceiveStreamSocket(stream_consumer *consumer, int index, int first, int *count)
+{
+	mmsghdr *messages=consumer->messages + first;
+	uint64_t arrival_us;
+	int received;
+
+	for(int i=0;i<consumer->batch-first;++i)
+		messages[i].msg_hdr.msg_namelen=sizeof(sockaddr_in);
+
+	if( (received=recvmmsg(consumer->sockets[index], messages, consumer->batch-first, MSG_DONTWAIT, NULL)) == -1)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		DieErrno("ReceiveStreamConsumer: recvmmsg");
+	}
+
+	arrival_us=TimestampUs();
+	++consumer->receive_calls;
+
+	//valid packets are compacted in datagrams, they keep pointing to their slots
+	for(int i=0;i<received;++i)
+	{
+		stream_datagram *datagram=consumer->datagrams + *count;
+		const char *data=(const char*)consumer->vectors[first+i].iov_base;
+		int length=messages[i].msg_len;
+
+		if( (messages[i].msg_hdr.msg_flags & MSG_TRUNC) || !DecodeStreamHeader(data, length, &datagram->header))
+		{
+			++consumer->invalid;
+			continue;
+		}
+
+		datagram->data=data;
+		datagram->length=length;
+		datagram->payload=data + PACKET_HEADER_BYTES;
+		datagram->port=consumer->ports[index];
+		datagram->source=consumer->sources[first+i];
+		datagram->arrival_us=arrival_us;
+		++consumer->received;
+		++*count;
+	}
+
+	return received;
+}
+
+void CloseStreamConsumer(stream_consumer *consumer)
+{
+	for(int i=0;i<consumer->port_count;++i)
+		CloseNetworkUDP(consumer->sockets[i]);
+
+	if(close(consumer->epoll_fd) == -1)
+		DieErrno("CloseStreamConsumer: close");
+
+	free(consumer->arena);
+	free(consumer->messages);
+	free(consumer->vectors);
+	free(consumer->sources);
+	free(consumer->datagrams);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "packets.h"
+
+#include <stdint.h> //uint64_t
+#include <netinet/in.h> //sockaddr_in
+
+struct mmsghdr;
+struct iovec;
+
+/*
+ * Consumer of module streams (on the host, e.g. logging and monitoring)
+ *
+ * Listens on UDP ports of the modules and receives datagrams in batches (one recvmmsg call
+ * per ready socket) into arena of fixed slots allocated once. Only packets with valid header
+ * (see DecodeStreamHeader in stream_stats.h) are returned, the payload is not copied or decoded,
+ * typed views below read the fields in place.
+ *
+ * stream_consumer consumer;
+ * InitStreamConsumer(&consumer, ports, port_count, STREAM_CONSUMER_DEFAULT_BATCH);
+ * n=ReceiveStreamConsumer(&consumer, 1000);
+ * for(int i=0;i<n;++i)
+ *	if(consumer.datagrams[i].header.type == PACKET_ODOMETRY)
+ *		StreamView<odometry_view>(consumer.datagrams[i]).position_left();
+ * CloseStreamConsumer(&consumer);
+ *
+ * The datagrams (and views) are valid until the next ReceiveStreamConsumer call.
+ */
+
+const int STREAM_CONSUMER_MAX_PORTS=16;
+const int STREAM_CONSUMER_DEFAULT_BATCH=64;
+const int STREAM_CONSUMER_SLOT_BYTES=1472; //UDP payload that fits ethernet MTU
+
+struct stream_datagram
+{
+	packet_header header;
+	const char *data; //the whole packet, in consumer arena
+	int length;
+	const char *payload; //after header, PacketPayloadBytes(header.type)
+	int port; //local port it was received on
+	sockaddr_in source;
+	uint64_t arrival_us; //TimestampUs after recvmmsg returned (the same for the batch from one socket)
+};
+
+struct stream_consumer
+{
+	int sockets[STREAM_CONSUMER_MAX_PORTS];
+	int ports[STREAM_CONSUMER_MAX_PORTS];
+	int port_count;
+	int epoll_fd;
+	int batch; //max datagrams per ReceiveStreamConsumer
+	char *arena; //batch slots of STREAM_CONSUMER_SLOT_BYTES
+	mmsghdr *messages;
+	iovec *vectors;
+	sockaddr_in *sources;
+	stream_datagram *datagrams; //received by the last ReceiveStreamConsumer
+	uint64_t received; //valid packets
+	uint64_t invalid; //without header or truncated
+	uint64_t receive_calls; //recvmmsg calls
+};
+
+void InitStreamConsumer(stream_consumer *consumer, const int *ports, int port_count, int batch);
+// waits up to timeout_ms (-1 without limit) for datagrams, receives up to batch of them
+// returns the number of valid packets in consumer->datagrams, 0 on timeout or signal
+int ReceiveStreamConsumer(stream_consumer *consumer, int timeout_ms);
+void CloseStreamConsumer(stream_consumer *consumer);
+
+// typed views over payloads, fields are decoded on access
+
+struct odometry_view : PacketView<odometry_codec>
+{
+	uint64_t timestamp_us() const { return Get<0>(); }
+	int32_t position_left() const { return Get<1>(); }
+	int32_t position_right() const { return Get<2>(); }
+};
+
+struct dead_reconning_view : PacketView<dead_reconning_codec>
+{
+	uint64_t timestamp_us() const { return Get<0>(); }
+	int32_t position_left() const { return Get<1>(); }
+	int32_t position_right() const { return Get<2>(); }
+	int16_t heading() const { return Get<3>(); }
+};
+
+struct wifi_view : PacketView<wifi_codec>
+{
+	uint64_t timestamp_us() const { return Get<0>(); }
+	const uint8_t *bssid() const { return (const uint8_t*)Bytes<1>(); } //WIFI_BSSID_BYTES
+	const char *ssid() const { return Bytes<2>(); } //WIFI_SSID_BYTES, not terminated if sender didn't terminate it
+	int8_t signal_dbm() const { return Get<3>(); }
+	uint32_t rx_packets() const { return Get<4>(); }
+	uint32_t tx_packets() const { return Get<5>(); }
+};
+
+struct laser_view : PacketView<laser_codec>
+{
+	static const int READINGS=LASER_READINGS_PER_FRAME*LASER_FRAMES_PER_READ;
+
+	uint64_t timestamp_us() const { return Get<0>(); }
+	uint16_t laser_speed() const { return Get<1>(); }
+	uint16_t laser_angle() const { return Get<2>(); }
+	laser_reading reading(int index) const { return Element<3>(index); } //index < READINGS
+};
+
+// the caller checks the datagram type
+template <typename VIEW>
+VIEW StreamView(const stream_datagram &datagram)
+{
+	VIEW view;
+	view.data=datagram.payload;
+	return view;
+}
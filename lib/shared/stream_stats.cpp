@@ -0,0 +1,155 @@
+#include "stream_stats.h"
+
+#include <string.h> //memset
+
+void InitStreamStats(stream_stats_table *table)
+{
+	memset(table, 0, sizeof(*table));
+}
+
+const char *PacketTypeName(int type)
+{
+	switch(type)
+	{
+		case PACKET_ODOMETRY: return "odometry";
+		case PACKET_DEAD_RECONNING: return "dead-reconning";
+		case PACKET_LASER: return "laser";
+		case PACKET_WIFI: return "wifi";
+	}
+	return "unknown";
+}
+
+int PacketPayloadBytes(int type)
+{
+	switch(type)
+	{
+		case PACKET_ODOMETRY: return ODOMETRY_PACKET_BYTES;
+		case PACKET_DEAD_RECONNING: return DEAD_RECONNING_PACKET_BYTES;
+		case PACKET_LASER: return LASER_PACKET_BYTES;
+		case PACKET_WIFI: return WIFI_PACKET_BYTES;
+	}
+	return 0;
+}
+
+bool DecodeStreamHeader(const char *data, int length, packet_header *header)
+{
+	if(length < PACKET_HEADER_BYTES)
+		return false;
+
+	packet_header_codec::Decode(header, data);
+
+	return header->version == PACKET_VERSION && PacketPayloadBytes(header->type) != 0 &&
+		length == PACKET_HEADER_BYTES + PacketPayloadBytes(header->type);
+}
+
+stream_stats *FindStream(stream_stats_table *table, uint8_t type, uint16_t stream)
+{
+	for(int i=0;i<table->count;++i)
+		if(table->streams[i].type == type && table->streams[i].stream == stream)
+			return table->streams + i;
+
+	if(table->count == STREAM_STATS_MAX_STREAMS)
+		return NULL;
+
+	stream_stats *stats=table->streams + table->count++;
+	stats->type=type;
+	stats->stream=stream;
+	return stats;
+}
+
+// returns false for duplicate
+bool AddStreamSequence(stream_stats *stats, uint32_t sequence)
+{
+	int32_t distance=(int32_t)(sequence - stats->next_sequence);
+
+	if(stats->received == 0 || distance < -STREAM_STATS_RESTART)
+	{
+		stats->restarts += stats->received > 0;
+		stats->next_sequence=sequence+1;
+		stats->window=1;
+		return true;
+	}
+
+	if(distance >= 0) //the newest, skipped distance packets
+	{
+		stats->lost += distance;
+		stats->window = distance+1 < STREAM_STATS_WINDOW ? (stats->window << (distance+1)) | 1 : 1;
+		stats->next_sequence=sequence+1;
+		return true;
+	}
+
+	int age=-distance-1; //0 is the newest
+
+	if(age >= STREAM_STATS_WINDOW)
+	{
+		++stats->reordered;
+		return true;
+	}
+
+	uint64_t bit=1ULL << age;
+
+	if(stats->window & bit)
+	{
+		++stats->duplicated;
+		return false;
+	}
+
+	stats->window |= bit;
+	++stats->reordered;
+	if(stats->lost > 0)
+		--stats->lost;
+	return true;
+}
+
+stream_stats *AddStreamPacket(stream_stats_table *table, const char *data, int length, uint64_t arrival_us)
+{
+	packet_header header;
+	uint64_t timestamp_us;
+	stream_stats *stats;
+	int64_t transit_us, difference_us;
+
+	if(!DecodeStreamHeader(data, length, &header))
+	{
+		++table->invalid;
+		return NULL;
+	}
+
+	if( (stats=FindStream(table, header.type, header.stream)) == NULL)
+	{
+		++table->overflow;
+		return NULL;
+	}
+
+	//all payloads start with timestamp_us
+	PacketValue<uint64_t>::Get(data + PACKET_HEADER_BYTES, &timestamp_us);
+	transit_us=(int64_t)(arrival_us - timestamp_us);
+
+	if(AddStreamSequence(stats, header.sequence))
+	{
+		if(stats->received > 0)
+		{
+			difference_us=transit_us - stats->last_transit_us;
+			stats->jitter_us += ((difference_us < 0 ? -difference_us : difference_us) - stats->jitter_us) / 16.0;
+		}
+		stats->last_transit_us=transit_us;
+	}
+
+	++stats->received;
+	return stats;
+}
+
+double StreamLostPct(const stream_stats &stats)
+{
+	uint32_t sent=stats.received - stats.duplicated + stats.lost;
+	return sent ? 100.0 * stats.lost / sent : 0.0;
+}
+
+double StreamDuplicatedPct(const stream_stats &stats)
+{
+	return stats.received ? 100.0 * stats.duplicated / stats.received : 0.0;
+}
+
+double StreamReorderedPct(const stream_stats &stats)
+{
+	return stats.received ? 100.0 * stats.reordered / stats.received : 0.0;
+}
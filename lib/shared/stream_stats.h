@@ -0,0 +1,65 @@
+#pragma once
+
+#include "packets.h"
+
+#include <stdint.h> //uint32_t, uint64_t
+
+/*
+ * Receiver side accounting of module streams (packets with common header, see packets.h)
+ *
+ * Per stream (packet type and stream id):
+ * - lost: skipped sequence numbers (decreased when the packet arrives late)
+ * - duplicated: sequence number received again
+ * - reordered: packet older than the newest received one (late, not duplicate)
+ * - jitter: interarrival jitter as in RTP (RFC 3550), smoothed difference of transit times,
+ *   transit = arrival (receiver clock) - timestamp_us (robot clock), clocks offset cancels out
+ *
+ * Duplicates and late packets are recognized within STREAM_STATS_WINDOW newest sequence numbers,
+ * older packets are counted as reordered (lost is not decreased, they could be duplicates).
+ * Backward jump of sequence by more than STREAM_STATS_RESTART is module restart.
+ */
+
+const int STREAM_STATS_WINDOW=64; //bits of window
+const int STREAM_STATS_RESTART=1024;
+const int STREAM_STATS_MAX_STREAMS=32;
+
+struct stream_stats
+{
+	uint8_t type; //PacketType
+	uint16_t stream;
+	uint32_t received; //including duplicates
+	uint32_t lost;
+	uint32_t duplicated;
+	uint32_t reordered;
+	uint32_t restarts;
+	uint32_t next_sequence; //the newest received + 1
+	uint64_t window; //bit i is set if sequence next_sequence-1-i was received
+	int64_t last_transit_us;
+	double jitter_us;
+};
+
+struct stream_stats_table
+{
+	stream_stats streams[STREAM_STATS_MAX_STREAMS];
+	int count;
+	uint32_t invalid; //without header, unknown type or wrong length
+	uint32_t overflow; //valid packets of streams that didn't fit the table
+};
+
+void InitStreamStats(stream_stats_table *table);
+// accounts the packet received at arrival_us (TimestampUs), returns its stream or NULL if not accounted
+stream_stats *AddStreamPacket(stream_stats_table *table, const char *data, int length, uint64_t arrival_us);
+
+// in percent of sent packets (received without duplicates + lost)
+double StreamLostPct(const stream_stats &stats);
+// in percent of received packets
+double StreamDuplicatedPct(const stream_stats &stats);
+double StreamReorderedPct(const stream_stats &stats);
+
+// decodes the header, false if there is none (or unknown type, payload length doesn't match the type)
+bool DecodeStreamHeader(const char *data, int length, packet_header *header);
+
+// the name of PacketType (e.g. "laser"), "unknown" if it is not known
+const char *PacketTypeName(int type);
+// payload length of PacketType, 0 if it is not known
+int PacketPayloadBytes(int type);
@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+
+# This script expects:
+# -CAP_NET_ADMIN (e.g. root) to change loopback qdisc, skips otherwise
+# -tc (iproute2) and loopback with default qdisc (noqueue)
+#
+# Script:
+# - limits loopback rate (tbf) and adds qdisc with priority bands (prio or pfifo_fast) below it
+#   so that packets queue as on congested WiFi
+# - runs bench/traffic_class_check, it floods TRAFFIC_BULK packets and measures TRAFFIC_CONTROL round trips
+# - restores loopback qdisc
+#
+# Exits with failure if control packets wait behind the flood.
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+CAP_NET_ADMIN=12
+
+CAP_EFFECTIVE=$(awk '/^CapEff/ {print $2}' /proc/self/status)
+if (( ((0x$CAP_EFFECTIVE >> CAP_NET_ADMIN) & 1) == 0 )); then
+	echo 'No CAP_NET_ADMIN, skipping traffic class test'
+	exit 0
+fi
+
+if ! command -v tc > /dev/null; then
+	echo 'No tc, skipping traffic class test'
+	exit 0
+fi
+
+if ! tc qdisc show dev lo | grep -q '^qdisc noqueue'; then
+	echo 'Loopback has qdisc already, skipping traffic class test'
+	exit 0
+fi
+
+make -s -C "$ROOT/bench" traffic_class_check || exit 1
+
+echo 'Limiting loopback rate to 8 mbit'
+if ! tc qdisc add dev lo root handle 1: tbf rate 8mbit burst 4000 limit 200000; then
+	echo 'Unable to add tbf qdisc, skipping traffic class test'
+	exit 0
+fi
+trap 'tc qdisc del dev lo root' EXIT
+
+echo 'Adding priority bands'
+if ! tc qdisc add dev lo parent 1:1 handle 10: prio 2> /dev/null; then
+	echo 'No prio qdisc, using pfifo_fast'
+	tc qdisc add dev lo parent 1:1 handle 10: pfifo_fast || exit 1
+fi
+
+echo 'Measuring round trips under bulk flood'
+(cd "$ROOT/bench" && ./traffic_class_check)
+RESULT=$?
+
+if [ $RESULT -eq 0 ]; then
+	echo 'Passed'
+else
+	echo 'Failed'
+fi
+
+exit $RESULT